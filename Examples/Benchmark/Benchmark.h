@@ -0,0 +1,303 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/**
+ * slam_benchmark和microbench共用的数据集读取和统计
+ * 支持TUM(单目、RGB-D)、KITTI(单目、双目)、EuRoC(单目、双目，路径为mav0目录)
+ */
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<sstream>
+#include<iomanip>
+#include<string>
+#include<vector>
+#include<cmath>
+#include<cstdlib>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/highgui/highgui.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<System.h>
+
+using namespace std;
+
+// 数据集的类型、路径和读取参数
+struct DatasetOptions
+{
+    string strDataset;          // tum_mono | tum_rgbd | kitti_mono | kitti_stereo | euroc_mono | euroc_stereo
+    string strSequence;
+    string strSettings;         // EuRoC双目从中读取校正参数
+    string strAssociation;      // TUM RGB-D的关联文件
+    string strTimes;            // EuRoC的时间戳文件，默认读取cam0/data.csv
+    int nMaxFrames;             // 只读取前n帧，0为全部
+};
+
+struct Sequence
+{
+    ORB_SLAM2::System::eSensor sensor;
+    vector<string> vstrImages;      // 单目/左目/RGB
+    vector<string> vstrImages2;     // 右目/深度
+    vector<double> vTimestamps;
+    // EuRoC双目的校正映射
+    cv::Mat M1l, M2l, M1r, M2r;
+};
+
+struct Stats
+{
+    size_t n;
+    double mean, median, p90, max, total, rmse;
+};
+
+inline Stats ComputeStats(vector<double> v)
+{
+    Stats s = Stats();
+    s.n = v.size();
+    if(v.empty())
+        return s;
+    sort(v.begin(),v.end());
+    double sq = 0;
+    for(size_t i=0; i<v.size(); i++)
+    {
+        s.total += v[i];
+        sq += v[i]*v[i];
+    }
+    s.mean = s.total/v.size();
+    s.rmse = sqrt(sq/v.size());
+    s.median = v[v.size()/2];
+    s.p90 = v[min(v.size()-1,(size_t)(0.9*v.size()))];
+    s.max = v.back();
+    return s;
+}
+
+inline bool FileExists(const string &strFile)
+{
+    ifstream f(strFile.c_str());
+    return f.good();
+}
+
+// 读取一行中以空白或逗号分隔的字段，忽略空行和以#开头的注释行
+inline bool ReadFields(istream &f, vector<string> &vFields)
+{
+    string s;
+    while(getline(f,s))
+    {
+        if(s.empty() || s[0]=='#')
+            continue;
+        replace(s.begin(),s.end(),',',' ');
+        stringstream ss(s);
+        vFields.clear();
+        string field;
+        while(ss >> field)
+            vFields.push_back(field);
+        if(!vFields.empty())
+            return true;
+    }
+    return false;
+}
+
+inline bool LoadTUM(const DatasetOptions &opt, const bool bRGBD, Sequence &seq)
+{
+    const string strFile = bRGBD ? opt.strAssociation : opt.strSequence+"/rgb.txt";
+    ifstream f(strFile.c_str());
+    if(!f.is_open())
+    {
+        cerr << "ERROR: cannot open " << strFile << (bRGBD ? " (use --association)" : "") << endl;
+        return false;
+    }
+    vector<string> v;
+    while(ReadFields(f,v))
+    {
+        if(v.size()<(bRGBD ? 4u : 2u))
+            continue;
+        seq.vTimestamps.push_back(atof(v[0].c_str()));
+        seq.vstrImages.push_back(opt.strSequence+"/"+v[1]);
+        if(bRGBD)
+            seq.vstrImages2.push_back(opt.strSequence+"/"+v[3]);
+    }
+    return true;
+}
+
+inline bool LoadKITTI(const DatasetOptions &opt, const bool bStereo, Sequence &seq)
+{
+    const string strFile = opt.strSequence+"/times.txt";
+    ifstream f(strFile.c_str());
+    if(!f.is_open())
+    {
+        cerr << "ERROR: cannot open " << strFile << endl;
+        return false;
+    }
+    vector<string> v;
+    while(ReadFields(f,v))
+    {
+        stringstream ss;
+        ss << setfill('0') << setw(6) << seq.vTimestamps.size();
+        seq.vTimestamps.push_back(atof(v[0].c_str()));
+        seq.vstrImages.push_back(opt.strSequence+"/image_0/"+ss.str()+".png");
+        if(bStereo)
+            seq.vstrImages2.push_back(opt.strSequence+"/image_1/"+ss.str()+".png");
+    }
+    return true;
+}
+
+// 序列路径为EuRoC的mav0目录
+inline bool LoadEuRoC(const DatasetOptions &opt, const bool bStereo, Sequence &seq)
+{
+    const string strFile = opt.strTimes.empty() ? opt.strSequence+"/cam0/data.csv" : opt.strTimes;
+    ifstream f(strFile.c_str());
+    if(!f.is_open())
+    {
+        cerr << "ERROR: cannot open " << strFile << endl;
+        return false;
+    }
+    vector<string> v;
+    while(ReadFields(f,v))
+    {
+        seq.vTimestamps.push_back(atof(v[0].c_str())/1e9);
+        seq.vstrImages.push_back(opt.strSequence+"/cam0/data/"+v[0]+".png");
+        if(bStereo)
+            seq.vstrImages2.push_back(opt.strSequence+"/cam1/data/"+v[0]+".png");
+    }
+
+    if(!bStereo)
+        return true;
+
+    // 与stereo_euroc相同，用配置文件中的参数校正双目图像
+    cv::FileStorage fsSettings(opt.strSettings, cv::FileStorage::READ);
+    cv::Mat K_l, K_r, P_l, P_r, R_l, R_r, D_l, D_r;
+    fsSettings["LEFT.K"] >> K_l;
+    fsSettings["RIGHT.K"] >> K_r;
+    fsSettings["LEFT.P"] >> P_l;
+    fsSettings["RIGHT.P"] >> P_r;
+    fsSettings["LEFT.R"] >> R_l;
+    fsSettings["RIGHT.R"] >> R_r;
+    fsSettings["LEFT.D"] >> D_l;
+    fsSettings["RIGHT.D"] >> D_r;
+    int rows_l = fsSettings["LEFT.height"];
+    int cols_l = fsSettings["LEFT.width"];
+    int rows_r = fsSettings["RIGHT.height"];
+    int cols_r = fsSettings["RIGHT.width"];
+
+    if(K_l.empty() || K_r.empty() || P_l.empty() || P_r.empty() || R_l.empty() || R_r.empty() || D_l.empty() || D_r.empty() ||
+            rows_l==0 || rows_r==0 || cols_l==0 || cols_r==0)
+    {
+        cerr << "ERROR: Calibration parameters to rectify stereo are missing!" << endl;
+        return false;
+    }
+
+    cv::initUndistortRectifyMap(K_l,D_l,R_l,P_l.rowRange(0,3).colRange(0,3),cv::Size(cols_l,rows_l),CV_32F,seq.M1l,seq.M2l);
+    cv::initUndistortRectifyMap(K_r,D_r,R_r,P_r.rowRange(0,3).colRange(0,3),cv::Size(cols_r,rows_r),CV_32F,seq.M1r,seq.M2r);
+    return true;
+}
+
+inline bool LoadSequence(const DatasetOptions &opt, Sequence &seq)
+{
+    bool bOK = false;
+    if(opt.strDataset=="tum_mono")
+    {
+        seq.sensor = ORB_SLAM2::System::MONOCULAR;
+        bOK = LoadTUM(opt,false,seq);
+    }
+    else if(opt.strDataset=="tum_rgbd")
+    {
+        seq.sensor = ORB_SLAM2::System::RGBD;
+        bOK = LoadTUM(opt,true,seq);
+    }
+    else if(opt.strDataset=="kitti_mono" || opt.strDataset=="kitti_stereo")
+    {
+        const bool bStereo = opt.strDataset=="kitti_stereo";
+        seq.sensor = bStereo ? ORB_SLAM2::System::STEREO : ORB_SLAM2::System::MONOCULAR;
+        bOK = LoadKITTI(opt,bStereo,seq);
+    }
+    else if(opt.strDataset=="euroc_mono" || opt.strDataset=="euroc_stereo")
+    {
+        const bool bStereo = opt.strDataset=="euroc_stereo";
+        seq.sensor = bStereo ? ORB_SLAM2::System::STEREO : ORB_SLAM2::System::MONOCULAR;
+        bOK = LoadEuRoC(opt,bStereo,seq);
+    }
+    else
+        cerr << "ERROR: unknown dataset type " << opt.strDataset << endl;
+
+    if(bOK && seq.vstrImages.empty())
+    {
+        cerr << "ERROR: no images found in " << opt.strSequence << endl;
+        bOK = false;
+    }
+    if(bOK && opt.nMaxFrames>0 && (size_t)opt.nMaxFrames<seq.vstrImages.size())
+    {
+        seq.vTimestamps.resize(opt.nMaxFrames);
+        seq.vstrImages.resize(opt.nMaxFrames);
+        if(!seq.vstrImages2.empty())
+            seq.vstrImages2.resize(opt.nMaxFrames);
+    }
+    return bOK;
+}
+
+// EuRoC双目校正，其他数据集不做处理
+inline void RectifyImages(const Sequence &seq, cv::Mat &im, cv::Mat &im2)
+{
+    if(seq.M1l.empty())
+        return;
+    cv::Mat imRect, imRect2;
+    cv::remap(im,imRect,seq.M1l,seq.M2l,cv::INTER_LINEAR);
+    cv::remap(im2,imRect2,seq.M1r,seq.M2r,cv::INTER_LINEAR);
+    im = imRect;
+    im2 = imRect2;
+}
+
+inline bool LoadImages(const Sequence &seq, const size_t i, cv::Mat &im, cv::Mat &im2)
+{
+    im = cv::imread(seq.vstrImages[i],CV_LOAD_IMAGE_UNCHANGED);
+    if(im.empty())
+    {
+        cerr << endl << "Failed to load image at: " << seq.vstrImages[i] << endl;
+        return false;
+    }
+    if(seq.vstrImages2.empty())
+        return true;
+
+    im2 = cv::imread(seq.vstrImages2[i],CV_LOAD_IMAGE_UNCHANGED);
+    if(im2.empty())
+    {
+        cerr << endl << "Failed to load image at: " << seq.vstrImages2[i] << endl;
+        return false;
+    }
+    RectifyImages(seq,im,im2);
+    return true;
+}
+
+inline string JsonString(const string &s)
+{
+    string r = "\"";
+    for(size_t i=0; i<s.size(); i++)
+    {
+        if(s[i]=='"' || s[i]=='\\')
+            r += '\\';
+        r += s[i];
+    }
+    return r+"\"";
+}
+
+#endif // BENCHMARK_H
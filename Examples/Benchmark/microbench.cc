@@ -0,0 +1,946 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * 热点函数的微基准测试
+ * 先用双目/RGB-D序列的前几帧建立一个小地图作为测试数据(不启动任何线程，过程是确定的)，
+ * 再对每个函数反复计时：预热一次，自动确定每个样本的迭代次数，使一个样本不短于--min-time，
+ * 取多个样本的中位数、最小值、平均值和MAD(中位数绝对偏差)，结果写成JSON，用于比较函数级的优化
+ */
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<iomanip>
+#include<chrono>
+#include<functional>
+#include<memory>
+#include<set>
+#include<cmath>
+#include<random>
+#include<sstream>
+
+#include<opencv2/core/core.hpp>
+
+#include<System.h>
+#include<Frame.h>
+#include<KeyFrame.h>
+#include<MapPoint.h>
+#include<Map.h>
+#include<KeyFrameDatabase.h>
+#include<ORBextractor.h>
+#include<ORBmatcher.h>
+#include<ORBVocabulary.h>
+#include<Optimizer.h>
+#include<Converter.h>
+
+#include"Benchmark.h"
+
+using namespace std;
+using namespace ORB_SLAM2;
+
+struct Options : public DatasetOptions
+{
+    string strVocabulary;
+    string strFilter;           // 只运行名字中包含该字符串的测试
+    string strJson;
+    int nKeyFrames;             // 测试地图的关键帧数
+    int nStride;                // 相邻关键帧之间间隔的图像数
+    int nSamples;
+    double minTime;             // 每个样本的最短时间(秒)
+    vector<int> vnPoseGraphSizes;   // 合成位姿图的关键帧数
+};
+
+// 测试数据：一个由前几帧建立的小地图，以及最后两帧
+struct Fixture
+{
+    System::eSensor sensor;
+    ORBVocabulary* pVocabulary;
+    KeyFrameDatabase* pKeyFrameDB;
+    Map* pMap;
+    ORBextractor* pExtractorLeft;
+    ORBextractor* pExtractorRight;
+    cv::Mat K;
+    cv::Mat DistCoef;
+    float bf;
+    float thDepth;
+    float depthMapFactor;
+    bool bRGB;
+    int nFeatures;
+    float scaleFactor;
+    int nLevels;
+    int iniThFAST;
+    int minThFAST;
+
+    // 已跟踪的帧(与vpKeyFrames一一对应)，mvpMapPoints中为跟踪得到的匹配
+    vector<Frame> vFrames;
+    vector<KeyFrame*> vpKeyFrames;
+    // 最后构造的一帧，提取器中的金字塔属于这一帧，ComputeStereoMatches()需要用到
+    Frame lastBuilt;
+    cv::Mat imGray;
+};
+
+struct Benchmark
+{
+    string name;
+    size_t nItems;                  // 每次调用处理的元素数，用于换算每个元素的耗时
+    function<void()> setup;         // 预热前调用一次
+    function<void()> reset;         // 每次调用前恢复输入，不计时
+    function<int()> run;
+};
+
+struct Result
+{
+    string name;
+    size_t nItems;
+    size_t nIterations;             // 每个样本的迭代次数
+    vector<double> vSamples;        // 每个样本中单次调用的平均耗时(秒)
+    double median, min, mean, mad;
+};
+
+// 防止编译器把结果没有被使用的调用优化掉
+static volatile int gSink = 0;
+
+static double Now()
+{
+    return chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool ReadSettings(const string &strSettings, Fixture &fx)
+{
+    cv::FileStorage fSettings(strSettings, cv::FileStorage::READ);
+    if(!fSettings.isOpened())
+    {
+        cerr << "ERROR: failed to open settings file at: " << strSettings << endl;
+        return false;
+    }
+
+    // 与Tracking的构造函数读取方式相同
+    const float fxCamera = fSettings["Camera.fx"];
+    fx.K = cv::Mat::eye(3,3,CV_32F);
+    fx.K.at<float>(0,0) = fxCamera;
+    fx.K.at<float>(1,1) = fSettings["Camera.fy"];
+    fx.K.at<float>(0,2) = fSettings["Camera.cx"];
+    fx.K.at<float>(1,2) = fSettings["Camera.cy"];
+
+    fx.DistCoef = cv::Mat(4,1,CV_32F);
+    fx.DistCoef.at<float>(0) = fSettings["Camera.k1"];
+    fx.DistCoef.at<float>(1) = fSettings["Camera.k2"];
+    fx.DistCoef.at<float>(2) = fSettings["Camera.p1"];
+    fx.DistCoef.at<float>(3) = fSettings["Camera.p2"];
+    const float k3 = fSettings["Camera.k3"];
+    if(k3!=0)
+    {
+        fx.DistCoef.resize(5);
+        fx.DistCoef.at<float>(4) = k3;
+    }
+
+    fx.bf = fSettings["Camera.bf"];
+    fx.thDepth = fx.bf*(float)fSettings["ThDepth"]/fxCamera;
+    fx.depthMapFactor = fSettings["DepthMapFactor"];
+    if(fabs(fx.depthMapFactor)<1e-5)
+        fx.depthMapFactor = 1;
+    else
+        fx.depthMapFactor = 1.0f/fx.depthMapFactor;
+    int nRGB = fSettings["Camera.RGB"];
+    fx.bRGB = nRGB;
+
+    fx.nFeatures = fSettings["ORBextractor.nFeatures"];
+    fx.scaleFactor = fSettings["ORBextractor.scaleFactor"];
+    fx.nLevels = fSettings["ORBextractor.nLevels"];
+    fx.iniThFAST = fSettings["ORBextractor.iniThFAST"];
+    fx.minThFAST = fSettings["ORBextractor.minThFAST"];
+    return true;
+}
+
+static cv::Mat ToGray(const cv::Mat &im, const bool bRGB)
+{
+    cv::Mat imGray = im;
+    if(im.channels()==3)
+        cv::cvtColor(im,imGray,bRGB ? CV_RGB2GRAY : CV_BGR2GRAY);
+    else if(im.channels()==4)
+        cv::cvtColor(im,imGray,bRGB ? CV_RGBA2GRAY : CV_BGRA2GRAY);
+    return imGray;
+}
+
+// 与Tracking::CreateNewKeyFrame()和LocalMapping::ProcessNewKeyFrame()相同：
+// 用近处的双目/深度点补充新的地图点，给已匹配的地图点添加观测，更新共视图
+static KeyFrame* CreateKeyFrame(Fixture &fx, Frame &F)
+{
+    KeyFrame* pKF = new KeyFrame(F,fx.pMap,fx.pKeyFrameDB);
+
+    for(int i=0; i<F.N; i++)
+    {
+        MapPoint* pMP = F.mvpMapPoints[i];
+        if(pMP && !pMP->isBad())
+        {
+            pMP->AddObservation(pKF,i);
+            pMP->UpdateNormalAndDepth();
+            pMP->ComputeDistinctiveDescriptors();
+        }
+    }
+
+    F.UpdatePoseMatrices();
+    vector<pair<float,int> > vDepthIdx;
+    vDepthIdx.reserve(F.N);
+    for(int i=0; i<F.N; i++)
+        if(F.mvDepth[i]>0)
+            vDepthIdx.push_back(make_pair(F.mvDepth[i],i));
+    sort(vDepthIdx.begin(),vDepthIdx.end());
+
+    int nPoints = 0;
+    for(size_t j=0; j<vDepthIdx.size(); j++)
+    {
+        const int i = vDepthIdx[j].second;
+        if(!F.mvpMapPoints[i])
+        {
+            MapPoint* pNewMP = new MapPoint(F.UnprojectStereo(i),pKF,fx.pMap);
+            pNewMP->AddObservation(pKF,i);
+            pKF->AddMapPoint(pNewMP,i);
+            pNewMP->ComputeDistinctiveDescriptors();
+            pNewMP->UpdateNormalAndDepth();
+            fx.pMap->AddMapPoint(pNewMP);
+            F.mvpMapPoints[i] = pNewMP;
+        }
+        nPoints++;
+        // 第一帧使用所有点
+        if(!fx.vpKeyFrames.empty() && vDepthIdx[j].first>fx.thDepth && nPoints>100)
+            break;
+    }
+
+    pKF->UpdateConnections();
+    fx.pMap->AddKeyFrame(pKF);
+    fx.vpKeyFrames.push_back(pKF);
+    return pKF;
+}
+
+// 恒速为零的跟踪：上一帧投影匹配+位姿优化，再和局部地图匹配+位姿优化，剔除外点
+static bool TrackFrame(Fixture &fx, Frame &F, const Frame &LastFrame)
+{
+    const int th = fx.sensor==System::STEREO ? 7 : 15;
+    ORBmatcher matcher(0.9,true);
+
+    F.SetPose(LastFrame.mTcw);
+    fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+    int nMatches = matcher.SearchByProjection(F,LastFrame,th,false);
+    if(nMatches<20)
+    {
+        fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+        nMatches = matcher.SearchByProjection(F,LastFrame,2*th,false);
+    }
+    if(nMatches<20)
+        return false;
+
+    for(int pass=0; pass<2; pass++)
+    {
+        Optimizer::PoseOptimization(&F);
+        for(int i=0; i<F.N; i++)
+        {
+            if(F.mvpMapPoints[i] && F.mvbOutlier[i])
+            {
+                F.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
+                F.mvbOutlier[i] = false;
+            }
+        }
+        if(pass==1)
+            break;
+
+        // 与Tracking::SearchLocalPoints()相同，测试地图很小，以整个地图为局部地图
+        for(int i=0; i<F.N; i++)
+        {
+            MapPoint* pMP = F.mvpMapPoints[i];
+            if(pMP)
+            {
+                pMP->mnLastFrameSeen = F.mnId;
+                pMP->mbTrackInView = false;
+            }
+        }
+        const vector<MapPoint*> vpLocalMapPoints = fx.pMap->GetAllMapPoints();
+        for(size_t i=0; i<vpLocalMapPoints.size(); i++)
+        {
+            MapPoint* pMP = vpLocalMapPoints[i];
+            if(pMP->mnLastFrameSeen!=F.mnId && !pMP->isBad())
+                F.isInFrustum(pMP,0.5);
+        }
+        ORBmatcher localMatcher(0.8);
+        localMatcher.SearchByProjection(F,vpLocalMapPoints,fx.sensor==System::RGBD ? 3 : 1);
+    }
+    return true;
+}
+
+static bool BuildFixture(const Options &opt, const Sequence &seq, Fixture &fx)
+{
+    fx.sensor = seq.sensor;
+    if(fx.sensor==System::MONOCULAR)
+    {
+        cerr << "ERROR: the microbenchmark needs a stereo or RGB-D sequence (tum_rgbd, kitti_stereo, euroc_stereo)" << endl;
+        return false;
+    }
+    if(!ReadSettings(opt.strSettings,fx))
+        return false;
+
+    cout << "Loading ORB Vocabulary..." << endl;
+    fx.pVocabulary = new ORBVocabulary();
+    if(!fx.pVocabulary->loadFromTextFile(opt.strVocabulary))
+    {
+        cerr << "ERROR: failed to open vocabulary at: " << opt.strVocabulary << endl;
+        return false;
+    }
+    fx.pKeyFrameDB = new KeyFrameDatabase(*fx.pVocabulary);
+    fx.pMap = new Map();
+    fx.pExtractorLeft = new ORBextractor(fx.nFeatures,fx.scaleFactor,fx.nLevels,fx.iniThFAST,fx.minThFAST);
+    fx.pExtractorRight = new ORBextractor(fx.nFeatures,fx.scaleFactor,fx.nLevels,fx.iniThFAST,fx.minThFAST);
+
+    for(size_t ni=0; ni<seq.vstrImages.size(); ni+=opt.nStride)
+    {
+        cv::Mat im, im2;
+        if(!LoadImages(seq,ni,im,im2))
+            return false;
+        fx.imGray = ToGray(im,fx.bRGB);
+        if(fx.sensor==System::STEREO)
+        {
+            fx.lastBuilt = Frame(fx.imGray,ToGray(im2,fx.bRGB),seq.vTimestamps[ni],fx.pExtractorLeft,fx.pExtractorRight,
+                                 fx.pVocabulary,fx.K,fx.DistCoef,fx.bf,fx.thDepth);
+        }
+        else
+        {
+            cv::Mat imDepth = im2;
+            if(fabs(fx.depthMapFactor-1.0f)>1e-5 || imDepth.type()!=CV_32F)
+                im2.convertTo(imDepth,CV_32F,fx.depthMapFactor);
+            fx.lastBuilt = Frame(fx.imGray,imDepth,seq.vTimestamps[ni],fx.pExtractorLeft,
+                                 fx.pVocabulary,fx.K,fx.DistCoef,fx.bf,fx.thDepth);
+        }
+
+        Frame F(fx.lastBuilt);
+        F.ComputeBoW();
+        if(fx.vFrames.empty())
+        {
+            if(F.N<=500)
+                continue;
+            F.SetPose(cv::Mat::eye(4,4,CV_32F));
+        }
+        else if(!TrackFrame(fx,F,fx.vFrames.back()))
+        {
+            cout << "Tracking lost at image " << ni << ", using the first " << fx.vFrames.size() << " keyframes" << endl;
+            break;
+        }
+
+        CreateKeyFrame(fx,F);
+        fx.vFrames.push_back(F);
+        if((int)fx.vFrames.size()>=opt.nKeyFrames)
+            break;
+    }
+
+    if(fx.vFrames.size()<2)
+    {
+        cerr << "ERROR: could not build a map with at least two keyframes" << endl;
+        return false;
+    }
+    cout << "Fixture: " << fx.pMap->KeyFramesInMap() << " keyframes, " << fx.pMap->MapPointsInMap() << " map points" << endl;
+    return true;
+}
+
+static void Add(vector<Benchmark> &vBenchmarks, const string &name, const size_t nItems, const function<int()> &run,
+                const function<void()> &reset=function<void()>(), const function<void()> &setup=function<void()>())
+{
+    Benchmark b;
+    b.name = name;
+    b.nItems = nItems;
+    b.setup = setup;
+    b.reset = reset;
+    b.run = run;
+    vBenchmarks.push_back(b);
+}
+
+static void ResetMatches(Frame &F)
+{
+    fill(F.mvpMapPoints.begin(),F.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
+    fill(F.mvbOutlier.begin(),F.mvbOutlier.end(),false);
+}
+
+// 局部BA的输入：所有关键帧位姿和地图点坐标
+struct MapSnapshot
+{
+    vector<KeyFrame*> vpKFs;
+    vector<cv::Mat> vTcw;
+    vector<MapPoint*> vpMPs;
+    vector<cv::Mat> vPos;
+};
+
+static void TakeSnapshot(Map* pMap, MapSnapshot &s)
+{
+    s.vpKFs = pMap->GetAllKeyFrames();
+    s.vTcw.resize(s.vpKFs.size());
+    for(size_t i=0; i<s.vpKFs.size(); i++)
+        s.vTcw[i] = s.vpKFs[i]->GetPose();
+    s.vpMPs = pMap->GetAllMapPoints();
+    s.vPos.resize(s.vpMPs.size());
+    for(size_t i=0; i<s.vpMPs.size(); i++)
+        s.vPos[i] = s.vpMPs[i]->GetWorldPos();
+}
+
+// 恢复位姿和坐标，并清除LocalBundleAdjustment()的标记，否则以同一关键帧重复调用时局部窗口为空
+static void RestoreSnapshot(const MapSnapshot &s)
+{
+    for(size_t i=0; i<s.vpKFs.size(); i++)
+    {
+        s.vpKFs[i]->SetPose(s.vTcw[i]);
+        s.vpKFs[i]->mnBALocalForKF = 0;
+        s.vpKFs[i]->mnBAFixedForKF = 0;
+    }
+    for(size_t i=0; i<s.vpMPs.size(); i++)
+    {
+        s.vpMPs[i]->SetWorldPos(s.vPos[i]);
+        s.vpMPs[i]->mnBALocalForKF = 0;
+    }
+}
+
+static int CountObservations(const MapSnapshot &s)
+{
+    int n = 0;
+    for(size_t i=0; i<s.vpMPs.size(); i++)
+        n += s.vpMPs[i]->Observations();
+    return n;
+}
+
+static void RegisterBenchmarks(Fixture &fx, vector<Benchmark> &vb)
+{
+    const size_t nFrames = fx.vFrames.size();
+    const Frame &CurrentFrame = fx.vFrames[nFrames-1];
+    const Frame &LastFrame = fx.vFrames[nFrames-2];
+    KeyFrame* pCurrentKF = fx.vpKeyFrames[nFrames-1];
+    KeyFrame* pLastKF = fx.vpKeyFrames[nFrames-2];
+
+    // 以下测试用到的输入都是副本，测试之间互不影响(局部BA除外，放在最后)
+    shared_ptr<ORBextractor> pExtractor = make_shared<ORBextractor>(fx.nFeatures,fx.scaleFactor,fx.nLevels,fx.iniThFAST,fx.minThFAST);
+    shared_ptr<vector<cv::KeyPoint> > pvKeys = make_shared<vector<cv::KeyPoint> >();
+    shared_ptr<cv::Mat> pDescriptors = make_shared<cv::Mat>();
+    const cv::Mat imGray = fx.imGray;
+    Add(vb,"ORBextractor",1,[=]()
+    {
+        (*pExtractor)(imGray,cv::Mat(),*pvKeys,*pDescriptors);
+        return (int)pvKeys->size();
+    });
+
+    const int nDesc = min(256,min(CurrentFrame.mDescriptors.rows,LastFrame.mDescriptors.rows));
+    shared_ptr<vector<cv::Mat> > pvDesc1 = make_shared<vector<cv::Mat> >();
+    shared_ptr<vector<cv::Mat> > pvDesc2 = make_shared<vector<cv::Mat> >();
+    for(int i=0; i<nDesc; i++)
+    {
+        pvDesc1->push_back(CurrentFrame.mDescriptors.row(i));
+        pvDesc2->push_back(LastFrame.mDescriptors.row(i));
+    }
+    Add(vb,"DescriptorDistance",nDesc*nDesc,[=]()
+    {
+        int sum = 0;
+        for(int i=0; i<nDesc; i++)
+            for(int j=0; j<nDesc; j++)
+                sum += ORBmatcher::DescriptorDistance((*pvDesc1)[i],(*pvDesc2)[j]);
+        return sum;
+    });
+
+    // 跟踪中的上一帧投影匹配，初值为上一帧位姿
+    shared_ptr<Frame> pF = make_shared<Frame>(CurrentFrame);
+    const cv::Mat LastTcw = LastFrame.mTcw.clone();
+    const float thLast = fx.sensor==System::STEREO ? 7 : 15;
+    Add(vb,"SearchByProjection/LastFrame",pF->N,[=]()
+    {
+        ORBmatcher matcher(0.9,true);
+        return matcher.SearchByProjection(*pF,LastFrame,thLast,false);
+    },
+    [=]()
+    {
+        pF->SetPose(LastTcw);
+        ResetMatches(*pF);
+    });
+
+    // 局部地图投影匹配，isInFrustum()填写的投影信息只需要计算一次
+    shared_ptr<Frame> pFLocal = make_shared<Frame>(CurrentFrame);
+    shared_ptr<vector<MapPoint*> > pvpLocalMapPoints = make_shared<vector<MapPoint*> >(fx.pMap->GetAllMapPoints());
+    const float thLocal = fx.sensor==System::RGBD ? 3 : 1;
+    Add(vb,"SearchByProjection/LocalMap",pvpLocalMapPoints->size(),[=]()
+    {
+        ORBmatcher matcher(0.8);
+        return matcher.SearchByProjection(*pFLocal,*pvpLocalMapPoints,thLocal);
+    },
+    [=]()
+    {
+        ResetMatches(*pFLocal);
+    },
+    [=]()
+    {
+        for(size_t i=0; i<pvpLocalMapPoints->size(); i++)
+        {
+            MapPoint* pMP = (*pvpLocalMapPoints)[i];
+            pMP->mnLastFrameSeen = 0;
+            if(!pMP->isBad())
+                pFLocal->isInFrustum(pMP,0.5);
+            else
+                pMP->mbTrackInView = false;
+        }
+    });
+
+    // 重定位中的关键帧投影匹配
+    shared_ptr<Frame> pFReloc = make_shared<Frame>(CurrentFrame);
+    Add(vb,"SearchByProjection/KeyFrame",pLastKF->GetMapPoints().size(),[=]()
+    {
+        ORBmatcher matcher(0.9,true);
+        return matcher.SearchByProjection(*pFReloc,pLastKF,set<MapPoint*>(),10,100);
+    },
+    [=]()
+    {
+        ResetMatches(*pFReloc);
+    });
+
+    // 闭环中的Sim3投影匹配，把整个地图投影到当前关键帧
+    shared_ptr<vector<MapPoint*> > pvpMatched = make_shared<vector<MapPoint*> >();
+    const cv::Mat Scw = pCurrentKF->GetPose();
+    Add(vb,"SearchByProjection/Sim3",pvpLocalMapPoints->size(),[=]()
+    {
+        ORBmatcher matcher(0.75,true);
+        return matcher.SearchByProjection(pCurrentKF,Scw,*pvpLocalMapPoints,*pvpMatched,10);
+    },
+    [=]()
+    {
+        pvpMatched->assign(pCurrentKF->N,static_cast<MapPoint*>(NULL));
+    });
+
+    shared_ptr<Frame> pFBoW = make_shared<Frame>(CurrentFrame);
+    shared_ptr<vector<MapPoint*> > pvpBoWMatches = make_shared<vector<MapPoint*> >();
+    Add(vb,"SearchByBoW/KeyFrameFrame",pLastKF->N,[=]()
+    {
+        ORBmatcher matcher(0.7,true);
+        return matcher.SearchByBoW(pLastKF,*pFBoW,*pvpBoWMatches);
+    });
+
+    shared_ptr<vector<MapPoint*> > pvpBoWMatches12 = make_shared<vector<MapPoint*> >();
+    Add(vb,"SearchByBoW/KeyFrameKeyFrame",pCurrentKF->N,[=]()
+    {
+        ORBmatcher matcher(0.75,true);
+        return matcher.SearchByBoW(pCurrentKF,pLastKF,*pvpBoWMatches12);
+    });
+
+    // 提取器中保存的是最后构造的那一帧的金字塔
+    if(fx.sensor==System::STEREO)
+    {
+        shared_ptr<Frame> pFStereo = make_shared<Frame>(fx.lastBuilt);
+        Add(vb,"Frame::ComputeStereoMatches",pFStereo->N,[=]()
+        {
+            pFStereo->ComputeStereoMatches();
+            return (int)count_if(pFStereo->mvDepth.begin(),pFStereo->mvDepth.end(),[](float z){return z>0;});
+        });
+    }
+
+    shared_ptr<Frame> pFGrid = make_shared<Frame>(CurrentFrame);
+    Add(vb,"Frame::GetFeaturesInArea",pFGrid->N,[=]()
+    {
+        int sum = 0;
+        for(int i=0; i<pFGrid->N; i++)
+        {
+            const cv::KeyPoint &kp = pFGrid->mvKeysUn[i];
+            sum += pFGrid->GetFeaturesInArea(kp.pt.x,kp.pt.y,15*pFGrid->mvScaleFactors[kp.octave],kp.octave-1,kp.octave+1).size();
+        }
+        return sum;
+    });
+
+    shared_ptr<vector<cv::Mat> > pvDescVector = make_shared<vector<cv::Mat> >(Converter::toDescriptorVector(CurrentFrame.mDescriptors));
+    shared_ptr<DBoW2::BowVector> pBowVec = make_shared<DBoW2::BowVector>();
+    shared_ptr<DBoW2::FeatureVector> pFeatVec = make_shared<DBoW2::FeatureVector>();
+    ORBVocabulary* pVocabulary = fx.pVocabulary;
+    Add(vb,"TemplatedVocabulary::transform",pvDescVector->size(),[=]()
+    {
+        pVocabulary->transform(*pvDescVector,*pBowVec,*pFeatVec,4);
+        return (int)pBowVec->size();
+    });
+
+    // 位姿优化，初值为上一帧位姿，匹配为跟踪得到的匹配
+    shared_ptr<Frame> pFPose = make_shared<Frame>(CurrentFrame);
+    const vector<MapPoint*> vpTrackedMapPoints = CurrentFrame.mvpMapPoints;
+    Add(vb,"Optimizer::PoseOptimization",pFPose->N,[=]()
+    {
+        return Optimizer::PoseOptimization(pFPose.get());
+    },
+    [=]()
+    {
+        pFPose->SetPose(LastTcw);
+        pFPose->mvpMapPoints = vpTrackedMapPoints;
+        fill(pFPose->mvbOutlier.begin(),pFPose->mvbOutlier.end(),false);
+    });
+
+    // 局部BA会永久删除外点观测：setup中重复运行直到观测数不再变化，之后每次从同一个输入开始
+    shared_ptr<MapSnapshot> pSnapshot = make_shared<MapSnapshot>();
+    Map* pMap = fx.pMap;
+    TakeSnapshot(pMap,*pSnapshot);
+    for(int s=0; s<2; s++)
+    {
+        const bool bSchur = s==1;
+        Add(vb,bSchur ? "Optimizer::LocalBundleAdjustment/BASolver" : "Optimizer::LocalBundleAdjustment/g2o",pSnapshot->vpMPs.size(),[=]()
+        {
+            bool bStopFlag = false;
+            Optimizer::LocalBundleAdjustment(pCurrentKF,&bStopFlag,pMap);
+            return (int)pCurrentKF->mnBALocalForKF;
+        },
+        [=]()
+        {
+            RestoreSnapshot(*pSnapshot);
+        },
+        [=]()
+        {
+            Optimizer::SetUseBASolver(bSchur);
+            for(int i=0; i<5; i++)
+            {
+                const int nObs = CountObservations(*pSnapshot);
+                RestoreSnapshot(*pSnapshot);
+                bool bStopFlag = false;
+                Optimizer::LocalBundleAdjustment(pCurrentKF,&bStopFlag,pMap);
+                if(CountObservations(*pSnapshot)==nObs)
+                    break;
+            }
+        });
+    }
+}
+
+// 合成的位姿图：关键帧在平面上沿一个圆走nLaps圈，每一圈间隔1米
+// 父节点为前一个关键帧，与前两个关键帧以及上一圈同一位置的关键帧有共视边，每隔50个关键帧与上一圈形成一条闭环边
+// 观测由真值加噪声得到，初值为带噪声的相对位姿(里程计)的累积，有漂移，和闭环修正之前的情况类似
+static void BuildSyntheticPoseGraph(const int N, Optimizer::EssentialGraph &graph)
+{
+    const int nLaps = 4;
+    const int nPerLap = max(1,N/nLaps);
+    const double radius = nPerLap/(2*M_PI);
+
+    mt19937 rng(N);
+    normal_distribution<double> noise(0.0,1.0);
+    const double sigmaR = 0.002, sigmat = 0.01, sigmas = 0.001;
+
+    // 真值
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScwTrue(N);
+    for(int i=0; i<N; i++)
+    {
+        const double theta = 2*M_PI*(i%nPerLap)/nPerLap;
+        const Eigen::Vector3d twc(radius*cos(theta),radius*sin(theta),0.1*(i/nPerLap));
+        const Eigen::Matrix3d Rwc = Eigen::AngleAxisd(theta+M_PI/2,Eigen::Vector3d::UnitZ()).toRotationMatrix();
+        vScwTrue[i] = g2o::Sim3(Rwc,twc,1.0).inverse();
+    }
+
+    Optimizer::EssentialGraph::Edge e;
+    auto AddEdge = [&](const int i, const int j, const bool bCoarse)
+    {
+        // 噪声在切空间中采样：[omega,upsilon,sigma]
+        Eigen::Matrix<double,7,1> d;
+        for(int k=0; k<7; k++)
+            d(k) = (k<3 ? sigmaR : k<6 ? sigmat : sigmas)*noise(rng);
+        const g2o::Sim3 dS(d);
+        e.i = i;
+        e.j = j;
+        e.Sji = dS*vScwTrue[j]*vScwTrue[i].inverse();
+        e.bCoarse = bCoarse;
+        graph.vEdges.push_back(e);
+    };
+
+    graph.vnIds.resize(N);
+    graph.vScw.resize(N);
+    graph.vbFixed.assign(N,false);
+    graph.vEdges.clear();
+    for(int i=0; i<N; i++)
+    {
+        graph.vnIds[i] = i;
+        if(i==0)
+        {
+            graph.vScw[0] = vScwTrue[0];
+            graph.vbFixed[0] = true;
+            continue;
+        }
+
+        // Spanning tree，初值由父节点和带噪声的观测得到：Siw = Sji^-1*Sjw
+        AddEdge(i,i-1,true);
+        graph.vScw[i] = graph.vEdges.back().Sji.inverse()*graph.vScw[i-1];
+
+        if(i>=2)
+            AddEdge(i,i-2,false);
+        if(i>=3)
+            AddEdge(i,i-3,false);
+        if(i>=nPerLap)
+            AddEdge(i,i-nPerLap,i%50==0);
+    }
+}
+
+static void RegisterPoseGraphBenchmarks(const Options &opt, vector<Benchmark> &vb)
+{
+    for(size_t k=0; k<opt.vnPoseGraphSizes.size(); k++)
+    {
+        const int N = opt.vnPoseGraphSizes[k];
+        shared_ptr<Optimizer::EssentialGraph> pGraph = make_shared<Optimizer::EssentialGraph>();
+        BuildSyntheticPoseGraph(N,*pGraph);
+
+        // g2o，PoseGraphSolver，以及先在spanning tree和闭环边上迭代5次的分层求解
+        // PoseGraphSolver的消元顺序在调用之间缓存，预热之后测的是沿用缓存时的耗时
+        const char* vNames[3] = {"g2o","PoseGraphSolver","PoseGraphSolver+coarse"};
+        for(int s=0; s<3; s++)
+        {
+            stringstream ss;
+            ss << "Optimizer::OptimizeEssentialGraph/" << vNames[s] << "/" << N;
+            Add(vb,ss.str(),N,[=]()
+            {
+                vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScwOptimized;
+                return Optimizer::OptimizeEssentialGraph(*pGraph,false,20,vScwOptimized);
+            },
+            function<void()>(),
+            [=]()
+            {
+                Optimizer::SetUsePoseGraphSolver(s>0,s==2 ? 5 : 0);
+            });
+        }
+    }
+}
+
+static double Median(vector<double> v)
+{
+    sort(v.begin(),v.end());
+    const size_t n = v.size();
+    return n%2 ? v[n/2] : 0.5*(v[n/2-1]+v[n/2]);
+}
+
+// 一个样本：nIterations次调用的总耗时，有reset时只统计run的时间
+static double RunSample(const Benchmark &b, const size_t nIterations)
+{
+    double t = 0;
+    int sink = 0;
+    if(b.reset)
+    {
+        for(size_t i=0; i<nIterations; i++)
+        {
+            b.reset();
+            const double t0 = Now();
+            sink += b.run();
+            t += Now()-t0;
+        }
+    }
+    else
+    {
+        const double t0 = Now();
+        for(size_t i=0; i<nIterations; i++)
+            sink += b.run();
+        t = Now()-t0;
+    }
+    gSink += sink;
+    return t;
+}
+
+static Result RunBenchmark(const Benchmark &b, const Options &opt)
+{
+    Result r;
+    r.name = b.name;
+    r.nItems = b.nItems;
+
+    // 预热，同时估计单次耗时
+    if(b.reset)
+        b.reset();
+    const double t0 = Now();
+    gSink += b.run();
+    const double tWarmup = Now()-t0;
+
+    // 每个样本的迭代次数，使样本耗时不短于minTime，减小计时误差的影响
+    r.nIterations = 1;
+    double t = RunSample(b,1);
+    t = min(t,tWarmup);
+    while(t<opt.minTime && r.nIterations<(1u<<30))
+    {
+        const double factor = t>0 ? min(10.0,max(2.0,1.2*opt.minTime/t)) : 10.0;
+        r.nIterations = max<size_t>(r.nIterations+1,(size_t)(r.nIterations*factor));
+        t = RunSample(b,r.nIterations);
+    }
+
+    for(int i=0; i<opt.nSamples; i++)
+        r.vSamples.push_back(RunSample(b,r.nIterations)/r.nIterations);
+
+    r.median = Median(r.vSamples);
+    r.min = *min_element(r.vSamples.begin(),r.vSamples.end());
+    r.mean = 0;
+    vector<double> vDev(r.vSamples.size());
+    for(size_t i=0; i<r.vSamples.size(); i++)
+    {
+        r.mean += r.vSamples[i];
+        vDev[i] = fabs(r.vSamples[i]-r.median);
+    }
+    r.mean /= r.vSamples.size();
+    r.mad = Median(vDev);
+    return r;
+}
+
+static bool WriteJson(const string &strFile, const Options &opt, const Fixture &fx, const vector<Result> &vResults)
+{
+    ofstream f(strFile.c_str());
+    if(!f.is_open())
+    {
+        cerr << "ERROR: could not write " << strFile << endl;
+        return false;
+    }
+    f << fixed << setprecision(9);
+    f << "{" << endl;
+    f << "  \"config\": {\"dataset\": " << JsonString(opt.strDataset) << ", \"sequence\": " << JsonString(opt.strSequence)
+      << ", \"settings\": " << JsonString(opt.strSettings) << ", \"keyframes\": " << fx.vpKeyFrames.size()
+      << ", \"stride\": " << opt.nStride << ", \"map_points\": " << fx.pMap->MapPointsInMap()
+      << ", \"features\": " << fx.vFrames.back().N << ", \"samples\": " << opt.nSamples << ", \"min_time\": " << opt.minTime << "}," << endl;
+    f << "  \"benchmarks\": [" << endl;
+    for(size_t i=0; i<vResults.size(); i++)
+    {
+        const Result &r = vResults[i];
+        // 时间单位为秒
+        f << "    {\"name\": " << JsonString(r.name) << ", \"items\": " << r.nItems << ", \"iterations\": " << r.nIterations
+          << ", \"median\": " << r.median << ", \"min\": " << r.min << ", \"mean\": " << r.mean << ", \"mad\": " << r.mad
+          << ", \"samples\": [";
+        for(size_t j=0; j<r.vSamples.size(); j++)
+            f << (j ? ", " : "") << r.vSamples[j];
+        f << "]}" << (i+1<vResults.size() ? "," : "") << endl;
+    }
+    f << "  ]" << endl << "}" << endl;
+    return true;
+}
+
+static void PrintUsage()
+{
+    cerr << endl << "Usage: ./microbench path_to_vocabulary path_to_settings dataset path_to_sequence [options]" << endl
+         << "  dataset: tum_rgbd | kitti_stereo | euroc_stereo" << endl
+         << "           (EuRoC: path_to_sequence is the mav0 folder)" << endl
+         << "  --association file   TUM RGB-D association file (required for tum_rgbd)" << endl
+         << "  --times file         EuRoC timestamps file (default: mav0/cam0/data.csv)" << endl
+         << "  --keyframes n        keyframes in the test map (default 10)" << endl
+         << "  --stride n           images between consecutive keyframes (default 5)" << endl
+         << "  --samples n          samples per benchmark (default 15)" << endl
+         << "  --min-time s         minimum duration of a sample in seconds (default 0.05)" << endl
+         << "  --filter str         only run benchmarks whose name contains str" << endl
+         << "  --json file          JSON results (default microbench.json)" << endl
+         << "  --pose-graph n,...   keyframes of the synthetic pose graphs (default 1000,10000; 0 to skip)" << endl;
+}
+
+static bool ParseOptions(int argc, char **argv, Options &opt)
+{
+    if(argc<5)
+        return false;
+    opt.strVocabulary = argv[1];
+    opt.strSettings = argv[2];
+    opt.strDataset = argv[3];
+    opt.strSequence = argv[4];
+    opt.strJson = "microbench.json";
+    opt.nKeyFrames = 10;
+    opt.nStride = 5;
+    opt.nSamples = 15;
+    opt.minTime = 0.05;
+    opt.vnPoseGraphSizes.push_back(1000);
+    opt.vnPoseGraphSizes.push_back(10000);
+
+    for(int i=5; i<argc; i++)
+    {
+        const string arg = argv[i];
+        if(i+1>=argc)
+        {
+            cerr << "ERROR: missing value or unknown option " << arg << endl;
+            return false;
+        }
+        else if(arg=="--association")
+            opt.strAssociation = argv[++i];
+        else if(arg=="--times")
+            opt.strTimes = argv[++i];
+        else if(arg=="--keyframes")
+            opt.nKeyFrames = atoi(argv[++i]);
+        else if(arg=="--stride")
+            opt.nStride = atoi(argv[++i]);
+        else if(arg=="--samples")
+            opt.nSamples = atoi(argv[++i]);
+        else if(arg=="--min-time")
+            opt.minTime = atof(argv[++i]);
+        else if(arg=="--filter")
+            opt.strFilter = argv[++i];
+        else if(arg=="--json")
+            opt.strJson = argv[++i];
+        else if(arg=="--pose-graph")
+        {
+            opt.vnPoseGraphSizes.clear();
+            stringstream ss(argv[++i]);
+            string item;
+            while(getline(ss,item,','))
+            {
+                const int n = atoi(item.c_str());
+                if(n>0)
+                    opt.vnPoseGraphSizes.push_back(n);
+            }
+        }
+        else
+        {
+            cerr << "ERROR: unknown option " << arg << endl;
+            return false;
+        }
+    }
+    if(opt.nKeyFrames<2 || opt.nStride<1 || opt.nSamples<1)
+    {
+        cerr << "ERROR: --keyframes must be at least 2, --stride and --samples at least 1" << endl;
+        return false;
+    }
+    // 只读取建图需要的图像
+    opt.nMaxFrames = 4*opt.nKeyFrames*opt.nStride;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if(!ParseOptions(argc,argv,opt))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    Sequence seq;
+    if(!LoadSequence(opt,seq))
+        return 1;
+
+    Fixture fx;
+    if(!BuildFixture(opt,seq,fx))
+        return 1;
+
+    vector<Benchmark> vBenchmarks;
+    RegisterBenchmarks(fx,vBenchmarks);
+    RegisterPoseGraphBenchmarks(opt,vBenchmarks);
+
+    cout << endl << left << setw(44) << "benchmark" << right << setw(12) << "median(us)" << setw(12) << "min(us)"
+         << setw(10) << "mad(%)" << setw(12) << "ns/item" << setw(12) << "iterations" << endl;
+    vector<Result> vResults;
+    for(size_t i=0; i<vBenchmarks.size(); i++)
+    {
+        const Benchmark &b = vBenchmarks[i];
+        if(!opt.strFilter.empty() && b.name.find(opt.strFilter)==string::npos)
+            continue;
+        if(b.setup)
+            b.setup();
+
+        const Result r = RunBenchmark(b,opt);
+        vResults.push_back(r);
+        cout << left << setw(44) << r.name << right << fixed << setprecision(2) << setw(12) << r.median*1e6 << setw(12) << r.min*1e6
+             << setw(10) << (r.median>0 ? 100*r.mad/r.median : 0) << setw(12) << (r.nItems ? r.median*1e9/r.nItems : 0)
+             << setw(12) << r.nIterations << endl;
+    }
+
+    if(!WriteJson(opt.strJson,opt,fx,vResults))
+        return 1;
+    cout << endl << "Results saved to " << opt.strJson << endl;
+    return 0;
+}
@@ -0,0 +1,541 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * 离线基准测试
+ * 以最快速度(或固定倍速)回放TUM/KITTI/EuRoC序列，不显示界面，
+ * 记录每帧和每个关键帧各阶段的耗时，与真值比较计算ATE/RPE，
+ * 结果写成JSON报告，用于比较不同版本的速度和精度
+ */
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<sstream>
+#include<iomanip>
+#include<chrono>
+#include<thread>
+#include<cmath>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/highgui/highgui.hpp>
+#include<opencv2/imgproc/imgproc.hpp>
+
+#include<Eigen/Core>
+#include<Eigen/Geometry>
+#include<Eigen/StdVector>
+
+#include<System.h>
+#include<ImageLoader.h>
+
+#include"Benchmark.h"
+
+using namespace std;
+
+typedef vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > PoseVector;
+
+struct Options : public DatasetOptions
+{
+    string strVocabulary;
+    string strGroundTruth;
+    string strReport;
+    string strTrajectory;
+    string strFramesCsv;
+    string strCacheDir;         // 解码后图像的缓存目录
+    int nLoaderThreads;         // 读图线程数，0为在主循环中同步读取
+    int nPrefetch;              // 最多预读的帧数
+    double rate;                // 回放倍速，0为尽快处理
+    bool bSync;                 // 每帧之后等待局部建图空闲
+    bool bViewer;
+    double rpeDelta;            // RPE的时间间隔(秒)
+    double maxTimeDiff;         // 与真值关联的最大时间差(秒)
+};
+
+// 真值，默认路径：TUM为groundtruth.txt，EuRoC为state_groundtruth_estimate0/data.csv(IMU坐标系)，KITTI需要指定poses/XX.txt
+static bool LoadGroundTruth(const Options &opt, const Sequence &seq, vector<double> &vTimestamps, PoseVector &vTwc)
+{
+    string strFile = opt.strGroundTruth;
+    if(strFile.empty())
+    {
+        if(opt.strDataset.compare(0,3,"tum")==0)
+            strFile = opt.strSequence+"/groundtruth.txt";
+        else if(opt.strDataset.compare(0,5,"euroc")==0)
+            strFile = opt.strSequence+"/state_groundtruth_estimate0/data.csv";
+    }
+    if(strFile.empty() || !FileExists(strFile))
+    {
+        cout << "No ground truth found, skipping accuracy evaluation (use --groundtruth)" << endl;
+        return false;
+    }
+
+    ifstream f(strFile.c_str());
+    vector<string> v;
+    const bool bKITTI = opt.strDataset.compare(0,5,"kitti")==0;
+    const bool bEuRoC = opt.strDataset.compare(0,5,"euroc")==0;
+    while(ReadFields(f,v))
+    {
+        Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+        double t;
+        if(bKITTI)
+        {
+            // 每行为3x4的Twc，与times.txt逐行对应
+            if(v.size()<12 || vTimestamps.size()>=seq.vTimestamps.size())
+                continue;
+            for(int r=0; r<3; r++)
+                for(int c=0; c<4; c++)
+                    T(r,c) = atof(v[4*r+c].c_str());
+            t = seq.vTimestamps[vTimestamps.size()];
+        }
+        else if(bEuRoC)
+        {
+            // timestamp[ns],px,py,pz,qw,qx,qy,qz,...
+            if(v.size()<8)
+                continue;
+            t = atof(v[0].c_str())/1e9;
+            T.block<3,1>(0,3) << atof(v[1].c_str()), atof(v[2].c_str()), atof(v[3].c_str());
+            T.block<3,3>(0,0) = Eigen::Quaterniond(atof(v[4].c_str()),atof(v[5].c_str()),atof(v[6].c_str()),atof(v[7].c_str())).normalized().toRotationMatrix();
+        }
+        else
+        {
+            // timestamp tx ty tz qx qy qz qw
+            if(v.size()<8)
+                continue;
+            t = atof(v[0].c_str());
+            T.block<3,1>(0,3) << atof(v[1].c_str()), atof(v[2].c_str()), atof(v[3].c_str());
+            T.block<3,3>(0,0) = Eigen::Quaterniond(atof(v[7].c_str()),atof(v[4].c_str()),atof(v[5].c_str()),atof(v[6].c_str())).normalized().toRotationMatrix();
+        }
+        vTimestamps.push_back(t);
+        vTwc.push_back(T);
+    }
+    cout << "Ground truth: " << strFile << " (" << vTwc.size() << " poses)" << endl;
+    return !vTwc.empty();
+}
+
+struct Accuracy
+{
+    size_t nMatched;
+    double scale;
+    Stats ate;          // 米
+    Stats rpeTrans;     // 米
+    Stats rpeRot;       // 度
+};
+
+/**
+ * 按时间戳关联估计值和真值，用Umeyama对齐(单目带尺度)后计算
+ * ATE: 对齐后位置误差
+ * RPE: 间隔rpeDelta秒的相对位姿误差
+ */
+static bool Evaluate(const Options &opt, const bool bMonocular, const vector<double> &vEstTimes, const PoseVector &vEst,
+                     const vector<double> &vGtTimes, const PoseVector &vGt, Accuracy &acc)
+{
+    // 真值按时间排序，二分查找最近的时间戳
+    vector<size_t> vGtOrder(vGtTimes.size());
+    for(size_t i=0; i<vGtOrder.size(); i++)
+        vGtOrder[i] = i;
+    sort(vGtOrder.begin(),vGtOrder.end(),[&](size_t a, size_t b){ return vGtTimes[a]<vGtTimes[b]; });
+    vector<double> vSortedTimes(vGtOrder.size());
+    for(size_t i=0; i<vGtOrder.size(); i++)
+        vSortedTimes[i] = vGtTimes[vGtOrder[i]];
+
+    vector<double> vTimes;
+    PoseVector vE, vG;
+    for(size_t i=0; i<vEst.size(); i++)
+    {
+        const double t = vEstTimes[i];
+        vector<double>::const_iterator it = lower_bound(vSortedTimes.begin(),vSortedTimes.end(),t);
+        size_t best = vSortedTimes.size();
+        double bestDiff = opt.maxTimeDiff;
+        if(it!=vSortedTimes.end() && fabs(*it-t)<=bestDiff)
+        {
+            best = it-vSortedTimes.begin();
+            bestDiff = fabs(*it-t);
+        }
+        if(it!=vSortedTimes.begin() && fabs(*(it-1)-t)<=bestDiff)
+            best = it-1-vSortedTimes.begin();
+        if(best==vSortedTimes.size())
+            continue;
+        vTimes.push_back(t);
+        vE.push_back(vEst[i]);
+        vG.push_back(vGt[vGtOrder[best]]);
+    }
+
+    acc = Accuracy();
+    acc.nMatched = vE.size();
+    if(vE.size()<3)
+    {
+        cerr << "Only " << vE.size() << " poses matched the ground truth, skipping accuracy evaluation" << endl;
+        return false;
+    }
+
+    Eigen::Matrix3Xd src(3,vE.size()), dst(3,vG.size());
+    for(size_t i=0; i<vE.size(); i++)
+    {
+        src.col(i) = vE[i].block<3,1>(0,3);
+        dst.col(i) = vG[i].block<3,1>(0,3);
+    }
+    const Eigen::Matrix4d S = Eigen::umeyama(src,dst,bMonocular);
+    const Eigen::Matrix3d sR = S.block<3,3>(0,0);
+    acc.scale = pow(sR.determinant(),1.0/3.0);
+
+    // 对齐后的估计位姿
+    PoseVector vAligned(vE.size());
+    vector<double> vAte(vE.size());
+    for(size_t i=0; i<vE.size(); i++)
+    {
+        Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+        T.block<3,3>(0,0) = sR/acc.scale*vE[i].block<3,3>(0,0);
+        T.block<3,1>(0,3) = sR*vE[i].block<3,1>(0,3)+S.block<3,1>(0,3);
+        vAligned[i] = T;
+        vAte[i] = (T.block<3,1>(0,3)-vG[i].block<3,1>(0,3)).norm();
+    }
+    acc.ate = ComputeStats(vAte);
+
+    vector<double> vRpeTrans, vRpeRot;
+    size_t j = 0;
+    for(size_t i=0; i<vAligned.size(); i++)
+    {
+        if(j<=i)
+            j = i+1;
+        while(j<vAligned.size() && vTimes[j]<vTimes[i]+opt.rpeDelta)
+            j++;
+        if(j>=vAligned.size())
+            break;
+        const Eigen::Matrix4d Egt = vG[i].inverse()*vG[j];
+        const Eigen::Matrix4d Eest = vAligned[i].inverse()*vAligned[j];
+        const Eigen::Matrix4d E = Egt.inverse()*Eest;
+        vRpeTrans.push_back(E.block<3,1>(0,3).norm());
+        const double c = max(-1.0,min(1.0,(E.block<3,3>(0,0).trace()-1.0)/2.0));
+        vRpeRot.push_back(acos(c)*180.0/M_PI);
+    }
+    acc.rpeTrans = ComputeStats(vRpeTrans);
+    acc.rpeRot = ComputeStats(vRpeRot);
+    return true;
+}
+
+// scale为写入时的单位换算，例如秒换算为毫秒时为1000
+static void WriteStats(ostream &f, const string &strName, const Stats &s, const double scale, const bool bLast=false)
+{
+    f << "    " << JsonString(strName) << ": {\"n\": " << s.n << ", \"mean\": " << s.mean*scale << ", \"median\": " << s.median*scale
+      << ", \"p90\": " << s.p90*scale << ", \"max\": " << s.max*scale << ", \"rmse\": " << s.rmse*scale
+      << ", \"total\": " << s.total*scale << "}" << (bLast ? "" : ",") << endl;
+}
+
+static void PrintUsage()
+{
+    cerr << endl << "Usage: ./slam_benchmark path_to_vocabulary path_to_settings dataset path_to_sequence [options]" << endl
+         << "  dataset: tum_mono | tum_rgbd | kitti_mono | kitti_stereo | euroc_mono | euroc_stereo" << endl
+         << "           (EuRoC: path_to_sequence is the mav0 folder)" << endl
+         << "  --association file   TUM RGB-D association file (required for tum_rgbd)" << endl
+         << "  --times file         EuRoC timestamps file (default: mav0/cam0/data.csv)" << endl
+         << "  --groundtruth file   ground truth (TUM/EuRoC: found in the sequence by default)" << endl
+         << "  --rate r             replay speed relative to real time, 0 = as fast as possible (default 0)" << endl
+         << "  --sync               wait for local mapping after every frame (reproducible keyframe decisions)" << endl
+         << "  --frames n           process only the first n frames" << endl
+         << "  --rpe-delta s        RPE interval in seconds (default 1.0)" << endl
+         << "  --max-time-diff s    max timestamp difference to match ground truth (default 0.02)" << endl
+         << "  --report file        JSON report (default benchmark.json)" << endl
+         << "  --trajectory file    save the estimated trajectory in TUM format" << endl
+         << "  --frames-csv file    save per-frame timings" << endl
+         << "  --loader-threads n   image decoding threads, 0 = load synchronously (default 2)" << endl
+         << "  --prefetch n         max frames decoded ahead (default 8)" << endl
+         << "  --cache-dir dir      cache decoded images as raw files, memory-mapped on later runs" << endl
+         << "  --viewer             show the viewer (off by default)" << endl;
+}
+
+static bool ParseOptions(int argc, char **argv, Options &opt)
+{
+    if(argc<5)
+        return false;
+    opt.strVocabulary = argv[1];
+    opt.strSettings = argv[2];
+    opt.strDataset = argv[3];
+    opt.strSequence = argv[4];
+    opt.strReport = "benchmark.json";
+    opt.rate = 0;
+    opt.bSync = false;
+    opt.bViewer = false;
+    opt.nMaxFrames = 0;
+    opt.rpeDelta = 1.0;
+    opt.maxTimeDiff = 0.02;
+    opt.nLoaderThreads = 2;
+    opt.nPrefetch = 8;
+
+    for(int i=5; i<argc; i++)
+    {
+        const string arg = argv[i];
+        const bool bHasValue = i+1<argc;
+        if(arg=="--sync")
+            opt.bSync = true;
+        else if(arg=="--viewer")
+            opt.bViewer = true;
+        else if(!bHasValue)
+        {
+            cerr << "ERROR: missing value or unknown option " << arg << endl;
+            return false;
+        }
+        else if(arg=="--association")
+            opt.strAssociation = argv[++i];
+        else if(arg=="--times")
+            opt.strTimes = argv[++i];
+        else if(arg=="--groundtruth")
+            opt.strGroundTruth = argv[++i];
+        else if(arg=="--rate")
+            opt.rate = atof(argv[++i]);
+        else if(arg=="--frames")
+            opt.nMaxFrames = atoi(argv[++i]);
+        else if(arg=="--rpe-delta")
+            opt.rpeDelta = atof(argv[++i]);
+        else if(arg=="--max-time-diff")
+            opt.maxTimeDiff = atof(argv[++i]);
+        else if(arg=="--report")
+            opt.strReport = argv[++i];
+        else if(arg=="--trajectory")
+            opt.strTrajectory = argv[++i];
+        else if(arg=="--frames-csv")
+            opt.strFramesCsv = argv[++i];
+        else if(arg=="--loader-threads")
+            opt.nLoaderThreads = atoi(argv[++i]);
+        else if(arg=="--prefetch")
+            opt.nPrefetch = atoi(argv[++i]);
+        else if(arg=="--cache-dir")
+            opt.strCacheDir = argv[++i];
+        else
+        {
+            cerr << "ERROR: unknown option " << arg << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if(!ParseOptions(argc,argv,opt))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    Sequence seq;
+    if(!LoadSequence(opt,seq))
+        return 1;
+    const size_t nImages = seq.vstrImages.size();
+
+    // Create SLAM system. It initializes all system threads and gets ready to process frames.
+    ORB_SLAM2::System SLAM(opt.strVocabulary,opt.strSettings,seq.sensor,opt.bViewer);
+
+    cout << endl << "-------" << endl;
+    cout << "Start processing sequence ..." << endl;
+    cout << "Images in the sequence: " << nImages << endl;
+    cout << "Rate: " << (opt.rate>0 ? opt.rate : 0) << (opt.rate>0 ? "x" : " (as fast as possible)") << (opt.bSync ? ", synchronous local mapping" : "") << endl << endl;
+
+    // 每帧的读图、跟踪耗时(秒)和各阶段耗时
+    vector<double> vLoad(nImages), vTrack(nImages);
+    vector<ORB_SLAM2::Tracking::FrameTimes> vFrameTimes(nImages);
+    vector<int> vStates(nImages);
+
+    // 读图、解码和EuRoC双目校正在后台线程中进行，load只统计跟踪等待图像的时间
+    ORB_SLAM2::ImageLoader loader(seq.vstrImages,seq.vstrImages2,opt.nLoaderThreads,opt.nPrefetch,opt.strCacheDir);
+    loader.SetProcessFunction([&seq](cv::Mat &im, cv::Mat &im2){ RectifyImages(seq,im,im2); });
+
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    cv::Mat im, im2;
+    for(size_t ni=0; ni<nImages; ni++)
+    {
+        // 按时间戳回放
+        if(opt.rate>0)
+        {
+            const double tTarget = (seq.vTimestamps[ni]-seq.vTimestamps[0])/opt.rate;
+            this_thread::sleep_until(tStart+chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(tTarget)));
+        }
+
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        if(!loader.Get(ni,im,im2))
+            return 1;
+        chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+
+        if(seq.sensor==ORB_SLAM2::System::MONOCULAR)
+            SLAM.TrackMonocular(im,seq.vTimestamps[ni]);
+        else if(seq.sensor==ORB_SLAM2::System::STEREO)
+            SLAM.TrackStereo(im,im2,seq.vTimestamps[ni]);
+        else
+            SLAM.TrackRGBD(im,im2,seq.vTimestamps[ni]);
+
+        chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+        vLoad[ni] = chrono::duration_cast<chrono::duration<double> >(t1-t0).count();
+        vTrack[ni] = chrono::duration_cast<chrono::duration<double> >(t2-t1).count();
+        vFrameTimes[ni] = SLAM.GetFrameTimes();
+        vStates[ni] = SLAM.GetTrackingState();
+
+        if(opt.bSync)
+            SLAM.WaitForLocalMapping();
+
+        if((ni+1)%100==0)
+            cout << "Processed " << ni+1 << "/" << nImages << " frames" << endl;
+    }
+
+    // 最终轨迹要包含闭环之后的全局BA结果
+    while(SLAM.IsRunningGlobalBA())
+        this_thread::sleep_for(chrono::milliseconds(10));
+    const double tWall = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-tStart).count();
+
+    long unsigned int nKFs, nMPs;
+    SLAM.GetMapSize(nKFs,nMPs);
+
+    // Stop all threads
+    SLAM.Shutdown();
+
+    vector<double> vEstTimes;
+    vector<cv::Mat> vEstTwc;
+    SLAM.GetTrajectory(vEstTimes,vEstTwc);
+    PoseVector vEst(vEstTwc.size());
+    for(size_t i=0; i<vEstTwc.size(); i++)
+    {
+        vEst[i] = Eigen::Matrix4d::Identity();
+        for(int r=0; r<3; r++)
+            for(int c=0; c<4; c++)
+                vEst[i](r,c) = vEstTwc[i].at<float>(r,c);
+    }
+
+    if(!opt.strTrajectory.empty())
+    {
+        ofstream f(opt.strTrajectory.c_str());
+        f << fixed;
+        for(size_t i=0; i<vEst.size(); i++)
+        {
+            const Eigen::Quaterniond q(Eigen::Matrix3d(vEst[i].block<3,3>(0,0)));
+            f << setprecision(6) << vEstTimes[i] << setprecision(9) << " " << vEst[i](0,3) << " " << vEst[i](1,3) << " " << vEst[i](2,3)
+              << " " << q.x() << " " << q.y() << " " << q.z() << " " << q.w() << endl;
+        }
+    }
+
+    if(!opt.strFramesCsv.empty())
+    {
+        ofstream f(opt.strFramesCsv.c_str());
+        f << "timestamp,state,load,track,extract,pose,local_map,keyframe" << endl;
+        f << fixed;
+        for(size_t i=0; i<nImages; i++)
+        {
+            const ORB_SLAM2::Tracking::FrameTimes &ft = vFrameTimes[i];
+            f << setprecision(6) << seq.vTimestamps[i] << "," << vStates[i] << setprecision(9) << "," << vLoad[i] << "," << vTrack[i]
+              << "," << ft.tExtract << "," << ft.tPose << "," << ft.tLocalMap << "," << ft.tKeyFrame << endl;
+        }
+    }
+
+    // 统计
+    int nTracked = 0, nLost = 0;
+    vector<double> vExtract(nImages), vPose(nImages), vLocalMap(nImages), vKeyFrame(nImages);
+    for(size_t i=0; i<nImages; i++)
+    {
+        if(vStates[i]==ORB_SLAM2::Tracking::OK)
+            nTracked++;
+        else if(vStates[i]==ORB_SLAM2::Tracking::LOST)
+            nLost++;
+        vExtract[i] = vFrameTimes[i].tExtract;
+        vPose[i] = vFrameTimes[i].tPose;
+        vLocalMap[i] = vFrameTimes[i].tLocalMap;
+        vKeyFrame[i] = vFrameTimes[i].tKeyFrame;
+    }
+
+    const vector<ORB_SLAM2::LocalMapping::KeyFrameTimes> vKFTimes = SLAM.GetKeyFrameTimes();
+    vector<double> vProcess, vTriangulate, vFuse, vLocalBA, vCulling, vKFTotal;
+    for(size_t i=0; i<vKFTimes.size(); i++)
+    {
+        vProcess.push_back(vKFTimes[i].tProcess);
+        vTriangulate.push_back(vKFTimes[i].tTriangulate);
+        vFuse.push_back(vKFTimes[i].tFuse);
+        vLocalBA.push_back(vKFTimes[i].tLocalBA);
+        vCulling.push_back(vKFTimes[i].tCulling);
+        vKFTotal.push_back(vKFTimes[i].tTotal);
+    }
+
+    vector<double> vGtTimes;
+    PoseVector vGt;
+    Accuracy acc;
+    bool bAccuracy = false;
+    if(LoadGroundTruth(opt,seq,vGtTimes,vGt))
+        bAccuracy = Evaluate(opt,seq.sensor==ORB_SLAM2::System::MONOCULAR,vEstTimes,vEst,vGtTimes,vGt,acc);
+
+    const Stats trackStats = ComputeStats(vTrack);
+    cout << "-------" << endl << endl;
+    cout << "frames: " << nImages << " (tracked " << nTracked << ", lost " << nLost << ")" << endl;
+    cout << "wall time: " << tWall << " s, " << nImages/tWall << " fps" << endl;
+    cout << "median tracking time: " << trackStats.median << endl;
+    cout << "mean tracking time: " << trackStats.mean << endl;
+    cout << "keyframes: " << nKFs << ", map points: " << nMPs << endl;
+    if(bAccuracy)
+    {
+        cout << "ATE rmse: " << acc.ate.rmse << " m (" << acc.nMatched << " poses, scale " << acc.scale << ")" << endl;
+        cout << "RPE rmse: " << acc.rpeTrans.rmse << " m, " << acc.rpeRot.rmse << " deg per " << opt.rpeDelta << " s" << endl;
+    }
+
+    // JSON报告，时间单位为毫秒
+    ofstream f(opt.strReport.c_str());
+    if(!f.is_open())
+    {
+        cerr << "ERROR: cannot write " << opt.strReport << endl;
+        return 1;
+    }
+    f << setprecision(9);
+    f << "{" << endl;
+    f << "  \"build\": {\"compiled\": " << JsonString(string(__DATE__)+" "+__TIME__) << ", \"compiler\": " << JsonString(__VERSION__) << "}," << endl;
+    f << "  \"config\": {\"dataset\": " << JsonString(opt.strDataset) << ", \"sequence\": " << JsonString(opt.strSequence)
+      << ", \"settings\": " << JsonString(opt.strSettings) << ", \"rate\": " << opt.rate << ", \"sync\": " << (opt.bSync ? "true" : "false")
+      << ", \"threads\": " << thread::hardware_concurrency() << ", \"loader_threads\": " << opt.nLoaderThreads
+      << ", \"prefetch\": " << opt.nPrefetch << ", \"image_cache\": " << (opt.strCacheDir.empty() ? "false" : "true") << "}," << endl;
+    f << "  \"run\": {\"frames\": " << nImages << ", \"tracked\": " << nTracked << ", \"lost\": " << nLost
+      << ", \"wall_time_s\": " << tWall << ", \"fps\": " << nImages/tWall
+      << ", \"keyframes\": " << nKFs << ", \"map_points\": " << nMPs << ", \"trajectory_poses\": " << vEst.size() << "}," << endl;
+    f << "  \"tracking_ms\": {" << endl;
+    WriteStats(f,"load",ComputeStats(vLoad),1e3);
+    WriteStats(f,"track",trackStats,1e3);
+    WriteStats(f,"extract",ComputeStats(vExtract),1e3);
+    WriteStats(f,"pose",ComputeStats(vPose),1e3);
+    WriteStats(f,"local_map",ComputeStats(vLocalMap),1e3);
+    WriteStats(f,"keyframe",ComputeStats(vKeyFrame),1e3,true);
+    f << "  }," << endl;
+    f << "  \"local_mapping_ms\": {" << endl;
+    WriteStats(f,"process",ComputeStats(vProcess),1e3);
+    WriteStats(f,"triangulate",ComputeStats(vTriangulate),1e3);
+    WriteStats(f,"fuse",ComputeStats(vFuse),1e3);
+    WriteStats(f,"local_ba",ComputeStats(vLocalBA),1e3);
+    WriteStats(f,"culling",ComputeStats(vCulling),1e3);
+    WriteStats(f,"total",ComputeStats(vKFTotal),1e3,true);
+    f << "  }," << endl;
+    if(bAccuracy)
+    {
+        f << "  \"accuracy\": {" << endl;
+        f << "    \"matched_poses\": " << acc.nMatched << ", \"scale\": " << acc.scale << ", \"rpe_delta_s\": " << opt.rpeDelta << "," << endl;
+        WriteStats(f,"ate_m",acc.ate,1.0);
+        WriteStats(f,"rpe_trans_m",acc.rpeTrans,1.0);
+        WriteStats(f,"rpe_rot_deg",acc.rpeRot,1.0,true);
+        f << "  }" << endl;
+    }
+    else
+        f << "  \"accuracy\": null" << endl;
+    f << "}" << endl;
+
+    cout << "Report saved to " << opt.strReport << endl;
+
+    return 0;
+}
@@ -27,6 +27,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImageLoader.h>
 
 using namespace std;
 
@@ -63,23 +64,22 @@ int main(int argc, char **argv)
     cout << "Images in the sequence: " << nImages << endl << endl;
 
     // Main loop
+    // 图像在后台线程中预读和解码
+    vector<string> vstrImagePaths(nImages);
+    for(int ni=0; ni<nImages; ni++)
+        vstrImagePaths[ni] = string(argv[3])+"/"+vstrImageFilenames[ni];
+    ORB_SLAM2::ImageLoader loader(vstrImagePaths,vector<string>());
     cv::Mat im;
     //循环读取图片
     for(int ni=0; ni<nImages; ni++)
     {
         // Read image from file
 	//读取图片
-        im = cv::imread(string(argv[3])+"/"+vstrImageFilenames[ni],CV_LOAD_IMAGE_UNCHANGED);
+        if(!loader.Get(ni,im))
+            return 1;
 	//读取时间戳
         double tframe = vTimestamps[ni];
 
-        if(im.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(argv[3]) << "/" << vstrImageFilenames[ni] << endl;
-            return 1;
-        }
-
 #ifdef COMPILEDWITHC11
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 #else
@@ -27,6 +27,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImageLoader.h>
 
 using namespace std;
 
@@ -73,20 +74,21 @@ int main(int argc, char **argv)
     cout << "Images in the sequence: " << nImages << endl << endl;
 
     // Main loop
+    // 彩色图和深度图在后台线程中预读和解码
+    vector<string> vstrPathsRGB(nImages), vstrPathsD(nImages);
+    for(int ni=0; ni<nImages; ni++)
+    {
+        vstrPathsRGB[ni] = string(argv[3])+"/"+vstrImageFilenamesRGB[ni];
+        vstrPathsD[ni] = string(argv[3])+"/"+vstrImageFilenamesD[ni];
+    }
+    ORB_SLAM2::ImageLoader loader(vstrPathsRGB,vstrPathsD);
     cv::Mat imRGB, imD;
     for(int ni=0; ni<nImages; ni++)
     {
         // Read image and depthmap from file
-        imRGB = cv::imread(string(argv[3])+"/"+vstrImageFilenamesRGB[ni],CV_LOAD_IMAGE_UNCHANGED);
-        imD = cv::imread(string(argv[3])+"/"+vstrImageFilenamesD[ni],CV_LOAD_IMAGE_UNCHANGED);
-        double tframe = vTimestamps[ni];
-
-        if(imRGB.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(argv[3]) << "/" << vstrImageFilenamesRGB[ni] << endl;
+        if(!loader.Get(ni,imRGB,imD))
             return 1;
-        }
+        double tframe = vTimestamps[ni];
 
 #ifdef COMPILEDWITHC11
         std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
@@ -28,6 +28,7 @@
 #include<opencv2/core/core.hpp>
 
 #include<System.h>
+#include<ImageLoader.h>
 
 using namespace std;
 
@@ -112,29 +113,22 @@ int main(int argc, char **argv)
     cout << "Images in the sequence: " << nImages << endl << endl;
 
     // Main loop
-    cv::Mat imLeft, imRight, imLeftRect, imRightRect;
+    // 左右目图像在后台线程中预读、解码和校正
+    ORB_SLAM2::ImageLoader loader(vstrImageLeft,vstrImageRight);
+    loader.SetProcessFunction([&](cv::Mat &imLeft, cv::Mat &imRight)
+    {
+        cv::Mat imLeftRect, imRightRect;
+        cv::remap(imLeft,imLeftRect,M1l,M2l,cv::INTER_LINEAR);
+        cv::remap(imRight,imRightRect,M1r,M2r,cv::INTER_LINEAR);
+        imLeft = imLeftRect;
+        imRight = imRightRect;
+    });
+    cv::Mat imLeftRect, imRightRect;
     for(int ni=0; ni<nImages; ni++)
     {
         // Read left and right images from file
-        imLeft = cv::imread(vstrImageLeft[ni],CV_LOAD_IMAGE_UNCHANGED);
-        imRight = cv::imread(vstrImageRight[ni],CV_LOAD_IMAGE_UNCHANGED);
-
-        if(imLeft.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(vstrImageLeft[ni]) << endl;
+        if(!loader.Get(ni,imLeftRect,imRightRect))
             return 1;
-        }
-
-        if(imRight.empty())
-        {
-            cerr << endl << "Failed to load image at: "
-                 << string(vstrImageRight[ni]) << endl;
-            return 1;
-        }
-
-        cv::remap(imLeft,imLeftRect,M1l,M2l,cv::INTER_LINEAR);
-        cv::remap(imRight,imRightRect,M1r,M2r,cv::INTER_LINEAR);
 
         double tframe = vTimeStamp[ni];
 
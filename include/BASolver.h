@@ -0,0 +1,198 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BASOLVER_H
+#define BASOLVER_H
+
+#include <vector>
+#include <atomic>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM2
+{
+
+/**
+ * 专用于ORB-SLAM两种边(单目2维重投影误差、双目3维重投影误差)的BA求解器
+ * 与g2o::BlockSolver_6_3的区别：
+ * 1. 位姿块6维、点块3维都是编译期固定大小，没有虚函数调用
+ * 2. 边按类型以SoA(structure of arrays)的方式连续储存
+ * 3. 每次迭代显式地对点块做Schur消元，得到只含相机的约化系统
+ * 4. 约化系统相机少时用稠密LDLT，相机多时用稀疏LDLT(AMD排序，符号分解只做一次)
+ * 误差定义、雅克比、Huber核以及LM阻尼策略都与g2o中对应的实现保持一致，方便在相同输入上对比
+ */
+class BASolver
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    BASolver();
+
+    /**
+     * 添加相机位姿顶点
+     * @param Tcw    世界坐标系到相机坐标系的变换
+     * @param bFixed 是否固定(不优化)
+     * @return 相机顶点序号
+     */
+    int AddCamera(const g2o::SE3Quat &Tcw, const double fx, const double fy, const double cx, const double cy,
+                  const double bf, const bool bFixed);
+    //添加地图点顶点，返回地图点顶点序号
+    int AddPoint(const Eigen::Vector3d &Xw);
+
+    //添加单目边，观测为(u,v)，信息矩阵为invSigma2*I
+    int AddMonoEdge(const int nCam, const int nPoint, const Eigen::Vector2d &obs, const double invSigma2);
+    //添加双目边，观测为(u,v,ur)，信息矩阵为invSigma2*I
+    int AddStereoEdge(const int nCam, const int nPoint, const Eigen::Vector3d &obs, const double invSigma2);
+
+    //Huber核函数参数，bRobust为false时不使用核函数
+    void SetRobustKernel(const bool bRobust, const double deltaMono, const double deltaStereo);
+
+    //和g2o::SparseOptimizer::setForceStopFlag一样，每次迭代前检查
+    void SetForceStopFlag(bool* pbStopFlag);
+    //和IterationCounter一样，每次迭代后写入已完成的迭代次数，供其它线程读取进度
+    void SetIterationCounter(std::atomic<int>* pnIterationsDone);
+
+    //每个点只有一个观测时约化系统仍然可解，但相机数超过这个阈值就改用稀疏分解
+    void SetDenseThreshold(const int nMaxDenseCameras);
+
+    //Levenberg-Marquardt迭代，返回实际的迭代次数
+    int Optimize(const int nIterations);
+
+    // 边的状态，用于在两轮优化之间剔除外点(对应g2o的edge->setLevel(1))
+    void SetMonoActive(const size_t i, const bool bActive);
+    void SetStereoActive(const size_t i, const bool bActive);
+    //不带核函数的卡方值 e'*Omega*e
+    double MonoChi2(const size_t i) const;
+    double StereoChi2(const size_t i) const;
+    bool IsMonoDepthPositive(const size_t i) const;
+    bool IsStereoDepthPositive(const size_t i) const;
+
+    const g2o::SE3Quat &GetCameraPose(const int nCam) const;
+    const Eigen::Vector3d &GetPoint(const int nPoint) const;
+
+    size_t CamerasSize() const { return mvPoses.size(); }
+    size_t PointsSize() const { return mvPoints.size(); }
+    size_t MonoEdgesSize() const { return mMono.vCam.size(); }
+    size_t StereoEdgesSize() const { return mStereo.vCam.size(); }
+
+protected:
+
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+    typedef Eigen::Matrix<double,6,3> Matrix63;
+
+    // 同一种边的所有数据(SoA)，D为误差维度
+    template<int D>
+    struct EdgeSet
+    {
+        typedef Eigen::Matrix<double,D,1> VectorD;
+        std::vector<int> vCam;
+        std::vector<int> vPoint;
+        std::vector<VectorD, Eigen::aligned_allocator<VectorD> > vObs;
+        std::vector<double> vInvSigma2;
+        std::vector<char> vbActive;
+    };
+
+    //建立点到边的邻接关系，以及约化系统的块结构，只在图结构改变后执行一次
+    void BuildStructure();
+
+    //统一边序号对应的相机
+    int EdgeCamera(const size_t e) const;
+
+    //在当前估计处线性化所有边，累加U,V,W,bc,bp，返回带核函数的总误差
+    double Linearize();
+    template<int D>
+    void LinearizeEdges(const EdgeSet<D> &edges, const double delta, const size_t nOffset, double &chi2);
+
+    //在给定阻尼下求解增量，返回false表示分解失败
+    bool SolveReducedSystem(const double lambda);
+
+    //计算带核函数的总误差
+    double ComputeTotalChi2() const;
+    template<int D>
+    double ComputeEdgesChi2(const EdgeSet<D> &edges, const double delta) const;
+
+    //把增量加到当前估计上，返回 dx'*(lambda*dx+b) 用于计算增益比
+    double ApplyUpdate(const double lambda);
+
+protected:
+
+    // 相机
+    std::vector<g2o::SE3Quat, Eigen::aligned_allocator<g2o::SE3Quat> > mvPoses;
+    std::vector<double> mvfx, mvfy, mvcx, mvcy, mvbf;
+    std::vector<bool> mvbFixed;
+    //相机在约化系统中的序号，固定的相机为-1
+    std::vector<int> mvCamIdx;
+    int mnFreeCams;
+
+    // 地图点
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > mvPoints;
+
+    // 边
+    EdgeSet<2> mMono;
+    EdgeSet<3> mStereo;
+
+    bool mbRobust;
+    double mDeltaMono;
+    double mDeltaStereo;
+
+    bool* mpbStopFlag;
+    std::atomic<int>* mpnIterationsDone;
+    int mnMaxDenseCameras;
+
+    // 点到边的邻接关系(CSR)，边序号为统一序号：单目边在前，双目边在后
+    bool mbStructureDirty;
+    std::vector<int> mvPointEdgeStart;
+    std::vector<int> mvPointEdges;
+    //每个点的每对边(a<=b，两者所在相机都不固定)在约化系统中对应的块序号
+    std::vector<int> mvPointPairStart;
+    std::vector<int> mvPairBlock;
+    //约化系统中的非零块(上三角)
+    std::vector<std::pair<int,int> > mvBlockIdx;
+
+    // 线性化结果
+    std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > mvU;
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > mvbc;
+    std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d> > mvV;
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > mvbp;
+    std::vector<Matrix63, Eigen::aligned_allocator<Matrix63> > mvW;
+    std::vector<char> mvbEdgeLinearized;
+    //每个点参与线性化的边数，为0的点不更新
+    std::vector<int> mvnPointEdges;
+
+    // 求解结果
+    std::vector<Eigen::Matrix3d, Eigen::aligned_allocator<Eigen::Matrix3d> > mvVinv;
+    std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > mvS;
+    Eigen::VectorXd mDeltaCams;
+    std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > mvDeltaPoints;
+
+    // 稀疏分解，符号分解(排序)在结构不变时复用
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>, Eigen::Upper> mSparseLDLT;
+    bool mbPatternAnalyzed;
+};
+
+} //namespace ORB_SLAM
+
+#endif // BASOLVER_H
@@ -22,6 +22,7 @@
 #define FRAME_H
 
 #include<vector>
+#include<atomic>
 
 #include "MapPoint.h"
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
@@ -130,14 +131,14 @@ public:
     double mTimeStamp;
 
     // Calibration matrix and OpenCV distortion parameters.
-    // 相机内参
+    // 相机内参，多相机时各不相同，每帧保存自己相机的值
     cv::Mat mK; //mk貌似是经过畸变矫正的相机内参，由cv::undistortPoints实现?
-    static float fx;
-    static float fy;
-    static float cx;
-    static float cy;
-    static float invfx;
-    static float invfy;
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    float invfx;
+    float invfy;
     cv::Mat mDistCoef;  // 畸变参数
 
     // Stereo baseline multiplied by fx.
@@ -194,9 +195,9 @@ public:
 
     // Keypoints are assigned to cells in a grid to reduce matching complexity when projecting MapPoints.
     //x轴窗格宽倒数
-    static float mfGridElementWidthInv;
+    float mfGridElementWidthInv;
     //y轴窗格高倒数
-    static float mfGridElementHeightInv;
+    float mfGridElementHeightInv;
     //储存这各个窗格的特征点在mvKeysUn中的序号
     std::vector<std::size_t> mGrid[FRAME_GRID_COLS][FRAME_GRID_ROWS];
 
@@ -205,7 +206,8 @@ public:
 
     // Current and Next Frame id.
     //静态变量，下一个Frame对象id
-    static long unsigned int nNextId;
+    //多相机时各相机的Tracking在各自的线程中创建Frame，id在所有相机之间唯一
+    static std::atomic<long unsigned int> nNextId;
     //当前Frame对象id
     long unsigned int mnId;
 
@@ -224,13 +226,11 @@ public:
     vector<float> mvLevelSigma2;
     vector<float> mvInvLevelSigma2;
 
-    // Undistorted Image Bounds (computed once).
-    static float mnMinX;
-    static float mnMaxX;
-    static float mnMinY;
-    static float mnMaxY;
-
-    static bool mbInitialComputations;
+    // Undistorted Image Bounds.
+    float mnMinX;
+    float mnMaxX;
+    float mnMinY;
+    float mnMaxY;
 
 
 private:
@@ -245,6 +245,9 @@ private:
     // 计算图像边界, 对去畸变的图像
     void ComputeImageBounds(const cv::Mat &imLeft);
 
+    // 由mK、mDistCoef和mbf计算内参、基线、图像边界和窗格大小(called in the constructor)
+    void ComputeCalibration(const cv::Mat &imLeft);
+
     // Assign keypoints to the grid for speed up feature matching (called in the constructor).
     void AssignFeaturesToGrid();
 
@@ -0,0 +1,126 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM2
+{
+
+/**
+ * 数据集回放用的异步图像读取器
+ * 若干个解码线程按帧序号预读后面的图像，放入长度有限的队列，解码和SLAM处理并行进行
+ * 每帧1张(单目)或2张(双目左右目、RGB-D彩色图和深度图)图像，按CV_LOAD_IMAGE_UNCHANGED读取
+ * 可选的缓存目录：第一次读取时把解码后的图像按原始格式写入缓存，之后直接内存映射读取，不再解码PNG
+ * 图像路径和时间戳仍由各个例子的LoadImages()读取，这里只负责读取图像
+ */
+class ImageLoader
+{
+public:
+
+    // 对每帧图像的额外处理(例如双目校正)，在解码线程中执行，im2在单目时为空
+    typedef std::function<void(cv::Mat &im, cv::Mat &im2)> ProcessFunction;
+
+    /**
+     * @param vstrFiles    每帧的第一张图像
+     * @param vstrFiles2   每帧的第二张图像，为空表示每帧只有一张图像，否则大小必须与vstrFiles相同
+     * @param nThreads     解码线程数，为0时在调用线程中同步读取(不预读)
+     * @param nPrefetch    最多预读的帧数
+     * @param strCacheDir  原始图像缓存目录，为空时不使用缓存
+     */
+    ImageLoader(const std::vector<std::string> &vstrFiles, const std::vector<std::string> &vstrFiles2,
+                const int nThreads=2, const int nPrefetch=8, const std::string &strCacheDir=std::string());
+    ~ImageLoader();
+
+    // 必须在第一次调用Get()之前设置
+    void SetProcessFunction(const ProcessFunction &process);
+
+    // 取第i帧的图像，读取失败返回false
+    // 通常按顺序调用：跳过的帧被丢弃，向前跳回时重新开始预读
+    bool Get(const size_t i, cv::Mat &im);
+    bool Get(const size_t i, cv::Mat &im, cv::Mat &im2);
+
+    size_t Size() const { return mvstrFiles.size(); }
+
+    // 调用者在Get()中等待图像的总时间(秒)，明显大于0说明读取跟不上处理速度
+    double GetWaitTime();
+
+protected:
+
+    struct LoadedFrame
+    {
+        bool bReady;
+        bool bOK;
+        cv::Mat im;
+        cv::Mat im2;
+    };
+
+    // 解码线程
+    void Run();
+
+    // 读取并处理第i帧
+    bool LoadFrame(const size_t i, cv::Mat &im, cv::Mat &im2);
+    // 先查缓存，缓存没有时解码并写入缓存
+    bool LoadImage(const std::string &strFile, cv::Mat &im);
+
+    std::string CachePath(const std::string &strFile) const;
+    bool ReadCache(const std::string &strFile, cv::Mat &im) const;
+    void WriteCache(const std::string &strFile, const cv::Mat &im) const;
+
+protected:
+
+    std::vector<std::string> mvstrFiles;
+    std::vector<std::string> mvstrFiles2;
+    const int mnPrefetch;
+    const std::string mstrCacheDir;
+    ProcessFunction mProcess;
+
+    std::vector<std::thread> mvThreads;
+    const int mnThreads;
+
+    std::mutex mMutex;
+    // 有新的帧可以读取
+    std::condition_variable mCondLoad;
+    // 有帧读取完成
+    std::condition_variable mCondReady;
+    // 正在读取和已经读取完的帧，只保存[mnNextToGet,mnNextToGet+mnPrefetch)范围内的帧
+    std::map<size_t,LoadedFrame> mmFrames;
+    // 下一个交给解码线程的帧
+    size_t mnNextToLoad;
+    // 调用者期望的下一帧
+    size_t mnNextToGet;
+    bool mbFinish;
+    double mWaitTime;
+};
+
+} //namespace ORB_SLAM
+
+#endif // IMAGELOADER_H
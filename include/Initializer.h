@@ -21,7 +21,9 @@
 #define INITIALIZER_H
 
 #include<opencv2/opencv.hpp>
+#include<Eigen/Core>
 #include "Frame.h"
+#include "ThreadPool.h"
 
 
 namespace ORB_SLAM2
@@ -40,9 +42,10 @@ public:
     * @param ReferenceFrame 输入Initializer的参考帧
     * @param sigma  //计算单应矩阵H和基础矩阵得分F时候一个参数
     * @param iterations  RANSAC迭代次数
+    * @param pThreadPool 并行计算RANSAC假设的线程池，为NULL时串行计算
     */
     // Fix the reference frame
-    Initializer(const Frame &ReferenceFrame, float sigma = 1.0, int iterations = 200);
+    Initializer(const Frame &ReferenceFrame, float sigma = 1.0, int iterations = 200, ThreadPool* pThreadPool = NULL);
 
 
     /**
@@ -54,7 +57,7 @@ public:
     * @param vP3D 其大小为vKeys1大小，表示三角化重投影成功的匹配点的3d点在相机1下的坐标
     * @param vbTriangulated  其大小为vKeys1大小，表示初始化成功后，特征点中三角化投影成功的情况
     */
-    // Computes in parallel a fundamental matrix and a homography
+    // Computes a fundamental matrix and a homography, the RANSAC hypotheses are evaluated in parallel
     // Selects a model and tries to recover the motion and the structure from motion
     bool Initialize(const Frame &CurrentFrame, const vector<int> &vMatches12,
                     cv::Mat &R21, cv::Mat &t21, vector<cv::Point3f> &vP3D, vector<bool> &vbTriangulated);
@@ -77,29 +80,40 @@ private:
     * @param H21 输出F21
     */
     void FindFundamental(vector<bool> &vbInliers, float &score, cv::Mat &F21);
+
+    /**
+    * 按轮计算RANSAC假设，有线程池时每轮内部并行；每轮之后按最优假设的内点比例自适应地减少假设数
+    * @param hypothesis   计算第it个假设，得分写入vScores[it]
+    * @param countInliers 统计第it个假设的内点数，每次出现更好的假设时调用
+    * @return 得分最高的假设序号，得分相同时取序号小的，与串行计算的结果一致；没有则返回-1
+    */
+    int RunHypotheses(const std::function<void(int)> &hypothesis, const vector<float> &vScores,
+                      const std::function<int(int)> &countInliers);
+
     //视觉slam十四讲P147,7.3.3.单应矩阵
-    //通过vP1，vP2求得单应矩阵并返回
-    cv::Mat ComputeH21(const vector<cv::Point2f> &vP1, const vector<cv::Point2f> &vP2);
-    //通过vP1，vP2求得基础矩阵并返回
-    cv::Mat ComputeF21(const vector<cv::Point2f> &vP1, const vector<cv::Point2f> &vP2);
+    //通过归一化的点对求得单应矩阵并返回
+    Eigen::Matrix3f ComputeH21(const Eigen::Matrix<float,8,2> &P1, const Eigen::Matrix<float,8,2> &P2);
+    //通过归一化的点对求得基础矩阵并返回
+    Eigen::Matrix3f ComputeF21(const Eigen::Matrix<float,8,2> &P1, const Eigen::Matrix<float,8,2> &P2);
 
 
     /**
     * 计算单应矩阵得分，判断哪些点重投影成功
-    * @param vbMatchesInliers 通过H21，H12，匹配点重投影成功情况
+    * 匹配点按块计算误差(SoA，便于编译器向量化)，每块之后检查得分上界，不可能超过minScore时提前返回-1
+    * @param pvbMatchesInliers 通过H21，H12，匹配点重投影成功情况，为NULL时不输出
     * @param sigma 计算得分时需要的参数
+    * @param minScore 需要超过的得分
     * @return 单应矩阵得分
     */
-    float CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vector<bool> &vbMatchesInliers, float sigma);
+    float CheckHomography(const Eigen::Matrix3f &H21, const Eigen::Matrix3f &H12, vector<bool> *pvbMatchesInliers, float sigma,
+                          float minScore = 0);
 
     /**
-    * 计算基础得分，判断哪些匹配点重投影成功
-    * @param
-    * @param vbMatchesInliers 针对输入的单应矩阵F，匹配点重投影成功情况
-    * @param
+    * 计算基础得分，判断哪些匹配点重投影成功，提前返回的条件同CheckHomography()
+    * @param pvbMatchesInliers 针对输入的单应矩阵F，匹配点重投影成功情况，为NULL时不输出
     * @return 基础矩阵得分
     */
-    float CheckFundamental(const cv::Mat &F21, vector<bool> &vbMatchesInliers, float sigma);
+    float CheckFundamental(const Eigen::Matrix3f &F21, vector<bool> *pvbMatchesInliers, float sigma, float minScore = 0);
 
     /**
     * 通过输入的F21计算Rt
@@ -186,6 +200,8 @@ private:
     // Current Matches from Reference to Current
     //储存着匹配点对在参考帧F1和当前帧F2中的序号
     vector<Match> mvMatches12;
+    //匹配点对的像素坐标(SoA)，mvU1[i]对应mvMatches12[i].first的x坐标，其余类推
+    vector<float> mvU1, mvV1, mvU2, mvV2;
     //描述参考帧F1中特征点匹配情况
     vector<bool> mvbMatched1;
 
@@ -199,13 +215,15 @@ private:
     float mSigma, mSigma2;
 
     // Ransac max iterations
-    //Ransac算法的最大迭代次数
+    //Ransac算法的最大迭代次数，实际的次数按内点比例自适应地减少
     int mMaxIterations;
 
     // Ransac sets
     //使用8点法计算F或者H时的RANSAC点对
     vector<vector<size_t> > mvSets;   
 
+    ThreadPool* mpThreadPool;
+
 };
 
 } //namespace ORB_SLAM
@@ -43,7 +43,8 @@ class KeyFrameDatabase;
 class KeyFrame
 {
 public:
-    KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
+    // nAgentId: 多相机共享地图时创建这个关键帧的相机(Tracking)
+    KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB, const int nAgentId=0);
 
     // Pose functions
     void SetPose(const cv::Mat &Tcw);
@@ -89,6 +90,12 @@ public:
     KeyFrame* GetParent();
     bool hasChild(KeyFrame* pKF);
 
+    // 多地图：所属的子地图，子地图的id是它原点关键帧的mnId
+    long unsigned int GetMapId();
+    void SetMapId(const long unsigned int nMapId);
+    //是否为所属子地图的原点(优化时固定)
+    bool IsMapOrigin();
+
     // Loop Edges
     //添加一个闭环检测帧
     void AddLoopEdge(KeyFrame* pKF);
@@ -134,6 +141,17 @@ public:
     void SetBadFlag();
     bool isBad();
 
+    // 释放被删除的关键帧的特征点、描述子、BoW和网格，只保留位姿和spanning tree(保存轨迹时需要)
+    // 由Map::ReclaimErased()在所有持有地图指针的线程都确认之后调用，之后按特征点序号访问的函数返回空
+    void ReleaseData();
+
+    // Redundancy counters for keyframe culling
+    // 由MapPoint在观测变化时增量更新(见MapPoint::UpdateRedundancy())：
+    // nPoints为此帧观测到的mappoint数，nRedundant为其中至少被其它3个关键帧在相同或更精细尺度上观测到的数量
+    // bClose表示该观测的深度在mThDepth以内，双目/RGBD只统计这部分
+    void UpdateCullingCounters(const bool bClose, const int nDeltaPoints, const int nDeltaRedundant);
+    void GetCullingCounters(const bool bOnlyClose, int &nPoints, int &nRedundant);
+
     // Compute Scene Depth (q=2 median). Used in monocular.
     //返回mappoint集合在此帧的深度的中位数
     float ComputeSceneMedianDepth(const int q);
@@ -156,6 +174,8 @@ public:
     long unsigned int mnId;
     //生成这个keyframe的Frame id
     const long unsigned int mnFrameId;
+    //生成这个keyframe的相机序号
+    const int mnAgentId;
 
     const double mTimeStamp;
 
@@ -203,15 +223,17 @@ public:
     //mbf : 基线*fx
 
     // Number of KeyPoints
-    const int N;
+    // 关键帧被回收时由ReleaseData()置为0，之后按特征点遍历的循环都不再执行
+    int N;
 
     // KeyPoints, stereo coordinate and descriptors (all associated by an index)
-    const std::vector<cv::KeyPoint> mvKeys;
+    // 创建后不再改变，只有关键帧被删除并回收时由ReleaseData()清空
+    std::vector<cv::KeyPoint> mvKeys;
     //
-    const std::vector<cv::KeyPoint> mvKeysUn;
-    const std::vector<float> mvuRight; // negative value for monocular points
-    const std::vector<float> mvDepth; // negative value for monocular points
-    const cv::Mat mDescriptors;
+    std::vector<cv::KeyPoint> mvKeysUn;
+    std::vector<float> mvuRight; // negative value for monocular points
+    std::vector<float> mvDepth; // negative value for monocular points
+    cv::Mat mDescriptors;
 
     //BoW
     //mBowVec本质是一个map<WordId, WordValue>
@@ -294,10 +316,21 @@ protected:
     float mHalfBaseline; // Only for visualization
 
     Map* mpMap;
+    //所属的子地图，子地图合并时由闭环线程修改
+    long unsigned int mnMapId;
 
     std::mutex mMutexPose;
     std::mutex mMutexConnections;
     std::mutex mMutexFeatures;
+    // Map::MergeMaps()持有地图的锁时修改mnMapId，用单独的锁避免和mMutexConnections嵌套
+    std::mutex mMutexMapId;
+
+    // 关键帧剔除用的冗余计数，mMutexCulling不与其它锁嵌套(MapPoint持有自己的锁时会调用)
+    int mnCullingPoints;
+    int mnCullingRedundant;
+    int mnCullingClosePoints;
+    int mnCullingCloseRedundant;
+    std::mutex mMutexCulling;
 };
 
 } //namespace ORB_SLAM
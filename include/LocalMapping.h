@@ -26,9 +26,14 @@
 #include "LoopClosing.h"
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
+#include "ThreadPool.h"
 #include <unistd.h>
 
 #include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include <Eigen/Core>
 
 
 namespace ORB_SLAM2
@@ -59,6 +64,8 @@ public:
     bool Stop();
     void Release();
     bool isStopped();
+    // 阻塞直到局部建图线程真正停止(结束时也视为停止)，配合RequestStop()使用
+    void WaitUntilStopped();
     bool stopRequested();
     //返回mbAcceptKeyFrames，查询局部地图管理器是否繁忙
     bool AcceptKeyFrames();
@@ -71,11 +78,37 @@ public:
 
     void RequestFinish();
     bool isFinished();
+    void WaitUntilFinished();
+
+    // 长时间运行的内存上限，0表示不限制
+    // 超出任一上限时按观测次数、最近被跟踪使用的时间和共视关系删除关键帧和mappoint，直到降到上限的90%
+    void SetMapBudget(const int nMaxKeyFrames, const int nMaxMapPoints, const size_t nMaxMemoryBytes);
+    // 是否回收已从地图删除的对象(默认回收)，见Map::ReclaimErased()
+    void SetReclaimErased(const bool bReclaim);
 
     int KeyframesInQueue(){
         unique_lock<std::mutex> lock(mMutexNewKFs);
         return mlNewKeyFrames.size();
     }
+    //队列中相机nAgentId的关键帧数量
+    int KeyframesInQueue(const int nAgentId);
+    // 队列中还没有加入地图的关键帧，闭环线程合并子地图时(LocalMapping已停止)修正它们的位姿
+    std::vector<KeyFrame*> GetNewKeyFrames();
+
+    // 阻塞直到队列中的关键帧都已处理完(或者局部建图被停止、结束)
+    void WaitUntilIdle();
+
+    // 处理每个关键帧各阶段的耗时(秒)，供基准测试统计
+    struct KeyFrameTimes
+    {
+        double tProcess;        // ProcessNewKeyFrame和MapPointCulling
+        double tTriangulate;    // CreateNewMapPoints
+        double tFuse;           // SearchInNeighbors
+        double tLocalBA;        // 局部BA
+        double tCulling;        // 关键帧剔除、地图上限和回收
+        double tTotal;
+    };
+    std::vector<KeyFrameTimes> GetKeyFrameTimes();
 
 protected:
 
@@ -96,6 +129,17 @@ protected:
      */
     void CreateNewMapPoints();
 
+    // 与相邻关键帧三角化得到的候选点，idx1/idx2为特征点在当前关键帧/相邻关键帧中的序号
+    struct TriangulatedPoint
+    {
+        int idx1;
+        int idx2;
+        Eigen::Vector3d x3D;
+    };
+    // 与一个相邻关键帧做极线搜索并三角化，通过检验的点存入vTriangulated
+    // 只读取关键帧数据、不修改地图，可以对不同的相邻关键帧并行调用
+    void TriangulateWithNeighbor(KeyFrame* pKF2, std::vector<TriangulatedPoint> &vTriangulated);
+
     // 剔除ProcessNewKeyFrame和CreateNewMapPoints函数中引入在mlpRecentAddedMapPoints的质量不好的MapPoints
     void MapPointCulling();
     // 检查并融合与当前关键帧共视程度高的帧重复的MapPoints
@@ -104,6 +148,20 @@ protected:
     // 检测并剔除当前帧相邻的关键帧中冗余的关键帧
     // 剔除的标准是：该关键帧的90%的MapPoints可以被其它至少3个关键帧观测到
     void KeyFrameCulling();
+    // 按照上面的标准判断关键帧是否冗余，只读取关键帧中增量维护的计数
+    bool IsRedundant(KeyFrame* pKF);
+    // 在整个地图中循环检查冗余关键帧，每次最多检查mnCullingBudget个
+    void MapKeyFrameCulling();
+
+    // 检查地图是否超出SetMapBudget()设置的上限，超出时删除最不重要的关键帧和mappoint
+    void EnforceMapBudget();
+    // 删除nEvict个关键帧/mappoint，返回实际删除的数量(正在被闭环使用的关键帧不会被删除)
+    int EvictKeyFrames(const size_t nEvict);
+    int EvictMapPoints(const size_t nEvict);
+    // 粗略估计地图占用的内存，nFeatures为每个关键帧的特征点数
+    static size_t EstimateMapMemory(const size_t nKFs, const size_t nMPs, const int nFeatures);
+    // 确认本线程不再持有已删除的mappoint，然后回收所有线程都确认过的对象
+    void ReclaimErasedObjects();
 
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
@@ -121,6 +179,16 @@ protected:
     bool mbFinished;
     std::mutex mMutexFinish;
 
+    // 线程间的事件通知：新关键帧、停止/释放、重置、结束请求都会唤醒等待者
+    // 局部建图线程空闲时阻塞在mCondWake上，而不是轮询
+    // 是否有需要局部建图线程处理的事件
+    bool HasWork();
+    void WaitForWork();
+    // 修改上述任一状态后调用，调用时不能持有其它锁
+    void WakeUp();
+    std::mutex mMutexWake;
+    std::condition_variable mCondWake;
+
     Map* mpMap;
 
     LoopClosing* mpLoopCloser;
@@ -128,6 +196,8 @@ protected:
 
     //待处理关键帧列表
     std::list<KeyFrame*> mlNewKeyFrames;
+    //多相机时各相机的关键帧轮流处理，上一个处理的关键帧的相机序号
+    int mnLastAgentId;
 
     KeyFrame* mpCurrentKeyFrame;
 
@@ -145,6 +215,30 @@ protected:
     //是否能接受插入新的keyframe标志位
     bool mbAcceptKeyFrames;
     std::mutex mMutexAccept;
+
+    // CreateNewMapPoints和SearchInNeighbors中并行计算用的线程池
+    ThreadPool mThreadPool;
+
+    // MapKeyFrameCulling上次检查到的关键帧id，以及每次检查的关键帧数
+    unsigned long mnCullingCursor;
+    int mnCullingBudget;
+
+    // 地图上限，0表示不限制
+    size_t mnMaxKeyFrames;
+    size_t mnMaxMapPoints;
+    size_t mnMaxMemoryBytes;
+    bool mbReclaimErased;
+    // 在地图回收中注册的编号
+    int mnReclaimSlot;
+
+    // 统计：因超出上限删除的关键帧/mappoint数，以及回收的mappoint/关键帧数
+    unsigned long mnEvictedKeyFrames;
+    unsigned long mnEvictedMapPoints;
+    unsigned long mnDeletedMapPoints;
+    unsigned long mnReleasedKeyFrames;
+
+    std::vector<KeyFrameTimes> mvKeyFrameTimes;
+    std::mutex mMutexTimes;
 };
 
 } //namespace ORB_SLAM
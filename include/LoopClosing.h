@@ -28,9 +28,12 @@
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "ThreadPool.h"
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM2
@@ -54,6 +57,8 @@ public:
     LoopClosing(Map* pMap, KeyFrameDatabase* pDB, ORBVocabulary* pVoc,const bool bFixScale);
 
     void SetTracker(Tracking* pTracker);
+    // 所有相机的Tracking，合并子地图时变换它们的状态(见MergePendingState())
+    void AddTracker(Tracking* pTracker);
 
     void SetLocalMapper(LocalMapping* pLocalMapper);
 
@@ -75,11 +80,30 @@ public:
         unique_lock<std::mutex> lock(mMutexGBA);
         return mbFinishedGBA;
     }   
+    //全局BA的结果正在分批合并到地图中
+    bool isMergingGBA(){
+        unique_lock<std::mutex> lock(mMutexGBA);
+        return mbMergingGBA;
+    }
+    //闭环修正的位姿图正在优化或优化结果正在应用到地图中
+    bool isMergingLoop(){
+        unique_lock<std::mutex> lock(mMutexGBA);
+        return mbMergingLoop;
+    }
+    //全局BA的进度：已完成的迭代次数和总迭代次数
+    void GetGBAProgress(int &nIterationsDone, int &nIterations){
+        unique_lock<std::mutex> lock(mMutexGBA);
+        nIterationsDone = mnGBAIterationsDone;
+        nIterations = mnGBAIterations;
+    }
 
     void RequestFinish();
 
     bool isFinished();
 
+    // 阻塞直到闭环线程和全局BA线程都已结束
+    void WaitUntilFinished();
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 protected:
@@ -103,6 +127,27 @@ protected:
      */
     bool ComputeSim3();
 
+    // 一个闭环候选关键帧的验证结果
+    struct Sim3Candidate
+    {
+        // Sim3优化后内点不少于20时的次序：nRound*候选帧数+候选帧序号，即原来轮流迭代时通过的先后，没有通过为-1
+        int nOrder;
+        // 是否通过验证：Sim3优化后内点不少于20，且投影匹配的总数不少于40
+        bool bMatch;
+        int nTotalMatches;
+        // 优化后候选帧到当前帧的Sim3 (s,R,t)
+        Eigen::Matrix3d R;
+        Eigen::Vector3d t;
+        double s;
+        // 当前帧特征点匹配的mappoint，以及闭环帧和其共视关键帧的mappoint
+        std::vector<MapPoint*> vpMatchedPoints;
+        std::vector<MapPoint*> vpLoopMapPoints;
+    };
+    // 对第nIndex个(共nCandidates个)候选关键帧完成ComputeSim3()中的全部验证步骤，只读取地图，可以对不同候选帧并行调用
+    // nFirstOrder为已经通过Sim3优化的候选帧中最小的次序，本候选帧的次序不可能比它小时放弃
+    void EvaluateSim3Candidate(KeyFrame* pKF, const int nIndex, const int nCandidates,
+                               std::atomic<int> &nFirstOrder, Sim3Candidate &result);
+
     /** 目的： 尽量使用闭环关键帧及其共视关键帧所观测到的mappoint来替换旧的mappoint
      * 针对CorrectedPosesMap里的关键帧，mvpLoopMapPoints投影到这个关键帧上与其特征点并进行匹配。
      * 如果匹配成功的特征点本身就有mappoint，就用mvpLoopMapPoints里匹配的点替换，替换下来的mappoint则销毁
@@ -118,9 +163,42 @@ protected:
     * 3. 通过MapPoints的匹配关系更新这些帧之间的连接关系，即更新covisibility graph
     * 4. 对Essential Graph（Pose Graph）进行优化，MapPoints的位置则根据优化后的位姿做相对应的调整
     * 5. 创建线程进行全局Bundle Adjustment
+    * LocalMapping在1-3和建立位姿图时暂停，优化期间继续运行，应用优化结果(ApplyEssentialGraph())时再次暂停
     */
     void CorrectLoop();
 
+    /**
+     * @brief 合并子地图时修正还没有进入地图的状态，在CorrectLoop()中持有地图更新锁、LocalMapping停止时调用
+     *
+     * LocalMapping队列中属于子地图nMapId的关键帧及其地图点用同一个相似变换修正，
+     * 各相机Tracking的上一帧、速度模型和相对参考关键帧的位姿见Tracking::TransformMap()
+     * @param nMapId 被合并的子地图
+     * @param g2oSnw 从子地图nMapId的坐标系到闭环关键帧所在子地图坐标系的相似变换
+     */
+    void MergePendingState(const long unsigned int nMapId, const g2o::Sim3 &g2oSnw);
+
+    /**
+     * @brief 将位姿图优化的结果应用到地图中
+     *
+     * 整个过程中LocalMapping保持暂停，并持有地图更新锁：修正只是一次遍历，Tracking不会看到修正了一半的地图。
+     * 优化期间新插入的关键帧不在位姿图中，开始时为每一个记录修正值(保持与已有修正值的共视关键帧或父关键帧的相对位姿)，
+     * 加入InitialSim3和OptimizedSim3，不依赖沿spanning tree的遍历
+     * @param InitialSim3   关键帧优化前的sim3位姿
+     * @param OptimizedSim3 关键帧优化后的sim3位姿
+     */
+    void ApplyEssentialGraph(KeyFrameAndPose &InitialSim3, KeyFrameAndPose &OptimizedSim3);
+
+    /**
+     * @brief 将全局BA的结果合并到地图中
+     *
+     * 先沿spanning tree更新关键帧位姿，再更新地图点，每批只处理固定数量的关键帧或地图点。
+     * LocalMapping在整个合并期间暂停，地图更新锁只在每批内部持有
+     */
+    void MergeGlobalBundleAdjustment(unsigned long nLoopKF);
+
+    //请求LocalMapping暂停并等待其停下
+    void PauseLocalMapping();
+
     void ResetIfRequested();
     bool mbResetRequested;
     std::mutex mMutexReset;
@@ -131,8 +209,18 @@ protected:
     bool mbFinished;
     std::mutex mMutexFinish;
 
+    // 新关键帧、重置、结束请求都会唤醒闭环线程，空闲时阻塞在mCondWake上
+    bool HasWork();
+    void WaitForWork();
+    // 修改上述任一状态后调用，调用时不能持有其它锁
+    void WakeUp();
+    std::mutex mMutexWake;
+    std::condition_variable mCondWake;
+
     Map* mpMap;
     Tracking* mpTracker;
+    std::vector<Tracking*> mvpTrackers;
+    std::mutex mMutexTrackers;
 
     KeyFrameDatabase* mpKeyFrameDB;
     ORBVocabulary* mpORBVocabulary;
@@ -171,14 +259,35 @@ protected:
     bool mbRunningGBA;
     bool mbFinishedGBA;
     bool mbStopGBA;
+    //全局BA被新的闭环打断后，线程不退出，等闭环修正完成后从当前地图重新开始
+    bool mbRestartGBA;
+    //全局BA的结果正在合并到地图中，此时不能打断
+    bool mbMergingGBA;
+    //闭环修正的优化结果正在应用到地图中，与mbMergingGBA一样LocalMapping此时跳过局部BA和关键帧剔除
+    bool mbMergingLoop;
+    //重新开始时使用的闭环关键帧id
+    unsigned long mnLoopKFGBA;
     std::mutex mMutexGBA;
+    //上面几个全局BA标志位的变化通过mCondGBA通知(与mMutexGBA配合使用)
+    std::condition_variable mCondGBA;
     std::thread* mpThreadGBA;
 
+    //全局BA的迭代次数，以及已完成的迭代次数(每次迭代后由全局BA线程更新，不需要加锁)
+    int mnGBAIterations;
+    std::atomic<int> mnGBAIterationsDone;
+
+    //合并全局BA结果时每批处理的关键帧和地图点数量
+    int mnMergeBatchKFs;
+    int mnMergeBatchMPs;
+
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
+    // ComputeSim3中并行验证闭环候选帧用的线程池
+    ThreadPool mThreadPool;
 
-    bool mnFullBAIdx;
+    // 在地图回收中注册的编号
+    int mnReclaimSlot;
 };
 
 } //namespace ORB_SLAM
@@ -24,8 +24,12 @@
 #include "MapPoint.h"
 #include "KeyFrame.h"
 #include <set>
+#include <list>
+#include <map>
+#include <unordered_map>
 
 #include <mutex>
+#include <atomic>
 
 
 
@@ -38,6 +42,21 @@ class KeyFrame;
 class Map
 {
 public:
+    // 地图元素的变化类型，同一个元素在两次读取之间的多次变化按位或合并
+    enum eChange
+    {
+        CHANGE_ADDED=1,
+        CHANGE_MODIFIED=2,
+        CHANGE_ERASED=4
+    };
+
+    // 地图点的变化，保存变化时的位置，读取时不需要访问地图点(可能已经被回收)
+    struct MapPointChange
+    {
+        int nFlags;
+        float x, y, z;
+    };
+
     Map();
 
     void AddKeyFrame(KeyFrame* pKF);
@@ -49,8 +68,12 @@ public:
     int GetLastBigChangeIdx();
 
     std::vector<KeyFrame*> GetAllKeyFrames();
+    //按id顺序返回id大于nId的关键帧，最多nMax个
+    std::vector<KeyFrame*> GetKeyFramesAfter(const long unsigned int nId, const size_t nMax);
+    //id为nId的关键帧，不在地图中时返回NULL
+    KeyFrame* GetKeyFrame(const long unsigned int nId);
     std::vector<MapPoint*> GetAllMapPoints();
-    std::vector<MapPoint*> GetReferenceMapPoints();
+    std::vector<long unsigned int> GetReferenceMapPointIds();
 
     long unsigned int MapPointsInMap();
     //返回Map中keyframe数量
@@ -58,8 +81,67 @@ public:
 
     long unsigned int GetMaxKFid();
 
+    /**
+     * 多地图：同一个Map中保存多个互不相连的子地图，关键帧的mnMapId表示它所属的子地图
+     * 子地图的id是它第一个关键帧的mnId，原点关键帧固定，作为子地图的坐标系
+     * 跟踪丢失后StartNewMap()开始新的子地图，旧的子地图和它在关键帧数据库中的关键帧都保留，
+     * 闭环线程检测到跨子地图的闭环时用MergeMaps()把当前子地图并入旧的子地图
+     */
+    // 多相机共享地图时每个相机(nAgentId)有自己的当前子地图
+    //相机nAgentId新建的关键帧所属的子地图
+    long unsigned int GetCurrentMapId(const int nAgentId=0);
+    //相机nAgentId下一个创建的关键帧开始新的子地图
+    //(只由Tracking调用，关键帧也只在Tracking中创建，各相机的Tracking由mMutexMapUpdate互斥)
+    void StartNewMap(const int nAgentId=0);
+    //重定位到其它子地图后，新关键帧属于那个子地图
+    void SetCurrentMapId(const long unsigned int nMapId, const int nAgentId=0);
+    //把子地图nFrom的关键帧全部并入子地图nTo，调用前nFrom的位姿已经变换到nTo的坐标系
+    void MergeMaps(const long unsigned int nFrom, const long unsigned int nTo);
+    std::vector<KeyFrame*> GetMapKeyFrames(const long unsigned int nMapId);
+    long unsigned int KeyFramesInMap(const long unsigned int nMapId);
+    int GetNumberOfMaps();
+
+    /**
+     * 回收已经从地图中删除的对象(quiescent-state based reclamation)
+     * 在线程之间持有地图对象指针的线程(每个相机的Tracking、LocalMapping、LoopClosing、全局BA)各自注册，
+     * 并在不再持有已删除对象的时候调用QuiescentState()确认
+     * 对象在删除时记下当时的删除序号，只有所有已注册的线程都确认过这个序号之后才会回收
+     * MapPoint直接delete，KeyFrame只释放特征点、描述子、BoW等数据，保留位姿和spanning tree用于保存轨迹，
+     * 所以线程可以继续持有被删除的KeyFrame指针，但确认之后不能再访问它的特征数据
+     * @param nDeletedMPs   本次delete的MapPoint数量
+     * @param nReleasedKFs  本次释放数据的KeyFrame数量
+     */
+    void ReclaimErased(int &nDeletedMPs, int &nReleasedKFs);
+    //注册一个持有地图对象指针的线程，返回它的编号
+    int RegisterReclaimThread();
+    //线程不再持有任何地图对象指针，之后不再等待它确认
+    void UnregisterReclaimThread(const int nSlot);
+    //当前的删除序号，线程先读取序号，再清理自己持有的已删除对象，最后用这个序号确认
+    long unsigned int GetEraseEpoch();
+    //线程nSlot确认不再持有删除序号<=nEpoch的对象
+    void QuiescentState(const int nSlot, const long unsigned int nEpoch);
+    //等待回收的对象数量
+    void GetErasedCount(int &nErasedMPs, int &nErasedKFs);
+
     void clear();
 
+    /**
+     * 地图变化的增量记录(change feed)，供可视化增量更新顶点缓冲
+     * EnableChangeFeed()之前不记录，没有可视化时不占用内存
+     * 按地图点id和关键帧合并，记录的大小不超过地图的大小
+     * ADDED/ERASED在mMutexMap下发布，位置在地图点的mMutexPos下发布，合并后的记录与地图的最终状态一致
+     */
+    void EnableChangeFeed();
+    void NotifyMapPointChanged(const long unsigned int nId, const int nFlag, const cv::Mat &Pos);
+    void NotifyKeyFrameChanged(KeyFrame* pKF, const int nFlag);
+    /**
+     * 取出并清空累积的变化
+     * 关键帧在clear()之前不会被delete，可以在读取之后访问
+     * @return clear()的次数，与上次读取时不同说明之前取到的状态全部作废
+     */
+    int TakeMapPointChanges(std::unordered_map<long unsigned int,MapPointChange> &mChanges);
+    int TakeKeyFrameChanges(std::unordered_map<KeyFrame*,int> &mChanges);
+
     vector<KeyFrame*> mvpKeyFrameOrigins;
 
     std::mutex mMutexMapUpdate;
@@ -71,15 +153,43 @@ protected:
     std::set<MapPoint*> mspMapPoints;
     //目前地图上的关键帧
     std::set<KeyFrame*> mspKeyFrames;
+    // 同样的关键帧按id索引，用于按id顺序分批遍历地图
+    std::map<long unsigned int,KeyFrame*> mmKeyFramesById;
 
-    std::vector<MapPoint*> mvpReferenceMapPoints;
+    // Tracking的局部地图点的id，用于绘图
+    std::vector<long unsigned int> mvnReferenceMapPointIds;
 
     long unsigned int mnMaxKFid;
 
+    // 多地图，每个相机的当前子地图
+    std::map<int,long unsigned int> mmCurrentMapIds;
+    // 已合并的子地图 -> 合并到的子地图，合并前创建、还在队列中的关键帧加入地图时据此更新
+    std::map<long unsigned int,long unsigned int> mmMergedMaps;
+    // 每个子地图的关键帧数量
+    std::map<long unsigned int,long unsigned int> mmMapKeyFrames;
+
+    // 已从地图删除、等待回收的对象，按删除顺序排列，first为删除序号
+    std::list<std::pair<long unsigned int,MapPoint*> > mlErasedMapPoints;
+    std::list<std::pair<long unsigned int,KeyFrame*> > mlErasedKeyFrames;
+    // 已经释放了数据的关键帧，只在clear()时delete
+    std::vector<KeyFrame*> mvpReleasedKeyFrames;
+    // 删除序号，每删除一个对象加一
+    long unsigned int mnEraseEpoch;
+    // 已注册的线程 -> 它确认过的删除序号
+    std::map<int,long unsigned int> mmReclaimEpochs;
+    int mnNextReclaimSlot;
+
     // Index related to a big change in the map (loop closure, global BA)
     int mnBigChangeIdx;
 
     std::mutex mMutexMap;
+
+    // 增量记录
+    std::atomic<bool> mbChangeFeed;
+    std::unordered_map<long unsigned int,MapPointChange> mmMapPointChanges;
+    std::unordered_map<KeyFrame*,int> mmKeyFrameChanges;
+    int mnClearIdx;
+    std::mutex mMutexChanges;
 };
 
 } //namespace ORB_SLAM
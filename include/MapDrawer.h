@@ -27,10 +27,35 @@
 #include<pangolin/pangolin.h>
 
 #include<mutex>
+#include<vector>
+#include<unordered_map>
 
 namespace ORB_SLAM2
 {
 
+/**
+ * 顶点缓冲(VBO)，CPU端保留完整的数据，每次只上传修改过的字节范围
+ * 只使用固定管线的glVertexPointer/glColorPointer，OpenGL ES 1和Mesa软件渲染下都可用
+ * 必须在GL上下文所在的线程(Viewer)中调用
+ */
+class GlDynamicBuffer
+{
+public:
+    GlDynamicBuffer();
+
+    // 标记[nBegin,nEnd)字节需要上传
+    void SetDirty(const size_t nBegin, const size_t nEnd);
+    // 上传修改过的部分，容量不足时按两倍扩容并上传全部nBytes
+    void Upload(const void* pData, const size_t nBytes);
+    void Bind() const;
+
+private:
+    GLuint mnBuffer;
+    size_t mnCapacity;
+    size_t mnDirtyBegin;
+    size_t mnDirtyEnd;
+};
+
 class MapDrawer
 {
 public:
@@ -47,6 +72,14 @@ public:
 
 private:
 
+    // 从地图的变化记录中增量更新CPU端的顶点数据
+    void UpdateMapPoints();
+    void UpdateKeyFrames();
+    // 删除第nSlot个顶点(组)，用最后一个填补空位
+    void RemoveMapPoint(const int nSlot);
+    void RemoveKeyFrame(const int nSlot);
+    void SetMapPointColor(const int nSlot, const unsigned char r, const unsigned char g, const unsigned char b);
+
     float mKeyFrameSize;
     float mKeyFrameLineWidth;
     float mGraphLineWidth;
@@ -57,6 +90,29 @@ private:
     cv::Mat mCameraPose;
 
     std::mutex mMutexCamera;
+
+    // 地图点：每个点一个顶点，顶点连续存放
+    int mnPointsClearIdx;
+    std::vector<float> mvPointVertices;                         // xyz
+    std::vector<unsigned char> mvPointColors;                   // rgb
+    std::vector<long unsigned int> mvPointIds;                  // 顶点 -> 地图点id
+    std::unordered_map<long unsigned int,int> mmPointSlots;     // 地图点id -> 顶点
+    std::vector<long unsigned int> mvRefPointIds;               // 当前标红的参考地图点
+    GlDynamicBuffer mPointVertexBuffer;
+    GlDynamicBuffer mPointColorBuffer;
+
+    // 关键帧：每个关键帧16个顶点(8条线段)，在CPU端变换到世界坐标系
+    int mnKeyFramesClearIdx;
+    std::vector<float> mvFrustumVertices;
+    std::vector<KeyFrame*> mvpKeyFrames;                        // 顶点组 -> 关键帧
+    std::unordered_map<KeyFrame*,int> mmKeyFrameSlots;          // 关键帧 -> 顶点组
+    std::vector<float> mvKeyFrameCenters;                       // 光心
+    std::vector<std::vector<KeyFrame*> > mvvpGraphNeighbors;    // 需要连线的共视、父节点、回环关键帧
+    GlDynamicBuffer mFrustumBuffer;
+    // 图的连线在任何关键帧变化后整体重建，数量与关键帧数同阶
+    std::vector<float> mvGraphVertices;
+    bool mbGraphDirty;
+    GlDynamicBuffer mGraphBuffer;
 };
 
 } //namespace ORB_SLAM
@@ -44,6 +44,8 @@ public:
 
     void SetWorldPos(const cv::Mat &Pos);
     cv::Mat GetWorldPos();
+    // 在mMutexPos下把当前位置发布到地图的change feed，与SetWorldPos()的发布保持先后顺序
+    void PublishWorldPos(const int nFlag);
 
     // 平均的观测方向
     cv::Mat GetNormal();
@@ -184,6 +186,31 @@ protected:
 
      std::mutex mMutexPos;
      std::mutex mMutexFeatures;
+
+     // 观测缓存，随mObservations增量更新(受mMutexFeatures保护)，第i项对应关键帧mvpObsKFs[i]中的观测
+     // mvObsLevels: 特征点的金字塔层数
+     // mvbObsClose: 特征点深度在mThDepth以内(双目/RGBD的关键帧剔除只统计这部分)
+     // mvbObsRedundant: 该观测是否计入关键帧的冗余计数，见UpdateRedundancy()
+     // mvDescriptors: 特征点的描述子
+     // mvvDescriptorDistances[i][j]为mvDescriptors[i]与mvDescriptors[j]之间的汉明距离，
+     // 只保存前MAX_CACHED_DESCRIPTORS个观测，内存和每次更新的代价都有上限，描述子只在这些观测中选择
+     std::vector<KeyFrame*> mvpObsKFs;
+     std::vector<int> mvObsLevels;
+     std::vector<char> mvbObsClose;
+     std::vector<char> mvbObsRedundant;
+     std::vector<cv::Mat> mvDescriptors;
+     std::vector<std::vector<int> > mvvDescriptorDistances;
+     static const size_t MAX_CACHED_DESCRIPTORS;
+     // 观测变化后mDescriptor需要重新选择，在GetDescriptor()中进行
+     bool mbDescriptorDirty;
+
+     // 以下函数调用时需持有mMutexFeatures
+     void SelectDistinctiveDescriptor();
+     void AddCachedDistances(const size_t idx);
+     void EraseCachedObservation(KeyFrame* pKF);
+     void ClearCachedObservations();
+     // 观测变化后重新判断每个观测是否冗余，并更新对应关键帧的冗余计数
+     void UpdateRedundancy();
 };
 
 } //namespace ORB_SLAM
@@ -0,0 +1,74 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef MAPPOINTGRID_H
+#define MAPPOINTGRID_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+
+namespace ORB_SLAM2
+{
+
+class MapPoint;
+class KeyFrame;
+
+/**
+ * 一组mappoint的体素索引，用于闭环融合时快速找出落在某个关键帧视野内的点
+ * 建立时记录每个点的位置和可观测距离，之后只读，可以被多个线程同时查询
+ * 查询以体素为单位做保守的视锥检验，返回的候选点还需要逐点投影检验
+ */
+class MapPointGrid
+{
+public:
+    // fVoxelSize<=0时按点的分布自动选取，平均每个体素约16个点
+    MapPointGrid(const std::vector<MapPoint*> &vpMapPoints, float fVoxelSize=0);
+
+    /**
+     * 找出可能在pKF视野内的点
+     * @param pKF       关键帧，提供内参和图像边界
+     * @param Scw       世界坐标系到pKF相机坐标系的sim3变换(sR,t)
+     * @param vIndices  候选点在建立索引时的vpMapPoints中的序号
+     */
+    void GetPointsInFrustum(KeyFrame* pKF, const cv::Mat &Scw, std::vector<int> &vIndices) const;
+
+    int VoxelsSize() const { return mvVoxelCenters.size(); }
+    float GetVoxelSize() const { return mfVoxelSize; }
+
+protected:
+
+    float mfVoxelSize;
+
+    // 非空体素的中心，以及体素内点的可观测距离范围
+    std::vector<Eigen::Vector3f> mvVoxelCenters;
+    std::vector<float> mvVoxelMinDistance;
+    std::vector<float> mvVoxelMaxDistance;
+
+    // 第i个体素内的点为mvPointIndices[mvVoxelStart[i]]到mvPointIndices[mvVoxelStart[i+1]-1]
+    std::vector<int> mvVoxelStart;
+    std::vector<int> mvPointIndices;
+};
+
+} //namespace ORB_SLAM
+
+#endif // MAPPOINTGRID_H
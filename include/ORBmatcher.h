@@ -49,6 +49,10 @@ public:
     // Computes the Hamming distance between two ORB descriptors
     static int DescriptorDistance(const cv::Mat &a, const cv::Mat &b);
 
+    // 计算描述子a(32字节)与连续储存的n个描述子pB的汉明距离，结果存入pDist
+    // 有AVX2时每次用一个256位寄存器处理一对描述子，否则使用64位popcount
+    static void DescriptorDistances(const unsigned char *a, const unsigned char *pB, const int n, int *pDist);
+
     // Search matches between Frame keypoints and projected MapPoints. Returns number of matches
     // Used to track the local map (Tracking)
     /** 局部地图点与当前帧特征点的匹配,目的是为了增加局部地图点和当前帧匹配数量
@@ -147,11 +151,23 @@ public:
      */
     int Fuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const float th=3.0);
 
+    // 把Fuse拆成两步，便于批量并行：SearchForFuse只做投影搜索(只读，可并行)，ApplyFuse串行地执行融合
+    void SearchForFuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const int nBegin, const int nEnd,
+                       vector<int> &vMatches, const float th=3.0);
+    int ApplyFuse(KeyFrame* pKF, const vector<MapPoint *> &vpMapPoints, const vector<int> &vMatches,
+                  vector<MapPoint *> *pvpChanged=NULL);
+
     // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
     //vpPoints通过Scw投影到pKF，与pKF中的特征点匹配。如果匹配的pKF中的特征点本身有就的匹配mappoint，就用vpPoints替代它。
     //vpReplacePoint大小与vpPoints一致，储存着被替换下来的mappoint
     int Fuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint);
 
+    // 同样拆成两步：SearchForFuse只对vnCandidates中的点做投影搜索(只读，可并行)，结果存入vMatches(大小与vpPoints一致)
+    // ApplyFuse串行地建立观测，并记录需要替换的mappoint
+    void SearchForFuse(KeyFrame* pKF, cv::Mat Scw, const std::vector<MapPoint*> &vpPoints, const std::vector<int> &vnCandidates,
+                       float th, vector<int> &vMatches);
+    int ApplyFuse(KeyFrame* pKF, const std::vector<MapPoint*> &vpPoints, const vector<int> &vMatches, vector<MapPoint *> &vpReplacePoint);
+
 public:
 
     //匹配特征点时，描述子距离的阈值。特征点间描述子小于此值才考虑匹配
@@ -169,6 +185,9 @@ protected:
     //根据观测角的cos值确定搜索区域的半径
     float RadiusByViewingCos(const float &viewCos);
 
+    //将D中vIndices对应的描述子行连续拷贝到vBlock，供DescriptorDistances()使用
+    static void GatherDescriptors(const cv::Mat &D, const std::vector<unsigned int> &vIndices, std::vector<unsigned char> &vBlock);
+
     //找出数组histo中，vector.size()数量最大的前三位。也就是角度范围最多的前三位。
     void ComputeThreeMaxima(std::vector<int>* histo, const int L, int &ind1, int &ind2, int &ind3);
     //匹配特征点时，确定时候最好匹配与次好匹配差距的阈值。其值越小，其匹配越精确
@@ -27,6 +27,9 @@
 #include "LoopClosing.h"
 #include "Frame.h"
 
+#include <functional>
+#include <atomic>
+
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM2
@@ -44,14 +47,16 @@ public:
      * @param pbStopFlag  是否强制暂停
      * @param nLoopKF  表明在id为nLoopKF处进行的BA
      * @param bRobust  是否使用核函数
+     * @param pnIterationsDone 不为NULL时，每次迭代结束后写入已完成的迭代次数，用于报告进度
      */
     void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
                                  int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
+                                 const bool bRobust = true, std::atomic<int> *pnIterationsDone=NULL);
     /**调用BundleAdjustment()，将map中所有keyframe位姿和mappoint位置作为优化遍历进行BA
      */
     void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
-                                       const unsigned long nLoopKF=0, const bool bRobust = true);
+                                       const unsigned long nLoopKF=0, const bool bRobust = true,
+                                       std::atomic<int> *pnIterationsDone=NULL);
     /**
      * 将Covisibility graph中与pKF连接的关键帧放入lLocalKeyFrames作为g2o图的顶点
      * 将被lLocalKeyFrames看到的mappoint放入lLocalMapPoints中，作为g2o图的顶点
@@ -74,11 +79,47 @@ public:
     //顶点为map中所有keyframe
     //边为LoopConnections中的连接关系,以及essential graph中的边：1.扩展树（spanning tree）连接关系，
     //2.闭环连接关系,3.共视关系非常好的连接关系（共视点为100）
+    //不修改地图：InitialSim3为每个关键帧优化前的sim3位姿(CorrectedSim3中的修正位姿或原位姿)，OptimizedSim3为优化结果，
+    //由调用者应用到关键帧和mappoint上(见LoopClosing::ApplyEssentialGraph())
+    //建图完成后调用graphBuilt，此后不再读取地图，调用者可以在此恢复LocalMapping
     void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
-                                       const bool &bFixScale);
+                                       const bool &bFixScale,
+                                       LoopClosing::KeyFrameAndPose &InitialSim3,
+                                       LoopClosing::KeyFrameAndPose &OptimizedSim3,
+                                       const std::function<void()> &graphBuilt=std::function<void()>());
+
+    // OptimizeEssentialGraph()建立的位姿图，不依赖求解器，也可以直接构造(见Examples/Benchmark/microbench.cc)
+    struct EssentialGraph
+    {
+        struct Edge
+        {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+            int i;
+            int j;
+            //观测：从顶点i到顶点j的相对sim3变换
+            g2o::Sim3 Sji;
+            //spanning tree和闭环边，PoseGraphSolver分层求解时先只用这些边
+            bool bCoarse;
+        };
+
+        //顶点对应的关键帧id，PoseGraphSolver按它缓存消元顺序
+        std::vector<long unsigned int> vnIds;
+        //顶点优化前的sim3位姿
+        std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScw;
+        std::vector<bool> vbFixed;
+        std::vector<Edge,Eigen::aligned_allocator<Edge> > vEdges;
+    };
+
+    /**
+     * 优化位姿图，求解器由SetUsePoseGraphSolver()选择
+     * @param vScwOptimized 每个顶点优化后的sim3位姿
+     * @return 实际的迭代次数
+     */
+    static int OptimizeEssentialGraph(const EssentialGraph &graph, const bool bFixScale, const int nIterations,
+                                      std::vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScwOptimized);
 
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
     /**
@@ -88,6 +129,44 @@ public:
      */
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1,
                             g2o::Sim3 &g2oS12, const float th2, const bool bFixScale);
+
+    /**
+     * 选择BundleAdjustment和LocalBundleAdjustment使用的求解器
+     * false: g2o::BlockSolver_6_3(默认)
+     * true:  BASolver，固定块大小+显式Schur消元，用于在相同输入上和g2o对比
+     */
+    static void SetUseBASolver(const bool bUse);
+    static bool UseBASolver();
+
+    /**
+     * 选择OptimizeEssentialGraph使用的求解器
+     * bUse为false: g2o::BlockSolver_7_3(默认)；true: PoseGraphSolver，消元顺序在多次闭环之间缓存
+     * nCoarseIterations大于0时，先只用spanning tree和闭环边迭代这么多次，再优化完整的Essential Graph
+     */
+    static void SetUsePoseGraphSolver(const bool bUse, const int nCoarseIterations);
+
+protected:
+
+    // 与BundleAdjustment()相同，使用BASolver求解
+    void static BundleAdjustmentSchur(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
+                                      int nIterations, bool *pbStopFlag, const unsigned long nLoopKF,
+                                      const bool bRobust, std::atomic<int> *pnIterationsDone);
+    // 与LocalBundleAdjustment()相同，局部关键帧、固定关键帧和局部地图点由LocalBundleAdjustment()选好
+    void static LocalBundleAdjustmentSchur(KeyFrame* pKF, bool *pbStopFlag, Map *pMap,
+                                           const std::list<KeyFrame*> &lLocalKeyFrames,
+                                           const std::list<KeyFrame*> &lFixedCameras,
+                                           const std::list<MapPoint*> &lLocalMapPoints);
+
+    // 建立OptimizeEssentialGraph()的位姿图，vpKFs为每个顶点对应的关键帧
+    static void BuildEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                                    const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
+                                    const LoopClosing::KeyFrameAndPose &CorrectedSim3,
+                                    const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                    EssentialGraph &graph, std::vector<KeyFrame*> &vpKFs);
+
+    static bool mbUseBASolver;
+    static bool mbUsePoseGraphSolver;
+    static int mnPoseGraphCoarseIterations;
 };
 
 } //namespace ORB_SLAM
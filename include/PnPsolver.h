@@ -52,14 +52,19 @@
 #define PNPSOLVER_H
 
 #include <opencv2/core/core.hpp>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
 #include "MapPoint.h"
 #include "Frame.h"
+#include "Ransac.h"
 
 namespace ORB_SLAM2
 {
 
 class PnPsolver {
  public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
    /**构造函数
     * @param vpMapPointMatches 保存F中的特征点与与哪些mappoint匹配，vpMapPointMatches[i]表示F中第i个特征点所指向的mappoint
     */
@@ -78,77 +83,78 @@ class PnPsolver {
 
  private:
 
+  friend class Ransac<PnPsolver>;
+
+  // RANSAC框架调用的接口，见Ransac.h
+  //用vSample中的前3对点通过P3P计算位姿，其余的点对用来在多个解中选择
+  bool ComputeHypothesis(const std::vector<int> &vSample);
+  int ScoreHypothesis();
+  //内点数超过阈值时保存最好的结果并Refine()，成功则结束RANSAC
+  bool AcceptHypothesis(const int nInliers);
+
    //对于此次RANSAC计算的epnp求得的位姿，原先F中的特征点与mappoint的匹配还有哪些成立
-   //更新mnInliersi
-  void CheckInliers();
+   //更新mnInliersi，内点数不可能达到nRequired时提前返回
+  void CheckInliers(const int nRequired = 0);
   //以mvbBestInliers中的点对通过epnp计算位姿而不是先前使用4个点对计算位姿
   //如果计算的结果对应的inliner超过阈值mRansacMinInliers，则返回成功
   bool Refine();
 
-  // Functions from the original EPnP code
-  void set_maximum_number_of_correspondences(const int n);
-  void reset_correspondences(void);
-  // 将对应的3D-2D压入到pws和us
-  void add_correspondence(const double X, const double Y, const double Z,
-              const double u, const double v);
+  /**
+   * Kneip等人的P3P(CVPR 2011)，只用于RANSAC的最小集
+   * @param F  3个特征点的单位方向向量(每列一个)
+   * @param P  对应的3个世界坐标(每列一个)
+   * @param Rs ts 输出最多4个解Rcw,tcw
+   * @return 解的个数
+   */
+  static int ComputePoseP3P(const Eigen::Matrix3d &F, const Eigen::Matrix3d &P, Eigen::Matrix3d Rs[4], Eigen::Vector3d ts[4]);
 
-  //通过epnp计算相机位姿
-  double compute_pose(double R[3][3], double T[3]);
+  // Functions from the original EPnP code
+  // 全部改为固定大小的Eigen矩阵，不再使用CvMat，除了mvAlphas(预先reserve)之外不分配内存
+  // 参与计算的点对为mvCorrespondences
 
-  void relative_error(double & rot_err, double & transl_err,
-              const double Rtrue[3][3], const double ttrue[3],
-              const double Rest[3][3],  const double test[3]);
+  //通过epnp计算相机位姿，返回平均重投影误差
+  double compute_pose(Eigen::Matrix3d &R, Eigen::Vector3d &t);
 
-  void print_pose(const double R[3][3], const double t[3]);
-  double reprojection_error(const double R[3][3], const double t[3]);
+  double reprojection_error(const Eigen::Matrix3d &R, const Eigen::Vector3d &t);
 
   //获得EPnP算法中的四个控制点
   void choose_control_points(void);
   void compute_barycentric_coordinates(void);
-  void fill_M(CvMat * M, const int row, const double * alphas, const double u, const double v);
-  void compute_ccs(const double * betas, const double * ut);
-  void compute_pcs(void);
+  void compute_ccs(const Eigen::Vector4d &betas, const Eigen::Matrix<double,12,4> &V);
 
   void solve_for_sign(void);
 
-  void find_betas_approx_1(const CvMat * L_6x10, const CvMat * Rho, double * betas);
-  void find_betas_approx_2(const CvMat * L_6x10, const CvMat * Rho, double * betas);
-  void find_betas_approx_3(const CvMat * L_6x10, const CvMat * Rho, double * betas);
-  void qr_solve(CvMat * A, CvMat * b, CvMat * X);
+  void find_betas_approx_1(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, Eigen::Vector4d &betas);
+  void find_betas_approx_2(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, Eigen::Vector4d &betas);
+  void find_betas_approx_3(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, Eigen::Vector4d &betas);
 
-  double dot(const double * v1, const double * v2);
-  double dist2(const double * p1, const double * p2);
+  void compute_rho(Eigen::Matrix<double,6,1> &Rho);
+  void compute_L_6x10(const Eigen::Matrix<double,12,4> &V, Eigen::Matrix<double,6,10> &L_6x10);
 
-  void compute_rho(double * rho);
-  void compute_L_6x10(const double * ut, double * l_6x10);
+  void gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho, Eigen::Vector4d &betas);
+  void compute_A_and_b_gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                                    const Eigen::Vector4d &betas, Eigen::Matrix<double,6,4> &A, Eigen::Matrix<double,6,1> &b);
 
-  void gauss_newton(const CvMat * L_6x10, const CvMat * Rho, double current_betas[4]);
-  void compute_A_and_b_gauss_newton(const double * l_6x10, const double * rho,
-				    double cb[4], CvMat * A, CvMat * b);
+  double compute_R_and_t(const Eigen::Matrix<double,12,4> &V, const Eigen::Vector4d &betas,
+                         Eigen::Matrix3d &R, Eigen::Vector3d &t);
 
-  double compute_R_and_t(const double * ut, const double * betas,
-			 double R[3][3], double t[3]);
+  void estimate_R_and_t(Eigen::Matrix3d &R, Eigen::Vector3d &t);
 
-  void estimate_R_and_t(double R[3][3], double t[3]);
-
-  void copy_R_and_t(const double R_dst[3][3], const double t_dst[3],
-		    double R_src[3][3], double t_src[3]);
-
-  void mat_to_quat(const double R[3][3], double q[4]);
+  //第i个匹配的3d世界坐标
+  Eigen::Vector3d Pw(const int i) const { return Eigen::Vector3d(mvP3Dw[i].x,mvP3Dw[i].y,mvP3Dw[i].z); }
+  //第i个匹配的像素坐标
+  Eigen::Vector2d Us(const int i) const { return Eigen::Vector2d(mvP2D[i].x,mvP2D[i].y); }
 
 
   //相机内参
   double uc, vc, fu, fv;
-  //pws,us为RANSAC随机选取的3d，2d点对的容器,索引一一对应
-  //alphas为pws，pcs在控制点下的hd坐标
-  //pws，pcs分别为3d点的世界坐标和相机坐标
-  double * pws, * us, * alphas, * pcs;
-  int maximum_number_of_correspondences;
-  int number_of_correspondences;
+  //参与EPnP计算的点对序号
+  vector<int> mvCorrespondences;
+  //mvCorrespondences中的点在控制点下的坐标
+  vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d> > mvAlphas;
 
-  //4个控制点在世界坐标系和相机坐标系下的坐标
-  double cws[4][3], ccs[4][3];
-  double cws_determinant;
+  //4个控制点在世界坐标系和相机坐标系下的坐标，每列一个
+  Eigen::Matrix<double,3,4> mCws, mCcs;
 
   //mvpMapPointMatches[i]表示F中第i个特征点所指向的mappoint
   vector<MapPoint*> mvpMapPointMatches;
@@ -163,14 +169,17 @@ class PnPsolver {
   //F的mappoint的3d世界坐标，F的特征点数量大小
   vector<cv::Point3f> mvP3Dw;
 
+  //mvP2D对应的单位方向向量
+  vector<Eigen::Vector3d> mvBearings;
+
   // Index in Frame
   //mvP2D,mvP3Dw对应F的特征点在F中的序号
   vector<size_t> mvKeyPointIndices;
 
   // Current Estimation
   //当前估计的位姿
-  double mRi[3][3];
-  double mti[3];
+  Eigen::Matrix3d mRi;
+  Eigen::Vector3d mti;
   cv::Mat mTcwi;
   //对于每次RANSAC计算出的位姿，哪些点对属于inliners
   vector<bool> mvbInliersi;
@@ -178,8 +187,8 @@ class PnPsolver {
   int mnInliersi;
 
   // Current Ransac State
-  // 这个PnpSolver总的迭代次数记录
-  int mnIterations;
+  // 抽样、迭代次数和自适应终止
+  Ransac<PnPsolver> mRansac;
   //mnBestInliers对应那次RANSAC的mvbInliersi
   vector<bool> mvbBestInliers;
   //已执行的RANSAC中，最大的mnInliersi值
@@ -197,9 +206,8 @@ class PnPsolver {
   //匹配点对的数量
   int N;
 
-  // Indices for random selection [0 .. N-1]
-  //[0,..,N]的序列，N为F的特征点数量大小,也等于F.mvpMapPoints.size()
-  vector<size_t> mvAllIndices;
+  // 匹配的描述子距离，距离小的点对在RANSAC中优先抽样(PROSAC)
+  vector<int> mvDistances;
 
   // RANSAC probability
   double mRansacProb;
@@ -208,10 +216,6 @@ class PnPsolver {
   //一次RANSAC迭代成功的阈值
   int mRansacMinInliers;
 
-  // RANSAC max iterations
-  //RANSAC最大累计迭代次数阈值
-  int mRansacMaxIts;
-
   // RANSAC expected inliers/total ratio
   float mRansacEpsilon;
 
@@ -0,0 +1,163 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POSEGRAPHSOLVER_H
+#define POSEGRAPHSOLVER_H
+
+#include <vector>
+#include <utility>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <Eigen/SparseCore>
+#include <Eigen/SparseCholesky>
+
+#include "Thirdparty/g2o/g2o/types/sim3.h"
+
+namespace ORB_SLAM2
+{
+
+/**
+ * Essential Graph(Sim3位姿图)的专用求解器，用于Optimizer::OptimizeEssentialGraph
+ * 与g2o::BlockSolver_7_3+LinearSolverEigen相比：
+ * 1. 7x7块按块结构直接写入稀疏矩阵的数值数组，结构不变时不重新建立稀疏矩阵
+ * 2. 在块(关键帧)层面计算AMD排序，同一关键帧的7个变量在消元顺序中连续
+ * 3. 排序可以按关键帧id缓存，下次调用时已排序的关键帧沿用原来的次序，新的关键帧排在最后
+ * 4. 可选的分层求解：先只用spanning tree和闭环边(几乎没有填充)迭代，得到好的初值后再优化完整的图
+ * 误差定义 e = log(Sji*Si*Sj^-1)、左乘更新以及LM阻尼策略与g2o::EdgeSim3/VertexSim3Expmap一致
+ */
+class PoseGraphSolver
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef Eigen::Matrix<double,7,1> Vector7d;
+    typedef Eigen::Matrix<double,7,7> Matrix7d;
+
+    // 跨多次调用缓存的消元顺序
+    struct Ordering
+    {
+        Ordering():nOrdered(0){}
+        //关键帧id对应的消元次序，-1表示没有参与排序
+        std::vector<int> vRank;
+        //计算排序时的顶点数
+        size_t nOrdered;
+    };
+
+    PoseGraphSolver();
+
+    /**
+     * 添加顶点
+     * @param Siw    世界坐标系到相机坐标系的Sim3变换
+     * @param bFixed 是否固定
+     * @param nKey   用于缓存消元顺序的键(关键帧id)
+     * @return 顶点序号
+     */
+    int AddVertex(const g2o::Sim3 &Siw, const bool bFixed, const long unsigned int nKey);
+
+    /**
+     * 添加边，观测为Sji，信息矩阵为单位阵
+     * @param bCoarse 是否属于分层求解第一步使用的粗略图(spanning tree和闭环边)
+     */
+    int AddEdge(const int i, const int j, const g2o::Sim3 &Sji, const bool bCoarse);
+
+    //双目/RGB-D固定尺度，对应VertexSim3Expmap::_fix_scale
+    void SetFixScale(const bool bFixScale);
+
+    //对应g2o::OptimizationAlgorithmLevenberg::setUserLambdaInit
+    void SetLambdaInit(const double lambda);
+
+    //为NULL时每次都重新排序
+    void SetOrderingCache(Ordering* pOrdering);
+
+    //已排序的顶点少于这个比例时放弃缓存重新排序
+    void SetOrderingReuseRatio(const double ratio);
+
+    /**
+     * Levenberg-Marquardt迭代
+     * @param nIterations       完整图的迭代次数
+     * @param nCoarseIterations 大于0时先在粗略图上迭代这么多次
+     * @return 完整图上实际的迭代次数
+     */
+    int Optimize(const int nIterations, const int nCoarseIterations=0);
+
+    const g2o::Sim3 &GetEstimate(const int i) const { return mvEstimates[i]; }
+
+    size_t VerticesSize() const { return mvEstimates.size(); }
+    size_t EdgesSize() const { return mvEdgeI.size(); }
+
+protected:
+
+    //建立块结构、稀疏矩阵以及块到数值数组的索引，并做符号分解
+    void BuildStructure(const bool bCoarse);
+
+    //计算可优化顶点的消元次序(块层面)
+    void ComputeOrdering(const bool bCoarse, std::vector<int> &vRank);
+
+    //在当前估计处线性化，把H和b写入mH和mb，返回总误差
+    double Linearize(const bool bCoarse);
+
+    double ComputeChi2(const bool bCoarse) const;
+
+    //把H的块写入稀疏矩阵的数值数组，对角线加上lambda
+    void FillMatrix(const double lambda);
+
+    int RunLM(const int nIterations, const bool bCoarse);
+
+protected:
+
+    // 顶点
+    std::vector<g2o::Sim3, Eigen::aligned_allocator<g2o::Sim3> > mvEstimates;
+    std::vector<bool> mvbFixed;
+    std::vector<long unsigned int> mvKeys;
+
+    // 边
+    std::vector<int> mvEdgeI;
+    std::vector<int> mvEdgeJ;
+    std::vector<g2o::Sim3, Eigen::aligned_allocator<g2o::Sim3> > mvMeasurements;
+    std::vector<char> mvbCoarse;
+
+    bool mbFixScale;
+    double mLambdaInit;
+    Ordering* mpOrdering;
+    double mOrderingReuseRatio;
+
+    // 当前结构：顶点在约化系统中的块位置(固定顶点为-1)
+    std::vector<int> mvPos;
+    int mnFree;
+    //每条边的非对角块序号(-1表示一端固定)，对角块序号等于块位置
+    std::vector<int> mvEdgeBlock;
+    //块的(行,列)位置，行<=列
+    std::vector<std::pair<int,int> > mvBlockIdx;
+    //块的每一列在稀疏矩阵数值数组中的起始位置
+    std::vector<int> mvBlockColStart;
+
+    // 线性化结果
+    std::vector<Matrix7d, Eigen::aligned_allocator<Matrix7d> > mvBlocks;
+    Eigen::VectorXd mb;
+
+    Eigen::SparseMatrix<double> mH;
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>, Eigen::Upper, Eigen::NaturalOrdering<int> > mLDLT;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSEGRAPHSOLVER_H
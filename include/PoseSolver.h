@@ -0,0 +1,131 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM2
+{
+
+/**
+ * 只优化单帧位姿(motion-only BA)的求解器，用于Optimizer::PoseOptimization
+ * 与g2o::SparseOptimizer+LinearSolverDense相比：
+ * 1. 地图点固定，只有一个6维位姿变量，正规方程为6x6，直接用LDLT求解
+ * 2. 3D-2D(单目)和3D-3D(双目)对应关系以SoA的方式连续储存，Clear()只清空不释放内存
+ * 3. 迭代过程中不在堆上分配内存，重复使用同一个对象时预热后不再分配
+ * 误差、雅克比、Huber核和LM阻尼策略与g2o::EdgeSE3ProjectXYZOnlyPose等保持一致
+ */
+class PoseSolver
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    PoseSolver();
+
+    //清空所有边，保留已分配的内存
+    void Clear();
+
+    //相机内参，单目时bf不使用
+    void SetCalibration(const double fx, const double fy, const double cx, const double cy, const double bf);
+
+    void SetPose(const g2o::SE3Quat &Tcw);
+    const g2o::SE3Quat &GetPose() const { return mTcw; }
+
+    //添加单目边，Xw为地图点世界坐标，观测为(u,v)，信息矩阵为invSigma2*I
+    int AddMonoEdge(const Eigen::Vector3d &Xw, const Eigen::Vector2d &obs, const double invSigma2);
+    //添加双目边，观测为(u,v,ur)
+    int AddStereoEdge(const Eigen::Vector3d &Xw, const Eigen::Vector3d &obs, const double invSigma2);
+
+    //是否使用Huber核函数
+    void SetRobustKernel(const bool bRobust, const double deltaMono, const double deltaStereo);
+
+    //Levenberg-Marquardt迭代，返回实际的迭代次数
+    int Optimize(const int nIterations);
+
+    // 边的状态，对应g2o的edge->setLevel()
+    void SetMonoActive(const size_t i, const bool bActive) { mMono.vbActive[i] = bActive; }
+    void SetStereoActive(const size_t i, const bool bActive) { mStereo.vbActive[i] = bActive; }
+    //当前位姿下不带核函数的卡方值 e'*Omega*e
+    double MonoChi2(const size_t i) const;
+    double StereoChi2(const size_t i) const;
+
+    size_t MonoEdgesSize() const { return mMono.vbActive.size(); }
+    size_t StereoEdgesSize() const { return mStereo.vbActive.size(); }
+
+protected:
+
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+
+    // 同一种边的所有数据(SoA)，D为误差维度
+    template<int D>
+    struct EdgeSet
+    {
+        typedef Eigen::Matrix<double,D,1> VectorD;
+        std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > vXw;
+        std::vector<VectorD, Eigen::aligned_allocator<VectorD> > vObs;
+        std::vector<double> vInvSigma2;
+        std::vector<char> vbActive;
+
+        void clear()
+        {
+            vXw.clear();
+            vObs.clear();
+            vInvSigma2.clear();
+            vbActive.clear();
+        }
+    };
+
+    //在Tcw处线性化所有有效边，得到H和b，返回带核函数的总误差
+    double Linearize(const g2o::SE3Quat &Tcw, Matrix6d &H, Vector6d &b) const;
+    template<int D>
+    void LinearizeEdges(const EdgeSet<D> &edges, const double delta, const g2o::SE3Quat &Tcw,
+                        Matrix6d &H, Vector6d &b, double &chi2) const;
+
+    //带核函数的总误差
+    double ComputeTotalChi2(const g2o::SE3Quat &Tcw) const;
+    template<int D>
+    double ComputeEdgesChi2(const EdgeSet<D> &edges, const double delta, const g2o::SE3Quat &Tcw) const;
+
+protected:
+
+    g2o::SE3Quat mTcw;
+
+    double mfx, mfy, mcx, mcy, mbf;
+
+    EdgeSet<2> mMono;
+    EdgeSet<3> mStereo;
+
+    bool mbRobust;
+    double mDeltaMono;
+    double mDeltaStereo;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSESOLVER_H
@@ -0,0 +1,277 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RANSAC_H
+#define RANSAC_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+namespace ORB_SLAM2
+{
+
+/**
+ * RANSAC抽样使用的随机数发生器(xorshift64*)
+ * 每个求解器持有自己的实例：相同的种子得到相同的抽样序列，多个求解器在不同线程中同时运行也互不影响
+ * (DUtils::Random基于全局的rand()，既不能复现也不是线程安全的)
+ */
+class RansacRandom
+{
+public:
+    explicit RansacRandom(const uint64_t seed = 0) { Seed(seed); }
+
+    void Seed(const uint64_t seed)
+    {
+        // 用splitmix64打散种子，状态不能为0
+        uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        mState = (z ^ (z >> 31)) | 1ULL;
+    }
+
+    uint32_t Next()
+    {
+        mState ^= mState >> 12;
+        mState ^= mState << 25;
+        mState ^= mState >> 27;
+        return (uint32_t)((mState * 0x2545F4914F6CDD1DULL) >> 32);
+    }
+
+    // [0,n)中的随机整数，用乘法取高位代替取模
+    int Uniform(const int n)
+    {
+        return (int)(((uint64_t)Next() * (uint32_t)n) >> 32);
+    }
+
+private:
+    uint64_t mState;
+};
+
+/**
+ * 以probability的概率至少抽到一次全是内点的最小集所需的迭代次数
+ * @param inlierRatio    内点比例
+ * @param nSampleSize    最小集大小
+ * @param nMaxIterations 迭代次数上限
+ */
+inline int RansacIterations(const double probability, const double inlierRatio, const int nSampleSize, const int nMaxIterations)
+{
+    if(inlierRatio>=1.0)
+        return 1;
+
+    const double pGood = std::pow(inlierRatio,nSampleSize);
+    if(!(pGood>0.0))
+        return std::max(1,nMaxIterations);
+
+    const double nIterations = std::ceil(std::log(1.0-probability)/std::log1p(-pGood));
+    return std::max(1,(int)std::min(nIterations,(double)nMaxIterations));
+}
+
+/**
+ * 从N个数据中无放回地抽取最小集
+ * 默认均匀抽样；SetOrder()给出按质量(如描述子距离)从好到坏的排序后改用PROSAC的渐进抽样：
+ * 先从质量最好的少数数据中抽样，随着迭代逐步扩大抽样范围，nGrowthIterations次之后与均匀抽样相同
+ */
+class RansacSampler
+{
+public:
+    RansacSampler(): mN(0), mnSampleSize(0), mbProsac(false), mnIteration(0), mn(0), mTn(0), mnTnPrime(0) {}
+
+    void Reset(const int N, const int nSampleSize)
+    {
+        mN = N;
+        mnSampleSize = nSampleSize;
+        mvIndices.resize(N);
+        for(int i=0; i<N; i++)
+            mvIndices[i] = i;
+        mbProsac = false;
+    }
+
+    // vOrder为按质量从好到坏排列的全部数据序号
+    void SetOrder(const std::vector<int> &vOrder, const int nGrowthIterations)
+    {
+        if((int)vOrder.size()!=mN || mN<=mnSampleSize)
+            return;
+
+        mvIndices = vOrder;
+        mbProsac = true;
+        mnIteration = 0;
+        mn = mnSampleSize;
+        // T_n: 在nGrowthIterations次均匀抽样中，最小集全部来自前n个数据的平均次数
+        mTn = nGrowthIterations;
+        for(int i=0; i<mnSampleSize; i++)
+            mTn *= (double)(mnSampleSize-i)/(mN-i);
+        mnTnPrime = 1;
+    }
+
+    void Draw(RansacRandom &rng, std::vector<int> &vSample)
+    {
+        vSample.resize(mnSampleSize);
+
+        int nPool = mN;
+        int nDraw = mnSampleSize;
+        if(mbProsac)
+        {
+            mnIteration++;
+            if(mnIteration>mnTnPrime && mn<mN)
+            {
+                const double Tn1 = mTn*(mn+1)/(mn+1-mnSampleSize);
+                mnTnPrime += (int)std::ceil(Tn1-mTn);
+                mTn = Tn1;
+                mn++;
+            }
+
+            nPool = mn;
+            if(mnTnPrime>=mnIteration)
+            {
+                // 新加入范围的第n个数据一定在最小集中，其余的从前n-1个数据中抽取
+                vSample[mnSampleSize-1] = mvIndices[mn-1];
+                nPool = mn-1;
+                nDraw = mnSampleSize-1;
+            }
+        }
+
+        // 部分Fisher-Yates洗牌：抽中的数据换到范围的末尾
+        // mvIndices始终是原序列的一个排列，且只在前nPool个之间交换，前缀包含的数据不变
+        for(int j=0; j<nDraw; j++)
+        {
+            const int last = nPool-1-j;
+            const int r = rng.Uniform(last+1);
+            std::swap(mvIndices[r],mvIndices[last]);
+            vSample[j] = mvIndices[last];
+        }
+    }
+
+private:
+    int mN;
+    int mnSampleSize;
+    //均匀抽样时为[0,N)的一个排列，PROSAC时前缀为当前的抽样范围
+    std::vector<int> mvIndices;
+
+    // PROSAC状态
+    bool mbProsac;
+    int mnIteration;
+    //当前抽样范围的大小
+    int mn;
+    double mTn;
+    int mnTnPrime;
+};
+
+/**
+ * 多个求解器共用的RANSAC框架，TSolver提供最小集求解和打分：
+ *   bool ComputeHypothesis(const std::vector<int> &vSample);  由最小集计算模型，失败时返回false
+ *   int  ScoreHypothesis();                                   统计当前模型的内点数，确定不会被采用时可以提前返回
+ *   bool AcceptHypothesis(const int nInliers);                保存更好的模型，返回true时RANSAC结束
+ * 迭代次数按目前最多的内点数自适应地减少
+ * Iterate()可以多次调用，每次最多计算nIterations个假设，便于和其他候选交替进行
+ */
+template<class TSolver>
+class Ransac
+{
+public:
+    explicit Ransac(TSolver* pSolver):
+        mpSolver(pSolver), mN(0), mnSampleSize(0), mProbability(0.99), mnMaxIterations(0), mnIterations(0), mnBestInliers(0)
+    {
+    }
+
+    /**
+     * @param N              数据数量
+     * @param nSampleSize    最小集大小
+     * @param probability    至少抽到一次全是内点的最小集的概率
+     * @param epsilon        预计的内点比例，决定初始的迭代次数
+     * @param nMaxIterations 迭代次数上限
+     * @param seed           随机数种子
+     */
+    void SetParameters(const int N, const int nSampleSize, const double probability, const float epsilon,
+                       const int nMaxIterations, const uint64_t seed = 0)
+    {
+        mN = N;
+        mnSampleSize = nSampleSize;
+        mProbability = probability;
+        mnMaxIterations = RansacIterations(probability,epsilon,nSampleSize,nMaxIterations);
+        mnIterations = 0;
+        mnBestInliers = 0;
+
+        mSampler.Reset(N,nSampleSize);
+        mRandom.Seed(seed);
+    }
+
+    // vOrder为按质量从好到坏排列的数据序号，之后使用PROSAC抽样
+    void SetOrder(const std::vector<int> &vOrder)
+    {
+        mSampler.SetOrder(vOrder,mnMaxIterations);
+    }
+
+    // 最多计算nIterations个假设，AcceptHypothesis()返回true时返回true
+    bool Iterate(const int nIterations)
+    {
+        if(mN<mnSampleSize)
+        {
+            mnIterations = mnMaxIterations;
+            return false;
+        }
+
+        for(int i=0; i<nIterations && mnIterations<mnMaxIterations; i++)
+        {
+            mnIterations++;
+
+            mSampler.Draw(mRandom,mvSample);
+            if(!mpSolver->ComputeHypothesis(mvSample))
+                continue;
+
+            const int nInliers = mpSolver->ScoreHypothesis();
+            if(nInliers>mnBestInliers)
+            {
+                mnBestInliers = nInliers;
+                // 按目前的内点比例重新估计需要的迭代次数，只减不增
+                mnMaxIterations = RansacIterations(mProbability,(double)nInliers/mN,mnSampleSize,mnMaxIterations);
+            }
+
+            if(mpSolver->AcceptHypothesis(nInliers))
+                return true;
+        }
+
+        return false;
+    }
+
+    bool Exhausted() const { return mnIterations>=mnMaxIterations; }
+    int Iterations() const { return mnIterations; }
+    int MaxIterations() const { return mnMaxIterations; }
+    int BestInliers() const { return mnBestInliers; }
+
+private:
+    TSolver* mpSolver;
+
+    int mN;
+    int mnSampleSize;
+    double mProbability;
+    int mnMaxIterations;
+    int mnIterations;
+    int mnBestInliers;
+
+    RansacRandom mRandom;
+    RansacSampler mSampler;
+    std::vector<int> mvSample;
+};
+
+} //namespace ORB_SLAM
+
+#endif // RANSAC_H
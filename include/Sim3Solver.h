@@ -25,7 +25,10 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+#include <Eigen/Core>
+
 #include "KeyFrame.h"
+#include "Ransac.h"
 
 
 
@@ -52,17 +55,24 @@ public:
 
 protected:
 
-    void ComputeCentroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C);
+    friend class Ransac<Sim3Solver>;
+
+    // RANSAC框架调用的接口，见Ransac.h
+    //用vSample对应的3对点计算Sim3
+    bool ComputeHypothesis(const std::vector<int> &vSample);
+    int ScoreHypothesis();
+    //保存内点最多的结果，内点数超过阈值时结束RANSAC
+    bool AcceptHypothesis(const int nInliers);
 
-    // 根据3对匹配的3D点，计算之间的Sim3变换，也就是计算尺度s旋转R以及平移t
-    void ComputeSim3(cv::Mat &P1, cv::Mat &P2);
+    // 根据3对匹配的3D点(每列一个点)，计算之间的Sim3变换，也就是计算尺度s旋转R以及平移t
+    // 全部使用固定大小的矩阵，每次迭代不分配内存
+    void ComputeSim3(const Eigen::Matrix3f &P1, const Eigen::Matrix3f &P2);
 
-    void CheckInliers();
+    //内点数不可能达到nRequired时提前返回
+    void CheckInliers(const int nRequired = 0);
 
-    //将vP3Dw中的3d点通过参数Tcw，K投影为2d像素坐标，放入vP2D
-    void Project(const std::vector<cv::Mat> &vP3Dw, std::vector<cv::Mat> &vP2D, cv::Mat Tcw, cv::Mat K);
     //相机坐标转化为像素坐标
-    void FromCameraToImage(const std::vector<cv::Mat> &vP3Dc, std::vector<cv::Mat> &vP2D, cv::Mat K);
+    static Eigen::Vector2f Project(const Eigen::Vector3f &P3Dc, const float fx, const float fy, const float cx, const float cy);
 
 
 protected:
@@ -72,9 +82,9 @@ protected:
     KeyFrame* mpKF2;
 
     //mvpMapPoints1在相机mpKF1下的坐标
-    std::vector<cv::Mat> mvX3Dc1;
+    std::vector<Eigen::Vector3f> mvX3Dc1;
     //mvpMapPoints2在相机mpKF2下的坐标
-    std::vector<cv::Mat> mvX3Dc2;
+    std::vector<Eigen::Vector3f> mvX3Dc2;
     //与mpKF1匹配的mappoint，大小是匹配点大小
     std::vector<MapPoint*> mvpMapPoints1;
     //与mpKF2匹配的mappoint，大小是匹配点大小
@@ -82,45 +92,43 @@ protected:
     std::vector<MapPoint*> mvpMatches12;
     //mvnIndices1[i]表示mvpMapPoints1[i]指向的mappoint对应的在mpKF1中的特征点的序号
     std::vector<size_t> mvnIndices1;
-    std::vector<size_t> mvSigmaSquare1;
-    std::vector<size_t> mvSigmaSquare2;
-    std::vector<size_t> mvnMaxError1;
-    std::vector<size_t> mvnMaxError2;
+    //重投影误差阈值(像素平方)
+    std::vector<float> mvnMaxError1;
+    std::vector<float> mvnMaxError2;
 
     int N;
     int mN1;
 
     // Current Estimation
-    //通过sim3计算出的sRt
-    cv::Mat mR12i;
-    cv::Mat mt12i;
+    //通过sim3计算出的sRt，从坐标系2到1的变换
+    Eigen::Matrix3f mR12i;
+    Eigen::Vector3f mt12i;
     float ms12i;
-    cv::Mat mT12i;  //从坐标系2到1的变换
-    cv::Mat mT21i;
+    //从坐标系1到2的变换 sR21 = (1/s)*R12^T，t21 = -sR21*t12
+    Eigen::Matrix3f msR21i;
+    Eigen::Vector3f mt21i;
     std::vector<bool> mvbInliersi;
     int mnInliersi;
 
     // Current Ransac State
-    int mnIterations;
+    Ransac<Sim3Solver> mRansac;
     std::vector<bool> mvbBestInliers;
     int mnBestInliers;
-    cv::Mat mBestT12;
-    cv::Mat mBestRotation;
-    cv::Mat mBestTranslation;
+    Eigen::Matrix3f mBestRotation;
+    Eigen::Vector3f mBestTranslation;
     float mBestScale;
 
     // Scale is fixed to 1 in the stereo/RGBD case
     bool mbFixScale;
 
-    // Indices for random selection
-    //为了随机抽取而准备的序列，如果匹配数为N，则mvAllIndices=[0,1,...,N-1]
-    std::vector<size_t> mvAllIndices;
+    // 匹配的描述子距离，距离小的点对在RANSAC中优先抽样(PROSAC)
+    std::vector<int> mvDistances;
 
     // Projections
     //mvpMapPoints1在相机mpKF1下的像素坐标
-    std::vector<cv::Mat> mvP1im1;
-    //mvpMapPoints1在相机mpKF2下的像素坐标
-    std::vector<cv::Mat> mvP2im2;
+    std::vector<Eigen::Vector2f> mvP1im1;
+    //mvpMapPoints2在相机mpKF2下的像素坐标
+    std::vector<Eigen::Vector2f> mvP2im2;
 
     // RANSAC probability
     double mRansacProb;
@@ -128,16 +136,13 @@ protected:
     // RANSAC min inliers
     int mRansacMinInliers;
 
-    // RANSAC max iterations
-    int mRansacMaxIts;
-
     // Threshold inlier/outlier. e = dist(Pi,T_ij*Pj)^2 < 5.991*mSigma2
     float mTh;
     float mSigma2;
 
     // Calibration
-    cv::Mat mK1;
-    cv::Mat mK2;
+    float mfx1, mfy1, mcx1, mcy1;
+    float mfx2, mfy2, mcx2, mcy2;
 
 };
 
@@ -0,0 +1,90 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOLVERKERNELS_H
+#define SOLVERKERNELS_H
+
+#include <cmath>
+
+#include <Eigen/Core>
+
+namespace ORB_SLAM2
+{
+
+/**
+ * BASolver、PoseSolver、PoseGraphSolver共用的小函数
+ * 投影和Huber核与g2o中EdgeSE3ProjectXYZ/EdgeStereoSE3ProjectXYZ/RobustKernelHuber的定义一致
+ */
+namespace SolverKernels
+{
+
+inline Eigen::Matrix3d Skew(const Eigen::Vector3d &v)
+{
+    Eigen::Matrix3d m;
+    m <<     0, -v(2),  v(1),
+          v(2),     0, -v(0),
+         -v(1),  v(0),     0;
+    return m;
+}
+
+// 单目投影 h=(u,v)，以及h对相机坐标系下3D点的导数
+inline void Project(const Eigen::Vector3d &Xc, const double fx, const double fy, const double cx, const double cy,
+                    const double /*bf*/, Eigen::Vector2d &h, Eigen::Matrix<double,2,3> &J)
+{
+    const double invz = 1.0/Xc(2);
+    const double x = Xc(0)*invz;
+    const double y = Xc(1)*invz;
+    h << fx*x+cx, fy*y+cy;
+    J << fx*invz, 0, -fx*x*invz,
+         0, fy*invz, -fy*y*invz;
+}
+
+// 双目投影 h=(u,v,ur)，ur = u - bf/z
+inline void Project(const Eigen::Vector3d &Xc, const double fx, const double fy, const double cx, const double cy,
+                    const double bf, Eigen::Vector3d &h, Eigen::Matrix<double,3,3> &J)
+{
+    const double invz = 1.0/Xc(2);
+    const double x = Xc(0)*invz;
+    const double y = Xc(1)*invz;
+    h << fx*x+cx, fy*y+cy, fx*x+cx-bf*invz;
+    J << fx*invz, 0, -fx*x*invz,
+         0, fy*invz, -fy*y*invz,
+         fx*invz, 0, -fx*x*invz+bf*invz*invz;
+}
+
+// g2o::RobustKernelHuber，返回rho(e2)，w为一阶导数rho'(e2)
+inline double Huber(const double e2, const double delta, double &w)
+{
+    const double dsqr = delta*delta;
+    if(e2<=dsqr)
+    {
+        w = 1.0;
+        return e2;
+    }
+    const double sqrte = std::sqrt(e2);
+    w = delta/sqrte;
+    return 2*sqrte*delta - dsqr;
+}
+
+} //namespace SolverKernels
+
+} //namespace ORB_SLAM
+
+#endif // SOLVERKERNELS_H
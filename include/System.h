@@ -24,24 +24,23 @@
 
 #include<string>
 #include<thread>
+#include<condition_variable>
 #include<opencv2/core/core.hpp>
 #include <unistd.h>
 
 #include "Tracking.h"
-#include "FrameDrawer.h"
-#include "MapDrawer.h"
 #include "Map.h"
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "KeyFrameDatabase.h"
 #include "ORBVocabulary.h"
-#include "Viewer.h"
 
 namespace ORB_SLAM2
 {
 
 class Viewer;
 class FrameDrawer;
+class MapDrawer;
 class Map;
 class Tracking;
 class LocalMapping;
@@ -62,21 +61,28 @@ public:
     // Initialize the SLAM system. It launches the Local Mapping, Loop Closing and Viewer threads.
     System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor, const bool bUseViewer = true);
 
+    // 多相机：添加一个共享地图、关键帧数据库、词典以及LocalMapping和LoopClosing线程的相机，返回相机序号
+    // 构造函数中的相机序号为0。传感器类型与构造时相同，strSettingsFile给出这个相机的标定和ORB参数
+    // 在开始跟踪之前调用。之后每个相机可以在自己的线程中调用Track*(..., nCamera)
+    // 每个相机从自己的子地图开始，检测到相机之间的闭环后合并(见Map::MergeMaps)
+    int AddCamera(const string &strSettingsFile);
+    int GetNumberOfCameras();
+
     // Proccess the given stereo frame. Images must be synchronized and rectified.
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Returns the camera pose (empty if tracking fails).
-    cv::Mat TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp);
+    cv::Mat TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const int nCamera=0);
 
     // Process the given rgbd frame. Depthmap must be registered to the RGB frame.
     // Input image: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Input depthmap: Float (CV_32F).
     // Returns the camera pose (empty if tracking fails).
-    cv::Mat TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp);
+    cv::Mat TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, const int nCamera=0);
 
     // Proccess the given monocular frame
     // Input images: RGB (CV_8UC3) or grayscale (CV_8U). RGB is converted to grayscale.
     // Returns the camera pose (empty if tracking fails).
-    cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp);
+    cv::Mat TrackMonocular(const cv::Mat &im, const double &timestamp, const int nCamera=0);
 
     // This stops local mapping thread (map building) and performs only camera tracking.
     void ActivateLocalizationMode();
@@ -99,7 +105,7 @@ public:
     // Only for stereo and RGB-D. This method does not work for monocular.
     // Call first Shutdown()
     // See format details at: http://vision.in.tum.de/data/datasets/rgbd-dataset
-    void SaveTrajectoryTUM(const string &filename);
+    void SaveTrajectoryTUM(const string &filename, const int nCamera=0);
 
     // Save keyframe poses in the TUM RGB-D dataset format.
     // This method works for all sensor input.
@@ -111,7 +117,7 @@ public:
     // Only for stereo and RGB-D. This method does not work for monocular.
     // Call first Shutdown()
     // See format details at: http://www.cvlibs.net/datasets/kitti/eval_odometry.php
-    void SaveTrajectoryKITTI(const string &filename);
+    void SaveTrajectoryKITTI(const string &filename, const int nCamera=0);
 
     // TODO: Save/Load functions
     // SaveMap(const string &filename);
@@ -119,12 +125,35 @@ public:
 
     // Information from most recent processed frame
     // You can call this right after TrackMonocular (or stereo or RGBD)
-    int GetTrackingState();
-    std::vector<MapPoint*> GetTrackedMapPoints();
-    std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
+    int GetTrackingState(const int nCamera=0);
+    std::vector<MapPoint*> GetTrackedMapPoints(const int nCamera=0);
+    std::vector<cv::KeyPoint> GetTrackedKeyPointsUn(const int nCamera=0);
+
+    // 基准测试用的接口
+    // 最近一帧各阶段的耗时，在TrackMonocular(或双目、RGBD)之后调用
+    Tracking::FrameTimes GetFrameTimes(const int nCamera=0);
+    // 局部建图处理每个关键帧的耗时
+    std::vector<LocalMapping::KeyFrameTimes> GetKeyFrameTimes();
+    // 阻塞直到局部建图处理完已插入的关键帧，每帧之后调用可以使关键帧的决策不受处理速度的影响
+    void WaitForLocalMapping();
+    // 全局BA是否在运行，需要等它结束后再取最终的轨迹
+    bool IsRunningGlobalBA();
+    void GetMapSize(long unsigned int &nKeyFrames, long unsigned int &nMapPoints);
+    // 所有跟踪成功的帧的位姿Twc，与SaveTrajectoryTUM相同(以帧所在子地图的第一个关键帧为原点)，单目时尺度任意
+    // 参考关键帧已不在任何子地图中的帧不输出
+    // 先调用Shutdown()
+    void GetTrajectory(std::vector<double> &vTimestamps, std::vector<cv::Mat> &vTwc, const int nCamera=0);
 
 private:
 
+    // 跟踪一帧之前：等待其它相机处理完当前帧后执行模式切换和重置，返回相机nCamera的Tracking
+    Tracking* BeginTracking(const int nCamera);
+    // 跟踪一帧之后：保存相机nCamera的跟踪状态
+    void EndTracking(const int nCamera);
+
+    // 每个子地图的原点：id最小的关键帧的位姿Twc，保存轨迹时使用
+    void GetMapOrigins(std::map<long unsigned int,cv::Mat> &mTwo);
+
     // Input sensor
     eSensor mSensor;
 
@@ -141,6 +170,8 @@ private:
     // It also decides when to insert a new keyframe, create some new MapPoints and
     // performs relocalization if tracking fails.
     Tracking* mpTracker;
+    // 所有相机的Tracking，mvpTrackers[0]==mpTracker(绘图只显示它)
+    std::vector<Tracking*> mvpTrackers;
 
     // Local Mapper. It manages the local map and performs local bundle adjustment.
     LocalMapping* mpLocalMapper;
@@ -150,6 +181,7 @@ private:
     LoopClosing* mpLoopCloser;
 
     // The viewer draws the map and the current camera pose. It uses Pangolin.
+    // 无界面时viewer和绘图器都为NULL，编译时关闭WITH_VIEWER则完全不依赖Pangolin
     Viewer* mpViewer;
 
     FrameDrawer* mpFrameDrawer;
@@ -164,16 +196,20 @@ private:
     // Reset flag
     std::mutex mMutexReset;
     bool mbReset;
+    // 正在跟踪的相机数量，由mMutexReset保护
+    int mnTrackingCameras;
+    std::condition_variable mCondTracking;
 
     // Change mode flags
     std::mutex mMutexMode;
     bool mbActivateLocalizationMode;
     bool mbDeactivateLocalizationMode;
 
-    // Tracking state
-    int mTrackingState;
-    std::vector<MapPoint*> mTrackedMapPoints;
-    std::vector<cv::KeyPoint> mTrackedKeyPointsUn;
+    // Tracking state，每个相机一个
+    std::vector<int> mvTrackingState;
+    std::vector<std::vector<MapPoint*> > mvTrackedMapPoints;
+    std::vector<std::vector<cv::KeyPoint> > mvTrackedKeyPointsUn;
+    std::vector<Tracking::FrameTimes> mvFrameTimes;
     std::mutex mMutexState;
 };
 
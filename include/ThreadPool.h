@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace ORB_SLAM2
+{
+
+/**
+ * 固定大小的工作线程池，只提供并行for
+ * 线程在构造时创建并一直保留，避免每次调用都创建/销毁线程
+ * 同一个线程池同一时间只能被一个线程调用ParallelFor(不可重入)
+ */
+class ThreadPool
+{
+public:
+    // nThreads为参与计算的线程总数(包括调用线程)，<=0时按硬件线程数选取
+    ThreadPool(int nThreads);
+    ~ThreadPool();
+
+    // 对[0,n)中的每个i执行f(i)，调用线程也参与计算，所有任务完成后返回
+    // 任务按序号动态分配，f必须是线程安全的
+    void ParallelFor(const int n, const std::function<void(int)> &f);
+
+    // 参与计算的线程总数
+    int Size() const { return mvThreads.size()+1; }
+
+protected:
+
+    void WorkerLoop();
+
+    // 不断取下一个序号执行，直到取完
+    void RunJob();
+
+protected:
+
+    std::vector<std::thread> mvThreads;
+
+    std::mutex mMutex;
+    std::condition_variable mCondJob;
+    std::condition_variable mCondDone;
+
+    const std::function<void(int)>* mpJob;
+    int mnJobSize;
+    std::atomic<int> mnNextIdx;
+    //还没有完成当前任务的工作线程数
+    int mnActive;
+    //每提交一次任务加一，工作线程据此判断是否有新任务
+    unsigned long mnGeneration;
+    bool mbFinish;
+};
+
+} //namespace ORB_SLAM
+
+#endif // THREADPOOL_H
@@ -25,8 +25,6 @@
 #include<opencv2/core/core.hpp>
 #include<opencv2/features2d/features2d.hpp>
 
-#include"Viewer.h"
-#include"FrameDrawer.h"
 #include"Map.h"
 #include"LocalMapping.h"
 #include"LoopClosing.h"
@@ -35,16 +33,16 @@
 #include"KeyFrameDatabase.h"
 #include"ORBextractor.h"
 #include "Initializer.h"
-#include "MapDrawer.h"
-#include "System.h"
 
 #include <mutex>
+#include <chrono>
 
 namespace ORB_SLAM2
 {
 
 class Viewer;
 class FrameDrawer;
+class MapDrawer;
 class Map;
 class LocalMapping;
 class LoopClosing;
@@ -54,8 +52,9 @@ class Tracking
 {  
 
 public:
+    // nAgentId: 多相机共享地图时的相机序号，各相机的Tracking共享地图、关键帧数据库、LocalMapping和LoopClosing
     Tracking(System* pSys, ORBVocabulary* pVoc, FrameDrawer* pFrameDrawer, MapDrawer* pMapDrawer, Map* pMap,
-             KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor);
+             KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor, const int nAgentId=0);
 
     // Preprocess the input and call Track(). Extract features and performs stereo matching.
     cv::Mat GrabImageStereo(const cv::Mat &imRectLeft,const cv::Mat &imRectRight, const double &timestamp);
@@ -124,10 +123,36 @@ public:
     // True if local mapping is deactivated and we are performing only localization
     bool mbOnlyTracking;
 
+    // 最近一帧各阶段的耗时(秒)，供基准测试统计
+    struct FrameTimes
+    {
+        double tExtract;    // 灰度转换和构造Frame(ORB特征提取、双目匹配)
+        double tPose;       // 初始化，或者用运动模型/参考关键帧/重定位估计初始位姿
+        double tLocalMap;   // 跟踪局部地图
+        double tKeyFrame;   // 判断和创建关键帧
+        double tTotal;
+    };
+    FrameTimes mFrameTimes;
+
     void Reset();
+    // 只重置这个Tracking自己的状态，多相机时地图已经由其它相机的Reset()清空
+    void ResetState();
+    // 子地图nMapId被合并到另一个子地图的坐标系(X' = s*Rnw*X + tnw)，由闭环线程持有地图更新锁时调用
+    // 变换上一帧的位姿，速度模型和参考这个子地图关键帧的相对位姿的平移乘以s
+    void TransformMap(const long unsigned int nMapId, const cv::Mat &Rnw, const cv::Mat &tnw, const float s);
 
 protected:
 
+    // 多地图：跟踪丢失太久后保留当前地图，开始初始化新的子地图
+    void StartNewMap();
+
+    // 开始记录当前帧的耗时
+    void StartFrameTimes();
+    // 返回上次调用以来经过的时间(秒)
+    double StageTime();
+    std::chrono::steady_clock::time_point mtFrameStart;
+    std::chrono::steady_clock::time_point mtStageStart;
+
     // Main tracking function. It is independent of the input sensor.
     //跟踪
     void Track();
@@ -151,6 +176,8 @@ protected:
     void CreateInitialMapMonocular();
 
     void CheckReplacedInLastFrame();
+    // 清理上一帧中已删除的mappoint，并向地图确认，见Map::QuiescentState()
+    void QuiescentState();
     
     /**
     * 将将上一帧的位姿作为当前帧mCurrentFrame的初始位姿；
@@ -211,6 +238,10 @@ protected:
     */
     void CreateNewKeyFrame();
 
+    // 更新可视化，无界面时为空操作
+    void UpdateFrameDrawer();
+    void SetDrawerCameraPose(const cv::Mat &Tcw);
+
     // In case of performing only localization, this flag is true when there are no matches to
     // points in the map. Still tracking will continue if there are enough matches with temporal points.
     // In that case we are doing visual odometry. The system will try to do relocalization to recover
@@ -233,6 +264,7 @@ protected:
 
     // Initalization (only for monocular)
     Initializer* mpInitializer;
+    ThreadPool* mpIniThreadPool;
 
     //Local Map
     //参考关键帧
@@ -282,11 +314,23 @@ protected:
     KeyFrame* mpLastKeyFrame;
     // 记录最近的一帧
     Frame mLastFrame;
-    //tracking上一次插入mpLastKeyFrame的Frame的ID
+    // 相机序号
+    int mnAgentId;
+    // 在地图回收中注册的编号
+    int mnReclaimSlot;
+    // 本相机处理过的帧数，多相机时Frame::mnId在各相机之间交错，帧的间隔都用它计算
+    unsigned int mnFrameCount;
+    //tracking上一次插入mpLastKeyFrame时的帧数
     unsigned int mnLastKeyFrameId;
-    //上一次Relocalization()使用的Frame ID，最近一次重定位帧的ID
+    //最近一次重定位成功时的帧数
     unsigned int mnLastRelocFrameId;
 
+    // 多地图(Map.MultiMap)：重定位连续失败mnNewMapAfterLostFrames帧后开始新的子地图
+    bool mbMultiMap;
+    int mnNewMapAfterLostFrames;
+    //开始丢失时的帧数
+    unsigned int mnLostFrameId;
+
     //Motion Model
     cv::Mat mVelocity;
 
@@ -28,6 +28,7 @@
 #include "System.h"
 
 #include <mutex>
+#include <condition_variable>
 
 namespace ORB_SLAM2
 {
@@ -54,6 +55,11 @@ public:
 
     bool isStopped();
 
+    // 阻塞直到绘图线程停止/结束
+    void WaitUntilStopped();
+
+    void WaitUntilFinished();
+
     void Release();
 
 private:
@@ -76,10 +82,12 @@ private:
     bool mbFinishRequested;
     bool mbFinished;
     std::mutex mMutexFinish;
+    std::condition_variable mCondFinish;
 
     bool mbStopped;
     bool mbStopRequested;
     std::mutex mMutexStop;
+    std::condition_variable mCondStop;
 
 };
 
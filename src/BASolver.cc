@@ -0,0 +1,593 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BASolver.h"
+
+#include "SolverKernels.h"
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+using namespace SolverKernels;
+
+BASolver::BASolver():
+    mnFreeCams(0), mbRobust(true), mDeltaMono(sqrt(5.991)), mDeltaStereo(sqrt(7.815)),
+    mpbStopFlag(NULL), mpnIterationsDone(NULL), mnMaxDenseCameras(64), mbStructureDirty(true), mbPatternAnalyzed(false)
+{
+}
+
+int BASolver::AddCamera(const g2o::SE3Quat &Tcw, const double fx, const double fy, const double cx, const double cy,
+                        const double bf, const bool bFixed)
+{
+    mvPoses.push_back(Tcw);
+    mvfx.push_back(fx);
+    mvfy.push_back(fy);
+    mvcx.push_back(cx);
+    mvcy.push_back(cy);
+    mvbf.push_back(bf);
+    mvbFixed.push_back(bFixed);
+    mbStructureDirty = true;
+    return mvPoses.size()-1;
+}
+
+int BASolver::AddPoint(const Eigen::Vector3d &Xw)
+{
+    mvPoints.push_back(Xw);
+    mbStructureDirty = true;
+    return mvPoints.size()-1;
+}
+
+int BASolver::AddMonoEdge(const int nCam, const int nPoint, const Eigen::Vector2d &obs, const double invSigma2)
+{
+    mMono.vCam.push_back(nCam);
+    mMono.vPoint.push_back(nPoint);
+    mMono.vObs.push_back(obs);
+    mMono.vInvSigma2.push_back(invSigma2);
+    mMono.vbActive.push_back(true);
+    mbStructureDirty = true;
+    return mMono.vCam.size()-1;
+}
+
+int BASolver::AddStereoEdge(const int nCam, const int nPoint, const Eigen::Vector3d &obs, const double invSigma2)
+{
+    mStereo.vCam.push_back(nCam);
+    mStereo.vPoint.push_back(nPoint);
+    mStereo.vObs.push_back(obs);
+    mStereo.vInvSigma2.push_back(invSigma2);
+    mStereo.vbActive.push_back(true);
+    mbStructureDirty = true;
+    return mStereo.vCam.size()-1;
+}
+
+void BASolver::SetRobustKernel(const bool bRobust, const double deltaMono, const double deltaStereo)
+{
+    mbRobust = bRobust;
+    mDeltaMono = deltaMono;
+    mDeltaStereo = deltaStereo;
+}
+
+void BASolver::SetForceStopFlag(bool *pbStopFlag)
+{
+    mpbStopFlag = pbStopFlag;
+}
+
+void BASolver::SetIterationCounter(std::atomic<int> *pnIterationsDone)
+{
+    mpnIterationsDone = pnIterationsDone;
+}
+
+void BASolver::SetDenseThreshold(const int nMaxDenseCameras)
+{
+    mnMaxDenseCameras = nMaxDenseCameras;
+}
+
+void BASolver::SetMonoActive(const size_t i, const bool bActive)
+{
+    mMono.vbActive[i] = bActive;
+}
+
+void BASolver::SetStereoActive(const size_t i, const bool bActive)
+{
+    mStereo.vbActive[i] = bActive;
+}
+
+double BASolver::MonoChi2(const size_t i) const
+{
+    const int c = mMono.vCam[i];
+    const Eigen::Vector3d Xc = mvPoses[c].map(mvPoints[mMono.vPoint[i]]);
+    Eigen::Vector2d h;
+    Eigen::Matrix<double,2,3> J;
+    Project(Xc,mvfx[c],mvfy[c],mvcx[c],mvcy[c],mvbf[c],h,J);
+    return mMono.vInvSigma2[i]*(mMono.vObs[i]-h).squaredNorm();
+}
+
+double BASolver::StereoChi2(const size_t i) const
+{
+    const int c = mStereo.vCam[i];
+    const Eigen::Vector3d Xc = mvPoses[c].map(mvPoints[mStereo.vPoint[i]]);
+    Eigen::Vector3d h;
+    Eigen::Matrix3d J;
+    Project(Xc,mvfx[c],mvfy[c],mvcx[c],mvcy[c],mvbf[c],h,J);
+    return mStereo.vInvSigma2[i]*(mStereo.vObs[i]-h).squaredNorm();
+}
+
+bool BASolver::IsMonoDepthPositive(const size_t i) const
+{
+    return mvPoses[mMono.vCam[i]].map(mvPoints[mMono.vPoint[i]])(2)>0.0;
+}
+
+bool BASolver::IsStereoDepthPositive(const size_t i) const
+{
+    return mvPoses[mStereo.vCam[i]].map(mvPoints[mStereo.vPoint[i]])(2)>0.0;
+}
+
+const g2o::SE3Quat &BASolver::GetCameraPose(const int nCam) const
+{
+    return mvPoses[nCam];
+}
+
+const Eigen::Vector3d &BASolver::GetPoint(const int nPoint) const
+{
+    return mvPoints[nPoint];
+}
+
+int BASolver::EdgeCamera(const size_t e) const
+{
+    const size_t nMono = mMono.vCam.size();
+    if(e<nMono)
+        return mMono.vCam[e];
+    else
+        return mStereo.vCam[e-nMono];
+}
+
+void BASolver::BuildStructure()
+{
+    const int nCams = mvPoses.size();
+    const int nPoints = mvPoints.size();
+    const size_t nMono = mMono.vCam.size();
+    const size_t nEdges = nMono+mStereo.vCam.size();
+
+    // 步骤1：给不固定的相机在约化系统中编号
+    mvCamIdx.assign(nCams,-1);
+    mnFreeCams = 0;
+    for(int i=0; i<nCams; i++)
+    {
+        if(!mvbFixed[i])
+            mvCamIdx[i] = mnFreeCams++;
+    }
+
+    // 步骤2：按点分组边(计数排序，保持边的先后顺序)
+    mvPointEdgeStart.assign(nPoints+1,0);
+    for(size_t i=0; i<nMono; i++)
+        mvPointEdgeStart[mMono.vPoint[i]+1]++;
+    for(size_t i=0; i<mStereo.vPoint.size(); i++)
+        mvPointEdgeStart[mStereo.vPoint[i]+1]++;
+    for(int p=0; p<nPoints; p++)
+        mvPointEdgeStart[p+1] += mvPointEdgeStart[p];
+
+    mvPointEdges.resize(nEdges);
+    vector<int> vFill(mvPointEdgeStart.begin(),mvPointEdgeStart.end()-1);
+    for(size_t i=0; i<nMono; i++)
+        mvPointEdges[vFill[mMono.vPoint[i]]++] = i;
+    for(size_t i=0; i<mStereo.vPoint.size(); i++)
+        mvPointEdges[vFill[mStereo.vPoint[i]]++] = nMono+i;
+
+    // 步骤3：约化系统的块结构，前mnFreeCams个块为对角块
+    mvBlockIdx.clear();
+    map<pair<int,int>,int> mBlocks;
+    for(int c=0; c<mnFreeCams; c++)
+    {
+        mBlocks[make_pair(c,c)] = mvBlockIdx.size();
+        mvBlockIdx.push_back(make_pair(c,c));
+    }
+
+    mvPointPairStart.assign(nPoints+1,0);
+    mvPairBlock.clear();
+    for(int p=0; p<nPoints; p++)
+    {
+        mvPointPairStart[p] = mvPairBlock.size();
+        for(int a=mvPointEdgeStart[p]; a<mvPointEdgeStart[p+1]; a++)
+        {
+            const int ca = mvCamIdx[EdgeCamera(mvPointEdges[a])];
+            if(ca<0)
+                continue;
+            for(int b=a; b<mvPointEdgeStart[p+1]; b++)
+            {
+                const int cb = mvCamIdx[EdgeCamera(mvPointEdges[b])];
+                if(cb<0)
+                    continue;
+                const pair<int,int> key(min(ca,cb),max(ca,cb));
+                map<pair<int,int>,int>::iterator mit = mBlocks.find(key);
+                if(mit==mBlocks.end())
+                {
+                    mit = mBlocks.insert(make_pair(key,(int)mvBlockIdx.size())).first;
+                    mvBlockIdx.push_back(key);
+                }
+                mvPairBlock.push_back(mit->second);
+            }
+        }
+    }
+    mvPointPairStart[nPoints] = mvPairBlock.size();
+
+    // 工作空间
+    mvU.resize(mnFreeCams);
+    mvbc.resize(mnFreeCams);
+    mvV.resize(nPoints);
+    mvbp.resize(nPoints);
+    mvVinv.resize(nPoints);
+    mvnPointEdges.resize(nPoints);
+    mvDeltaPoints.resize(nPoints);
+    mvW.resize(nEdges);
+    mvbEdgeLinearized.resize(nEdges);
+    mvS.resize(mvBlockIdx.size());
+    mDeltaCams.resize(6*mnFreeCams);
+
+    mbPatternAnalyzed = false;
+    mbStructureDirty = false;
+}
+
+template<int D>
+void BASolver::LinearizeEdges(const EdgeSet<D> &edges, const double delta, const size_t nOffset, double &chi2)
+{
+    typedef Eigen::Matrix<double,D,1> VectorD;
+    typedef Eigen::Matrix<double,D,3> MatrixD3;
+    typedef Eigen::Matrix<double,D,6> MatrixD6;
+
+    for(size_t i=0, iend=edges.vCam.size(); i<iend; i++)
+    {
+        const size_t e = nOffset+i;
+        mvbEdgeLinearized[e] = false;
+        if(!edges.vbActive[i])
+            continue;
+
+        const int c = edges.vCam[i];
+        const int p = edges.vPoint[i];
+        const g2o::SE3Quat &Tcw = mvPoses[c];
+        const Eigen::Vector3d Xc = Tcw.map(mvPoints[p]);
+
+        VectorD h;
+        MatrixD3 Jproj;
+        Project(Xc,mvfx[c],mvfy[c],mvcx[c],mvcy[c],mvbf[c],h,Jproj);
+
+        // 误差 e = obs - h，和g2o的边定义一致
+        const VectorD err = edges.vObs[i]-h;
+        const double e2 = edges.vInvSigma2[i]*err.squaredNorm();
+        double w = 1.0;
+        if(mbRobust)
+            chi2 += Huber(e2,delta,w);
+        else
+            chi2 += e2;
+        const double wInfo = w*edges.vInvSigma2[i];
+
+        // 误差对点的雅克比 -Jproj*R，对位姿(左乘扰动[omega,upsilon])的雅克比 -Jproj*[-[Xc]x I]
+        const MatrixD3 Jp = -Jproj*Tcw.rotation().toRotationMatrix();
+        MatrixD6 Jc;
+        Jc.template leftCols<3>() = Jproj*Skew(Xc);
+        Jc.template rightCols<3>() = -Jproj;
+
+        mvV[p].noalias() += wInfo*Jp.transpose()*Jp;
+        mvbp[p].noalias() -= wInfo*Jp.transpose()*err;
+        mvnPointEdges[p]++;
+
+        const int ci = mvCamIdx[c];
+        if(ci>=0)
+        {
+            mvU[ci].noalias() += wInfo*Jc.transpose()*Jc;
+            mvbc[ci].noalias() -= wInfo*Jc.transpose()*err;
+            mvW[e].noalias() = wInfo*Jc.transpose()*Jp;
+        }
+        mvbEdgeLinearized[e] = true;
+    }
+}
+
+double BASolver::Linearize()
+{
+    for(int c=0; c<mnFreeCams; c++)
+    {
+        mvU[c].setZero();
+        mvbc[c].setZero();
+    }
+    for(size_t p=0; p<mvPoints.size(); p++)
+    {
+        mvV[p].setZero();
+        mvbp[p].setZero();
+        mvnPointEdges[p] = 0;
+    }
+
+    double chi2 = 0;
+    LinearizeEdges(mMono,mDeltaMono,0,chi2);
+    LinearizeEdges(mStereo,mDeltaStereo,mMono.vCam.size(),chi2);
+    return chi2;
+}
+
+bool BASolver::SolveReducedSystem(const double lambda)
+{
+    const int nPoints = mvPoints.size();
+
+    // 步骤1：点块加阻尼后求逆(3x3，直接求逆)
+    for(int p=0; p<nPoints; p++)
+    {
+        if(mvnPointEdges[p]==0)
+        {
+            mvVinv[p].setZero();
+            continue;
+        }
+        Eigen::Matrix3d V = mvV[p];
+        V.diagonal().array() += lambda;
+        mvVinv[p] = V.inverse();
+    }
+
+    // 步骤2：Schur消元 S = U - W*V^-1*W'，r = bc - W*V^-1*bp
+    for(size_t k=0; k<mvS.size(); k++)
+        mvS[k].setZero();
+    for(int c=0; c<mnFreeCams; c++)
+    {
+        mvS[c] = mvU[c];
+        mvS[c].diagonal().array() += lambda;
+        mDeltaCams.segment<6>(6*c) = mvbc[c];
+    }
+
+    for(int p=0; p<nPoints; p++)
+    {
+        if(mvnPointEdges[p]==0)
+            continue;
+
+        const Eigen::Matrix3d &Vinv = mvVinv[p];
+        int k = mvPointPairStart[p];
+        for(int a=mvPointEdgeStart[p]; a<mvPointEdgeStart[p+1]; a++)
+        {
+            const int ea = mvPointEdges[a];
+            const int ca = mvCamIdx[EdgeCamera(ea)];
+            if(ca<0)
+                continue;
+            const bool bLinA = mvbEdgeLinearized[ea];
+            const Matrix63 WVinv = bLinA ? Matrix63(mvW[ea]*Vinv) : Matrix63(Matrix63::Zero());
+            if(bLinA)
+                mDeltaCams.segment<6>(6*ca).noalias() -= WVinv*mvbp[p];
+
+            for(int b=a; b<mvPointEdgeStart[p+1]; b++)
+            {
+                const int eb = mvPointEdges[b];
+                const int cb = mvCamIdx[EdgeCamera(eb)];
+                if(cb<0)
+                    continue;
+                const int blk = mvPairBlock[k++];
+                if(!bLinA || !mvbEdgeLinearized[eb])
+                    continue;
+
+                const Matrix6d M = WVinv*mvW[eb].transpose();
+                if(ca<cb)
+                    mvS[blk] -= M;
+                else if(ca>cb)
+                    mvS[blk] -= M.transpose();
+                else if(a==b)
+                    mvS[blk] -= M;
+                else
+                    mvS[blk] -= M + M.transpose();
+            }
+        }
+    }
+
+    // 步骤3：求解约化后的相机系统
+    if(mnFreeCams>0)
+    {
+        const int n = 6*mnFreeCams;
+        if(mnFreeCams<=mnMaxDenseCameras)
+        {
+            Eigen::MatrixXd S = Eigen::MatrixXd::Zero(n,n);
+            for(size_t k=0; k<mvBlockIdx.size(); k++)
+            {
+                const int i = mvBlockIdx[k].first;
+                const int j = mvBlockIdx[k].second;
+                S.block<6,6>(6*i,6*j) = mvS[k];
+                if(i!=j)
+                    S.block<6,6>(6*j,6*i) = mvS[k].transpose();
+            }
+            Eigen::LDLT<Eigen::MatrixXd> ldlt(S);
+            if(ldlt.info()!=Eigen::Success || !ldlt.isPositive())
+                return false;
+            mDeltaCams = ldlt.solve(mDeltaCams);
+        }
+        else
+        {
+            vector<Eigen::Triplet<double> > vTriplets;
+            vTriplets.reserve(mvBlockIdx.size()*36);
+            for(size_t k=0; k<mvBlockIdx.size(); k++)
+            {
+                const int i = mvBlockIdx[k].first;
+                const int j = mvBlockIdx[k].second;
+                for(int r=0; r<6; r++)
+                    for(int c=(i==j?r:0); c<6; c++)
+                        vTriplets.push_back(Eigen::Triplet<double>(6*i+r,6*j+c,mvS[k](r,c)));
+            }
+            Eigen::SparseMatrix<double> S(n,n);
+            S.setFromTriplets(vTriplets.begin(),vTriplets.end());
+
+            // 块结构不变，AMD排序和符号分解只做一次
+            if(!mbPatternAnalyzed)
+            {
+                mSparseLDLT.analyzePattern(S);
+                mbPatternAnalyzed = true;
+            }
+            mSparseLDLT.factorize(S);
+            if(mSparseLDLT.info()!=Eigen::Success)
+                return false;
+            mDeltaCams = mSparseLDLT.solve(mDeltaCams);
+        }
+        if(!mDeltaCams.allFinite())
+            return false;
+    }
+
+    // 步骤4：回代求点的增量 dp = V^-1*(bp - W'*dc)
+    for(int p=0; p<nPoints; p++)
+    {
+        if(mvnPointEdges[p]==0)
+        {
+            mvDeltaPoints[p].setZero();
+            continue;
+        }
+        Eigen::Vector3d r = mvbp[p];
+        for(int a=mvPointEdgeStart[p]; a<mvPointEdgeStart[p+1]; a++)
+        {
+            const int ea = mvPointEdges[a];
+            const int ca = mvCamIdx[EdgeCamera(ea)];
+            if(ca<0 || !mvbEdgeLinearized[ea])
+                continue;
+            r.noalias() -= mvW[ea].transpose()*mDeltaCams.segment<6>(6*ca);
+        }
+        mvDeltaPoints[p] = mvVinv[p]*r;
+    }
+
+    return true;
+}
+
+double BASolver::ApplyUpdate(const double lambda)
+{
+    double scale = 0;
+    for(size_t i=0; i<mvPoses.size(); i++)
+    {
+        const int ci = mvCamIdx[i];
+        if(ci<0)
+            continue;
+        const Vector6d dx = mDeltaCams.segment<6>(6*ci);
+        scale += dx.dot(lambda*dx+mvbc[ci]);
+        // 和g2o::VertexSE3Expmap::oplusImpl一致，左乘更新
+        mvPoses[i] = g2o::SE3Quat::exp(dx)*mvPoses[i];
+    }
+    for(size_t p=0; p<mvPoints.size(); p++)
+    {
+        if(mvnPointEdges[p]==0)
+            continue;
+        const Eigen::Vector3d &dp = mvDeltaPoints[p];
+        scale += dp.dot(lambda*dp+mvbp[p]);
+        mvPoints[p] += dp;
+    }
+    return scale;
+}
+
+template<int D>
+double BASolver::ComputeEdgesChi2(const EdgeSet<D> &edges, const double delta) const
+{
+    double chi2 = 0;
+    for(size_t i=0, iend=edges.vCam.size(); i<iend; i++)
+    {
+        if(!edges.vbActive[i])
+            continue;
+        const int c = edges.vCam[i];
+        const Eigen::Vector3d Xc = mvPoses[c].map(mvPoints[edges.vPoint[i]]);
+        Eigen::Matrix<double,D,1> h;
+        Eigen::Matrix<double,D,3> J;
+        Project(Xc,mvfx[c],mvfy[c],mvcx[c],mvcy[c],mvbf[c],h,J);
+        const double e2 = edges.vInvSigma2[i]*(edges.vObs[i]-h).squaredNorm();
+        double w;
+        chi2 += mbRobust ? Huber(e2,delta,w) : e2;
+    }
+    return chi2;
+}
+
+double BASolver::ComputeTotalChi2() const
+{
+    return ComputeEdgesChi2(mMono,mDeltaMono) + ComputeEdgesChi2(mStereo,mDeltaStereo);
+}
+
+int BASolver::Optimize(const int nIterations)
+{
+    if(mbStructureDirty)
+        BuildStructure();
+
+    vector<g2o::SE3Quat, Eigen::aligned_allocator<g2o::SE3Quat> > vBackupPoses;
+    vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d> > vBackupPoints;
+
+    // 阻尼策略与g2o::OptimizationAlgorithmLevenberg相同
+    double lambda = -1;
+    double ni = 2;
+    int it = 0;
+    for(; it<nIterations; it++)
+    {
+        if(mpnIterationsDone)
+            *mpnIterationsDone = it;
+
+        if(mpbStopFlag && *mpbStopFlag)
+            break;
+
+        const double chi2 = Linearize();
+
+        if(lambda<0)
+        {
+            double maxDiag = 0;
+            for(int c=0; c<mnFreeCams; c++)
+                maxDiag = max(maxDiag,mvU[c].diagonal().maxCoeff());
+            for(size_t p=0; p<mvPoints.size(); p++)
+                maxDiag = max(maxDiag,mvV[p].diagonal().maxCoeff());
+            lambda = 1e-5*maxDiag;
+        }
+
+        bool bAccepted = false;
+        for(int nTries=0; nTries<10; nTries++)
+        {
+            if(mpbStopFlag && *mpbStopFlag)
+                break;
+
+            if(SolveReducedSystem(lambda))
+            {
+                vBackupPoses = mvPoses;
+                vBackupPoints = mvPoints;
+
+                const double scale = ApplyUpdate(lambda)+1e-3;
+                const double newChi2 = ComputeTotalChi2();
+                const double rho = (chi2-newChi2)/scale;
+                if(rho>0 && std::isfinite(newChi2))
+                {
+                    const double alpha = min(1.-pow((2*rho-1),3),2./3.);
+                    lambda *= max(1./3.,alpha);
+                    ni = 2;
+                    bAccepted = true;
+                    break;
+                }
+
+                mvPoses.swap(vBackupPoses);
+                mvPoints.swap(vBackupPoints);
+            }
+
+            lambda *= ni;
+            ni *= 2;
+            if(!std::isfinite(lambda))
+                break;
+        }
+
+        if(!bAccepted)
+            break;
+    }
+
+    if(mpnIterationsDone)
+        *mpnIterationsDone = it;
+
+    return it;
+}
+
+} //namespace ORB_SLAM
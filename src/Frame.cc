@@ -26,12 +26,7 @@
 namespace ORB_SLAM2
 {
 //静态变量初始化
-long unsigned int Frame::nNextId=0;
-//标志此帧是否是初始化帧
-bool Frame::mbInitialComputations=true;
-float Frame::cx, Frame::cy, Frame::fx, Frame::fy, Frame::invfx, Frame::invfy;
-float Frame::mnMinX, Frame::mnMinY, Frame::mnMaxX, Frame::mnMaxY;
-float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
+std::atomic<long unsigned int> Frame::nNextId(0);
 
 Frame::Frame()
 {}
@@ -39,16 +34,19 @@ Frame::Frame()
 //Copy Constructor
 Frame::Frame(const Frame &frame)
     :mpORBvocabulary(frame.mpORBvocabulary), mpORBextractorLeft(frame.mpORBextractorLeft), mpORBextractorRight(frame.mpORBextractorRight),
-     mTimeStamp(frame.mTimeStamp), mK(frame.mK.clone()), mDistCoef(frame.mDistCoef.clone()),
+     mTimeStamp(frame.mTimeStamp), mK(frame.mK.clone()),
+     fx(frame.fx), fy(frame.fy), cx(frame.cx), cy(frame.cy), invfx(frame.invfx), invfy(frame.invfy), mDistCoef(frame.mDistCoef.clone()),
      mbf(frame.mbf), mb(frame.mb), mThDepth(frame.mThDepth), N(frame.N), mvKeys(frame.mvKeys),
      mvKeysRight(frame.mvKeysRight), mvKeysUn(frame.mvKeysUn),  mvuRight(frame.mvuRight),
      mvDepth(frame.mvDepth), mBowVec(frame.mBowVec), mFeatVec(frame.mFeatVec),
      mDescriptors(frame.mDescriptors.clone()), mDescriptorsRight(frame.mDescriptorsRight.clone()),
-     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier), mnId(frame.mnId),
+     mvpMapPoints(frame.mvpMapPoints), mvbOutlier(frame.mvbOutlier),
+     mfGridElementWidthInv(frame.mfGridElementWidthInv), mfGridElementHeightInv(frame.mfGridElementHeightInv), mnId(frame.mnId),
      mpReferenceKF(frame.mpReferenceKF), mnScaleLevels(frame.mnScaleLevels),
      mfScaleFactor(frame.mfScaleFactor), mfLogScaleFactor(frame.mfLogScaleFactor),
      mvScaleFactors(frame.mvScaleFactors), mvInvScaleFactors(frame.mvInvScaleFactors),
-     mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2)
+     mvLevelSigma2(frame.mvLevelSigma2), mvInvLevelSigma2(frame.mvInvLevelSigma2),
+     mnMinX(frame.mnMinX), mnMaxX(frame.mnMaxX), mnMinY(frame.mnMinY), mnMaxY(frame.mnMaxY)
 {
     for(int i=0;i<FRAME_GRID_COLS;i++)
         for(int j=0; j<FRAME_GRID_ROWS; j++)
@@ -83,6 +81,9 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     threadLeft.join();
     threadRight.join();
 
+    // 没有特征点时也要设置，Tracking和KeyFrame会读取
+    ComputeCalibration(imLeft);
+
     N = mvKeys.size();
 
     if(mvKeys.empty())
@@ -98,27 +99,6 @@ Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeSt
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));    
     mvbOutlier = vector<bool>(N,false);
 
-
-    // This is done only for the first Frame (or after a change in the calibration)
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imLeft);
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/(mnMaxY-mnMinY);
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
-    mb = mbf/fx;
-
     AssignFeaturesToGrid();
 }
 
@@ -142,6 +122,8 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
     // ORB extraction
     ExtractORB(0,imGray);
 
+    ComputeCalibration(imGray);
+
     N = mvKeys.size();
 
     if(mvKeys.empty())
@@ -157,27 +139,6 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
     //储存哪些关键点是离群值
     mvbOutlier = vector<bool>(N,false);
 
-    // This is done only for the first Frame (or after a change in the calibration)
-    
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imGray);
-
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/static_cast<float>(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/static_cast<float>(mnMaxY-mnMinY);
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
-    mb = mbf/fx;
-    
     //将特征点分配到窗格中以加速特征点匹配
     AssignFeaturesToGrid();
 }
@@ -203,6 +164,8 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     // 提取orb特征点
     ExtractORB(0,imGray);
 
+    ComputeCalibration(imGray);
+
     N = mvKeys.size();//特征点数量
 
     if(mvKeys.empty())
@@ -218,34 +181,6 @@ Frame::Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extra
     mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
     mvbOutlier = vector<bool>(N,false);
 
-    // This is done only for the first Frame (or after a change in the calibration)
-    // 只在第一帧进行,或者更改标定参数之后
-    if(mbInitialComputations)
-    {
-        ComputeImageBounds(imGray);
-
-
-        //FRAME_GRID_COLS:窗格列数
-        //FRAME_GRID_ROWS:窗格行数
-        //mnMaxX-mnMinX: 去畸变之后图像的列数
-        //mnMaxY-mnMinY: 去畸变之后图像的高
-        //目的: 将去畸变后的图像划分为 FRAME_GRID_COLS * FRAME_GRID_ROWS 个区域
-        //      然后将特征点分配到这些区域
-        mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/static_cast<float>(mnMaxX-mnMinX);
-        mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/static_cast<float>(mnMaxY-mnMinY);
-
-        fx = K.at<float>(0,0);
-        fy = K.at<float>(1,1);
-        cx = K.at<float>(0,2);
-        cy = K.at<float>(1,2);
-        invfx = 1.0f/fx;
-        invfy = 1.0f/fy;
-
-        mbInitialComputations=false;
-    }
-
-    mb = mbf/fx;
-
     //将特征点分配到窗格中以加速特征点匹配
     AssignFeaturesToGrid();
 }
@@ -536,6 +471,27 @@ void Frame::ComputeImageBounds(const cv::Mat &imLeft)
     }
 }
 
+void Frame::ComputeCalibration(const cv::Mat &imLeft)
+{
+    fx = mK.at<float>(0,0);
+    fy = mK.at<float>(1,1);
+    cx = mK.at<float>(0,2);
+    cy = mK.at<float>(1,2);
+    invfx = 1.0f/fx;
+    invfy = 1.0f/fy;
+
+    mb = mbf/fx;
+
+    ComputeImageBounds(imLeft);
+
+    //FRAME_GRID_COLS:窗格列数
+    //FRAME_GRID_ROWS:窗格行数
+    //目的: 将去畸变后的图像划分为 FRAME_GRID_COLS * FRAME_GRID_ROWS 个区域
+    //      然后将特征点分配到这些区域
+    mfGridElementWidthInv=static_cast<float>(FRAME_GRID_COLS)/static_cast<float>(mnMaxX-mnMinX);
+    mfGridElementHeightInv=static_cast<float>(FRAME_GRID_ROWS)/static_cast<float>(mnMaxY-mnMinY);
+}
+
 /**
  * @brief 双目匹配
  *
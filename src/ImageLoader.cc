@@ -0,0 +1,301 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ImageLoader.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <opencv2/highgui/highgui.hpp>
+
+namespace ORB_SLAM2
+{
+
+// 缓存文件格式：文件头 + 原图路径 + 按行连续存放的像素
+// 原图的大小和修改时间不一致时缓存失效，重新解码
+struct ImageCacheHeader
+{
+    char magic[8];
+    long long nSourceSize;
+    long long nSourceTime;
+    int rows;
+    int cols;
+    int type;
+    int nPathLength;
+};
+
+static const char CACHE_MAGIC[8] = {'O','R','B','I','M','G','0','1'};
+
+ImageLoader::ImageLoader(const std::vector<std::string> &vstrFiles, const std::vector<std::string> &vstrFiles2,
+                         const int nThreads, const int nPrefetch, const std::string &strCacheDir):
+    mvstrFiles(vstrFiles), mvstrFiles2(vstrFiles2), mnPrefetch(std::max(1,nPrefetch)), mstrCacheDir(strCacheDir),
+    mnThreads(std::max(0,nThreads)), mnNextToLoad(0), mnNextToGet(0), mbFinish(false), mWaitTime(0)
+{
+    if(!mvstrFiles2.empty() && mvstrFiles2.size()!=mvstrFiles.size())
+    {
+        std::cerr << "ImageLoader: different number of first and second images, ignoring the second images" << std::endl;
+        mvstrFiles2.clear();
+    }
+
+    if(!mstrCacheDir.empty())
+        mkdir(mstrCacheDir.c_str(),0755);
+}
+
+ImageLoader::~ImageLoader()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbFinish = true;
+    }
+    mCondLoad.notify_all();
+
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+void ImageLoader::SetProcessFunction(const ProcessFunction &process)
+{
+    mProcess = process;
+}
+
+bool ImageLoader::Get(const size_t i, cv::Mat &im)
+{
+    cv::Mat im2;
+    return Get(i,im,im2);
+}
+
+bool ImageLoader::Get(const size_t i, cv::Mat &im, cv::Mat &im2)
+{
+    if(i>=Size())
+        return false;
+
+    const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    // 同步读取
+    if(mnThreads==0)
+    {
+        const bool bOK = LoadFrame(i,im,im2);
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWaitTime += std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now()-t0).count();
+        return bOK;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    // 第一次调用时才启动解码线程，保证SetProcessFunction()已经生效
+    if(mvThreads.empty())
+    {
+        for(int t=0; t<mnThreads; t++)
+            mvThreads.push_back(std::thread(&ImageLoader::Run,this));
+    }
+
+    if(i<mnNextToGet)
+    {
+        // 向前跳回，之前预读的帧都不再需要
+        mmFrames.clear();
+        mnNextToLoad = i;
+    }
+    else
+    {
+        // 丢弃跳过的帧
+        mmFrames.erase(mmFrames.begin(),mmFrames.lower_bound(i));
+        if(mnNextToLoad<i)
+            mnNextToLoad = i;
+    }
+    mnNextToGet = i;
+    mCondLoad.notify_all();
+
+    std::map<size_t,LoadedFrame>::iterator it;
+    while((it=mmFrames.find(i))==mmFrames.end() || !it->second.bReady)
+        mCondReady.wait(lock);
+
+    const bool bOK = it->second.bOK;
+    im = it->second.im;
+    im2 = it->second.im2;
+    mmFrames.erase(it);
+    mnNextToGet = i+1;
+    mWaitTime += std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now()-t0).count();
+    lock.unlock();
+
+    // 空出了一个位置，可以预读下一帧
+    mCondLoad.notify_all();
+    return bOK;
+}
+
+double ImageLoader::GetWaitTime()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    return mWaitTime;
+}
+
+void ImageLoader::Run()
+{
+    while(true)
+    {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while(!mbFinish && (mnNextToLoad>=Size() || mnNextToLoad>=mnNextToGet+mnPrefetch))
+                mCondLoad.wait(lock);
+            if(mbFinish)
+                return;
+
+            i = mnNextToLoad++;
+            LoadedFrame &frame = mmFrames[i];
+            frame.bReady = false;
+            frame.bOK = false;
+        }
+
+        // 解码不持有锁，多个线程并行读取不同的帧
+        cv::Mat im, im2;
+        const bool bOK = LoadFrame(i,im,im2);
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            // 调用者已经跳过这一帧时直接丢弃
+            std::map<size_t,LoadedFrame>::iterator it = mmFrames.find(i);
+            if(it==mmFrames.end() || it->second.bReady)
+                continue;
+            it->second.bReady = true;
+            it->second.bOK = bOK;
+            it->second.im = im;
+            it->second.im2 = im2;
+        }
+        mCondReady.notify_all();
+    }
+}
+
+bool ImageLoader::LoadFrame(const size_t i, cv::Mat &im, cv::Mat &im2)
+{
+    if(!LoadImage(mvstrFiles[i],im))
+        return false;
+    if(!mvstrFiles2.empty() && !LoadImage(mvstrFiles2[i],im2))
+        return false;
+
+    if(mProcess)
+        mProcess(im,im2);
+    return true;
+}
+
+bool ImageLoader::LoadImage(const std::string &strFile, cv::Mat &im)
+{
+    if(!mstrCacheDir.empty() && ReadCache(strFile,im))
+        return true;
+
+    im = cv::imread(strFile,CV_LOAD_IMAGE_UNCHANGED);
+    if(im.empty())
+    {
+        std::cerr << std::endl << "Failed to load image at: " << strFile << std::endl;
+        return false;
+    }
+
+    if(!mstrCacheDir.empty())
+        WriteCache(strFile,im);
+    return true;
+}
+
+std::string ImageLoader::CachePath(const std::string &strFile) const
+{
+    std::stringstream ss;
+    ss << mstrCacheDir << "/" << std::hex << std::hash<std::string>()(strFile) << ".raw";
+    return ss.str();
+}
+
+bool ImageLoader::ReadCache(const std::string &strFile, cv::Mat &im) const
+{
+    struct stat stSource;
+    if(stat(strFile.c_str(),&stSource)!=0)
+        return false;
+
+    const int fd = open(CachePath(strFile).c_str(),O_RDONLY);
+    if(fd<0)
+        return false;
+    struct stat st;
+    if(fstat(fd,&st)!=0 || st.st_size<(off_t)sizeof(ImageCacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void* pData = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(pData==MAP_FAILED)
+        return false;
+
+    const ImageCacheHeader* pHeader = static_cast<const ImageCacheHeader*>(pData);
+    const char* pPath = static_cast<const char*>(pData)+sizeof(ImageCacheHeader);
+    bool bOK = memcmp(pHeader->magic,CACHE_MAGIC,sizeof(CACHE_MAGIC))==0 &&
+               pHeader->nSourceSize==(long long)stSource.st_size && pHeader->nSourceTime==(long long)stSource.st_mtime &&
+               pHeader->nPathLength==(int)strFile.size() && pHeader->rows>0 && pHeader->cols>0;
+    if(bOK)
+    {
+        const size_t nBytes = (size_t)pHeader->rows*pHeader->cols*CV_ELEM_SIZE(pHeader->type);
+        bOK = sizeof(ImageCacheHeader)+pHeader->nPathLength+nBytes==(size_t)st.st_size &&
+              strFile.compare(0,std::string::npos,pPath,pHeader->nPathLength)==0;
+    }
+    if(bOK)
+    {
+        // 映射的页面在munmap后失效，拷贝一份
+        cv::Mat(pHeader->rows,pHeader->cols,pHeader->type,const_cast<char*>(pPath+pHeader->nPathLength)).copyTo(im);
+    }
+    munmap(pData,st.st_size);
+    return bOK;
+}
+
+void ImageLoader::WriteCache(const std::string &strFile, const cv::Mat &im) const
+{
+    struct stat stSource;
+    if(stat(strFile.c_str(),&stSource)!=0 || !im.isContinuous())
+        return;
+
+    ImageCacheHeader header;
+    memcpy(header.magic,CACHE_MAGIC,sizeof(CACHE_MAGIC));
+    header.nSourceSize = stSource.st_size;
+    header.nSourceTime = stSource.st_mtime;
+    header.rows = im.rows;
+    header.cols = im.cols;
+    header.type = im.type();
+    header.nPathLength = strFile.size();
+
+    // 先写临时文件再改名，多个进程同时写同一个缓存时读到的也是完整的文件
+    const std::string strCache = CachePath(strFile);
+    std::stringstream ss;
+    ss << strCache << ".tmp" << getpid() << "_" << std::this_thread::get_id();
+    const std::string strTmp = ss.str();
+    std::ofstream f(strTmp.c_str(),std::ios::binary);
+    f.write(reinterpret_cast<const char*>(&header),sizeof(header));
+    f.write(strFile.c_str(),strFile.size());
+    f.write(reinterpret_cast<const char*>(im.data),im.total()*im.elemSize());
+    f.close();
+    if(!f || rename(strTmp.c_str(),strCache.c_str())!=0)
+        unlink(strTmp.c_str());
+}
+
+} //namespace ORB_SLAM
@@ -20,12 +20,15 @@
 
 #include "Initializer.h"
 
-#include "Thirdparty/DBoW2/DUtils/Random.h"
-
+#include "Ransac.h"
 #include "Optimizer.h"
 #include "ORBmatcher.h"
+#include "Converter.h"
 
-#include<thread>
+#include<atomic>
+#include<algorithm>
+#include<Eigen/SVD>
+#include<Eigen/LU>
 
 namespace ORB_SLAM2
 {
@@ -37,7 +40,8 @@ namespace ORB_SLAM2
  * @param sigma          测量误差
  * @param iterations     RANSAC迭代次数
  */
-Initializer::Initializer(const Frame &ReferenceFrame, float sigma, int iterations)
+Initializer::Initializer(const Frame &ReferenceFrame, float sigma, int iterations, ThreadPool* pThreadPool):
+    mpThreadPool(pThreadPool)
 {
     /// 使用参考帧初始化初始化器
 
@@ -86,70 +90,47 @@ bool Initializer::Initialize(const Frame &CurrentFrame, const vector<int> &vMatc
     //匹配点数
     const int N = mvMatches12.size();
 
-    // Indices for minimum set selection
-    vector<size_t> vAllIndices;
-    vAllIndices.reserve(N);
-    vector<size_t> vAvailableIndices;
-
-    //vAllIndices[1]=1 , vAllIndices[2]=2 , vAllIndices[3]=3 ...
+    // 匹配点对的坐标连续存放，计算得分时按块处理
+    mvU1.resize(N); mvV1.resize(N); mvU2.resize(N); mvV2.resize(N);
     for(int i=0; i<N; i++)
     {
-        vAllIndices.push_back(i);
+        mvU1[i] = mvKeys1[mvMatches12[i].first].pt.x;
+        mvV1[i] = mvKeys1[mvMatches12[i].first].pt.y;
+        mvU2[i] = mvKeys2[mvMatches12[i].second].pt.x;
+        mvV2[i] = mvKeys2[mvMatches12[i].second].pt.y;
     }
 
     // Generate sets of 8 points for each RANSAC iteration
-    // 在所有匹配特征点对中随机选择8对匹配特征点为一组，共选择mMaxIterations组
+    // 在所有匹配特征点对中随机选择8对匹配特征点为一组，最多选择mMaxIterations组
     // 用于FindHomography和FindFundamental求解
     // mMaxIterations:200
     mvSets = vector< vector<size_t> >(mMaxIterations,vector<size_t>(8,0));  //初始化,分配空间这个vector<vector> 是 200 * 8 的
 
-    DUtils::Random::SeedRandOnce(0);
-
-    //RANSAC循环mMaxIterations次
+    // 固定的种子，每次初始化的抽样可以复现
+    RansacRandom random(0);
+    RansacSampler sampler;
+    sampler.Reset(N,8);
+    vector<int> vSample;
     for(int it=0; it<mMaxIterations; it++)
     {
-        //每一次重新取8对点之前, 重新初始化vAvailableIndices
-        //vAvailableIndices[1]=1 , vAvailableIndices[2]=2 , vAvailableIndices[3]=3 ...
-        vAvailableIndices = vAllIndices;
-
         // Select a minimum set
         // 选择一个最小集合, 即随机抽取8对匹配特征点
+        sampler.Draw(random,vSample);
         for(size_t j=0; j<8; j++)
-        {
-            //RandomInt():返回一个随机int
-            int randi = DUtils::Random::RandomInt(0,vAvailableIndices.size()-1);
-            int idx = vAvailableIndices[randi]; //idx=randi
-
-            //储存这个 8对特征点集合
-            mvSets[it][j] = idx;
-
-            //用最后一个值往上面被抽中的位置覆盖idx
-            vAvailableIndices[randi] = vAvailableIndices.back();
-            //然后把最后一个值去掉,否则就重复了
-            vAvailableIndices.pop_back();
-        }
+            mvSets[it][j] = vSample[j];
     }
 
-    // Launch threads to compute in parallel a fundamental matrix and a homography
+    // Compute a fundamental matrix and a homography, each one evaluates its RANSAC hypotheses in parallel
     // vector<bool> vbMatchesInliersH储存: 哪些匹配点对能够通过H重投影成功
     vector<bool> vbMatchesInliersH, vbMatchesInliersF;
     //SH计算单应矩阵的得分，SF计算基础矩阵得分
     float SH, SF;
     cv::Mat H, F;
 
-    //启动线程，第一个参数是启用函数的指针，后面是调用这个函数所需的参数
-    //由于FindHomography第二三个参数是引用，所以需要用ref()包裹,线程引用传值,如果用&则不能通过编译
-    // ref():https://zhidao.baidu.com/question/1240776856100751219.html
     // 计算homograpy和得分
-    thread threadH(&Initializer::FindHomography,this,ref(vbMatchesInliersH), ref(SH), ref(H));
+    FindHomography(vbMatchesInliersH, SH, H);
     // 计算fundamental和得分
-    thread threadF(&Initializer::FindFundamental,this,ref(vbMatchesInliersF), ref(SF), ref(F));
-
-    // Wait until both threads have finished
-    //在这里等待线程threadH，threadF结束才往下继续执行
-    //也就是等待SH，SF的结果
-    threadH.join();
-    threadF.join();
+    FindFundamental(vbMatchesInliersF, SF, F);
 
     // Compute ratio of scores
     // 计算分数的比值
@@ -167,6 +148,56 @@ bool Initializer::Initialize(const Frame &CurrentFrame, const vector<int> &vMatc
 }
 
 
+int Initializer::RunHypotheses(const std::function<void(int)> &hypothesis, const vector<float> &vScores,
+                               const std::function<int(int)> &countInliers)
+{
+    // 每轮计算的假设数
+    const int nRoundSize = 32;
+    // 至少抽到一次全是内点的最小集的概率
+    const double probability = 0.99;
+
+    const int N = mvMatches12.size();
+    int nIterations = mMaxIterations;
+
+    int bestIt = -1;
+    float bestScore = 0;
+    for(int it0=0; it0<nIterations; it0+=nRoundSize)
+    {
+        const int it1 = min(it0+nRoundSize,nIterations);
+        if(mpThreadPool)
+            mpThreadPool->ParallelFor(it1-it0,[&](int i){ hypothesis(it0+i); });
+        else
+            for(int it=it0; it<it1; it++)
+                hypothesis(it);
+
+        //得分相同时取序号小的假设
+        bool bImproved = false;
+        for(int it=it0; it<it1; it++)
+        {
+            if(vScores[it]>bestScore)
+            {
+                bestScore = vScores[it];
+                bestIt = it;
+                bImproved = true;
+            }
+        }
+
+        //按最优假设的内点比例重新估计需要的假设数，只减不增
+        if(bImproved)
+            nIterations = RansacIterations(probability,(double)countInliers(bestIt)/N,8,nIterations);
+    }
+
+    return bestIt;
+}
+
+// 各个假设并行计算时共享的最高得分，只会增大
+static void UpdateBestScore(std::atomic<float> &best, const float score)
+{
+    float current = best.load();
+    while(score>current && !best.compare_exchange_weak(current,score))
+        ;
+}
+
 void Initializer::FindHomography(vector<bool> &vbMatchesInliers, float &score, cv::Mat &H21)
 {
     // Number of putative matches
@@ -179,57 +210,67 @@ void Initializer::FindHomography(vector<bool> &vbMatchesInliers, float &score, c
     cv::Mat T1, T2;
     Normalize(mvKeys1,vPn1, T1);
     Normalize(mvKeys2,vPn2, T2);
-    cv::Mat T2inv = T2.inv();   //求出T2^{-1}
-
-    // Best Results variables
-    // 这是要输出的,描述某个特征点是否内点
-    score = 0.0;
-    vbMatchesInliers = vector<bool>(N,false);
+    const Eigen::Matrix3f eT1 = Converter::toMatrix3d(T1).cast<float>();
+    const Eigen::Matrix3f eT2inv = Converter::toMatrix3d(T2).cast<float>().inverse();   //求出T2^{-1}
 
-    // Iteration variables
-    vector<cv::Point2f> vPn1i(8);
-    vector<cv::Point2f> vPn2i(8);
-    cv::Mat H21i, H12i;
-    vector<bool> vbCurrentInliers(N,false);
-    float currentScore;
+    // 每个假设的单应矩阵和得分，得分为-1表示提前放弃
+    vector<Eigen::Matrix3f> vH21(mMaxIterations);
+    vector<float> vScores(mMaxIterations,0);
+    std::atomic<float> bestScore(0);
 
-    // Perform all RANSAC iterations and save the solution with highest score
-    for(int it=0; it<mMaxIterations; it++)
+    // Perform RANSAC iterations and save the solution with highest score
+    auto hypothesis = [&](int it)
     {
-        // RANSAC迭代200次,取得分最高情况下算出来的单应矩阵H
+        // RANSAC最多迭代200次,取得分最高情况下算出来的单应矩阵H
         // Select a minimum set 每个集合8对点(8点法)
         // mvSets[当前迭代次数][0~7]= 某个最小集合随机索引idx
+        Eigen::Matrix<float,8,2> Pn1i, Pn2i;
         for(size_t j=0; j<8; j++)
         {
             int idx = mvSets[it][j];    //idx用来取某一堆匹配点对
             //mvMatches12[i]=pair(参考帧特征点idx,当前帧特征点idx), 这是匹配的特征点
-            vPn1i[j] = vPn1[mvMatches12[idx].first];
-            vPn2i[j] = vPn2[mvMatches12[idx].second];
+            const cv::Point2f &p1 = vPn1[mvMatches12[idx].first];
+            const cv::Point2f &p2 = vPn2[mvMatches12[idx].second];
+            Pn1i(j,0) = p1.x; Pn1i(j,1) = p1.y;
+            Pn2i(j,0) = p2.x; Pn2i(j,1) = p2.y;
         }
 
         //计算H
-        cv::Mat Hn = ComputeH21(vPn1i,vPn2i);
-        H21i = T2inv*Hn*T1; //注意: 这里是T2的逆,不是转置, 原因是约束方程里是叉乘关系, u2 X H * u1 = 0
-        H12i = H21i.inv();
-
-        //在参数 mSigma下，能够通过H21，H12重投影成功的点有哪些，并返回分数
-        currentScore = CheckHomography(H21i, H12i, vbCurrentInliers, mSigma);
+        const Eigen::Matrix3f Hn = ComputeH21(Pn1i,Pn2i);
+        const Eigen::Matrix3f H21i = eT2inv*Hn*eT1; //注意: 这里是T2的逆,不是转置, 原因是约束方程里是叉乘关系, u2 X H * u1 = 0
+        const Eigen::Matrix3f H12i = H21i.inverse();
+        vH21[it] = H21i;
+
+        //在参数 mSigma下，能够通过H21，H12重投影成功的点的得分，不可能超过当前最高得分时提前放弃
+        vScores[it] = CheckHomography(H21i, H12i, NULL, mSigma, bestScore.load());
+        UpdateBestScore(bestScore,vScores[it]);
+    };
+
+    // 这是要输出的,描述某个特征点是否内点，最后一次统计的就是最高得分的H
+    auto countInliers = [&](int it)
+    {
+        CheckHomography(vH21[it], vH21[it].inverse(), &vbMatchesInliers, mSigma);
+        return (int)count(vbMatchesInliers.begin(),vbMatchesInliers.end(),true);
+    };
 
-        //只取最高得分情况下的H以及内点判断vbMatchesInliers
-        if(currentScore>score)
-        {
-            H21 = H21i.clone();
-            vbMatchesInliers = vbCurrentInliers;
-            score = currentScore;
-        }
+    //只取最高得分情况下的H
+    const int bestIt = RunHypotheses(hypothesis,vScores,countInliers);
+    if(bestIt<0)
+    {
+        score = 0.0;
+        vbMatchesInliers = vector<bool>(N,false);
+        return;
     }
+
+    score = vScores[bestIt];
+    H21 = Converter::toCvMat(Eigen::Matrix3d(vH21[bestIt].cast<double>()));
 }
 
 
 void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score, cv::Mat &F21)
 {
     // Number of putative matches
-    const int N = vbMatchesInliers.size();
+    const int N = mvMatches12.size();
 
     // Normalize coordinates
     // 归一化点
@@ -237,38 +278,34 @@ void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score,
     cv::Mat T1, T2;
     Normalize(mvKeys1,vPn1, T1);
     Normalize(mvKeys2,vPn2, T2);
-    cv::Mat T2t = T2.t();
-
-    // Best Results variables
-    // 输出
-    score = 0.0;
-    vbMatchesInliers = vector<bool>(N,false);
+    const Eigen::Matrix3f eT1 = Converter::toMatrix3d(T1).cast<float>();
+    const Eigen::Matrix3f eT2t = Converter::toMatrix3d(T2).cast<float>().transpose();
 
-    // Iteration variables
-    vector<cv::Point2f> vPn1i(8);
-    vector<cv::Point2f> vPn2i(8);
-    cv::Mat F21i;
-    vector<bool> vbCurrentInliers(N,false);
-    float currentScore;
+    vector<Eigen::Matrix3f> vF21(mMaxIterations);
+    vector<float> vScores(mMaxIterations,0);
+    std::atomic<float> bestScore(0);
 
-    // Perform all RANSAC iterations and save the solution with highest score
-    for(int it=0; it<mMaxIterations; it++)
+    // Perform RANSAC iterations and save the solution with highest score
+    auto hypothesis = [&](int it)
     {
         // Select a minimum set
+        Eigen::Matrix<float,8,2> Pn1i, Pn2i;
         for(int j=0; j<8; j++)
         {
             int idx = mvSets[it][j];
 
             //mvMatches12[i]=pair(参考帧特征点idx,当前帧特征点idx)
-            vPn1i[j] = vPn1[mvMatches12[idx].first];
-            vPn2i[j] = vPn2[mvMatches12[idx].second];
+            const cv::Point2f &p1 = vPn1[mvMatches12[idx].first];
+            const cv::Point2f &p2 = vPn2[mvMatches12[idx].second];
+            Pn1i(j,0) = p1.x; Pn1i(j,1) = p1.y;
+            Pn2i(j,0) = p2.x; Pn2i(j,1) = p2.y;
         }
 
         //计算出归一化特征点对应的基础矩阵
         //由基础矩阵约束 u2'*F*u1=0
         //可以得到,使用归一化的点代入,有:  _u2' * _F * _u1 =0
         //下面求出来的Fn就是 上式子的 _F
-        cv::Mat Fn = ComputeF21(vPn1i,vPn2i);
+        const Eigen::Matrix3f Fn = ComputeF21(Pn1i,Pn2i);
 
         //又根据 _u2=T2*u2 , _u1=T1*u1
         //可得: _u2' * _F * _u1 = (T2*u2)' * _F *(T1*u1) = u2'*(T2' * _F * T1)* u1 = 0
@@ -277,20 +314,31 @@ void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score,
 
         //转换成归一化前特征点对应的基础矩阵
         //也就是求出没有归一化的点代入方程[u2'*F*u1=0]得到的F
-        F21i = T2t*Fn*T1;
+        vF21[it] = eT2t*Fn*eT1;
 
-        //在参数 mSigma下，能够通过F21li，
-        //重投影成功的点有哪些，并返回分数
-        currentScore = CheckFundamental(F21i, vbCurrentInliers, mSigma);
+        //在参数 mSigma下，能够通过F21li重投影成功的点的得分
+        vScores[it] = CheckFundamental(vF21[it], NULL, mSigma, bestScore.load());
+        UpdateBestScore(bestScore,vScores[it]);
+    };
 
-        //储存最高分的情况下的基础矩阵F
-        if(currentScore>score)
-        {
-            F21 = F21i.clone(); //F
-            vbMatchesInliers = vbCurrentInliers;    //内点判断(std::vector)(判断哪些特征点对是内点)
-            score = currentScore;
-        }
+    // 输出，最后一次统计的就是最高得分的F
+    auto countInliers = [&](int it)
+    {
+        CheckFundamental(vF21[it], &vbMatchesInliers, mSigma);
+        return (int)count(vbMatchesInliers.begin(),vbMatchesInliers.end(),true);
+    };
+
+    //储存最高分的情况下的基础矩阵F
+    const int bestIt = RunHypotheses(hypothesis,vScores,countInliers);
+    if(bestIt<0)
+    {
+        score = 0.0;
+        vbMatchesInliers = vector<bool>(N,false);
+        return;
     }
+
+    score = vScores[bestIt];
+    F21 = Converter::toCvMat(Eigen::Matrix3d(vF21[bestIt].cast<double>()));
 }
 
 // |x'|     | h1 h2 h3 ||x|
@@ -306,57 +354,39 @@ void Initializer::FindFundamental(vector<bool> &vbMatchesInliers, float &score,
 /**
  * @brief 从特征点匹配求homography（normalized DLT）
  *
- * @param  vP1 归一化后的点, in reference frame
- * @param  vP2 归一化后的点, in current frame
+ * @param  P1 归一化后的点, in reference frame
+ * @param  P2 归一化后的点, in current frame
  * @return     单应矩阵
  * @see        Multiple View Geometry in Computer Vision - Algorithm 4.2 p109
  */
 //SVD分解求H21矩阵
-cv::Mat Initializer::ComputeH21(const vector<cv::Point2f> &vP1, const vector<cv::Point2f> &vP2)
+Eigen::Matrix3f Initializer::ComputeH21(const Eigen::Matrix<float,8,2> &P1, const Eigen::Matrix<float,8,2> &P2)
 {
-    const int N = vP1.size();
-
-    cv::Mat A(2*N,9,CV_32F);
+    Eigen::Matrix<float,16,9> A;
 
     //虽然书上说最少用4个点对就可以解出单应矩阵，但是这里依然用的是8个点对
-    for(int i=0; i<N; i++)
+    for(int i=0; i<8; i++)
     {
         //构造A矩阵
-        const float u1 = vP1[i].x;
-        const float v1 = vP1[i].y;
-        const float u2 = vP2[i].x;
-        const float v2 = vP2[i].y;
-
-        A.at<float>(2*i,0) = 0.0;
-        A.at<float>(2*i,1) = 0.0;
-        A.at<float>(2*i,2) = 0.0;
-        A.at<float>(2*i,3) = -u1;
-        A.at<float>(2*i,4) = -v1;
-        A.at<float>(2*i,5) = -1;
-        A.at<float>(2*i,6) = v2*u1;
-        A.at<float>(2*i,7) = v2*v1;
-        A.at<float>(2*i,8) = v2;
-
-        A.at<float>(2*i+1,0) = u1;
-        A.at<float>(2*i+1,1) = v1;
-        A.at<float>(2*i+1,2) = 1;
-        A.at<float>(2*i+1,3) = 0.0;
-        A.at<float>(2*i+1,4) = 0.0;
-        A.at<float>(2*i+1,5) = 0.0;
-        A.at<float>(2*i+1,6) = -u2*u1;
-        A.at<float>(2*i+1,7) = -u2*v1;
-        A.at<float>(2*i+1,8) = -u2;
+        const float u1 = P1(i,0);
+        const float v1 = P1(i,1);
+        const float u2 = P2(i,0);
+        const float v2 = P2(i,1);
 
+        A.row(2*i) << 0.0, 0.0, 0.0, -u1, -v1, -1, v2*u1, v2*v1, v2;
+        A.row(2*i+1) << u1, v1, 1, 0.0, 0.0, 0.0, -u2*u1, -u2*v1, -u2;
     }
 
-    cv::Mat u,w,vt;
-
-    //SVD分解A=u*w*vt
-    cv::SVDecomp(A,w,u,vt,cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
+    //SVD分解A=u*w*vt，取最小奇异值对应的右奇异向量(9维)
+    Eigen::JacobiSVD<Eigen::Matrix<float,16,9> > svd(A,Eigen::ComputeFullV);
+    const Eigen::Matrix<float,9,1> h = svd.matrixV().col(8);
 
-    //返回了vt最后一个行向量 9维的向量
     //reshape成3x3
-    return vt.row(8).reshape(0, 3);
+    Eigen::Matrix3f H;
+    H << h(0), h(1), h(2),
+         h(3), h(4), h(5),
+         h(6), h(7), h(8);
+    return H;
 }
 
 // x'Fx = 0 整理可得：Af = 0
@@ -365,93 +395,79 @@ cv::Mat Initializer::ComputeH21(const vector<cv::Point2f> &vP1, const vector<cv:
 
 /**
  * @brief 从特征点匹配求fundamental matrix（normalized 8点法）
- * @param  vP1 归一化后的点, in reference frame
- * @param  vP2 归一化后的点, in current frame
+ * @param  P1 归一化后的点, in reference frame
+ * @param  P2 归一化后的点, in current frame
  * @return     基础矩阵
  * @see        Multiple View Geometry in Computer Vision - Algorithm 11.1 p282 (中文版 p191)
  */
 //8点法求基础矩阵F,并根据约束进行调整F
-cv::Mat Initializer::ComputeF21(const vector<cv::Point2f> &vP1,const vector<cv::Point2f> &vP2)
+Eigen::Matrix3f Initializer::ComputeF21(const Eigen::Matrix<float,8,2> &P1, const Eigen::Matrix<float,8,2> &P2)
 {
-    const int N = vP1.size();
-
-    cv::Mat A(N,9,CV_32F);
+    Eigen::Matrix<float,8,9> A;
 
     //八点法计算F
 
     //经过线性变换 DLT
     //构造矩阵A=u2^T F
-    for(int i=0; i<N; i++)
+    for(int i=0; i<8; i++)
     {
-        const float u1 = vP1[i].x;
-        const float v1 = vP1[i].y;
-        const float u2 = vP2[i].x;
-        const float v2 = vP2[i].y;
-
-        A.at<float>(i,0) = u2*u1;
-        A.at<float>(i,1) = u2*v1;
-        A.at<float>(i,2) = u2;
-        A.at<float>(i,3) = v2*u1;
-        A.at<float>(i,4) = v2*v1;
-        A.at<float>(i,5) = v2;
-        A.at<float>(i,6) = u1;
-        A.at<float>(i,7) = v1;
-        A.at<float>(i,8) = 1;
-    }
-
-    cv::Mat u,w,vt;
+        const float u1 = P1(i,0);
+        const float v1 = P1(i,1);
+        const float u2 = P2(i,0);
+        const float v2 = P2(i,1);
 
-    cv::SVDecomp(A,w,u,vt,cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
+        A.row(i) << u2*u1, u2*v1, u2, v2*u1, v2*v1, v2, u1, v1, 1;
+    }
 
     //用SVD算出基础矩阵
-    //vt [8x8] : 由特征向量组成的矩阵, 每个特征向量都是9维的
-    //vt.row(8):矩阵A经过SVD分解之后最小奇异值对应的特征向量9 维
+    //A只有8行，需要完整的V才能得到零空间的向量
+    //V.col(8):矩阵A经过SVD分解之后最小奇异值对应的特征向量9 维
     //重新reshape成3x3矩阵,得到基础矩阵F
-    cv::Mat Fpre = vt.row(8).reshape(0, 3);
+    Eigen::JacobiSVD<Eigen::Matrix<float,8,9> > svd(A,Eigen::ComputeFullV);
+    const Eigen::Matrix<float,9,1> f = svd.matrixV().col(8);
+
+    Eigen::Matrix3f Fpre;
+    Fpre << f(0), f(1), f(2),
+            f(3), f(4), f(5),
+            f(6), f(7), f(8);
 
     ///下面进行对基础矩阵F进行约束调整
     //将基础矩阵svd分解
-    cv::SVDecomp(Fpre,w,u,vt,cv::SVD::MODIFY_A | cv::SVD::FULL_UV);
+    Eigen::JacobiSVD<Eigen::Matrix3f> svdF(Fpre,Eigen::ComputeFullU|Eigen::ComputeFullV);
 
     //根据基础矩阵的性质分解出来的w第三个元素应该为0
-    w.at<float>(2)=0;
+    Eigen::Vector3f w = svdF.singularValues();
+    w(2) = 0;
 
     //返回复合要求的基础矩阵
-    return  u*cv::Mat::diag(w)*vt;
+    return svdF.matrixU()*w.asDiagonal()*svdF.matrixV().transpose();
 }
 
+// 每次计算误差的匹配点数量，块内的循环没有分支，可以被编译器向量化
+static const int SCORE_BLOCK = 64;
+
 //通过单应矩阵H21以及H21_inv 反投影,计算误差,得到当前单应矩阵H的分数
-float Initializer::CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vector<bool> &vbMatchesInliers, float sigma)
+float Initializer::CheckHomography(const Eigen::Matrix3f &H21, const Eigen::Matrix3f &H12, vector<bool> *pvbMatchesInliers,
+                                   float sigma, float minScore)
 {   
     const int N = mvMatches12.size();
 
     // |h11 h12 h13|
     // |h21 h22 h23|
     // |h31 h32 h33|
-    const float h11 = H21.at<float>(0,0);
-    const float h12 = H21.at<float>(0,1);
-    const float h13 = H21.at<float>(0,2);
-    const float h21 = H21.at<float>(1,0);
-    const float h22 = H21.at<float>(1,1);
-    const float h23 = H21.at<float>(1,2);
-    const float h31 = H21.at<float>(2,0);
-    const float h32 = H21.at<float>(2,1);
-    const float h33 = H21.at<float>(2,2);
+    const float h11 = H21(0,0), h12 = H21(0,1), h13 = H21(0,2);
+    const float h21 = H21(1,0), h22 = H21(1,1), h23 = H21(1,2);
+    const float h31 = H21(2,0), h32 = H21(2,1), h33 = H21(2,2);
 
     // |h11inv h12inv h13inv|
     // |h21inv h22inv h23inv|
     // |h31inv h32inv h33inv|
-    const float h11inv = H12.at<float>(0,0);
-    const float h12inv = H12.at<float>(0,1);
-    const float h13inv = H12.at<float>(0,2);
-    const float h21inv = H12.at<float>(1,0);
-    const float h22inv = H12.at<float>(1,1);
-    const float h23inv = H12.at<float>(1,2);
-    const float h31inv = H12.at<float>(2,0);
-    const float h32inv = H12.at<float>(2,1);
-    const float h33inv = H12.at<float>(2,2);
-
-    vbMatchesInliers.resize(N);
+    const float h11inv = H12(0,0), h12inv = H12(0,1), h13inv = H12(0,2);
+    const float h21inv = H12(1,0), h22inv = H12(1,1), h23inv = H12(1,2);
+    const float h31inv = H12(2,0), h32inv = H12(2,1), h33inv = H12(2,2);
+
+    if(pvbMatchesInliers)
+        pvbMatchesInliers->resize(N);
 
     float score = 0;
 
@@ -462,93 +478,85 @@ float Initializer::CheckHomography(const cv::Mat &H21, const cv::Mat &H12, vecto
     //信息矩阵，方差平方的倒数
     const float invSigmaSquare = 1.0/(sigma*sigma);
 
-    //遍历所有的匹配点
-    for(int i=0; i<N; i++)
-    {
-        bool bIn = true;
-
-        const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-        const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
-
-        const float u1 = kp1.pt.x;
-        const float v1 = kp1.pt.y;
-        const float u2 = kp2.pt.x;
-        const float v2 = kp2.pt.y;
-
-        // H约束: 点与点之间的约束
-
-        // Reprojection error in first image
-        // x2=[u2,v2,1]^T  x1=[u1,v1,1]^T
-        // 这里的 H_21_inv = [h11_inv h12_inv h12_inv
-        //                   h21_inv h22_inv h23_inv
-        //                   h31_inv h32_inv h33_inv ]
-        // H模型: 原模型: x2 = \hat{H_21} * x1
-        // 逆模型(左乘\hat{H_21}): H_21^{-1} * x2 = x1
-        // 逆模型就是将第2帧的特征点利用H21_inv矩阵反投影到第一帧
-        // 理解的时候,可以结合<视觉SLAM14讲-第二版 P171 公式7.20>来看
-        const float w2in1inv = 1.0/(h31inv*u2+h32inv*v2+h33inv);    //把H矩阵第3行的约束嵌入到第一第二行中,相当于归一化?
-        const float u2in1 = (h11inv*u2+h12inv*v2+h13inv)*w2in1inv;  //
-        const float v2in1 = (h21inv*u2+h22inv*v2+h23inv)*w2in1inv;
-
-        //计算u2，v2投影到F1后与u1,v1的距离的平方，也就是重投影误差
-        //H模型几何距离,使用对称转移误差,见<计算机视觉中的多视图几何> P58 公式3.7
-        const float squareDist1 = (u1-u2in1)*(u1-u2in1)+(v1-v2in1)*(v1-v2in1);
-
-        // 根据方差归一化误差
-        const float chiSquare1 = squareDist1*invSigmaSquare;
-
-        //chiSquare1>th说明匹配的点对F1投影到F2，重投影失败
-        if(chiSquare1>th)
-            bIn = false;
-        else
-            score += th - chiSquare1;
+    // 剩余点的得分上界留一点余量，避免浮点误差放弃掉得分相同的假设
+    const float minBound = minScore*(1.0f-1e-4f);
 
-        // Reprojection error in second image
-        // x1in2 = H21*x1
+    const float* pU1 = &mvU1[0];
+    const float* pV1 = &mvV1[0];
+    const float* pU2 = &mvU2[0];
+    const float* pV2 = &mvV2[0];
 
-        // H模型: 原模型: x2 = \hat{H_21} * x1
-        // 步骤基本同上
-        // 将图像1中的特征点单应到图像2中
-        const float w1in2inv = 1.0/(h31*u1+h32*v1+h33);
-        const float u1in2 = (h11*u1+h12*v1+h13)*w1in2inv;
-        const float v1in2 = (h21*u1+h22*v1+h23)*w1in2inv;
-	
-        const float squareDist2 = (u2-u1in2)*(u2-u1in2)+(v2-v1in2)*(v2-v1in2);
+    float vScore1[SCORE_BLOCK], vScore2[SCORE_BLOCK];
+    unsigned char vbIn[SCORE_BLOCK];
 
-        const float chiSquare2 = squareDist2*invSigmaSquare;
+    for(int i0=0; i0<N; i0+=SCORE_BLOCK)
+    {
+        const int n = min(SCORE_BLOCK,N-i0);
 
-        if(chiSquare2>th)
-            bIn = false;
-        else
-            score += th - chiSquare2;
+        for(int j=0; j<n; j++)
+        {
+            const float u1 = pU1[i0+j];
+            const float v1 = pV1[i0+j];
+            const float u2 = pU2[i0+j];
+            const float v2 = pV2[i0+j];
+
+            // Reprojection error in first image
+            // 将第2帧的特征点利用H21_inv矩阵反投影到第一帧
+            const float w2in1inv = 1.0f/(h31inv*u2+h32inv*v2+h33inv);
+            const float u2in1 = (h11inv*u2+h12inv*v2+h13inv)*w2in1inv;
+            const float v2in1 = (h21inv*u2+h22inv*v2+h23inv)*w2in1inv;
+
+            //H模型几何距离,使用对称转移误差,见<计算机视觉中的多视图几何> P58 公式3.7
+            const float squareDist1 = (u1-u2in1)*(u1-u2in1)+(v1-v2in1)*(v1-v2in1);
+            const float chiSquare1 = squareDist1*invSigmaSquare;
+
+            // Reprojection error in second image
+            // 将图像1中的特征点单应到图像2中
+            const float w1in2inv = 1.0f/(h31*u1+h32*v1+h33);
+            const float u1in2 = (h11*u1+h12*v1+h13)*w1in2inv;
+            const float v1in2 = (h21*u1+h22*v1+h23)*w1in2inv;
+
+            const float squareDist2 = (u2-u1in2)*(u2-u1in2)+(v2-v1in2)*(v2-v1in2);
+            const float chiSquare2 = squareDist2*invSigmaSquare;
+
+            //chiSquare>th说明重投影失败，不计分
+            vScore1[j] = chiSquare1>th ? 0.0f : th-chiSquare1;
+            vScore2[j] = chiSquare2>th ? 0.0f : th-chiSquare2;
+            vbIn[j] = !(chiSquare1>th) && !(chiSquare2>th);
+        }
 
-	//bIn标志着此对匹配点是否重投影成功
-        if(bIn)
-            vbMatchesInliers[i]=true;
-        else
-            vbMatchesInliers[i]=false;
+        // 按匹配点的顺序累加，结果与逐点计算相同
+        for(int j=0; j<n; j++)
+        {
+            score += vScore1[j];
+            score += vScore2[j];
+        }
+
+        //bIn标志着此对匹配点是否重投影成功
+        if(pvbMatchesInliers)
+            for(int j=0; j<n; j++)
+                (*pvbMatchesInliers)[i0+j] = vbIn[j];
+
+        // 剩下的点每个最多得2*th分
+        if(score+2*th*(N-i0-n)<minBound)
+            return -1;
     }
 
     return score;
 }
 
 //利用基础矩阵F进行重投影,计算得分
-float Initializer::CheckFundamental(const cv::Mat &F21, vector<bool> &vbMatchesInliers, float sigma)
+float Initializer::CheckFundamental(const Eigen::Matrix3f &F21, vector<bool> *pvbMatchesInliers, float sigma, float minScore)
 {
     const int N = mvMatches12.size();
 
-    const float f11 = F21.at<float>(0,0);
-    const float f12 = F21.at<float>(0,1);
-    const float f13 = F21.at<float>(0,2);
-    const float f21 = F21.at<float>(1,0);
-    const float f22 = F21.at<float>(1,1);
-    const float f23 = F21.at<float>(1,2);
-    const float f31 = F21.at<float>(2,0);
-    const float f32 = F21.at<float>(2,1);
-    const float f33 = F21.at<float>(2,2);
+    const float f11 = F21(0,0), f12 = F21(0,1), f13 = F21(0,2);
+    const float f21 = F21(1,0), f22 = F21(1,1), f23 = F21(1,2);
+    const float f31 = F21(2,0), f32 = F21(2,1), f33 = F21(2,2);
 
-    //std::vector<bool> vbMatchesInliers是输出,输出哪些匹配点对是内点
-    vbMatchesInliers.resize(N);
+    //输出哪些匹配点对是内点
+    if(pvbMatchesInliers)
+        pvbMatchesInliers->resize(N);
 
     float score = 0;
 
@@ -557,79 +565,65 @@ float Initializer::CheckFundamental(const cv::Mat &F21, vector<bool> &vbMatchesI
 
     const float invSigmaSquare = 1.0/(sigma*sigma);
 
-    for(int i=0; i<N; i++)  //遍历每一个特征点对
-    {
-        bool bIn = true;
-
-        //mvMatches12[i]=pair(参考帧特征点idx,当前帧特征点idx) ,这两个特征点认为相互匹配, 现在取出来看是否真的匹配
-        const cv::KeyPoint &kp1 = mvKeys1[mvMatches12[i].first];
-        const cv::KeyPoint &kp2 = mvKeys2[mvMatches12[i].second];
-
-        const float u1 = kp1.pt.x;
-        const float v1 = kp1.pt.y;
-        const float u2 = kp2.pt.x;
-        const float v2 = kp2.pt.y;
-
-        /****************************************************
-         * 利用F重投影
-         * (0)由极线约束的示意图可知: 极线l'在图像平面上的法向量可以由
-         *    极线上的两点叉乘得到
-         * (1)根据公式l'=F*u ==> 极线法向量 l2=F21 * x1  ===>极线法向量(a,b,c)
-         * (2)于是可以得到极线点法式方程: a(X-u1)+b(Y-v1)+c=0
-         * (3)假设在第一帧的点 x1 =[u1,v1,1]^T
-         * (4)根据点到直线距离公式 dist= |a*u1+b*u2+c|/ sqrt(a^2+b^2)
-         ****************************************************/
-
-        ///1. 将第一帧的特征点重投影到第二帧,计算误差
-        // l2=F21x1=[a2,b2,c2]^T (3x1)列向量
-        // F= [ f11 f12 f13
-        //      f21 f22 f23
-        //      f31 f32 f33 ]
-        //
-        // f1=[f11 f12 f13] U1=[u1 v1 1]^T  ===> a2=f1*U1
-        // 这里计算得到极线向量l2=[a2,b2,c2]
-        const float a2 = f11*u1+f12*v1+f13;     // (Fu)_x
-        const float b2 = f21*u1+f22*v1+f23;     // (Fu)_y
-        const float c2 = f31*u1+f32*v1+f33;
-	
-        // 计算点x1到直线l2距离
-        const float num2 = a2*u2+b2*v2+c2;
-
-        // 距离的平方
-        const float squareDist1 = num2*num2/(a2*a2+b2*b2);
+    const float minBound = minScore*(1.0f-1e-4f);
 
-        const float chiSquare1 = squareDist1*invSigmaSquare;
-
-        //判断距离是否超过阈值,并计算得分,距离越大,得分越小
-        if(chiSquare1>th)
-            bIn = false;
-        else
-            score += thScore - chiSquare1;
+    const float* pU1 = &mvU1[0];
+    const float* pV1 = &mvV1[0];
+    const float* pU2 = &mvU2[0];
+    const float* pV2 = &mvV2[0];
 
+    float vScore1[SCORE_BLOCK], vScore2[SCORE_BLOCK];
+    unsigned char vbIn[SCORE_BLOCK];
 
-        ///2. 将第二帧的特征点重投影到第一帧,计算误差(思路基本同上,计算点到直线距离)
-        // l1 =x2tF21=[a1,b1,c1] (1x3) 行向量
-        const float a1 = f11*u2+f21*v2+f31;
-        const float b1 = f12*u2+f22*v2+f32;
-        const float c1 = f13*u2+f23*v2+f33;
-
-        const float num1 = a1*u1+b1*v1+c1;
-
-        const float squareDist2 = num1*num1/(a1*a1+b1*b1);
+    for(int i0=0; i0<N; i0+=SCORE_BLOCK)
+    {
+        const int n = min(SCORE_BLOCK,N-i0);
 
-        const float chiSquare2 = squareDist2*invSigmaSquare;
+        for(int j=0; j<n; j++)
+        {
+            const float u1 = pU1[i0+j];
+            const float v1 = pV1[i0+j];
+            const float u2 = pU2[i0+j];
+            const float v2 = pV2[i0+j];
+
+            ///1. 将第一帧的特征点重投影到第二帧,计算点到极线l2=F21x1=[a2,b2,c2]的距离
+            const float a2 = f11*u1+f12*v1+f13;
+            const float b2 = f21*u1+f22*v1+f23;
+            const float c2 = f31*u1+f32*v1+f33;
+
+            const float num2 = a2*u2+b2*v2+c2;
+            const float squareDist1 = num2*num2/(a2*a2+b2*b2);
+            const float chiSquare1 = squareDist1*invSigmaSquare;
+
+            ///2. 将第二帧的特征点重投影到第一帧,极线l1 =x2tF21=[a1,b1,c1]
+            const float a1 = f11*u2+f21*v2+f31;
+            const float b1 = f12*u2+f22*v2+f32;
+            const float c1 = f13*u2+f23*v2+f33;
+
+            const float num1 = a1*u1+b1*v1+c1;
+            const float squareDist2 = num1*num1/(a1*a1+b1*b1);
+            const float chiSquare2 = squareDist2*invSigmaSquare;
+
+            //判断距离是否超过阈值,并计算得分,距离越大,得分越小
+            vScore1[j] = chiSquare1>th ? 0.0f : thScore-chiSquare1;
+            vScore2[j] = chiSquare2>th ? 0.0f : thScore-chiSquare2;
+            vbIn[j] = !(chiSquare1>th) && !(chiSquare2>th);
+        }
 
-        //判断距离是否超过阈值,并计算得分,距离越大,得分越小
-        if(chiSquare2>th)
-            bIn = false;
-        else
-            score += thScore - chiSquare2;
+        for(int j=0; j<n; j++)
+        {
+            score += vScore1[j];
+            score += vScore2[j];
+        }
 
         //设置标志: 描述这对特征点是否是inlier
-        if(bIn)
-            vbMatchesInliers[i]=true;
-        else
-            vbMatchesInliers[i]=false;
+        if(pvbMatchesInliers)
+            for(int j=0; j<n; j++)
+                (*pvbMatchesInliers)[i0+j] = vbIn[j];
+
+        // 剩下的点每个最多得2*thScore分
+        if(score+2*thScore*(N-i0-n)<minBound)
+            return -1;
     }
 
     return score;
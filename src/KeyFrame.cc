@@ -28,8 +28,8 @@ namespace ORB_SLAM2
 
 long unsigned int KeyFrame::nNextId=0;
 
-KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
-    mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
+KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB, const int nAgentId):
+    mnFrameId(F.mnId), mnAgentId(nAgentId), mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
     mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
     mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
@@ -41,9 +41,13 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
     mnMaxY(F.mnMaxY), mK(F.mK), mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB),
     mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
-    mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap)
+    mbToBeErased(false), mbBad(false), mHalfBaseline(F.mb/2), mpMap(pMap),
+    mnCullingPoints(0), mnCullingRedundant(0), mnCullingClosePoints(0), mnCullingCloseRedundant(0)
 {
     mnId=nNextId++;
+    mnMapId=pMap->GetCurrentMapId(mnAgentId);
+    // 子地图的原点是spanning tree的根，没有父节点
+    mbFirstConnection = !IsMapOrigin();
 
     mGrid.resize(mnGridCols);
     for(int i=0; i<mnGridCols;i++)
@@ -98,6 +102,8 @@ void KeyFrame::SetPose(const cv::Mat &Tcw_)
     // center: 左目相机坐标系下的右目相机中心
     // Cw : 右目相机中心在世界坐标系的表示
     Cw = Twc*center;
+
+    mpMap->NotifyKeyFrameChanged(this,Map::CHANGE_MODIFIED);
 }
 
 cv::Mat KeyFrame::GetPose()
@@ -189,6 +195,8 @@ void KeyFrame::UpdateBestCovisibles()
     // 权重从大到小
     mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
     mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());    
+
+    mpMap->NotifyKeyFrameChanged(this,Map::CHANGE_MODIFIED);
 }
 
 /**
@@ -267,29 +275,35 @@ int KeyFrame::GetWeight(KeyFrame *pKF)
         return 0;
 }
 
+// 以下按特征点序号访问mvpMapPoints的函数都检查序号：关键帧被回收后mvpMapPoints为空
 void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    mvpMapPoints[idx]=pMP;
+    if(idx<mvpMapPoints.size())
+        mvpMapPoints[idx]=pMP;
 }
 
 void KeyFrame::EraseMapPointMatch(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+    if(idx<mvpMapPoints.size())
+        mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
 }
 
 void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
 {
     int idx = pMP->GetIndexInKeyFrame(this);
-    if(idx>=0)
+    unique_lock<mutex> lock(mMutexFeatures);
+    if(idx>=0 && (size_t)idx<mvpMapPoints.size())
         mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
 }
 
 
 void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP)
 {
-    mvpMapPoints[idx]=pMP;
+    unique_lock<mutex> lock(mMutexFeatures);
+    if(idx<mvpMapPoints.size())
+        mvpMapPoints[idx]=pMP;
 }
 
 set<MapPoint*> KeyFrame::GetMapPoints()
@@ -321,7 +335,8 @@ int KeyFrame::TrackedMapPoints(const int &minObs)
     int nPoints=0;
     // minObs>=0 表示检查mappoint是否被观测到
     const bool bCheckObs = minObs>0;
-    for(int i=0; i<N; i++)
+    // 数据被释放后mvpMapPoints为空，所以不用N
+    for(size_t i=0, iend=mvpMapPoints.size(); i<iend; i++)
     {
         MapPoint* pMP = mvpMapPoints[i];    //遍历可以观测到的mappoint
         if(pMP)
@@ -352,6 +367,8 @@ vector<MapPoint*> KeyFrame::GetMapPointMatches()
 MapPoint* KeyFrame::GetMapPoint(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
+    if(idx>=mvpMapPoints.size())
+        return static_cast<MapPoint*>(NULL);
     return mvpMapPoints[idx];
 }
 
@@ -478,8 +495,8 @@ void KeyFrame::UpdateConnections()
         mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
         mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
 
-        //如果不是第一个关键帧，且此节点没有父节点
-        if(mbFirstConnection && mnId!=0)
+        //如果不是子地图的第一个关键帧，且此节点没有父节点
+        if(mbFirstConnection)
         {
             //这些在回环LoopClosing中用到
             //共视程度最高的那个关键帧设置为此节点在Spanning Tree中的父节点
@@ -490,6 +507,8 @@ void KeyFrame::UpdateConnections()
         }
 
     }
+
+    mpMap->NotifyKeyFrameChanged(this,Map::CHANGE_MODIFIED);
 }
 
 void KeyFrame::AddChild(KeyFrame *pKF)
@@ -509,6 +528,7 @@ void KeyFrame::ChangeParent(KeyFrame *pKF)
     unique_lock<mutex> lockCon(mMutexConnections);
     mpParent = pKF;
     pKF->AddChild(this);
+    mpMap->NotifyKeyFrameChanged(this,Map::CHANGE_MODIFIED);
 }
 
 set<KeyFrame*> KeyFrame::GetChilds()
@@ -529,11 +549,30 @@ bool KeyFrame::hasChild(KeyFrame *pKF)
     return mspChildrens.count(pKF);
 }
 
+long unsigned int KeyFrame::GetMapId()
+{
+    unique_lock<mutex> lock(mMutexMapId);
+    return mnMapId;
+}
+
+void KeyFrame::SetMapId(const long unsigned int nMapId)
+{
+    unique_lock<mutex> lock(mMutexMapId);
+    mnMapId = nMapId;
+}
+
+bool KeyFrame::IsMapOrigin()
+{
+    unique_lock<mutex> lock(mMutexMapId);
+    return mnId==mnMapId;
+}
+
 void KeyFrame::AddLoopEdge(KeyFrame *pKF)
 {
     unique_lock<mutex> lockCon(mMutexConnections);
     mbNotErase = true;
     mspLoopEdges.insert(pKF);
+    mpMap->NotifyKeyFrameChanged(this,Map::CHANGE_MODIFIED);
 }
 
 set<KeyFrame*> KeyFrame::GetLoopEdges()
@@ -566,15 +605,26 @@ void KeyFrame::SetErase()
 
 void KeyFrame::SetBadFlag()
 {   
+    // 子地图的原点是spanning tree的根，不删除
+    if(IsMapOrigin())
+        return;
+
+    // 从来没有共视关键帧的关键帧没有父关键帧，删除时挂到所在子地图的原点下，保证spanning tree上有到根的路径
+    KeyFrame* pOrigin = mpMap->GetKeyFrame(GetMapId());
+
     {
         unique_lock<mutex> lock(mMutexConnections);
-        if(mnId==0)
-            return;
-        else if(mbNotErase) //有可能在回环中被设置mbNotErase，作为回环的候选关键帧
+        if(mbNotErase) //有可能在回环中被设置mbNotErase，作为回环的候选关键帧
         {
             mbToBeErased = true;
             return;
         }
+        else if(!mpParent)
+        {
+            if(!pOrigin || pOrigin==this)
+                return;
+            mpParent = pOrigin;
+        }
     }
 
     // 让其它的KeyFrame删除与自己的联系
@@ -673,8 +723,9 @@ void KeyFrame::SetBadFlag()
     }
 
 
-    mpMap->EraseKeyFrame(this);
+    // 先从关键帧数据库中删除，从地图中删除(开始计算回收的删除序号)之后其它线程不会再查询到这个关键帧
     mpKeyFrameDB->erase(this);
+    mpMap->EraseKeyFrame(this);
 }
 
 bool KeyFrame::isBad()
@@ -683,6 +734,52 @@ bool KeyFrame::isBad()
     return mbBad;
 }
 
+void KeyFrame::ReleaseData()
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+
+    // swap保证vector的内存真正归还
+    vector<cv::KeyPoint>().swap(mvKeys);
+    vector<cv::KeyPoint>().swap(mvKeysUn);
+    vector<float>().swap(mvuRight);
+    vector<float>().swap(mvDepth);
+    mDescriptors.release();
+
+    mBowVec.clear();
+    mFeatVec.clear();
+
+    vector< vector <vector<size_t> > >().swap(mGrid);
+    vector<MapPoint*>().swap(mvpMapPoints);
+    N = 0;
+}
+
+void KeyFrame::UpdateCullingCounters(const bool bClose, const int nDeltaPoints, const int nDeltaRedundant)
+{
+    unique_lock<mutex> lock(mMutexCulling);
+    mnCullingPoints += nDeltaPoints;
+    mnCullingRedundant += nDeltaRedundant;
+    if(bClose)
+    {
+        mnCullingClosePoints += nDeltaPoints;
+        mnCullingCloseRedundant += nDeltaRedundant;
+    }
+}
+
+void KeyFrame::GetCullingCounters(const bool bOnlyClose, int &nPoints, int &nRedundant)
+{
+    unique_lock<mutex> lock(mMutexCulling);
+    if(bOnlyClose)
+    {
+        nPoints = mnCullingClosePoints;
+        nRedundant = mnCullingCloseRedundant;
+    }
+    else
+    {
+        nPoints = mnCullingPoints;
+        nRedundant = mnCullingRedundant;
+    }
+}
+
 void KeyFrame::EraseConnection(KeyFrame* pKF)
 {
     bool bUpdate = false;
@@ -708,6 +805,9 @@ void KeyFrame::EraseConnection(KeyFrame* pKF)
 vector<size_t> KeyFrame::GetFeaturesInArea(const float &x, const float &y, const float &r) const
 {
     vector<size_t> vIndices;
+    // 关键帧已被回收
+    if(mGrid.empty())
+        return vIndices;
     vIndices.reserve(N);
 
     const int nMinCellX = max(0,(int)floor((x-mnMinX-r)*mfGridElementWidthInv));
@@ -799,11 +899,11 @@ float KeyFrame::ComputeSceneMedianDepth(const int q)
     cv::Mat Rcw2 = Tcw_.row(2).colRange(0,3);
     Rcw2 = Rcw2.t();
     float zcw = Tcw_.at<float>(2,3);
-    for(int i=0; i<N; i++)  //N：特征点数量
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)  //N：特征点数量
     {
-        if(mvpMapPoints[i]) //特征点有对应的mappoint才进行计算
+        if(vpMapPoints[i]) //特征点有对应的mappoint才进行计算
         {
-            MapPoint* pMP = mvpMapPoints[i];
+            MapPoint* pMP = vpMapPoints[i];
             cv::Mat x3Dw = pMP->GetWorldPos();  //取对应mappoint的世界坐标
             //这里为了节约计算资源并没有计算整个重投影计算
             //mappoint转换到相机坐标系下
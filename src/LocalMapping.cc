@@ -22,15 +22,22 @@
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
+#include "Converter.h"
 
 #include<mutex>
+#include<algorithm>
+#include<chrono>
 
 namespace ORB_SLAM2
 {
 
 LocalMapping::LocalMapping(Map *pMap, const float bMonocular):
     mbMonocular(bMonocular), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
+    mnLastAgentId(0), mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
+    mThreadPool(std::min(4,(int)std::thread::hardware_concurrency())), mnCullingCursor(0), mnCullingBudget(20),
+    mnMaxKeyFrames(0), mnMaxMapPoints(0), mnMaxMemoryBytes(0), mbReclaimErased(true),
+    mnReclaimSlot(pMap->RegisterReclaimThread()),
+    mnEvictedKeyFrames(0), mnEvictedMapPoints(0), mnDeletedMapPoints(0), mnReleasedKeyFrames(0)
 {
 }
 
@@ -44,6 +51,27 @@ void LocalMapping::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LocalMapping::SetMapBudget(const int nMaxKeyFrames, const int nMaxMapPoints, const size_t nMaxMemoryBytes)
+{
+    mnMaxKeyFrames = nMaxKeyFrames>0 ? nMaxKeyFrames : 0;
+    mnMaxMapPoints = nMaxMapPoints>0 ? nMaxMapPoints : 0;
+    mnMaxMemoryBytes = nMaxMemoryBytes;
+}
+
+void LocalMapping::SetReclaimErased(const bool bReclaim)
+{
+    mbReclaimErased = bReclaim;
+}
+
+// 返回tLast到现在经过的时间(秒)，并把tLast更新为现在
+static double ElapsedSeconds(chrono::steady_clock::time_point &tLast)
+{
+    const chrono::steady_clock::time_point tNow = chrono::steady_clock::now();
+    const double t = chrono::duration_cast<chrono::duration<double> >(tNow-tLast).count();
+    tLast = tNow;
+    return t;
+}
+
 void LocalMapping::Run()
 {
 
@@ -61,6 +89,10 @@ void LocalMapping::Run()
         // 检查mlNewKeyFrames是否为空，也就是查询等待处理的关键帧列表是否空
         if(CheckNewKeyFrames())
         {
+            KeyFrameTimes times = KeyFrameTimes();
+            const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+            chrono::steady_clock::time_point tStage = tStart;
+
             // BoW conversion and insertion in Map
             // 计算关键帧特征点的BoW映射，将关键帧插入地图
             ProcessNewKeyFrame();
@@ -68,6 +100,7 @@ void LocalMapping::Run()
             // Check recent MapPoints
             // 剔除ProcessNewKeyFrame函数中引入的不合格MapPoints
             MapPointCulling();
+            times.tProcess = ElapsedSeconds(tStage);
 
             // Triangulate new MapPoints
 
@@ -80,6 +113,7 @@ void LocalMapping::Run()
             */
             // 相机运动过程中与相邻关键帧通过三角化恢复出一些MapPoints
             CreateNewMapPoints();
+            times.tTriangulate = ElapsedSeconds(tStage);
 
             //如果已经处理完队列中的最后的一个关键帧
             if(!CheckNewKeyFrames())    //如果还有关键帧 CheckNewKeyFrames()=true
@@ -89,16 +123,19 @@ void LocalMapping::Run()
                 // 检查并融合当前关键帧与相邻帧（两级相邻）重复的MapPoints
                 SearchInNeighbors();
             }
+            times.tFuse = ElapsedSeconds(tStage);
 
             mbAbortBA = false;
 
             // 已经处理完队列中的最后的一个关键帧，并且闭环检测此时没有请求停止LocalMapping或者是在正常SLAM模式而不是在纯跟踪定位模式
             // 有空就来次local BA
-            if(!CheckNewKeyFrames() && !stopRequested())
+            // 全局BA的结果或闭环修正正在分批合并时，地图一部分已修正一部分未修正，跳过局部BA和关键帧剔除
+            if(!CheckNewKeyFrames() && !stopRequested() && !mpLoopCloser->isMergingGBA() && !mpLoopCloser->isMergingLoop())
             {
                 // Local BA
                 if(mpMap->KeyFramesInMap()>2)
                     Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap);
+                times.tLocalBA = ElapsedSeconds(tStage);
 
                 // Check redundant local Keyframes
                 // 检测并剔除当前帧相邻的关键帧中冗余的关键帧
@@ -108,17 +145,30 @@ void LocalMapping::Run()
                 // 并且在Tracking中InsertKeyFrame函数的条件比较松，交给LocalMapping线程的关键帧会比较密
                 // 在这里再删除冗余的关键帧
                 KeyFrameCulling();
+
+
+                // 长时间运行时限制地图大小，并回收之前删除的对象
+                EnforceMapBudget();
+                ReclaimErasedObjects();
+                times.tCulling = ElapsedSeconds(tStage);
             }
             // 将当前帧加入到闭环检测关键帧队列中
             mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
+
+            times.tTotal = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-tStart).count();
+            {
+                unique_lock<mutex> lock(mMutexTimes);
+                mvKeyFrameTimes.push_back(times);
+            }
         }
         else if(Stop())
         {
             // Safe area to stop
-            //
-            while(isStopped() && !CheckFinish())
+            // 阻塞直到Release()或RequestFinish()
             {
-                usleep(3000);
+                unique_lock<mutex> lock(mMutexWake);
+                while(isStopped() && !CheckFinish())
+                    mCondWake.wait(lock);
             }
             if(CheckFinish())
                 break;
@@ -133,7 +183,12 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        usleep(3000);
+        // 队列中没有关键帧时，在整个地图中按预算检查一部分关键帧，不增加关键帧的处理时间
+        if(!CheckNewKeyFrames() && !stopRequested() && !mpLoopCloser->isMergingGBA() && !mpLoopCloser->isMergingLoop())
+            MapKeyFrameCulling();
+
+        // 没有新的关键帧和请求时阻塞，不占用CPU
+        WaitForWork();
     }
     //设置完成标志位,停止标志位
     SetFinish();
@@ -148,9 +203,12 @@ void LocalMapping::Run()
  */
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexNewKFs);
-    mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mlNewKeyFrames.push_back(pKF);
+        mbAbortBA=true;
+    }
+    WakeUp();
 }
 
 
@@ -160,6 +218,22 @@ bool LocalMapping::CheckNewKeyFrames()
     return(!mlNewKeyFrames.empty());
 }
 
+int LocalMapping::KeyframesInQueue(const int nAgentId)
+{
+    unique_lock<mutex> lock(mMutexNewKFs);
+    int n = 0;
+    for(list<KeyFrame*>::iterator lit=mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+        if((*lit)->mnAgentId==nAgentId)
+            n++;
+    return n;
+}
+
+vector<KeyFrame*> LocalMapping::GetNewKeyFrames()
+{
+    unique_lock<mutex> lock(mMutexNewKFs);
+    return vector<KeyFrame*>(mlNewKeyFrames.begin(),mlNewKeyFrames.end());
+}
+
 /**
  * @brief 处理列表中的关键帧
  *
@@ -172,10 +246,26 @@ void LocalMapping::ProcessNewKeyFrame()
 {
     // 步骤1：从缓冲队列中取出一帧关键帧
     // Tracking线程向LocalMapping中插入关键帧存在该队列中
+    // 多相机时在各相机之间轮流取：取相机序号大于上一个的最小序号的相机，没有则从最小序号重新开始
+    // 同一个相机的关键帧按插入顺序处理，只有一个相机时就是队首
     {
         unique_lock<mutex> lock(mMutexNewKFs);
-        mpCurrentKeyFrame = mlNewKeyFrames.front();
-        mlNewKeyFrames.pop_front();
+        list<KeyFrame*>::iterator litNext = mlNewKeyFrames.end();
+        list<KeyFrame*>::iterator litFirst = mlNewKeyFrames.end();
+        for(list<KeyFrame*>::iterator lit=mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+        {
+            const int nAgentId = (*lit)->mnAgentId;
+            if(nAgentId>mnLastAgentId && (litNext==lend || nAgentId<(*litNext)->mnAgentId))
+                litNext = lit;
+            if(litFirst==lend || nAgentId<(*litFirst)->mnAgentId)
+                litFirst = lit;
+        }
+        if(litNext==mlNewKeyFrames.end())
+            litNext = litFirst;
+
+        mpCurrentKeyFrame = *litNext;
+        mlNewKeyFrames.erase(litNext);
+        mnLastAgentId = mpCurrentKeyFrame->mnAgentId;
     }
 
     // 步骤2：计算该关键帧特征点的Bow映射关系
@@ -290,270 +380,295 @@ void LocalMapping::CreateNewMapPoints()
     // 单目取前20帧，双目取前10帧
     const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
 
-    ORBmatcher matcher(0.6,false);
-
-    //当前关键帧在世界坐标系下的位姿
-    cv::Mat Rcw1 = mpCurrentKeyFrame->GetRotation();
-    cv::Mat Rwc1 = Rcw1.t();
-    cv::Mat tcw1 = mpCurrentKeyFrame->GetTranslation();
-    cv::Mat Tcw1(3,4,CV_32F);   //转成3x4矩阵
-    Rcw1.copyTo(Tcw1.colRange(0,3));
-    tcw1.copyTo(Tcw1.col(3));
-    // 得到当前关键帧光心在世界坐标系中的坐标
-    cv::Mat Ow1 = mpCurrentKeyFrame->GetCameraCenter();
-
-    const float &fx1 = mpCurrentKeyFrame->fx;
-    const float &fy1 = mpCurrentKeyFrame->fy;
-    const float &cx1 = mpCurrentKeyFrame->cx;
-    const float &cy1 = mpCurrentKeyFrame->cy;
-    const float &invfx1 = mpCurrentKeyFrame->invfx;
-    const float &invfy1 = mpCurrentKeyFrame->invfy;
-
-    const float ratioFactor = 1.5f*mpCurrentKeyFrame->mfScaleFactor;
+    // 步骤2：并行地与每个相邻关键帧做极线搜索和三角化
+    // 这一步只读取关键帧数据，不修改地图，结果按相邻关键帧分别存放
+    vector<vector<TriangulatedPoint> > vvTriangulated(vpNeighKFs.size());
+    mThreadPool.ParallelFor(vpNeighKFs.size(), [&](int i)
+    {
+        if(i>0 && CheckNewKeyFrames())
+            return;
+        TriangulateWithNeighbor(vpNeighKFs[i],vvTriangulated[i]);
+    });
 
     int nnew=0;
 
-    // Search matches with epipolar restriction and triangulate
-    // 步骤2：遍历相邻关键帧vpNeighKFs
+    // 步骤3：按相邻关键帧的顺序串行地生成MapPoints
+    // 不同的相邻关键帧可能三角化了当前关键帧的同一个特征点，先生成的占用该特征点，后面的跳过。
+    // 注意这与原来的串行结果并不完全相同：串行时已经生成MapPoint的特征点不再参与后面相邻帧的匹配，
+    // 后面的相邻帧可能因此匹配到别的特征点；并行搜索时这些匹配被直接丢弃，新生成的点可能略少
     for(size_t i=0; i<vpNeighKFs.size(); i++)
     {
         if(i>0 && CheckNewKeyFrames())
             return;
 
-        // 取相邻关键帧pKF2
         KeyFrame* pKF2 = vpNeighKFs[i];
+        const vector<TriangulatedPoint> &vTriangulated = vvTriangulated[i];
 
-        // Check first that baseline is not too short
-        // 邻接的关键帧相机光心在世界坐标系中的坐标
-        cv::Mat Ow2 = pKF2->GetCameraCenter();
-        // 基线向量，
-        cv::Mat vBaseline = Ow2-Ow1;
-        // 基线长度，基线长度
-        const float baseline = cv::norm(vBaseline);
-
-        // 判断相机运动的基线是不是足够长
-        if(!mbMonocular)
-        {
-            //双目或RGBD
-            //关键帧间距太小时不生成3D点
-            if(baseline<pKF2->mb)
-            continue;
-        }
-        else
+        for(size_t ip=0; ip<vTriangulated.size(); ip++)
         {
-            //单目
-            // 邻接关键帧的场景深度中值
-            const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
-            // baseline与景深的比例
-            const float ratioBaselineDepth = baseline/medianDepthKF2;
-	  
-            // 如果特别远(比例特别小)，那么不考虑当前邻接的关键帧，不生成3D点
-            if(ratioBaselineDepth<0.01)
+            const int &idx1 = vTriangulated[ip].idx1;
+            const int &idx2 = vTriangulated[ip].idx2;
+
+            if(mpCurrentKeyFrame->GetMapPoint(idx1) || pKF2->GetMapPoint(idx2))
                 continue;
-        }
 
-        // Compute Fundamental Matrix
-        // 根据两个关键帧的位姿计算它们之间的基本矩阵
-        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
-
-        // Search matches that fullfil epipolar constraint
-        // 通过极线约束限制匹配时的搜索范围，进行特征点匹配
-        vector<pair<size_t,size_t> > vMatchedIndices;
-        // 匹配pKF1与pKF2之间未被匹配的特征点并通过bow加速，并校验是否符合对级约束。vMatchedPairs匹配成功的特征点在各自关键帧中的id。
-        matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);
-
-        cv::Mat Rcw2 = pKF2->GetRotation();
-        cv::Mat Rwc2 = Rcw2.t();
-        cv::Mat tcw2 = pKF2->GetTranslation();
-        cv::Mat Tcw2(3,4,CV_32F);
-        Rcw2.copyTo(Tcw2.colRange(0,3));
-        tcw2.copyTo(Tcw2.col(3));
-
-        const float &fx2 = pKF2->fx;
-        const float &fy2 = pKF2->fy;
-        const float &cx2 = pKF2->cx;
-        const float &cy2 = pKF2->cy;
-        const float &invfx2 = pKF2->invfx;
-        const float &invfy2 = pKF2->invfy;
-
-        // Triangulate each match
-	// 对每对匹配通过三角化生成3D点
-        const int nmatches = vMatchedIndices.size();
-	//遍历vMatchedIndices
-        for(int ikp=0; ikp<nmatches; ikp++)
-        {
-            const int &idx1 = vMatchedIndices[ikp].first;
-            const int &idx2 = vMatchedIndices[ikp].second;
+            // Triangulation is succesfull
+            //如果三角化成功
+            cv::Mat x3D = Converter::toCvMat(vTriangulated[ip].x3D);
+            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpMap);
 
-            const cv::KeyPoint &kp1 = mpCurrentKeyFrame->mvKeysUn[idx1];
-            const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
-            bool bStereo1 = kp1_ur>=0;
+            pMP->AddObservation(mpCurrentKeyFrame,idx1);
+            pMP->AddObservation(pKF2,idx2);
 
-            const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
-            const float kp2_ur = pKF2->mvuRight[idx2];
-            bool bStereo2 = kp2_ur>=0;
+            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
+            pKF2->AddMapPoint(pMP,idx2);
 
-            // Check parallax between rays
-	    //将像素坐标转化为归一化平面坐标
-            cv::Mat xn1 = (cv::Mat_<float>(3,1) << (kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0);
-            cv::Mat xn2 = (cv::Mat_<float>(3,1) << (kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0);
+            pMP->ComputeDistinctiveDescriptors();
 
-            cv::Mat ray1 = Rwc1*xn1;
-            cv::Mat ray2 = Rwc2*xn2;
-            const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));
+            pMP->UpdateNormalAndDepth();
 
-            float cosParallaxStereo = cosParallaxRays+1;
-            float cosParallaxStereo1 = cosParallaxStereo;
-            float cosParallaxStereo2 = cosParallaxStereo;
+            mpMap->AddMapPoint(pMP);
+            //新添加的点要加入这里，然后让MapPointCulling()检测
+            mlpRecentAddedMapPoints.push_back(pMP);
 
-            if(bStereo1)
-                cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
-            else if(bStereo2)
-                cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
+            nnew++;
+        }
+    }
+}
 
-            cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+void LocalMapping::TriangulateWithNeighbor(KeyFrame* pKF2, vector<TriangulatedPoint> &vTriangulated)
+{
+    KeyFrame* pKF1 = mpCurrentKeyFrame;
 
-            cv::Mat x3D;
-            if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
-            {
-                // Linear Triangulation Method
-                cv::Mat A(4,4,CV_32F);
-                A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-                A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-                A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-                A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+    // 每个线程使用自己的matcher
+    ORBmatcher matcher(0.6,false);
 
-                cv::Mat w,u,vt;
-		//SVD分解A=u*w*vt
-		//实际是要解Ax=0
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+    //当前关键帧在世界坐标系下的位姿
+    const Eigen::Matrix3d Rcw1 = Converter::toMatrix3d(pKF1->GetRotation());
+    const Eigen::Matrix3d Rwc1 = Rcw1.transpose();
+    const Eigen::Vector3d tcw1 = Converter::toVector3d(pKF1->GetTranslation());
+    Eigen::Matrix<double,3,4> Tcw1;   //转成3x4矩阵
+    Tcw1 << Rcw1, tcw1;
+    // 得到当前关键帧光心在世界坐标系中的坐标
+    const Eigen::Vector3d Ow1 = Converter::toVector3d(pKF1->GetCameraCenter());
 
-                x3D = vt.row(3).t();
+    const float &fx1 = pKF1->fx;
+    const float &fy1 = pKF1->fy;
+    const float &cx1 = pKF1->cx;
+    const float &cy1 = pKF1->cy;
+    const float &invfx1 = pKF1->invfx;
+    const float &invfy1 = pKF1->invfy;
 
-                if(x3D.at<float>(3)==0)
-                    continue;
+    const float ratioFactor = 1.5f*pKF1->mfScaleFactor;
 
-                // Euclidean coordinates
-		//归一化
-                x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+    // Check first that baseline is not too short
+    // 邻接的关键帧相机光心在世界坐标系中的坐标
+    const Eigen::Vector3d Ow2 = Converter::toVector3d(pKF2->GetCameraCenter());
+    // 基线长度
+    const float baseline = (Ow2-Ow1).norm();
 
-            }
-            else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
-            {
-                x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);                
-            }
-            else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
-            {
-                x3D = pKF2->UnprojectStereo(idx2);
-            }
-            else
-                continue; //No stereo and very low parallax
+    // 判断相机运动的基线是不是足够长
+    if(!mbMonocular)
+    {
+        //双目或RGBD
+        //关键帧间距太小时不生成3D点
+        if(baseline<pKF2->mb)
+            return;
+    }
+    else
+    {
+        //单目
+        // 邻接关键帧的场景深度中值
+        const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+        // baseline与景深的比例
+        const float ratioBaselineDepth = baseline/medianDepthKF2;
+
+        // 如果特别远(比例特别小)，那么不考虑当前邻接的关键帧，不生成3D点
+        if(ratioBaselineDepth<0.01)
+            return;
+    }
 
-            cv::Mat x3Dt = x3D.t();
+    // Compute Fundamental Matrix
+    // 根据两个关键帧的位姿计算它们之间的基本矩阵
+    cv::Mat F12 = ComputeF12(pKF1,pKF2);
+
+    // Search matches that fullfil epipolar constraint
+    // 匹配pKF1与pKF2之间未被匹配的特征点并通过bow加速，并校验是否符合对级约束。vMatchedPairs匹配成功的特征点在各自关键帧中的id。
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    matcher.SearchForTriangulation(pKF1,pKF2,F12,vMatchedIndices,false);
+
+    const Eigen::Matrix3d Rcw2 = Converter::toMatrix3d(pKF2->GetRotation());
+    const Eigen::Matrix3d Rwc2 = Rcw2.transpose();
+    const Eigen::Vector3d tcw2 = Converter::toVector3d(pKF2->GetTranslation());
+    Eigen::Matrix<double,3,4> Tcw2;
+    Tcw2 << Rcw2, tcw2;
+
+    const float &fx2 = pKF2->fx;
+    const float &fy2 = pKF2->fy;
+    const float &cx2 = pKF2->cx;
+    const float &cy2 = pKF2->cy;
+    const float &invfx2 = pKF2->invfx;
+    const float &invfy2 = pKF2->invfy;
+
+    // Triangulate each match
+    // 对每对匹配通过三角化生成3D点，全部使用固定大小的Eigen矩阵，不在堆上分配内存
+    const int nmatches = vMatchedIndices.size();
+    vTriangulated.reserve(nmatches);
+    for(int ikp=0; ikp<nmatches; ikp++)
+    {
+        const int &idx1 = vMatchedIndices[ikp].first;
+        const int &idx2 = vMatchedIndices[ikp].second;
 
-            //Check triangulation in front of cameras
-	    //检验3d点投影到第一个关键帧的误差
-            float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);
-            if(z1<=0)
-                continue;
+        const cv::KeyPoint &kp1 = pKF1->mvKeysUn[idx1];
+        const float kp1_ur=pKF1->mvuRight[idx1];
+        bool bStereo1 = kp1_ur>=0;
 
-            float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
-            if(z2<=0)
-                continue;
+        const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
+        const float kp2_ur = pKF2->mvuRight[idx2];
+        bool bStereo2 = kp2_ur>=0;
 
-            //Check reprojection error in first keyframe
-            const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
-            const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);
-            const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);
-            const float invz1 = 1.0/z1;
+        // Check parallax between rays
+        //将像素坐标转化为归一化平面坐标
+        const Eigen::Vector3d xn1((kp1.pt.x-cx1)*invfx1, (kp1.pt.y-cy1)*invfy1, 1.0);
+        const Eigen::Vector3d xn2((kp2.pt.x-cx2)*invfx2, (kp2.pt.y-cy2)*invfy2, 1.0);
 
-            if(!bStereo1)
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
-                    continue;
-            }
-            else
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                float errX1_r = u1_r - kp1_ur;
-                if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
-                    continue;
-            }
+        const Eigen::Vector3d ray1 = Rwc1*xn1;
+        const Eigen::Vector3d ray2 = Rwc2*xn2;
+        const float cosParallaxRays = ray1.dot(ray2)/(ray1.norm()*ray2.norm());
 
-            //Check reprojection error in second keyframe
-            //检验3d点投影到第二个关键帧的误差
-            const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
-            const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
-            const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
-            const float invz2 = 1.0/z2;
-            if(!bStereo2)
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
-                    continue;
-            }
-            else
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                float errX2_r = u2_r - kp2_ur;
-                if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
-                    continue;
-            }
+        float cosParallaxStereo = cosParallaxRays+1;
+        float cosParallaxStereo1 = cosParallaxStereo;
+        float cosParallaxStereo2 = cosParallaxStereo;
 
-            //Check scale consistency
-            //检验尺度的连续性
-            cv::Mat normal1 = x3D-Ow1;
-            float dist1 = cv::norm(normal1);
+        if(bStereo1)
+            cosParallaxStereo1 = cos(2*atan2(pKF1->mb/2,pKF1->mvDepth[idx1]));
+        else if(bStereo2)
+            cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
 
-            cv::Mat normal2 = x3D-Ow2;
-            float dist2 = cv::norm(normal2);
+        cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
 
-            if(dist1==0 || dist2==0)
+        Eigen::Vector3d x3D;
+        if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 || cosParallaxRays<0.9998))
+        {
+            // Linear Triangulation Method
+            Eigen::Matrix4d A;
+            A.row(0) = xn1(0)*Tcw1.row(2)-Tcw1.row(0);
+            A.row(1) = xn1(1)*Tcw1.row(2)-Tcw1.row(1);
+            A.row(2) = xn2(0)*Tcw2.row(2)-Tcw2.row(0);
+            A.row(3) = xn2(1)*Tcw2.row(2)-Tcw2.row(1);
+
+            //实际是要解Ax=0
+            //A'A最小特征值对应的特征向量就是A的SVD中最小奇异值对应的右奇异向量
+            //4x4对称矩阵的特征分解比一般矩阵的SVD便宜得多
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> eig(A.transpose()*A);
+            const Eigen::Vector4d x3Dh = eig.eigenvectors().col(0);
+
+            if(x3Dh(3)==0)
                 continue;
 
-            const float ratioDist = dist2/dist1;
-            const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
+            // Euclidean coordinates
+            //归一化
+            x3D = x3Dh.head<3>()/x3Dh(3);
+        }
+        else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
+        {
+            x3D = Converter::toVector3d(pKF1->UnprojectStereo(idx1));
+        }
+        else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
+        {
+            x3D = Converter::toVector3d(pKF2->UnprojectStereo(idx2));
+        }
+        else
+            continue; //No stereo and very low parallax
 
-            /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
-                continue;*/
-            if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
-                continue;
+        //Check triangulation in front of cameras
+        //检验3d点在两个相机前方
+        const Eigen::Vector3d x3Dc1 = Rcw1*x3D+tcw1;
+        const float z1 = x3Dc1(2);
+        if(z1<=0)
+            continue;
 
-            // Triangulation is succesfull
-	    //如果三角化成功
-            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpMap);
+        const Eigen::Vector3d x3Dc2 = Rcw2*x3D+tcw2;
+        const float z2 = x3Dc2(2);
+        if(z2<=0)
+            continue;
 
-            pMP->AddObservation(mpCurrentKeyFrame,idx1);            
-            pMP->AddObservation(pKF2,idx2);
+        //Check reprojection error in first keyframe
+        //检验3d点投影到第一个关键帧的误差
+        const float &sigmaSquare1 = pKF1->mvLevelSigma2[kp1.octave];
+        const float x1 = x3Dc1(0);
+        const float y1 = x3Dc1(1);
+        const float invz1 = 1.0/z1;
 
-            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
-            pKF2->AddMapPoint(pMP,idx2);
+        if(!bStereo1)
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
+                continue;
+        }
+        else
+        {
+            float u1 = fx1*x1*invz1+cx1;
+            float u1_r = u1 - pKF1->mbf*invz1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            float errX1_r = u1_r - kp1_ur;
+            if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
+                continue;
+        }
 
-            pMP->ComputeDistinctiveDescriptors();
+        //Check reprojection error in second keyframe
+        //检验3d点投影到第二个关键帧的误差
+        const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+        const float x2 = x3Dc2(0);
+        const float y2 = x3Dc2(1);
+        const float invz2 = 1.0/z2;
+        if(!bStereo2)
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
+                continue;
+        }
+        else
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float u2_r = u2 - pKF1->mbf*invz2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            float errX2_r = u2_r - kp2_ur;
+            if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
+                continue;
+        }
 
-            pMP->UpdateNormalAndDepth();
+        //Check scale consistency
+        //检验尺度的连续性
+        const float dist1 = (x3D-Ow1).norm();
+        const float dist2 = (x3D-Ow2).norm();
 
-            mpMap->AddMapPoint(pMP);
-	    //新添加的点要加入这里，然后让MapPointCulling()检测
-            mlpRecentAddedMapPoints.push_back(pMP);
+        if(dist1==0 || dist2==0)
+            continue;
 
-            nnew++;
-        }
+        const float ratioDist = dist2/dist1;
+        const float ratioOctave = pKF1->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
+
+        /*if(fabs(ratioDist-ratioOctave)>ratioFactor)
+            continue;*/
+        if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+            continue;
+
+        TriangulatedPoint tp;
+        tp.idx1 = idx1;
+        tp.idx2 = idx2;
+        tp.x3D = x3D;
+        vTriangulated.push_back(tp);
     }
 }
 // 检查并融合与当前关键帧共视程度高的帧重复的MapPoints
@@ -596,16 +711,6 @@ void LocalMapping::SearchInNeighbors()
     ORBmatcher matcher;
     //取出当前关键帧的mappoint与pKFi中的mappoint融合
     vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    //遍历vpTargetKFs中的keyframe
-    for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend; vit++)
-    {
-        KeyFrame* pKFi = *vit;
-
-        // 投影当前帧的MapPoints到相邻关键帧pKFi中，并判断是否有重复的MapPoints
-        // 1.如果MapPoint能匹配关键帧的特征点，并且该点有对应的MapPoint，那么将两个MapPoint合并（选择观测数多的）
-        // 2.如果MapPoint能匹配关键帧的特征点，并且该点没有对应的MapPoint，那么为该点添加MapPoint
-        matcher.Fuse(pKFi,vpMapPointMatches);
-    }
 
     // Search matches by projection from target KFs in current KF
     // 获取vpTargetKFs所有良好MapPoints的集合
@@ -636,27 +741,59 @@ void LocalMapping::SearchInNeighbors()
         }
     }
 
-    //mappoint融合
-    matcher.Fuse(mpCurrentKeyFrame,vpFuseCandidates);
+    // 两个方向的投影搜索作为一批任务并行执行：
+    // 前vpTargetKFs.size()个任务把当前帧的MapPoints投影到各个相邻帧，
+    // 其余任务把vpFuseCandidates分块投影到当前帧
+    // 搜索只读取地图，融合在后面串行执行
+    const int nTargets = vpTargetKFs.size();
+    const int nCandidates = vpFuseCandidates.size();
+    const int nChunk = 256;
+    const int nChunks = (nCandidates+nChunk-1)/nChunk;
+    vector<vector<int> > vvForwardMatches(nTargets);
+    vector<int> vReverseMatches(nCandidates,-1);
+    mThreadPool.ParallelFor(nTargets+nChunks, [&](int i)
+    {
+        if(i<nTargets)
+        {
+            vvForwardMatches[i].resize(vpMapPointMatches.size());
+            matcher.SearchForFuse(vpTargetKFs[i],vpMapPointMatches,0,vpMapPointMatches.size(),vvForwardMatches[i]);
+        }
+        else
+        {
+            const int nBegin = (i-nTargets)*nChunk;
+            const int nEnd = min(nBegin+nChunk,nCandidates);
+            matcher.SearchForFuse(mpCurrentKeyFrame,vpFuseCandidates,nBegin,nEnd,vReverseMatches);
+        }
+    });
 
+    // 按相邻帧的顺序、点的顺序依次融合，融合时重新检查点是否已失效，结果是确定的。
+    // 但搜索是在融合之前对同一份地图做的，看不到前面的融合对地图的修改(被替换的点、新增的观测)，
+    // 反向搜索的候选点也是在正向融合之前收集的，所以融合结果可能与原来的串行版本略有不同
+    // 1.如果MapPoint能匹配关键帧的特征点，并且该点有对应的MapPoint，那么将两个MapPoint合并（选择观测数多的）
+    // 2.如果MapPoint能匹配关键帧的特征点，并且该点没有对应的MapPoint，那么为该点添加MapPoint
+    vector<MapPoint*> vpChanged;
+    for(int i=0; i<nTargets; i++)
+        matcher.ApplyFuse(vpTargetKFs[i],vpMapPointMatches,vvForwardMatches[i],&vpChanged);
+
+    //mappoint融合
+    matcher.ApplyFuse(mpCurrentKeyFrame,vpFuseCandidates,vReverseMatches,&vpChanged);
 
     // Update points
-    // 步骤4：更新当前帧MapPoints的描述子，深度，观测主方向等属性
-    vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
+    // 步骤4：更新MapPoints的描述子，深度，观测主方向等属性
+    // 只有观测关系发生变化的点需要更新，其余点在创建或加入当前帧时已经更新过
+    sort(vpChanged.begin(),vpChanged.end());
+    vpChanged.erase(unique(vpChanged.begin(),vpChanged.end()),vpChanged.end());
+    mThreadPool.ParallelFor(vpChanged.size(), [&](int i)
     {
-        MapPoint* pMP=vpMapPointMatches[i];
-        if(pMP)
+        MapPoint* pMP=vpChanged[i];
+        if(!pMP->isBad())
         {
-            if(!pMP->isBad())
-            {
-                //在此mappoint能被看到的特征点中找出最能代表此mappoint的描述子
-                pMP->ComputeDistinctiveDescriptors();
-                //更新平均观测方向和观测距离
-                pMP->UpdateNormalAndDepth();
-            }
+            //在此mappoint能被看到的特征点中找出最能代表此mappoint的描述子
+            pMP->ComputeDistinctiveDescriptors();
+            //更新平均观测方向和观测距离
+            pMP->UpdateNormalAndDepth();
         }
-    }
+    });
 
     // Update connections in covisibility graph
     //更新共视图Covisibility graph,essential graph和spanningtree
@@ -700,23 +837,34 @@ cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 
 void LocalMapping::RequestStop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopRequested = true;
-    unique_lock<mutex> lock2(mMutexNewKFs);
-    mbAbortBA = true;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopRequested = true;
+        unique_lock<mutex> lock2(mMutexNewKFs);
+        mbAbortBA = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::Stop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    if(mbStopRequested && !mbNotStop)
     {
+        unique_lock<mutex> lock(mMutexStop);
+        if(!mbStopRequested || mbNotStop)
+            return false;
         mbStopped = true;
         cout << "Local Mapping STOP" << endl;
-        return true;
     }
+    // 通知在WaitUntilStopped()中等待的线程
+    WakeUp();
+    return true;
+}
 
-    return false;
+void LocalMapping::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexWake);
+    while(!isStopped())
+        mCondWake.wait(lock);
 }
 
 bool LocalMapping::isStopped()
@@ -733,17 +881,20 @@ bool LocalMapping::stopRequested()
 
 void LocalMapping::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-    if(mbFinished)
-        return;
-    mbStopped = false;
-    mbStopRequested = false;
-    for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
-        delete *lit;
-    mlNewKeyFrames.clear();
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+        if(mbFinished)
+            return;
+        mbStopped = false;
+        mbStopRequested = false;
+        for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+            delete *lit;
+        mlNewKeyFrames.clear();
 
-    cout << "Local Mapping RELEASE" << endl;
+        cout << "Local Mapping RELEASE" << endl;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::AcceptKeyFrames()
@@ -754,18 +905,41 @@ bool LocalMapping::AcceptKeyFrames()
 
 void LocalMapping::SetAcceptKeyFrames(bool flag)
 {
-    unique_lock<mutex> lock(mMutexAccept);
-    mbAcceptKeyFrames=flag;
+    {
+        unique_lock<mutex> lock(mMutexAccept);
+        mbAcceptKeyFrames=flag;
+    }
+    // 通知在WaitUntilIdle()中等待的线程
+    if(flag)
+        WakeUp();
+}
+
+void LocalMapping::WaitUntilIdle()
+{
+    unique_lock<mutex> lock(mMutexWake);
+    while((CheckNewKeyFrames() || !AcceptKeyFrames()) && !isStopped() && !isFinished())
+        mCondWake.wait(lock);
+}
+
+vector<LocalMapping::KeyFrameTimes> LocalMapping::GetKeyFrameTimes()
+{
+    unique_lock<mutex> lock(mMutexTimes);
+    return mvKeyFrameTimes;
 }
 
 bool LocalMapping::SetNotStop(bool flag)
 {
-    unique_lock<mutex> lock(mMutexStop);
+    {
+        unique_lock<mutex> lock(mMutexStop);
 
-    if(flag && mbStopped)
-        return false;
+        if(flag && mbStopped)
+            return false;
 
-    mbNotStop = flag;
+        mbNotStop = flag;
+    }
+    // 取消mbNotStop后，之前被推迟的停止请求可以执行了
+    if(!flag)
+        WakeUp();
 
     return true;
 }
@@ -796,80 +970,213 @@ void LocalMapping::KeyFrameCulling()
     for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
     {
         KeyFrame* pKF = *vit;
-        if(pKF->mnId==0)
+        if(pKF->IsMapOrigin())
             continue;
-        // 步骤2：提取每个共视关键帧的MapPoints
-        const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
-
-        int nObs = 3;
-        const int thObs=nObs;
-        int nRedundantObservations=0;
-        int nMPs=0;
 
-        // 步骤3：遍历该局部关键帧的MapPoints，判断是否90%以上的MapPoints能被其它关键帧（至少3个）观测到
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
-        {
-            MapPoint* pMP = vpMapPoints[i];
-            if(pMP)
-            {
-                if(!pMP->isBad())
-                {
-                    // 对于双目，仅考虑近处的MapPoints，不超过mbf * 35 / fx
-                    if(!mbMonocular)
-                    {
-                        if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
-                            continue;
-                    }
-
-                    nMPs++;
-                    //如果pMP被其他keyframe观测的数量大于thObs
-                    if(pMP->Observations()>thObs)
-                    {
-                        //pKF是与当前关键帧具有连接关系的关键帧
-                        //octave：代表是从金字塔哪一层
-                        const int &scaleLevel = pKF->mvKeysUn[i].octave;
-                        // 取观测到这个mappoint的关键帧
-                        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
-                        int nObs=0;
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            // 遍历能观测到mappoint的关键帧
-                            KeyFrame* pKFi = mit->first;
-
-                            //pKF是与当前关键帧具有连接关系的关键帧
-                            //pKFi是能观测到这个pKF的mappoint的关键帧
-                            if(pKFi==pKF)
-                                continue;
-
-                            const int &scaleLeveli = pKFi->mvKeysUn[mit->second].octave;
-                            // 如果这个mappoint在pKF和pKFi对应的特征点的金字塔层数相近，则认为mappoint与pKF和pKFi的距离相近
-                            // 表示pKF和pKFi是比较相邻近的关键帧
-                            if(scaleLeveli<=scaleLevel+1)
-                            {
-                                //nObs+1
-                                nObs++;
-                                if(nObs>=thObs)
-                                    break;
-                            }
-                        }
-                        //如果当前这个pKF的mappoint被其他临近的关键帧观测到超过3次，
-                        //统计+1
-                        if(nObs>=thObs)
-                        {
-                            nRedundantObservations++;
-                        }
-                    }
-                }
-            }
-        }  
-        //步骤4
         //如果当前这个pKF的90%mappoint被其他关键帧观测到，则丢弃这个与mpCurrentKeyFrame有共视关系的关键帧pKF
         //另外，如果这个关键帧正在被LoopClosing.cc处理，则会被设置noErace标志位，该帧不会被丢掉
-        if(nRedundantObservations>0.9*nMPs)
+        if(IsRedundant(pKF))
+            pKF->SetBadFlag();
+    }
+}
+
+bool LocalMapping::IsRedundant(KeyFrame* pKF)
+{
+    // 冗余计数由MapPoint在观测变化时增量维护，这里只需比较
+    // 对于双目，仅考虑近处的MapPoints，不超过mbf * 35 / fx
+    int nMPs, nRedundantObservations;
+    pKF->GetCullingCounters(!mbMonocular,nMPs,nRedundantObservations);
+    return nRedundantObservations>0.9*nMPs;
+}
+
+void LocalMapping::MapKeyFrameCulling()
+{
+    // 局部剔除只检查当前关键帧的共视关键帧，远离当前位置的冗余关键帧(例如重复经过同一区域)不会被剔除
+    // 这里每次按id顺序检查地图中id大于mnCullingCursor的mnCullingBudget个关键帧，到达地图末尾后从头开始
+    const vector<KeyFrame*> vpKFs = mpMap->GetKeyFramesAfter(mnCullingCursor,mnCullingBudget);
+    if(vpKFs.size()<(size_t)mnCullingBudget)
+        mnCullingCursor = 0;
+    else
+        mnCullingCursor = vpKFs.back()->mnId;
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->IsMapOrigin() || pKF==mpCurrentKeyFrame || pKF->isBad())
+            continue;
+
+        if(IsRedundant(pKF))
             pKF->SetBadFlag();
     }
 }
 
+size_t LocalMapping::EstimateMapMemory(const size_t nKFs, const size_t nMPs, const int nFeatures)
+{
+    // 每个特征点：去畸变前后的关键点、双目坐标和深度、256位描述子、mappoint指针、网格中的序号，以及BoW中的一项
+    const size_t nPerFeature = 2*sizeof(cv::KeyPoint)+2*sizeof(float)+32+sizeof(MapPoint*)+sizeof(size_t)+48;
+    // 每个mappoint按平均5个观测估计：mObservations的节点、描述子缓存和描述子距离矩阵
+    const size_t nObs = 5;
+    const size_t nPerPoint = sizeof(MapPoint)+nObs*(48+32+sizeof(KeyFrame*)+2)+nObs*nObs*sizeof(int);
+
+    return nKFs*(sizeof(KeyFrame)+nFeatures*nPerFeature)+nMPs*nPerPoint;
+}
+
+void LocalMapping::EnforceMapBudget()
+{
+    if(mnMaxKeyFrames==0 && mnMaxMapPoints==0 && mnMaxMemoryBytes==0)
+        return;
+
+    const size_t nKFs = mpMap->KeyFramesInMap();
+    size_t nMPs = mpMap->MapPointsInMap();
+    const size_t nBytes = EstimateMapMemory(nKFs,nMPs,mpCurrentKeyFrame->N);
+
+    const bool bOverKFs = mnMaxKeyFrames>0 && nKFs>mnMaxKeyFrames;
+    const bool bOverMPs = mnMaxMapPoints>0 && nMPs>mnMaxMapPoints;
+    const bool bOverBytes = mnMaxMemoryBytes>0 && nBytes>mnMaxMemoryBytes;
+    if(!bOverKFs && !bOverMPs && !bOverBytes)
+        return;
+
+    // 一次删到上限的90%，避免之后每个关键帧都触发
+    size_t nTargetKFs = bOverKFs ? 0.9*mnMaxKeyFrames : nKFs;
+    size_t nTargetMPs = bOverMPs ? 0.9*mnMaxMapPoints : nMPs;
+    if(bOverBytes)
+    {
+        const double scale = 0.9*mnMaxMemoryBytes/nBytes;
+        nTargetKFs = min(nTargetKFs,(size_t)(scale*nKFs));
+        nTargetMPs = min(nTargetMPs,(size_t)(scale*nMPs));
+    }
+
+    int nEvictedKFs = 0;
+    if(nKFs>nTargetKFs)
+        nEvictedKFs = EvictKeyFrames(nKFs-nTargetKFs);
+
+    // 删除关键帧后观测不足的mappoint也会被删除，重新统计
+    nMPs = mpMap->MapPointsInMap();
+    int nEvictedMPs = 0;
+    if(nMPs>nTargetMPs)
+        nEvictedMPs = EvictMapPoints(nMPs-nTargetMPs);
+
+    mnEvictedKeyFrames += nEvictedKFs;
+    mnEvictedMapPoints += nEvictedMPs;
+
+    int nErasedMPs, nErasedKFs;
+    mpMap->GetErasedCount(nErasedMPs,nErasedKFs);
+    cout << "Map budget: evicted " << nEvictedKFs << " keyframes and " << nEvictedMPs << " points"
+         << " (" << mpMap->KeyFramesInMap() << " keyframes, " << mpMap->MapPointsInMap() << " points left)."
+         << " Total evicted: " << mnEvictedKeyFrames << " keyframes, " << mnEvictedMapPoints << " points."
+         << " Total reclaimed: " << mnReleasedKeyFrames << " keyframes, " << mnDeletedMapPoints << " points,"
+         << " pending: " << nErasedKFs << " keyframes, " << nErasedMPs << " points." << endl;
+}
+
+int LocalMapping::EvictKeyFrames(const size_t nEvict)
+{
+    // 当前关键帧和它的共视关键帧组成跟踪用的局部地图，不删除
+    const vector<KeyFrame*> vpCovisible = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    const set<KeyFrame*> spLocal(vpCovisible.begin(),vpCovisible.end());
+    const unsigned long nCurrentFrame = mpCurrentKeyFrame->mnFrameId;
+
+    // 得分越高越先删除：距离上次被跟踪使用的帧数越多、共视关键帧越少，越不重要
+    vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    vector<pair<float,KeyFrame*> > vScoreKF;
+    vScoreKF.reserve(vpKFs.size());
+    {
+        // mnTrackReferenceForFrame由Tracking在持有地图更新锁时写入
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            KeyFrame* pKF = vpKFs[i];
+            if(pKF->IsMapOrigin() || pKF==mpCurrentKeyFrame || pKF->isBad() || spLocal.count(pKF))
+                continue;
+            // 闭环边是位姿图中的重要约束
+            if(!pKF->GetLoopEdges().empty())
+                continue;
+
+            const unsigned long nLastUsed = max(pKF->mnFrameId,pKF->mnTrackReferenceForFrame);
+            const float age = nCurrentFrame>nLastUsed ? nCurrentFrame-nLastUsed : 0;
+            const int nCovisible = pKF->GetVectorCovisibleKeyFrames().size();
+            vScoreKF.push_back(make_pair(age/(1+nCovisible),pKF));
+        }
+    }
+
+    const size_t n = min(nEvict,vScoreKF.size());
+    if(n<vScoreKF.size())
+        nth_element(vScoreKF.begin(),vScoreKF.begin()+n,vScoreKF.end(),greater<pair<float,KeyFrame*> >());
+
+    int nEvicted = 0;
+    for(size_t i=0; i<n; i++)
+    {
+        KeyFrame* pKF = vScoreKF[i].second;
+        pKF->SetBadFlag();
+        if(pKF->isBad())
+            nEvicted++;
+    }
+    return nEvicted;
+}
+
+int LocalMapping::EvictMapPoints(const size_t nEvict)
+{
+    // 当前关键帧看到的点不删除
+    const set<MapPoint*> spLocal = mpCurrentKeyFrame->GetMapPoints();
+    const long int nCurrentFrame = mpCurrentKeyFrame->mnFrameId;
+
+    // 得分越高越先删除：距离上次被看到的帧数越多、观测越少，越不重要
+    vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+    vector<pair<float,MapPoint*> > vScoreMP;
+    vScoreMP.reserve(vpMPs.size());
+    {
+        // mnLastFrameSeen同样由Tracking在持有地图更新锁时写入
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        for(size_t i=0; i<vpMPs.size(); i++)
+        {
+            MapPoint* pMP = vpMPs[i];
+            if(pMP->isBad() || spLocal.count(pMP))
+                continue;
+
+            const long int nLastSeen = max((long int)pMP->mnLastFrameSeen,pMP->mnFirstFrame);
+            const float age = nCurrentFrame>nLastSeen ? nCurrentFrame-nLastSeen : 0;
+            vScoreMP.push_back(make_pair(age/(1+pMP->Observations()),pMP));
+        }
+    }
+
+    const size_t n = min(nEvict,vScoreMP.size());
+    if(n<vScoreMP.size())
+        nth_element(vScoreMP.begin(),vScoreMP.begin()+n,vScoreMP.end(),greater<pair<float,MapPoint*> >());
+
+    for(size_t i=0; i<n; i++)
+        vScoreMP[i].second->SetBadFlag();
+
+    return n;
+}
+
+void LocalMapping::ReclaimErasedObjects()
+{
+    if(!mbReclaimErased)
+        return;
+
+    // 本线程在关键帧之间只通过mlpRecentAddedMapPoints持有mappoint，清理其中的坏点之后确认
+    // 其它线程(Tracking、LoopClosing、全局BA)在各自的安全点确认，没有确认的对象不会被回收
+    const long unsigned int nEpoch = mpMap->GetEraseEpoch();
+    list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
+    while(lit!=mlpRecentAddedMapPoints.end())
+    {
+        if((*lit)->isBad())
+            lit = mlpRecentAddedMapPoints.erase(lit);
+        else
+            lit++;
+    }
+    mpMap->QuiescentState(mnReclaimSlot,nEpoch);
+
+    int nDeletedMPs, nReleasedKFs;
+    {
+        // Tracking在一帧的处理过程中持有这个锁
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+        mpMap->ReclaimErased(nDeletedMPs,nReleasedKFs);
+    }
+
+    mnDeletedMapPoints += nDeletedMPs;
+    mnReleasedKeyFrames += nReleasedKFs;
+}
+
 cv::Mat LocalMapping::SkewSymmetricMatrix(const cv::Mat &v)
 {
     return (cv::Mat_<float>(3,3) <<             0, -v.at<float>(2), v.at<float>(1),
@@ -883,7 +1190,10 @@ void LocalMapping::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
+    // 等待ResetIfRequested()完成重置
+    unique_lock<mutex> lock(mMutexWake);
     while(1)
     {
         {
@@ -891,25 +1201,30 @@ void LocalMapping::RequestReset()
             if(!mbResetRequested)
                 break;
         }
-        usleep(3000);
+        mCondWake.wait(lock);
     }
 }
 
 void LocalMapping::ResetIfRequested()
 {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbResetRequested)
     {
+        unique_lock<mutex> lock(mMutexReset);
+        if(!mbResetRequested)
+            return;
         mlNewKeyFrames.clear();
         mlpRecentAddedMapPoints.clear();
         mbResetRequested=false;
     }
+    WakeUp();
 }
 
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::CheckFinish()
@@ -920,10 +1235,13 @@ bool LocalMapping::CheckFinish()
 
 void LocalMapping::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;    
-    unique_lock<mutex> lock2(mMutexStop);
-    mbStopped = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+        unique_lock<mutex> lock2(mMutexStop);
+        mbStopped = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::isFinished()
@@ -932,4 +1250,46 @@ bool LocalMapping::isFinished()
     return mbFinished;
 }
 
+void LocalMapping::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexWake);
+    while(!isFinished())
+        mCondWake.wait(lock);
+}
+
+bool LocalMapping::HasWork()
+{
+    if(CheckNewKeyFrames())
+        return true;
+
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        if(mbStopRequested && !mbNotStop && !mbStopped)
+            return true;
+    }
+
+    {
+        unique_lock<mutex> lock(mMutexReset);
+        if(mbResetRequested)
+            return true;
+    }
+
+    return CheckFinish();
+}
+
+void LocalMapping::WaitForWork()
+{
+    unique_lock<mutex> lock(mMutexWake);
+    while(!HasWork())
+        mCondWake.wait(lock);
+}
+
+void LocalMapping::WakeUp()
+{
+    // 先获得mMutexWake再通知：等待者检查条件和进入wait()之间不会漏掉通知
+    // 调用时不能持有其它锁，等待者会在持有mMutexWake的情况下获取它们
+    unique_lock<mutex> lock(mMutexWake);
+    mCondWake.notify_all();
+}
+
 } //namespace ORB_SLAM
@@ -28,8 +28,12 @@
 
 #include "ORBmatcher.h"
 
+#include "MapPointGrid.h"
+
 #include<mutex>
 #include<thread>
+#include<algorithm>
+#include<climits>
 
 
 namespace ORB_SLAM2
@@ -38,7 +42,9 @@ namespace ORB_SLAM2
 LoopClosing::LoopClosing(Map *pMap, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
     mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
     mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
-    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0)
+    mbStopGBA(false), mbRestartGBA(false), mbMergingGBA(false), mbMergingLoop(false), mnLoopKFGBA(0), mpThreadGBA(NULL),
+    mnGBAIterations(10), mnGBAIterationsDone(0), mnMergeBatchKFs(100), mnMergeBatchMPs(2000), mbFixScale(bFixScale),
+    mThreadPool(std::min(4,(int)std::thread::hardware_concurrency())), mnReclaimSlot(pMap->RegisterReclaimThread())
 {
     mnCovisibilityConsistencyTh = 3;
 }
@@ -48,6 +54,12 @@ void LoopClosing::SetTracker(Tracking *pTracker)
     mpTracker=pTracker;
 }
 
+void LoopClosing::AddTracker(Tracking *pTracker)
+{
+    unique_lock<mutex> lock(mMutexTrackers);
+    mvpTrackers.push_back(pTracker);
+}
+
 void LoopClosing::SetLocalMapper(LocalMapping *pLocalMapper)
 {
     mpLocalMapper=pLocalMapper;
@@ -92,7 +104,17 @@ void LoopClosing::Run()
         if(CheckFinish())
             break;
 
-        usleep(5000);
+        // 处理完一个关键帧之后不再使用匹配到的mappoint，清空之后向地图确认，见Map::QuiescentState()
+        // 队列中的关键帧只有指针，取出时检查是否已经被剔除
+        {
+            const long unsigned int nEpoch = mpMap->GetEraseEpoch();
+            mvpLoopMapPoints.clear();
+            mvpCurrentMatchedPoints.clear();
+            mpMap->QuiescentState(mnReclaimSlot,nEpoch);
+        }
+
+        // 没有新的关键帧和请求时阻塞，不占用CPU
+        WaitForWork();
     }
     //设置完成停止标志
     SetFinish();
@@ -100,9 +122,13 @@ void LoopClosing::Run()
 
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
-    if(pKF->mnId!=0)
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
+        if(pKF->mnId==0)
+            return;
         mlpLoopKeyFrameQueue.push_back(pKF);
+    }
+    WakeUp();
 }
 
 bool LoopClosing::CheckNewKeyFrames()
@@ -119,6 +145,9 @@ bool LoopClosing::DetectLoop()
         unique_lock<mutex> lock(mMutexLoopQueue);
         mpCurrentKF = mlpLoopKeyFrameQueue.front();
         mlpLoopKeyFrameQueue.pop_front();
+        // 在队列中等待时已经被剔除的关键帧不再处理，它的特征数据可能已经被回收
+        if(mpCurrentKF->isBad())
+            return false;
         // Avoid that a keyframe can be erased while it is being process by this thread
         // 避免这个关键帧被这个线程处理的时候被擦除掉，设置标志位
         mpCurrentKF->SetNotErase();
@@ -298,161 +327,35 @@ bool LoopClosing::ComputeSim3()
     // 对于每一个回环候选关键帧，都计算sim3
     const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // We compute first ORB matches for each candidate
-    // If enough matches are found, we setup a Sim3Solver
-    // 先进行ORB匹配，如果匹配度足够，则开始进行sim3求解
-    ORBmatcher matcher(0.75,true);
-
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);
-
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);
-
-    //标识nInitialCandidates中哪些keyframe将被抛弃
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);
-
-    //candidates with enough matches
-    //统计满足匹配条件的候选关键帧个数
-    int nCandidates=0;
-
-    //遍历候选闭环关键帧nInitialCandidates
-    //闭环关键帧与关键帧特征匹配，通过bow加速
-    //剔除特征点匹配数少的闭环候选帧
+    // avoid that local mapping erase them while they are being processed in this thread
+    // 防止在LocalMapping中KeyFrameCulling函数将候选帧作为冗余帧剔除
     for(int i=0; i<nInitialCandidates; i++)
+        mvpEnoughConsistentCandidates[i]->SetNotErase();
+
+    // 各个候选帧的验证(BoW匹配、Sim3 RANSAC、引导匹配、Sim3优化、投影匹配)互相独立，并行进行
+    // 原来的做法是每个候选帧按序号轮流做5次RANSAC迭代，第一个通过Sim3优化的候选帧决定成败
+    // 这里每个候选帧记录它通过Sim3优化时的轮数和序号组成的次序，次序最小的就是原来第一个通过的候选帧，
+    // 结果与线程的执行快慢无关；次序已经不可能最小的候选帧提前放弃
+    vector<Sim3Candidate> vCandidates(nInitialCandidates);
+    std::atomic<int> nFirstOrder(INT_MAX);
+    mThreadPool.ParallelFor(nInitialCandidates,[&](int i)
     {
-        // 步骤1：从筛选的闭环候选帧中取出一帧关键帧pKF
-        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
+        EvaluateSim3Candidate(mvpEnoughConsistentCandidates[i],i,nInitialCandidates,nFirstOrder,vCandidates[i]);
+    });
 
-        // avoid that local mapping erase it while it is being processed in this thread
-        // 防止在LocalMapping中KeyFrameCulling函数将此关键帧作为冗余帧剔除
-        pKF->SetNotErase();
-
-        if(pKF->isBad())
-        {
-            //舍弃该帧
-            vbDiscarded[i] = true;
-            continue;
-        }
-
-        // 步骤2：将当前帧mpCurrentKF与闭环候选关键帧pKF匹配
-        // 匹配mpCurrentKF与pKF之间的特征点并通过bow加速
-        // 返回vvpMapPointMatches[i][j]表示mpCurrentKF的特征点j通过mvpEnoughConsistentCandidates[i]匹配得到的mappoint
-        // vvpMapPointMatches[第i个候选关键帧][mpCurrentKF当前帧第j个特征点] = 与当前帧第j个特征点匹配的mappoint
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
-
-        // 两帧之间成功匹配特征点数量太少，剔除该候选关键帧
-        if(nmatches<20)
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-        else
-        {
-            //匹配数量足够，准备一个Sim求解器
-            //新建一个Sim3Solver对象
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i],mbFixScale);
-            pSolver->SetRansacParameters(0.99,20,300);
-            vpSim3Solvers[i] = pSolver;
-        }
-        //满足匹配条件的候选关键帧个数+1
-        nCandidates++;
-    }
-    //成功匹配标志，用来跳出while
-    bool bMatch = false;
-
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is succesful or all fail
-    // 进行RANSAC迭代，对每个候选关键帧
-    // 直到某个候选关键帧成功，或者全部都失败
-    while(nCandidates>0 && !bMatch)
+    int nBest = -1;
+    for(int i=0; i<nInitialCandidates; i++)
     {
-        //遍历nInitialCandidates
-        for(int i=0; i<nInitialCandidates; i++)
-        {
-            //如果是被丢弃的候选关键帧，则跳过
-            if(vbDiscarded[i])
-                continue;
-            //取候选关键帧
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
-
-            // 步骤3：对步骤2中有较好的匹配的关键帧求取Sim3变换
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bNoMore;
-
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            // 最多迭代5次，返回的Scm是候选帧pKF到当前帧mpCurrentKF的Sim3变换（T12）(s,R,t)
-            //m代表候选帧pKF，c代表当前帧
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
-
-            // If Ransac reachs max. iterations discard keyframe
-            // 经过n次循环，每次迭代5次，总共迭代 n*5 次
-            // 总迭代次数达到最大限制还没有求出合格的Sim3变换，该候选帧剔除
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
-
-            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
-            // 如果求出了sim3
-            if(!Scm.empty())
-            {
-                //将vvpMapPointMatches[i]中，取inlier(sim3求解得到的)存入vpMapPointMatches
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
-                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
-                {
-                    // 保存inlier的MapPoint
-                    if(vbInliers[j])
-                        vpMapPointMatches[j]=vvpMapPointMatches[i][j];
-                }
-
-                // 步骤4：通过步骤3求取的Sim3变换引导关键帧匹配弥补步骤2中的漏匹配的mappoint
-                // 这里的变换是从相机坐标系2到相机坐标系1的变换
-                cv::Mat R = pSolver->GetEstimatedRotation();
-                cv::Mat t = pSolver->GetEstimatedTranslation();
-                const float s = pSolver->GetEstimatedScale();
-
-                // 查找更多的匹配（成功的闭环匹配需要满足足够多的匹配特征点数，之前使用SearchByBoW进行特征点匹配时会有漏匹配）
-                // 通过Sim3变换，确定pKF1的特征点在pKF2中的大致区域，同理，确定pKF2的特征点在pKF1中的大致区域
-                // 在该区域内通过描述子进行匹配捕获pKF1和pKF2之前漏匹配的特征点，更新匹配vpMapPointMatches
-                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
-
-                // 步骤5：Sim3优化，只要有一个候选帧通过Sim3的求解与优化，就跳出停止对其它候选帧的判断
-                //gScm表示候选帧pKF到当前帧mpCurrentKF的Sim3变换
-                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
-                // 如果mbFixScale为true，则是6DoFf优化（双目 RGBD），如果是false，则是7DoF优化（单目）
-                //vpMapPointMatches表示mpCurrentKF与pKF的mappoint匹配情况
-                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);
-
-                // If optimization is succesful stop ransacs and continue
-                // 如果优化结果得到的nInliers满足阈值条件，即求解成功
-                if(nInliers>=20)
-                {
-                    //表示从候选帧中找到了闭环帧 mpMatchedKF
-                    bMatch = true;
-                    mpMatchedKF = pKF;  //记录这个候选关键帧
-                    //gSmw表示世界坐标系到候选帧的Sim3变换
-                    g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
-                    //gScm表示候选帧pKF到当前帧mpCurrentKF的Sim3变换
-                    //mg2oScw=gScm*gSmw;表示世界坐标系到当前帧mpCurrentKF的Sim3变换
-                    mg2oScw = gScm*gSmw;
-                    //表示世界坐标系到当前帧mpCurrentKF的变换
-                    mScw = Converter::toCvMat(mg2oScw);
-                    //记录通过sim3匹配的mappoint
-                    mvpCurrentMatchedPoints = vpMapPointMatches;
-                    //跳出循环，不再遍历候选关键帧
-                    break;
-                }
-            }
-        }
+        if(vCandidates[i].nOrder==nFirstOrder)
+            nBest = i;
     }
 
+    // 和原来一样，第一个通过Sim3优化的候选帧投影匹配不够时，这次闭环检测失败，不再尝试其它候选帧
+    if(nBest>=0 && !vCandidates[nBest].bMatch)
+        nBest = -1;
+
     //如果遍历完所有的候选关键帧，还是没有找到匹配
-    if(!bMatch)
+    if(nBest<0)
     {
         // 清除，返回false
         for(int i=0; i<nInitialCandidates; i++)
@@ -461,76 +364,144 @@ bool LoopClosing::ComputeSim3()
         return false;
     }
 
-    // 步骤6：
-    // Retrieve MapPoints seen in Loop Keyframe and neighbors
-    // mpMatchedKF: 也就是刚刚匹配成功的候选关键帧
-    // 将mpMatchedKF闭环关键帧相连的关键帧全部取出来放入vpLoopConnectedKFs
-    // 将vpLoopConnectedKFs的MapPoints取出来放入mvpLoopMapPoints
-    vector<KeyFrame*> vpLoopConnectedKFs = mpMatchedKF->GetVectorCovisibleKeyFrames();  //获取共视的其他关键帧
-    vpLoopConnectedKFs.push_back(mpMatchedKF);
-    mvpLoopMapPoints.clear();
-    // 遍历这个闭环关键帧以及它的共视关键帧
-    for(vector<KeyFrame*>::iterator vit=vpLoopConnectedKFs.begin(); vit!=vpLoopConnectedKFs.end(); vit++)
+    //表示从候选帧中找到了闭环帧 mpMatchedKF
+    Sim3Candidate &best = vCandidates[nBest];
+    mpMatchedKF = mvpEnoughConsistentCandidates[nBest];
+    //gSmw表示世界坐标系到候选帧的Sim3变换
+    g2o::Sim3 gSmw(Converter::toMatrix3d(mpMatchedKF->GetRotation()),Converter::toVector3d(mpMatchedKF->GetTranslation()),1.0);
+    //gScm表示候选帧pKF到当前帧mpCurrentKF的Sim3变换
+    g2o::Sim3 gScm(best.R,best.t,best.s);
+    //mg2oScw=gScm*gSmw;表示世界坐标系到当前帧mpCurrentKF的Sim3变换
+    mg2oScw = gScm*gSmw;
+    mScw = Converter::toCvMat(mg2oScw);
+    //记录通过sim3和投影匹配的mappoint
+    mvpCurrentMatchedPoints.swap(best.vpMatchedPoints);
+    mvpLoopMapPoints.swap(best.vpLoopMapPoints);
+
+    // 清空mvpEnoughConsistentCandidates，除了匹配上的闭环关键帧
+    for(int i=0; i<nInitialCandidates; i++)
+        if(mvpEnoughConsistentCandidates[i]!=mpMatchedKF)
+            mvpEnoughConsistentCandidates[i]->SetErase();
+    return true;
+}
+
+void LoopClosing::EvaluateSim3Candidate(KeyFrame* pKF, const int nIndex, const int nCandidates,
+                                        std::atomic<int> &nFirstOrder, Sim3Candidate &result)
+{
+    result.nOrder = -1;
+    result.bMatch = false;
+    result.nTotalMatches = 0;
+
+    if(pKF->isBad())
+        return;
+
+    // 每个线程使用自己的matcher
+    ORBmatcher matcher(0.75,true);
+
+    // 步骤1：将当前帧mpCurrentKF与闭环候选关键帧pKF匹配
+    // 匹配mpCurrentKF与pKF之间的特征点并通过bow加速
+    // vpMapPointMatches[mpCurrentKF当前帧第j个特征点] = 与当前帧第j个特征点匹配的mappoint
+    vector<MapPoint*> vpBoWMatches;
+    const int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vpBoWMatches);
+
+    // 两帧之间成功匹配特征点数量太少，剔除该候选关键帧
+    if(nmatches<20)
+        return;
+
+    //匹配数量足够，准备一个Sim求解器
+    Sim3Solver solver(mpCurrentKF,pKF,vpBoWMatches,mbFixScale);
+    solver.SetRansacParameters(0.99,20,300);
+
+    // 步骤2：RANSAC求Sim3，每轮5次迭代
+    // 每轮开始前检查：已经有次序更小的候选帧通过时，本候选帧不可能被选中，放弃
+    bool bNoMore = false;
+    for(int nRound=0; !bNoMore; nRound++)
     {
-        KeyFrame* pKF = *vit;
-        vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+        const int nOrder = nRound*nCandidates+nIndex;
+        if(nOrder>nFirstOrder)
+            return;
+
+        vector<bool> vbInliers;
+        int nInliers;
+        // 返回的Scm是候选帧pKF到当前帧mpCurrentKF的Sim3变换（T12）(s,R,t)
+        cv::Mat Scm = solver.iterate(5,bNoMore,vbInliers,nInliers);
+
+        if(Scm.empty())
+            continue;
+
+        // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
+        //将vpBoWMatches中，取inlier(sim3求解得到的)存入vpMapPointMatches
+        vector<MapPoint*> vpMapPointMatches(vpBoWMatches.size(), static_cast<MapPoint*>(NULL));
+        for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
+        {
+            if(vbInliers[j])
+                vpMapPointMatches[j]=vpBoWMatches[j];
+        }
+
+        // 步骤3：通过求取的Sim3变换引导关键帧匹配弥补步骤1中的漏匹配的mappoint
+        cv::Mat R = solver.GetEstimatedRotation();
+        cv::Mat t = solver.GetEstimatedTranslation();
+        const float s = solver.GetEstimatedScale();
+        matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
+
+        // 步骤4：Sim3优化，如果mbFixScale为true，则是6DoF优化（双目 RGBD），如果是false，则是7DoF优化（单目）
+        g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
+        const int nOptInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);
+
+        // 优化后内点不够，继续RANSAC
+        if(nOptInliers<20)
+            continue;
+
+        // 本候选帧通过Sim3优化，更新最小的次序
+        result.nOrder = nOrder;
+        int nPrev = nFirstOrder;
+        while(nOrder<nPrev && !nFirstOrder.compare_exchange_weak(nPrev,nOrder))
+            ;
+
+        // 步骤5：取出闭环帧及其共视关键帧的MapPoints(去重)，用Sim3投影到当前帧寻找更多匹配
+        // 几个候选帧并行处理，不能像之前一样用mappoint的mnLoopPointForKF去重，改用每个任务自己的集合
+        // 仍按共视关键帧和特征点的顺序加入，SearchByProjection()占用特征点的先后与地址无关
+        vector<KeyFrame*> vpLoopConnectedKFs = pKF->GetVectorCovisibleKeyFrames();
+        vpLoopConnectedKFs.push_back(pKF);
+        vector<MapPoint*> vpLoopMapPoints;
+        set<MapPoint*> spLoopMapPoints;
+        for(vector<KeyFrame*>::iterator vit=vpLoopConnectedKFs.begin(); vit!=vpLoopConnectedKFs.end(); vit++)
         {
-            MapPoint* pMP = vpMapPoints[i];
-            if(pMP)
+            vector<MapPoint*> vpMapPoints = (*vit)->GetMapPointMatches();
+            for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
             {
-                //将所有共视关键帧以及闭环关键帧的mappoint储存到mvpLoopMapPoints，用来下一步寻找更多匹配
-                //不再添加已经添加过的mappoint，因为各个共视关键帧之间会有重复的mappoint
-                if(!pMP->isBad() && pMP->mnLoopPointForKF!=mpCurrentKF->mnId)
-                {
-                    mvpLoopMapPoints.push_back(pMP);
-                    // 标记该MapPoint被mpCurrentKF闭环时观测到并添加，避免重复添加
-                    pMP->mnLoopPointForKF=mpCurrentKF->mnId;
-                }
+                MapPoint* pMP = vpMapPoints[i];
+                if(pMP && !pMP->isBad() && spLoopMapPoints.insert(pMP).second)
+                    vpLoopMapPoints.push_back(pMP);
             }
         }
-    }
 
-    // 步骤7：将闭环匹配上关键帧以及相连关键帧的MapPoints投影到当前关键帧进行投影匹配
-    // Find more matches projecting with the computed Sim3
-    /// 目的：
-    // 将mvpLoopMapPoints投影到当前关键帧mpCurrentKF进行投影匹配
-    // 根据投影查找更多的匹配（成功的闭环匹配需要满足足够多的匹配特征点数）
-    /// 具体做法:
-    // mScw表示世界坐标系到当前帧mpCurrentKF的变换(由sim3得到的)
-    // 根据Sim3变换，将每个mvpLoopMapPoints投影到mpCurrentKF上，并根据尺度确定一个搜索区域，
-    // 根据该MapPoint的描述子与该区域内的特征点进行匹配，如果匹配误差小于TH_LOW即匹配成功，更新mvpCurrentMatchedPoints
-    // mvpCurrentMatchedPoints将用于SearchAndFuse中检测当前帧MapPoints与匹配的MapPoints是否存在冲突
-    matcher.SearchByProjection(mpCurrentKF, mScw, mvpLoopMapPoints, mvpCurrentMatchedPoints,10);
-
-    // 步骤8：判断当前帧与检测出的所有闭环关键帧是否有足够多的MapPoints匹配
-    // If enough matches accept Loop
-    // 统计(当前帧)与(闭环关键帧及其共视关键帧)是否有足够多的MapPoints匹配
-    int nTotalMatches = 0;
-    for(size_t i=0; i<mvpCurrentMatchedPoints.size(); i++)
-    {
-        if(mvpCurrentMatchedPoints[i])
-            nTotalMatches++;
-    }
+        //gSmw表示世界坐标系到候选帧的Sim3变换，Scw表示世界坐标系到当前帧的变换
+        g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
+        cv::Mat Scw = Converter::toCvMat(gScm*gSmw);
+        matcher.SearchByProjection(mpCurrentKF, Scw, vpLoopMapPoints, vpMapPointMatches,10);
 
-    // 足够多，匹配完成
-    if(nTotalMatches>=40)
-    {
-        // 清空mvpEnoughConsistentCandidates，除了匹配上的闭环关键帧
-        for(int i=0; i<nInitialCandidates; i++)
-            if(mvpEnoughConsistentCandidates[i]!=mpMatchedKF)
-                mvpEnoughConsistentCandidates[i]->SetErase();
-        return true;
-    }
-    else
-    {
-        //否则，清空全部候选关键帧
-        for(int i=0; i<nInitialCandidates; i++)
-            mvpEnoughConsistentCandidates[i]->SetErase();
-        mpCurrentKF->SetErase();
-        return false;
-    }
+        // 步骤6：判断当前帧与闭环关键帧及其共视关键帧是否有足够多的MapPoints匹配
+        int nTotalMatches = 0;
+        for(size_t i=0; i<vpMapPointMatches.size(); i++)
+        {
+            if(vpMapPointMatches[i])
+                nTotalMatches++;
+        }
 
+        // 和原来一样，通过Sim3优化后这个候选帧的验证就结束了，匹配是否足够由ComputeSim3()判断
+        if(nTotalMatches>=40)
+        {
+            result.bMatch = true;
+            result.nTotalMatches = nTotalMatches;
+            result.R = gScm.rotation().toRotationMatrix();
+            result.t = gScm.translation();
+            result.s = gScm.scale();
+            result.vpMatchedPoints.swap(vpMapPointMatches);
+            result.vpLoopMapPoints.swap(vpLoopMapPoints);
+        }
+        return;
+    }
 }
 
 /**
@@ -541,43 +512,40 @@ bool LoopClosing::ComputeSim3()
 * 3. 通过MapPoints的匹配关系更新这些帧之间的连接关系，即更新covisibility graph
 * 4. 对Essential Graph（Pose Graph）进行优化，MapPoints的位置则根据优化后的位姿做相对应的调整
 * 5. 创建线程进行全局Bundle Adjustment
+*
+* LocalMapping在1-3以及建立位姿图时暂停。位姿图建好后就恢复LocalMapping，优化期间LocalMapping跳过局部BA和关键帧剔除，
+* 优化结果由ApplyEssentialGraph()在地图更新锁下一次应用，应用期间LocalMapping再次暂停
 */
 void LoopClosing::CorrectLoop()
 {
-    cout << "Loop detected!" << endl;
+    // 闭环关键帧在另一个子地图中：把当前子地图整体变换到闭环关键帧所在子地图的坐标系并合并
+    const long unsigned int nCurrentMapId = mpCurrentKF->GetMapId();
+    const bool bMergeMaps = mpMatchedKF->GetMapId()!=nCurrentMapId;
+    if(bMergeMaps)
+        cout << "Map merge detected!" << endl;
+    else
+        cout << "Loop detected!" << endl;
+
+    // If a Global Bundle Adjustment is running, interrupt it
+    // 全局BA正在合并结果时地图已被部分更新，不能打断，等待合并结束
+    // 否则打断全局BA，闭环修正完成后全局BA线程从当前地图重新开始
+    // 必须在请求LocalMapping停止之前完成，否则合并结束时的Release()会取消这里的停止请求
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        while(mbMergingGBA)
+            mCondGBA.wait(lock);
+        if(mbRunningGBA)
+            mbStopGBA = true;
+    }
 
     // Send a stop signal to Local Mapping
     // Avoid new keyframes are inserted while correcting the loop
     // 步骤0：请求局部地图停止，防止局部地图线程中InsertKeyFrame函数插入新的关键帧
     mpLocalMapper->RequestStop();
 
-    // If a Global Bundle Adjustment is running, abort it
-    //如果正在进行全局BA，放弃它
-    if(isRunningGBA())
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
-
-        mnFullBAIdx++;
-
-
-        if(mpThreadGBA)
-        {
-            //1.当使用join()函数时，主调线程阻塞，等待被调线程终止，然后主调线程回收被调线程资源，并继续运行；
-            //2.当使用detach()函数时，主调线程继续运行，被调线程驻留后台运行，
-            //  主调线程无法再取得该被调线程的控制权。当主调线程结束时，由运行时库负责清理与被调线程相关的资源。
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
-        }
-    }
-
     // Wait until Local Mapping has effectively stopped
-    // 这里可以利用C++多线程特性修改
     // 等待局部地图停止
-    while(!mpLocalMapper->isStopped())
-    {
-        usleep(1000);
-    }
+    mpLocalMapper->WaitUntilStopped();
 
     // Ensure current keyframe is updated
     // 步骤1：根据共视关系更新当前帧与其它关键帧之间的连接
@@ -587,8 +555,14 @@ void LoopClosing::CorrectLoop()
     // Retrive keyframes connected to the current keyframe and compute corrected Sim3 pose by propagation
     // 取出与当前帧在covisibility graph连接的关键帧，包括当前关键帧
     // 取出当前帧和与此当前帧具有连接关系(共视)的关键帧
-    mvpCurrentConnectedKFs = mpCurrentKF->GetVectorCovisibleKeyFrames();
-    mvpCurrentConnectedKFs.push_back(mpCurrentKF);
+    // 合并子地图时当前子地图的所有关键帧都用同一个sim3修正(包括当前关键帧)
+    if(bMergeMaps)
+        mvpCurrentConnectedKFs = mpMap->GetMapKeyFrames(nCurrentMapId);
+    else
+    {
+        mvpCurrentConnectedKFs = mpCurrentKF->GetVectorCovisibleKeyFrames();
+        mvpCurrentConnectedKFs.push_back(mpCurrentKF);
+    }
 
     KeyFrameAndPose CorrectedSim3, NonCorrectedSim3;
     //mg2oScw是根据ComputeSim3()算出来的当前关键帧在世界坐标系中的sim3位姿,在ComputeSim3()被设置
@@ -700,6 +674,19 @@ void LoopClosing::CorrectLoop()
             pKFi->UpdateConnections();
         }
 
+        // 修正之后两个子地图在同一个坐标系下，当前子地图的关键帧改属闭环关键帧的子地图
+        // 队列中的关键帧和Tracking的状态用同一个变换修正: Snw = Scw(修正后)^-1 * Scw(修正前)
+        if(bMergeMaps)
+        {
+            MergePendingState(nCurrentMapId,mg2oScw.inverse()*NonCorrectedSim3[mpCurrentKF]);
+            mpMap->MergeMaps(nCurrentMapId,mpMatchedKF->GetMapId());
+
+            // 被合并子地图原来的原点不再固定，挂到闭环关键帧下，spanning tree只保留一个根
+            KeyFrame* pOldOrigin = mpMap->GetKeyFrame(nCurrentMapId);
+            if(pOldOrigin)
+                pOldOrigin->ChangeParent(mpMatchedKF);
+        }
+
         // Start Loop Fusion    回环融合
         // Update matched map points and replace if duplicated
         // 步骤3：检查当前帧的MapPoints与闭环匹配帧的MapPoints是否存在冲突，对冲突的MapPoints进行替换或填补
@@ -782,7 +769,25 @@ void LoopClosing::CorrectLoop()
     // NonCorrectedSim3：当前关键帧以及共视的关键帧的原位姿
     // CorrectedSim3：当前关键帧以及共视的关键帧的经过sim3修正的位姿
     // LoopConnections: 新的共视连接关系
-    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale);
+    // 位姿图建好后优化只在优化器内部进行，此时恢复LocalMapping
+    // 从这里到修正应用完成，地图一部分已修正一部分未修正，LocalMapping不做局部BA和关键帧剔除
+    KeyFrameAndPose InitialSim3, OptimizedSim3;
+    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale,
+                                      InitialSim3, OptimizedSim3, [this]()
+    {
+        {
+            unique_lock<mutex> lock(mMutexGBA);
+            mbMergingLoop = true;
+        }
+        mpLocalMapper->Release();
+    });
+
+    ApplyEssentialGraph(InitialSim3, OptimizedSim3);
+
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        mbMergingLoop = false;
+    }
 
     mpMap->InformNewBigChange();
 
@@ -793,17 +798,180 @@ void LoopClosing::CorrectLoop()
     mpCurrentKF->AddLoopEdge(mpMatchedKF);
 
     // Launch a new thread to perform Global Bundle Adjustment
-    mbRunningGBA = true;
-    mbFinishedGBA = false;
-    mbStopGBA = false;
+    // 步骤8：全局BA优化
+    {
+        unique_lock<mutex> lock(mMutexGBA);
+        mnLoopKFGBA = mpCurrentKF->mnId;
+        mbFinishedGBA = false;
+        mbStopGBA = false;
+        if(mbRunningGBA)
+        {
+            // 被打断的全局BA线程还在等待，通知它从当前地图重新开始
+            mbRestartGBA = true;
+        }
+        else
+        {
+            // 新建一个线程用于全局BA优化，上一个线程已经结束
+            mbRunningGBA = true;
+            if(mpThreadGBA)
+            {
+                mpThreadGBA->join();
+                delete mpThreadGBA;
+            }
+            mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment,this,mpCurrentKF->mnId);
+        }
+    }
+    mCondGBA.notify_all();
 
-    // 步骤8：新建一个线程用于全局BA优化
-    mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment,this,mpCurrentKF->mnId);
+    mLastLoopKFid = mpCurrentKF->mnId;
+}
+
+void LoopClosing::ApplyEssentialGraph(KeyFrameAndPose &InitialSim3, KeyFrameAndPose &OptimizedSim3)
+{
+    // 修正期间LocalMapping暂停，不会再插入关键帧和mappoint
+    // 修正只是O(N)的遍历，地图更新锁在整个过程中持有，Tracking不会看到部分关键帧已修正、点还没有修正的地图
+    PauseLocalMapping();
+
+    {
+        // Get Map Mutex
+        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+
+        // 优化期间LocalMapping新插入的关键帧不在位姿图中，为每一个记录修正值：
+        // 保持与它共视程度最高、并且已有修正值的关键帧(没有时用父关键帧)的相对位姿
+        // 按id从小到大处理，后插入的关键帧可以使用先插入的关键帧的修正值
+        // 与位姿图没有连接的关键帧(例如其它子地图中的)不修正
+        vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+        sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            KeyFrame* pKF = vpKFs[i];
+            if(pKF->isBad() || OptimizedSim3.count(pKF))
+                continue;
+
+            KeyFrame* pRefKF = NULL;
+            const vector<KeyFrame*> vpCovisible = pKF->GetVectorCovisibleKeyFrames();
+            for(size_t j=0; j<vpCovisible.size() && !pRefKF; j++)
+                if(OptimizedSim3.count(vpCovisible[j]))
+                    pRefKF = vpCovisible[j];
+            if(!pRefKF)
+            {
+                KeyFrame* pParent = pKF->GetParent();
+                if(pParent && OptimizedSim3.count(pParent))
+                    pRefKF = pParent;
+            }
+            if(!pRefKF)
+                continue;
+
+            cv::Mat Tcw = pKF->GetPose();
+            g2o::Sim3 Scw(Converter::toMatrix3d(Tcw.rowRange(0,3).colRange(0,3)),
+                          Converter::toVector3d(Tcw.rowRange(0,3).col(3)),1.0);
+            InitialSim3[pKF] = Scw;
+            OptimizedSim3[pKF] = Scw*InitialSim3[pRefKF].inverse()*OptimizedSim3[pRefKF];
+        }
+
+        // 修正所有记录了修正值的关键帧
+        for(KeyFrameAndPose::const_iterator mit=OptimizedSim3.begin(), mend=OptimizedSim3.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKF = mit->first;
+            const g2o::Sim3 &Saft = mit->second;
+
+            // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
+            Eigen::Matrix3d eigR = Saft.rotation().toRotationMatrix();
+            Eigen::Vector3d eigt = Saft.translation();
+            double s = Saft.scale();
+            eigt *=(1./s); //[R t/s;0 1]
+
+            pKF->SetPose(Converter::toCvSE3(eigR,eigt));
+        }
+
+        // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
+        // 修正mappoint，先使用没有优化的位姿投影到参考关键帧，再使用该关键帧优化之后的sim3位姿投影回来
+        const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+
+        // CorrectLoop()中修正过的点记录的是修正它的关键帧id(mvpCurrentConnectedKFs之一)
+        map<long unsigned int, KeyFrame*> mCorrectedKFs;
+        for(size_t i=0; i<mvpCurrentConnectedKFs.size(); i++)
+            mCorrectedKFs[mvpCurrentConnectedKFs[i]->mnId] = mvpCurrentConnectedKFs[i];
+
+        for(size_t i=0; i<vpMPs.size(); i++)
+        {
+            MapPoint* pMP = vpMPs[i];
+
+            if(pMP->isBad())
+                continue;
+
+            // 在CorrectLoop()中修正过的点使用修正它的关键帧，否则使用参考关键帧
+            // MergePendingState()修正的点记录的是队列中的关键帧，不在mCorrectedKFs中，也使用参考关键帧
+            KeyFrame* pRefKF = NULL;
+            if(pMP->mnCorrectedByKF==mpCurrentKF->mnId)
+            {
+                map<long unsigned int, KeyFrame*>::const_iterator mit = mCorrectedKFs.find(pMP->mnCorrectedReference);
+                if(mit!=mCorrectedKFs.end())
+                    pRefKF = mit->second;
+            }
+            if(!pRefKF)
+                pRefKF = pMP->GetReferenceKeyFrame();
+
+            KeyFrameAndPose::const_iterator itAft = OptimizedSim3.find(pRefKF);
+            if(itAft==OptimizedSim3.end())
+                continue;
+
+            const g2o::Sim3 &Srw = InitialSim3[pRefKF];
+            const g2o::Sim3 correctedSwr = itAft->second.inverse();
+
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(pMP->GetWorldPos());
+            Eigen::Matrix<double,3,1> eigCorrectedP3Dw = correctedSwr.map(Srw.map(eigP3Dw));
+
+            pMP->SetWorldPos(Converter::toCvMat(eigCorrectedP3Dw));
+            pMP->UpdateNormalAndDepth();
+        }
+    }
 
-    // Loop closed. Release Local Mapping.
     mpLocalMapper->Release();
+}
 
-    mLastLoopKFid = mpCurrentKF->mnId;
+void LoopClosing::MergePendingState(const long unsigned int nMapId, const g2o::Sim3 &g2oSnw)
+{
+    const g2o::Sim3 g2oSwn = g2oSnw.inverse();
+
+    // LocalMapping队列中的关键帧还不在地图中，CorrectLoop()没有修正它们
+    const vector<KeyFrame*> vpNewKFs = mpLocalMapper->GetNewKeyFrames();
+    for(size_t i=0; i<vpNewKFs.size(); i++)
+    {
+        KeyFrame* pKFi = vpNewKFs[i];
+        if(pKFi->GetMapId()!=nMapId)
+            continue;
+
+        cv::Mat Tiw = pKFi->GetPose();
+        g2o::Sim3 g2oSiw(Converter::toMatrix3d(Tiw.rowRange(0,3).colRange(0,3)),Converter::toVector3d(Tiw.rowRange(0,3).col(3)),1.0);
+        g2o::Sim3 g2oCorrectedSiw = g2oSiw*g2oSwn;
+        Eigen::Vector3d eigt = g2oCorrectedSiw.translation()/g2oCorrectedSiw.scale();
+        pKFi->SetPose(Converter::toCvSE3(g2oCorrectedSiw.rotation().toRotationMatrix(),eigt));
+
+        // 只被队列中的关键帧观测的地图点(例如双目新建的点)也没有被修正
+        vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
+        for(size_t iMP=0; iMP<vpMPsi.size(); iMP++)
+        {
+            MapPoint* pMPi = vpMPsi[iMP];
+            if(!pMPi || pMPi->isBad() || pMPi->mnCorrectedByKF==mpCurrentKF->mnId)
+                continue;
+
+            Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(pMPi->GetWorldPos());
+            pMPi->SetWorldPos(Converter::toCvMat(g2oSnw.map(eigP3Dw)));
+            pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
+            pMPi->mnCorrectedReference = pKFi->mnId;
+            pMPi->UpdateNormalAndDepth();
+        }
+    }
+
+    // Tracking在跟踪每一帧时持有地图更新锁，这里不会和它同时修改
+    const cv::Mat Rnw = Converter::toCvMat(g2oSnw.rotation().toRotationMatrix());
+    const cv::Mat tnw = Converter::toCvMat(g2oSnw.translation());
+    const float s = g2oSnw.scale();
+
+    unique_lock<mutex> lock(mMutexTrackers);
+    for(size_t i=0; i<mvpTrackers.size(); i++)
+        mvpTrackers[i]->TransformMap(nMapId,Rnw,tnw,s);
 }
 
 /** 目的： 尽量使用闭环关键帧及其共视关键帧所观测到的mappoint来替换旧的mappoint
@@ -815,39 +983,57 @@ void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap)
 {
     ORBmatcher matcher(0.8);
 
-    //遍历CorrectedPosesMap
+    // mvpLoopMapPoints: 闭环关键帧及其所有共视关键帧的mappoint
+    // 建立一次体素索引，每个关键帧只投影落在其视锥内的点，而不是全部的点
+    const MapPointGrid grid(mvpLoopMapPoints);
+    const int nLP = mvpLoopMapPoints.size();
+
+    vector<KeyFrame*> vpKFs;
+    vector<cv::Mat> vScw;
+    vpKFs.reserve(CorrectedPosesMap.size());
+    vScw.reserve(CorrectedPosesMap.size());
     for(KeyFrameAndPose::const_iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
     {
         //取关键帧i，包含了当前关键帧
-        KeyFrame* pKF = mit->first;
+        vpKFs.push_back(mit->first);
         //取关键帧i的sim3修正位姿， 是从世界坐标系到相机坐标系的sim3变换
-        g2o::Sim3 g2oScw = mit->second;
-        cv::Mat cvScw = Converter::toCvMat(g2oScw); //(sR,t)
-
-        //mvpLoopMapPoints: 闭环关键帧及其所有共视关键帧的mappoint
-        vector<MapPoint*> vpReplacePoints(mvpLoopMapPoints.size(),static_cast<MapPoint*>(NULL));
-
-        // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
-        ///使用关键帧i的sim3位姿将mvpLoopMapPoints投影到关键帧i，进行匹配搜索,
-        ///寻找在关键帧pKF中，与当前这个mappoint可以匹配上的特征点，
-        ///使得当前这个mappoint可以和关键帧pKF建立联系
-        // mvpLoopMapPoints: 闭环关键帧及其所有共视关键帧的mappoint
-        // vpReplacePoint大小与vpPoints一致，储存着被替换下来的mappoint
+        vScw.push_back(Converter::toCvMat(mit->second)); //(sR,t)
+    }
+    const int nKFs = vpKFs.size();
+
+    // Project MapPoints into KeyFrame using a given Sim3 and search for duplicated MapPoints.
+    // 步骤1：对各个关键帧并行做投影搜索(只读)
+    // vvMatches[i][j]: mvpLoopMapPoints[j]在关键帧i中匹配的特征点序号，-1表示没有匹配
+    vector<vector<int> > vvMatches(nKFs);
+    mThreadPool.ParallelFor(nKFs,[&](int i)
+    {
+        vector<int> vnCandidates;
+        grid.GetPointsInFrustum(vpKFs[i],vScw[i],vnCandidates);
+        vvMatches[i].assign(nLP,-1);
+        matcher.SearchForFuse(vpKFs[i],vScw[i],mvpLoopMapPoints,vnCandidates,4,vvMatches[i]);
+    });
+
+    // 步骤2：按原来的顺序逐个关键帧融合
+    for(int i=0; i<nKFs; i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+
+        // vpReplacePoint大小与mvpLoopMapPoints一致，储存着被替换下来的mappoint
         // 如果匹配的pKF中的特征点本身有就的匹配mappoint，就用mvpLoopMapPoints替代它。
-        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4,vpReplacePoints);
+        vector<MapPoint*> vpReplacePoints(nLP,static_cast<MapPoint*>(NULL));
+        matcher.ApplyFuse(pKF,mvpLoopMapPoints,vvMatches[i],vpReplacePoints);
 
         // Get Map Mutex
         unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
-        const int nLP = mvpLoopMapPoints.size();
-        for(int i=0; i<nLP;i++)
+        for(int j=0; j<nLP;j++)
         {
             //遍历替换下来的mappoint
-            MapPoint* pRep = vpReplacePoints[i];
+            MapPoint* pRep = vpReplacePoints[j];
             if(pRep)
             {
-                //将pRep的相关信息继承给mvpLoopMapPoints[i]，修改自己在其他keyframe的信息，并且“自杀”
-                //mvpLoopMapPoints[i] : 用来替换的mappoint，也就是新的mappoint
-                pRep->Replace(mvpLoopMapPoints[i]);
+                //将pRep的相关信息继承给mvpLoopMapPoints[j]，修改自己在其他keyframe的信息，并且“自杀”
+                //mvpLoopMapPoints[j] : 用来替换的mappoint，也就是新的mappoint
+                pRep->Replace(mvpLoopMapPoints[j]);
             }
         }
     }
@@ -860,7 +1046,10 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
+    // 等待ResetIfRequested()完成重置
+    unique_lock<mutex> lock(mMutexWake);
     while(1)
     {
         {
@@ -868,30 +1057,85 @@ void LoopClosing::RequestReset()
             if(!mbResetRequested)
                 break;
         }
-        usleep(5000);
+        mCondWake.wait(lock);
     }
 }
 
 void LoopClosing::ResetIfRequested()
 {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbResetRequested)
     {
+        unique_lock<mutex> lock(mMutexReset);
+        if(!mbResetRequested)
+            return;
         mlpLoopKeyFrameQueue.clear();
         mLastLoopKFid=0;
         mbResetRequested=false;
     }
+    WakeUp();
 }
 
 void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 {
     //nLoopKF=mpCurrentKF->mnId 当前关键帧id
 
-    cout << "Starting Global Bundle Adjustment" << endl;
+    // 全局BA在整个运行和合并期间持有所有关键帧和mappoint的指针，结束前不确认
+    const int nReclaimSlot = mpMap->RegisterReclaimThread();
 
-    int idx =  mnFullBAIdx;
-    Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false);
+    while(1)
+    {
+        cout << "Starting Global Bundle Adjustment" << endl;
+
+        Optimizer::GlobalBundleAdjustemnt(mpMap,mnGBAIterations,&mbStopGBA,nLoopKF,false,&mnGBAIterationsDone);
+
+        // 优化结束或被新的闭环打断(每次迭代后检查mbStopGBA)
+        // 被打断时等待CorrectLoop()完成，再从当前地图(已经包含新闭环的修正)重新开始
+        bool bRestart = false;
+        {
+            unique_lock<mutex> lock(mMutexGBA);
+            while(!mbRestartGBA && mbStopGBA)
+                mCondGBA.wait(lock);
+            if(mbRestartGBA)
+            {
+                mbRestartGBA = false;
+                nLoopKF = mnLoopKFGBA;
+                bRestart = true;
+            }
+            else
+                mbMergingGBA = true;
+        }
 
+        if(!bRestart)
+            break;
+
+        cout << "Global Bundle Adjustment interrupted by a new loop, restarting" << endl;
+    }
+
+    cout << "Global Bundle Adjustment finished" << endl;
+    cout << "Updating map ..." << endl;
+
+    MergeGlobalBundleAdjustment(nLoopKF);
+
+    cout << "Map updated!" << endl;
+
+    mpMap->UnregisterReclaimThread(nReclaimSlot);
+
+    unique_lock<mutex> lock(mMutexGBA);
+    mbMergingGBA = false;
+    mbFinishedGBA = true;
+    mbRunningGBA = false;
+    mCondGBA.notify_all();
+}
+
+void LoopClosing::PauseLocalMapping()
+{
+    mpLocalMapper->RequestStop();
+    // Wait until Local Mapping has effectively stopped
+    // 局部建图线程结束时也会被标记为停止
+    mpLocalMapper->WaitUntilStopped();
+}
+
+void LoopClosing::MergeGlobalBundleAdjustment(unsigned long nLoopKF)
+{
     // Update all MapPoints and KeyFrames
     // 更新所有mappoint和关键帧
     // Local Mapping was active during BA, that means that there might be new keyframes
@@ -899,57 +1143,39 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
     // We need to propagate the correction through the spanning tree
     // 如果在全局BA的时候，局部地图器正在激活，这说明可能有新的关键帧插入
     // 新的关键帧没有被包含在这次BA里面，因此通过spanning tree父节点等关系将修正值传播
-    {
-        unique_lock<mutex> lock(mMutexGBA);
-        if(idx!=mnFullBAIdx)
-            return;
+    // 合并期间LocalMapping一直暂停，不会插入新的关键帧和地图点，spanning tree和地图点集合都不再变化；
+    // 地图更新锁只在每批内部持有，批与批之间Tracking可以继续跟踪(LocalMapping暂停时不会插入关键帧)
+    PauseLocalMapping();
 
-        if(!mbStopGBA)
-        {
-            cout << "Global Bundle Adjustment finished" << endl;
-            cout << "Updating map ..." << endl;
-            mpLocalMapper->RequestStop();
-            // Wait until Local Mapping has effectively stopped
-            // 等待Local Mapping停止
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
-            {
-                usleep(1000);
-            }
+    // Correct keyframes starting at map first keyframe
+    // 从地图的第一个关键帧开始修正关键帧
+    list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
 
+    while(!lpKFtoCheck.empty())
+    {
+        {
             // Get Map Mutex
             unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
-            // Correct keyframes starting at map first keyframe
-            // 从地图的第一个关键帧开始修正关键帧
-            list<KeyFrame*> lpKFtoCheck(mpMap->mvpKeyFrameOrigins.begin(),mpMap->mvpKeyFrameOrigins.end());
-
-            while(!lpKFtoCheck.empty())
+            for(int n=0; n<mnMergeBatchKFs && !lpKFtoCheck.empty(); n++)
             {
                 //取一个关键帧
                 KeyFrame* pKF = lpKFtoCheck.front();
-                //取子节点，共视的关键帧集合
+                //取子节点
                 const set<KeyFrame*> sChilds = pKF->GetChilds();
                 //取关键帧PKF的位姿的逆，即从相机坐标系到世界坐标系的变换
                 cv::Mat Twc = pKF->GetPoseInverse();
-                //遍历共视的关键帧集合
                 for(set<KeyFrame*>::const_iterator sit=sChilds.begin();sit!=sChilds.end();sit++)
                 {
-                    //nLoopKF=mpCurrentKF->mnId 当前关键帧id
                     KeyFrame* pChild = *sit;
-                    if(pChild->mnBAGlobalForKF!=nLoopKF)    //如果这个值没有被设置，表示是Local Mapping新插进来的关键帧
+                    if(pChild->mnBAGlobalForKF!=nLoopKF)
                     {
-                        //如果这个值没有被设置，表示是Local Mapping新插进来的关键帧
-                        //需要将修正值传播
-
-                        //Twc: 关键帧PKF的位姿的逆，即从相机坐标系到世界坐标系的变换
+                        //如果这个值没有被设置，表示是Local Mapping新插进来的关键帧，需要将修正值传播
                         //Tchildc ： 从关键帧pKF到子关键帧pChild的变换
                         cv::Mat Tchildc = pChild->GetPose()*Twc;
-                        //传播修正到子关键帧的全局位姿
-                        //得到世界坐标系到子关键帧pChild的变换，这是经过BA修正的
                         pChild->mTcwGBA = Tchildc*pKF->mTcwGBA;//*Tcorc*pKF->mTcwGBA;
                         pChild->mnBAGlobalForKF=nLoopKF;
                     }
-                    //表示需要一直传播，直到lpKFtoCheck里面的某个元素(关键帧)没有共视的关键帧集合
                     lpKFtoCheck.push_back(pChild);
                 }
 
@@ -959,31 +1185,36 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
                 pKF->SetPose(pKF->mTcwGBA);
                 lpKFtoCheck.pop_front();
             }
+        }
+    }
+
+    // Correct MapPoints
+    // 修正mappoint，暂停期间没有新建的地图点，这里取到的就是需要修正的全部地图点
+    const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+
+    for(size_t i0=0; i0<vpMPs.size(); i0+=mnMergeBatchMPs)
+    {
+        const size_t iend = min(vpMPs.size(),i0+mnMergeBatchMPs);
 
-            // Correct MapPoints
-            // 修正mappoint
-            // 取地图所有mappoint
-            const vector<MapPoint*> vpMPs = mpMap->GetAllMapPoints();
+        {
+            // Get Map Mutex
+            unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
-            for(size_t i=0; i<vpMPs.size(); i++)
+            for(size_t i=i0; i<iend; i++)
             {
                 MapPoint* pMP = vpMPs[i];
 
                 if(pMP->isBad())
                     continue;
-                //如果这个mappoint没有经历BA,也需要传播修正值
+
                 if(pMP->mnBAGlobalForKF==nLoopKF)
                 {
                     // If optimized by Global BA, just update
-                    // 表明这个这个mappoint是经过BA的
                     pMP->SetWorldPos(pMP->mPosGBA);
                 }
                 else
                 {
                     // Update according to the correction of its reference keyframe
-                    // 这个mappoint没有经历BA
-
-                    //取mappoint参考关键帧,即生成这个mappoint的关键帧为参考关键帧
                     KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
 
                     //如果这个mappoint的参考关键帧也没有经过BA，则跳过这个mappoint
@@ -991,7 +1222,6 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
                         continue;
 
                     // Map to non-corrected camera
-                    // mTcwBefGBA:储存着BA之前的结果
                     // 利用参考关键帧BA之前的位姿，将mappoint投影到参考关键帧相机坐标系
                     cv::Mat Rcw = pRefKF->mTcwBefGBA.rowRange(0,3).colRange(0,3);
                     cv::Mat tcw = pRefKF->mTcwBefGBA.rowRange(0,3).col(3);
@@ -1002,27 +1232,25 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
                     cv::Mat Twc = pRefKF->GetPoseInverse();
                     cv::Mat Rwc = Twc.rowRange(0,3).colRange(0,3);
                     cv::Mat twc = Twc.rowRange(0,3).col(3);
-                    // 设置修正的坐标
                     pMP->SetWorldPos(Rwc*Xc+twc);
                 }
             }
-            //表明地图有大改变
-            mpMap->InformNewBigChange();
-            //
-            mpLocalMapper->Release();
-
-            cout << "Map updated!" << endl;
         }
-        //没用的标志
-        mbFinishedGBA = true;
-        mbRunningGBA = false;
     }
+
+    mpLocalMapper->Release();
+
+    //表明地图有大改变
+    mpMap->InformNewBigChange();
 }
 
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LoopClosing::CheckFinish()
@@ -1033,8 +1261,11 @@ bool LoopClosing::CheckFinish()
 
 void LoopClosing::SetFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinished = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinished = true;
+    }
+    WakeUp();
 }
 
 bool LoopClosing::isFinished()
@@ -1043,5 +1274,47 @@ bool LoopClosing::isFinished()
     return mbFinished;
 }
 
+void LoopClosing::WaitUntilFinished()
+{
+    {
+        unique_lock<mutex> lock(mMutexWake);
+        while(!isFinished())
+            mCondWake.wait(lock);
+    }
+
+    // 全局BA在单独的线程中，闭环线程结束后仍可能在运行
+    unique_lock<mutex> lock(mMutexGBA);
+    while(mbRunningGBA)
+        mCondGBA.wait(lock);
+}
+
+bool LoopClosing::HasWork()
+{
+    if(CheckNewKeyFrames())
+        return true;
+
+    {
+        unique_lock<mutex> lock(mMutexReset);
+        if(mbResetRequested)
+            return true;
+    }
+
+    return CheckFinish();
+}
+
+void LoopClosing::WaitForWork()
+{
+    unique_lock<mutex> lock(mMutexWake);
+    while(!HasWork())
+        mCondWake.wait(lock);
+}
+
+void LoopClosing::WakeUp()
+{
+    // 与LocalMapping::WakeUp()相同，调用时不能持有其它锁
+    unique_lock<mutex> lock(mMutexWake);
+    mCondWake.notify_all();
+}
+
 
 } //namespace ORB_SLAM
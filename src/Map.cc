@@ -25,46 +25,74 @@
 namespace ORB_SLAM2
 {
 
-Map::Map():mnMaxKFid(0),mnBigChangeIdx(0)
+Map::Map():mnMaxKFid(0),mnEraseEpoch(0),mnNextReclaimSlot(0),mnBigChangeIdx(0),mbChangeFeed(false),mnClearIdx(0)
 {
 }
 
 void Map::AddKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.insert(pKF);
-    if(pKF->mnId>mnMaxKFid) //更新地图最大关键帧id
-        mnMaxKFid=pKF->mnId;
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        if(mspKeyFrames.insert(pKF).second)
+        {
+            mmKeyFramesById[pKF->mnId] = pKF;
+            // 创建之后所属的子地图被合并了
+            map<long unsigned int,long unsigned int>::const_iterator mit = mmMergedMaps.find(pKF->GetMapId());
+            if(mit!=mmMergedMaps.end())
+                pKF->SetMapId(mit->second);
+            mmMapKeyFrames[pKF->GetMapId()]++;
+        }
+        if(pKF->mnId>mnMaxKFid) //更新地图最大关键帧id
+            mnMaxKFid=pKF->mnId;
+        NotifyKeyFrameChanged(pKF,CHANGE_ADDED);
+    }
 }
 
 void Map::AddMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
     mspMapPoints.insert(pMP);
+    // 在地图锁下发布，与EraseMapPoint()的ERASED保持先后顺序
+    if(mbChangeFeed)
+        pMP->PublishWorldPos(CHANGE_ADDED);
 }
 
 void Map::EraseMapPoint(MapPoint *pMP)
 {
     unique_lock<mutex> lock(mMutexMap);
-    mspMapPoints.erase(pMP);
-
-    // TODO: This only erase the pointer.
-    // Delete the MapPoint
+    // 只删除指针，对象由ReclaimErased()延迟回收
+    if(!mspMapPoints.erase(pMP))
+        return;
+    mlErasedMapPoints.push_back(make_pair(++mnEraseEpoch,pMP));
+    NotifyMapPointChanged(pMP->mnId,CHANGE_ERASED,cv::Mat());
 }
 
 void Map::EraseKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexMap);
-    mspKeyFrames.erase(pKF);
-
-    // TODO: This only erase the pointer.
-    // Delete the MapPoint
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        // 只删除指针，数据由ReclaimErased()延迟释放
+        if(!mspKeyFrames.erase(pKF))
+            return;
+        mmKeyFramesById.erase(pKF->mnId);
+        if(--mmMapKeyFrames[pKF->GetMapId()]==0)
+            mmMapKeyFrames.erase(pKF->GetMapId());
+        mlErasedKeyFrames.push_back(make_pair(++mnEraseEpoch,pKF));
+        NotifyKeyFrameChanged(pKF,CHANGE_ERASED);
+    }
 }
 
 void Map::SetReferenceMapPoints(const vector<MapPoint *> &vpMPs)
 {
+    // 只保存id，读取的线程(可视化)不需要访问可能已经被回收的mappoint
+    vector<long unsigned int> vnIds;
+    vnIds.reserve(vpMPs.size());
+    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
+        if(vpMPs[i])
+            vnIds.push_back(vpMPs[i]->mnId);
+
     unique_lock<mutex> lock(mMutexMap);
-    mvpReferenceMapPoints = vpMPs;
+    mvnReferenceMapPointIds.swap(vnIds);
 }
 
 void Map::InformNewBigChange()
@@ -85,6 +113,26 @@ vector<KeyFrame*> Map::GetAllKeyFrames()
     return vector<KeyFrame*>(mspKeyFrames.begin(),mspKeyFrames.end());
 }
 
+vector<KeyFrame*> Map::GetKeyFramesAfter(const long unsigned int nId, const size_t nMax)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    vector<KeyFrame*> vpKFs;
+    vpKFs.reserve(min(nMax,mmKeyFramesById.size()));
+    for(map<long unsigned int,KeyFrame*>::const_iterator mit=mmKeyFramesById.upper_bound(nId), mend=mmKeyFramesById.end();
+        mit!=mend && vpKFs.size()<nMax; mit++)
+        vpKFs.push_back(mit->second);
+    return vpKFs;
+}
+
+KeyFrame* Map::GetKeyFrame(const long unsigned int nId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    map<long unsigned int,KeyFrame*>::const_iterator mit = mmKeyFramesById.find(nId);
+    if(mit==mmKeyFramesById.end())
+        return static_cast<KeyFrame*>(NULL);
+    return mit->second;
+}
+
 vector<MapPoint*> Map::GetAllMapPoints()
 {
     unique_lock<mutex> lock(mMutexMap);
@@ -103,10 +151,10 @@ long unsigned int Map::KeyFramesInMap()
     return mspKeyFrames.size();
 }
 
-vector<MapPoint*> Map::GetReferenceMapPoints()
+vector<long unsigned int> Map::GetReferenceMapPointIds()
 {
     unique_lock<mutex> lock(mMutexMap);
-    return mvpReferenceMapPoints;
+    return mvnReferenceMapPointIds;
 }
 
 long unsigned int Map::GetMaxKFid()
@@ -115,6 +163,152 @@ long unsigned int Map::GetMaxKFid()
     return mnMaxKFid;
 }
 
+long unsigned int Map::GetCurrentMapId(const int nAgentId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    map<int,long unsigned int>::const_iterator mit = mmCurrentMapIds.find(nAgentId);
+    return mit==mmCurrentMapIds.end() ? 0 : mit->second;
+}
+
+void Map::StartNewMap(const int nAgentId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    mmCurrentMapIds[nAgentId] = KeyFrame::nNextId;
+}
+
+void Map::SetCurrentMapId(const long unsigned int nMapId, const int nAgentId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    mmCurrentMapIds[nAgentId] = nMapId;
+}
+
+void Map::MergeMaps(const long unsigned int nFrom, const long unsigned int nTo)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
+    {
+        KeyFrame* pKF = *sit;
+        if(pKF->GetMapId()==nFrom)
+            pKF->SetMapId(nTo);
+    }
+
+    // 之前合并到nFrom的子地图现在也属于nTo
+    for(map<long unsigned int,long unsigned int>::iterator mit=mmMergedMaps.begin(), mend=mmMergedMaps.end(); mit!=mend; mit++)
+        if(mit->second==nFrom)
+            mit->second = nTo;
+    mmMergedMaps[nFrom] = nTo;
+
+    mmMapKeyFrames[nTo] += mmMapKeyFrames[nFrom];
+    mmMapKeyFrames.erase(nFrom);
+
+    // 原来的原点已经挂到闭环关键帧下(见LoopClosing::CorrectLoop())，不再是spanning tree的根
+    for(vector<KeyFrame*>::iterator vit=mvpKeyFrameOrigins.begin(); vit!=mvpKeyFrameOrigins.end(); )
+    {
+        if((*vit)->mnId==nFrom)
+            vit = mvpKeyFrameOrigins.erase(vit);
+        else
+            vit++;
+    }
+
+    for(map<int,long unsigned int>::iterator mit=mmCurrentMapIds.begin(), mend=mmCurrentMapIds.end(); mit!=mend; mit++)
+        if(mit->second==nFrom)
+            mit->second = nTo;
+}
+
+vector<KeyFrame*> Map::GetMapKeyFrames(const long unsigned int nMapId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    vector<KeyFrame*> vpKFs;
+    for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
+        if((*sit)->GetMapId()==nMapId)
+            vpKFs.push_back(*sit);
+    return vpKFs;
+}
+
+long unsigned int Map::KeyFramesInMap(const long unsigned int nMapId)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    map<long unsigned int,long unsigned int>::const_iterator mit = mmMapKeyFrames.find(nMapId);
+    return mit==mmMapKeyFrames.end() ? 0 : mit->second;
+}
+
+int Map::GetNumberOfMaps()
+{
+    unique_lock<mutex> lock(mMutexMap);
+    return mmMapKeyFrames.size();
+}
+
+void Map::ReclaimErased(int &nDeletedMPs, int &nReleasedKFs)
+{
+    vector<MapPoint*> vpToDelete;
+    vector<KeyFrame*> vpToRelease;
+    {
+        unique_lock<mutex> lock(mMutexMap);
+        // 所有已注册的线程都确认过的删除序号
+        long unsigned int nSafeEpoch = mnEraseEpoch;
+        for(map<int,long unsigned int>::const_iterator mit=mmReclaimEpochs.begin(), mend=mmReclaimEpochs.end(); mit!=mend; mit++)
+            nSafeEpoch = min(nSafeEpoch,mit->second);
+
+        // 列表按删除顺序排列，前面的先满足条件
+        while(!mlErasedMapPoints.empty() && mlErasedMapPoints.front().first<=nSafeEpoch)
+        {
+            vpToDelete.push_back(mlErasedMapPoints.front().second);
+            mlErasedMapPoints.pop_front();
+        }
+        while(!mlErasedKeyFrames.empty() && mlErasedKeyFrames.front().first<=nSafeEpoch)
+        {
+            vpToRelease.push_back(mlErasedKeyFrames.front().second);
+            mlErasedKeyFrames.pop_front();
+        }
+        mvpReleasedKeyFrames.insert(mvpReleasedKeyFrames.end(),vpToRelease.begin(),vpToRelease.end());
+    }
+
+    for(size_t i=0; i<vpToDelete.size(); i++)
+        delete vpToDelete[i];
+
+    for(size_t i=0; i<vpToRelease.size(); i++)
+        vpToRelease[i]->ReleaseData();
+
+    nDeletedMPs = vpToDelete.size();
+    nReleasedKFs = vpToRelease.size();
+}
+
+int Map::RegisterReclaimThread()
+{
+    unique_lock<mutex> lock(mMutexMap);
+    // 刚注册的线程还没有持有任何指针，之前删除的对象不需要等它确认
+    const int nSlot = mnNextReclaimSlot++;
+    mmReclaimEpochs[nSlot] = mnEraseEpoch;
+    return nSlot;
+}
+
+void Map::UnregisterReclaimThread(const int nSlot)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    mmReclaimEpochs.erase(nSlot);
+}
+
+long unsigned int Map::GetEraseEpoch()
+{
+    unique_lock<mutex> lock(mMutexMap);
+    return mnEraseEpoch;
+}
+
+void Map::QuiescentState(const int nSlot, const long unsigned int nEpoch)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    map<int,long unsigned int>::iterator mit = mmReclaimEpochs.find(nSlot);
+    if(mit!=mmReclaimEpochs.end() && mit->second<nEpoch)
+        mit->second = nEpoch;
+}
+
+void Map::GetErasedCount(int &nErasedMPs, int &nErasedKFs)
+{
+    unique_lock<mutex> lock(mMutexMap);
+    nErasedMPs = mlErasedMapPoints.size();
+    nErasedKFs = mlErasedKeyFrames.size();
+}
+
 void Map::clear()
 {
     for(set<MapPoint*>::iterator sit=mspMapPoints.begin(), send=mspMapPoints.end(); sit!=send; sit++)
@@ -123,11 +317,78 @@ void Map::clear()
     for(set<KeyFrame*>::iterator sit=mspKeyFrames.begin(), send=mspKeyFrames.end(); sit!=send; sit++)
         delete *sit;
 
+    for(list<pair<long unsigned int,MapPoint*> >::iterator lit=mlErasedMapPoints.begin(), lend=mlErasedMapPoints.end(); lit!=lend; lit++)
+        delete lit->second;
+
+    for(list<pair<long unsigned int,KeyFrame*> >::iterator lit=mlErasedKeyFrames.begin(), lend=mlErasedKeyFrames.end(); lit!=lend; lit++)
+        delete lit->second;
+
+    for(size_t i=0; i<mvpReleasedKeyFrames.size(); i++)
+        delete mvpReleasedKeyFrames[i];
+
     mspMapPoints.clear();
     mspKeyFrames.clear();
+    mmKeyFramesById.clear();
+    mlErasedMapPoints.clear();
+    mlErasedKeyFrames.clear();
+    mvpReleasedKeyFrames.clear();
     mnMaxKFid = 0;
-    mvpReferenceMapPoints.clear();
+    mmCurrentMapIds.clear();
+    mmMergedMaps.clear();
+    mmMapKeyFrames.clear();
+    mvnReferenceMapPointIds.clear();
     mvpKeyFrameOrigins.clear();
+
+    unique_lock<mutex> lock(mMutexChanges);
+    mmMapPointChanges.clear();
+    mmKeyFrameChanges.clear();
+    mnClearIdx++;
+}
+
+void Map::EnableChangeFeed()
+{
+    mbChangeFeed = true;
+}
+
+void Map::NotifyMapPointChanged(const long unsigned int nId, const int nFlag, const cv::Mat &Pos)
+{
+    if(!mbChangeFeed)
+        return;
+
+    unique_lock<mutex> lock(mMutexChanges);
+    MapPointChange &change = mmMapPointChanges[nId];
+    change.nFlags |= nFlag;
+    if(!Pos.empty())
+    {
+        change.x = Pos.at<float>(0);
+        change.y = Pos.at<float>(1);
+        change.z = Pos.at<float>(2);
+    }
+}
+
+void Map::NotifyKeyFrameChanged(KeyFrame *pKF, const int nFlag)
+{
+    if(!mbChangeFeed)
+        return;
+
+    unique_lock<mutex> lock(mMutexChanges);
+    mmKeyFrameChanges[pKF] |= nFlag;
+}
+
+int Map::TakeMapPointChanges(unordered_map<long unsigned int,MapPointChange> &mChanges)
+{
+    mChanges.clear();
+    unique_lock<mutex> lock(mMutexChanges);
+    mChanges.swap(mmMapPointChanges);
+    return mnClearIdx;
+}
+
+int Map::TakeKeyFrameChanges(unordered_map<KeyFrame*,int> &mChanges)
+{
+    mChanges.clear();
+    unique_lock<mutex> lock(mMutexChanges);
+    mChanges.swap(mmKeyFrameChanges);
+    return mnClearIdx;
 }
 
 } //namespace ORB_SLAM
@@ -23,12 +23,56 @@
 #include "KeyFrame.h"
 #include <pangolin/pangolin.h>
 #include <mutex>
+#include <limits>
+#include <algorithm>
 
 namespace ORB_SLAM2
 {
 
 
-MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap)
+GlDynamicBuffer::GlDynamicBuffer():
+    mnBuffer(0), mnCapacity(0), mnDirtyBegin(numeric_limits<size_t>::max()), mnDirtyEnd(0)
+{
+}
+
+void GlDynamicBuffer::SetDirty(const size_t nBegin, const size_t nEnd)
+{
+    mnDirtyBegin = min(mnDirtyBegin,nBegin);
+    mnDirtyEnd = max(mnDirtyEnd,nEnd);
+}
+
+void GlDynamicBuffer::Upload(const void *pData, const size_t nBytes)
+{
+    if(mnBuffer==0)
+        glGenBuffers(1,&mnBuffer);
+
+    glBindBuffer(GL_ARRAY_BUFFER,mnBuffer);
+    if(nBytes>mnCapacity)
+    {
+        mnCapacity = max(nBytes,2*mnCapacity);
+        glBufferData(GL_ARRAY_BUFFER,mnCapacity,NULL,GL_DYNAMIC_DRAW);
+        mnDirtyBegin = 0;
+        mnDirtyEnd = nBytes;
+    }
+
+    mnDirtyEnd = min(mnDirtyEnd,nBytes);
+    if(mnDirtyBegin<mnDirtyEnd)
+        glBufferSubData(GL_ARRAY_BUFFER,mnDirtyBegin,mnDirtyEnd-mnDirtyBegin,
+                        static_cast<const char*>(pData)+mnDirtyBegin);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+
+    mnDirtyBegin = numeric_limits<size_t>::max();
+    mnDirtyEnd = 0;
+}
+
+void GlDynamicBuffer::Bind() const
+{
+    glBindBuffer(GL_ARRAY_BUFFER,mnBuffer);
+}
+
+
+MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap),
+    mnPointsClearIdx(-1), mnKeyFramesClearIdx(-1), mbGraphDirty(false)
 {
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
 
@@ -39,151 +83,289 @@ MapDrawer::MapDrawer(Map* pMap, const string &strSettingPath):mpMap(pMap)
     mCameraSize = fSettings["Viewer.CameraSize"];
     mCameraLineWidth = fSettings["Viewer.CameraLineWidth"];
 
+    // 地图从此开始记录增量变化，绘制时不再每帧拷贝整个地图
+    mpMap->EnableChangeFeed();
 }
 
-void MapDrawer::DrawMapPoints()
+void MapDrawer::SetMapPointColor(const int nSlot, const unsigned char r, const unsigned char g, const unsigned char b)
 {
-    //取地图上所有mappoint
-    const vector<MapPoint*> &vpMPs = mpMap->GetAllMapPoints();
-    const vector<MapPoint*> &vpRefMPs = mpMap->GetReferenceMapPoints();
-
-    set<MapPoint*> spRefMPs(vpRefMPs.begin(), vpRefMPs.end());
+    mvPointColors[3*nSlot] = r;
+    mvPointColors[3*nSlot+1] = g;
+    mvPointColors[3*nSlot+2] = b;
+    mPointColorBuffer.SetDirty(3*nSlot,3*nSlot+3);
+}
 
-    if(vpMPs.empty())
-        return;
+void MapDrawer::RemoveMapPoint(const int nSlot)
+{
+    const int nLast = mvPointIds.size()-1;
+    mmPointSlots.erase(mvPointIds[nSlot]);
+    if(nSlot!=nLast)
+    {
+        copy(mvPointVertices.begin()+3*nLast,mvPointVertices.end(),mvPointVertices.begin()+3*nSlot);
+        copy(mvPointColors.begin()+3*nLast,mvPointColors.end(),mvPointColors.begin()+3*nSlot);
+        mvPointIds[nSlot] = mvPointIds[nLast];
+        mmPointSlots[mvPointIds[nSlot]] = nSlot;
+        mPointVertexBuffer.SetDirty(3*nSlot*sizeof(float),(3*nSlot+3)*sizeof(float));
+        mPointColorBuffer.SetDirty(3*nSlot,3*nSlot+3);
+    }
+    mvPointVertices.resize(3*nLast);
+    mvPointColors.resize(3*nLast);
+    mvPointIds.pop_back();
+}
 
-    glPointSize(mPointSize);
-    glBegin(GL_POINTS);
-    glColor3f(0.0,0.0,0.0);
+void MapDrawer::UpdateMapPoints()
+{
+    unordered_map<long unsigned int,Map::MapPointChange> mChanges;
+    const int nClearIdx = mpMap->TakeMapPointChanges(mChanges);
 
-    for(size_t i=0, iend=vpMPs.size(); i<iend;i++)
+    // 地图被清空过，之前的顶点全部作废
+    if(nClearIdx!=mnPointsClearIdx)
     {
-        if(vpMPs[i]->isBad() || spRefMPs.count(vpMPs[i]))
-            continue;
-        cv::Mat pos = vpMPs[i]->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+        mvPointVertices.clear();
+        mvPointColors.clear();
+        mvPointIds.clear();
+        mmPointSlots.clear();
+        mvRefPointIds.clear();
+        mnPointsClearIdx = nClearIdx;
     }
-    glEnd();
-
-    glPointSize(mPointSize);
-    glBegin(GL_POINTS);
-    glColor3f(1.0,0.0,0.0);
 
-    for(set<MapPoint*>::iterator sit=spRefMPs.begin(), send=spRefMPs.end(); sit!=send; sit++)
+    for(unordered_map<long unsigned int,Map::MapPointChange>::iterator mit=mChanges.begin(), mend=mChanges.end(); mit!=mend; mit++)
     {
-        if((*sit)->isBad())
+        const Map::MapPointChange &change = mit->second;
+        unordered_map<long unsigned int,int>::iterator sit = mmPointSlots.find(mit->first);
+
+        // 删除优先，被删除的点不会因为之后的位置更新而重新出现
+        if(change.nFlags & Map::CHANGE_ERASED)
+        {
+            if(sit!=mmPointSlots.end())
+                RemoveMapPoint(sit->second);
             continue;
-        cv::Mat pos = (*sit)->GetWorldPos();
-        glVertex3f(pos.at<float>(0),pos.at<float>(1),pos.at<float>(2));
+        }
 
-    }
+        int nSlot;
+        if(sit!=mmPointSlots.end())
+            nSlot = sit->second;
+        else if(change.nFlags & Map::CHANGE_ADDED)
+        {
+            nSlot = mvPointIds.size();
+            mvPointIds.push_back(mit->first);
+            mmPointSlots[mit->first] = nSlot;
+            mvPointVertices.resize(3*nSlot+3);
+            mvPointColors.resize(3*nSlot+3,0);
+            mPointColorBuffer.SetDirty(3*nSlot,3*nSlot+3);
+        }
+        else // 还没有加入地图的点(例如Tracking中的临时点)
+            continue;
 
-    glEnd();
-}
+        mvPointVertices[3*nSlot] = change.x;
+        mvPointVertices[3*nSlot+1] = change.y;
+        mvPointVertices[3*nSlot+2] = change.z;
+        mPointVertexBuffer.SetDirty(3*nSlot*sizeof(float),(3*nSlot+3)*sizeof(float));
+    }
 
-void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
-{
-    const float &w = mKeyFrameSize;
-    const float h = w*0.75;
-    const float z = w*0.6;
+    // 参考地图点标红，只修改颜色有变化的点
+    vector<long unsigned int> vRefIds = mpMap->GetReferenceMapPointIds();
+    sort(vRefIds.begin(),vRefIds.end());
 
-    //取地图上所有关键帧
-    const vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
-    //绘制关键帧
-    if(bDrawKF)
+    if(vRefIds!=mvRefPointIds)
     {
-        for(size_t i=0; i<vpKFs.size(); i++)
+        for(size_t i=0, iend=mvRefPointIds.size(); i<iend; i++)
         {
-            KeyFrame* pKF = vpKFs[i];
-            cv::Mat Twc = pKF->GetPoseInverse().t();
-
-            glPushMatrix();
+            unordered_map<long unsigned int,int>::iterator sit = mmPointSlots.find(mvRefPointIds[i]);
+            if(sit!=mmPointSlots.end() && !binary_search(vRefIds.begin(),vRefIds.end(),mvRefPointIds[i]))
+                SetMapPointColor(sit->second,0,0,0);
+        }
+        mvRefPointIds.swap(vRefIds);
+    }
+    // 新加入的点默认是黑色，参考点每次都重新标红
+    for(size_t i=0, iend=mvRefPointIds.size(); i<iend; i++)
+    {
+        unordered_map<long unsigned int,int>::iterator sit = mmPointSlots.find(mvRefPointIds[i]);
+        if(sit!=mmPointSlots.end() && mvPointColors[3*sit->second]!=255)
+            SetMapPointColor(sit->second,255,0,0);
+    }
 
-            glMultMatrixf(Twc.ptr<GLfloat>(0));
+    mPointVertexBuffer.Upload(mvPointVertices.data(),mvPointVertices.size()*sizeof(float));
+    mPointColorBuffer.Upload(mvPointColors.data(),mvPointColors.size());
+}
 
-            glLineWidth(mKeyFrameLineWidth);
-            glColor3f(0.0f,0.0f,1.0f);
-            glBegin(GL_LINES);
-            glVertex3f(0,0,0);
-            glVertex3f(w,h,z);
-            glVertex3f(0,0,0);
-            glVertex3f(w,-h,z);
-            glVertex3f(0,0,0);
-            glVertex3f(-w,-h,z);
-            glVertex3f(0,0,0);
-            glVertex3f(-w,h,z);
+void MapDrawer::DrawMapPoints()
+{
+    UpdateMapPoints();
 
-            glVertex3f(w,h,z);
-            glVertex3f(w,-h,z);
+    if(mvPointIds.empty())
+        return;
 
-            glVertex3f(-w,h,z);
-            glVertex3f(-w,-h,z);
+    glPointSize(mPointSize);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+
+    mPointVertexBuffer.Bind();
+    glVertexPointer(3,GL_FLOAT,0,0);
+    mPointColorBuffer.Bind();
+    glColorPointer(3,GL_UNSIGNED_BYTE,0,0);
+    glDrawArrays(GL_POINTS,0,mvPointIds.size());
+
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-            glVertex3f(-w,h,z);
-            glVertex3f(w,h,z);
+void MapDrawer::RemoveKeyFrame(const int nSlot)
+{
+    const int nLast = mvpKeyFrames.size()-1;
+    mmKeyFrameSlots.erase(mvpKeyFrames[nSlot]);
+    if(nSlot!=nLast)
+    {
+        copy(mvFrustumVertices.begin()+48*nLast,mvFrustumVertices.end(),mvFrustumVertices.begin()+48*nSlot);
+        copy(mvKeyFrameCenters.begin()+3*nLast,mvKeyFrameCenters.end(),mvKeyFrameCenters.begin()+3*nSlot);
+        mvpKeyFrames[nSlot] = mvpKeyFrames[nLast];
+        mvvpGraphNeighbors[nSlot].swap(mvvpGraphNeighbors[nLast]);
+        mmKeyFrameSlots[mvpKeyFrames[nSlot]] = nSlot;
+        mFrustumBuffer.SetDirty(48*nSlot*sizeof(float),48*(nSlot+1)*sizeof(float));
+    }
+    mvFrustumVertices.resize(48*nLast);
+    mvKeyFrameCenters.resize(3*nLast);
+    mvpKeyFrames.pop_back();
+    mvvpGraphNeighbors.pop_back();
+}
 
-            glVertex3f(-w,-h,z);
-            glVertex3f(w,-h,z);
-            glEnd();
+void MapDrawer::UpdateKeyFrames()
+{
+    unordered_map<KeyFrame*,int> mChanges;
+    const int nClearIdx = mpMap->TakeKeyFrameChanges(mChanges);
 
-            glPopMatrix();
-        }
+    if(nClearIdx!=mnKeyFramesClearIdx)
+    {
+        mvFrustumVertices.clear();
+        mvpKeyFrames.clear();
+        mmKeyFrameSlots.clear();
+        mvKeyFrameCenters.clear();
+        mvvpGraphNeighbors.clear();
+        mnKeyFramesClearIdx = nClearIdx;
+        mbGraphDirty = true;
     }
-    // 绘制图
-    if(bDrawGraph)
+
+    const float &w = mKeyFrameSize;
+    const float h = w*0.75;
+    const float z = w*0.6;
+    // 相机坐标系下的视锥线段端点，与DrawCurrentCamera相同
+    const float frustum[16][3] = {{0,0,0},{w,h,z},{0,0,0},{w,-h,z},{0,0,0},{-w,-h,z},{0,0,0},{-w,h,z},
+                                  {w,h,z},{w,-h,z},{-w,h,z},{-w,-h,z},{-w,h,z},{w,h,z},{-w,-h,z},{w,-h,z}};
+
+    for(unordered_map<KeyFrame*,int>::iterator mit=mChanges.begin(), mend=mChanges.end(); mit!=mend; mit++)
     {
-        glLineWidth(mGraphLineWidth);
-        glColor4f(0.0f,1.0f,0.0f,0.6f);
-        glBegin(GL_LINES);
+        KeyFrame* pKF = mit->first;
+        unordered_map<KeyFrame*,int>::iterator sit = mmKeyFrameSlots.find(pKF);
 
-        for(size_t i=0; i<vpKFs.size(); i++)
+        if((mit->second & Map::CHANGE_ERASED) || pKF->isBad())
         {
-            // Covisibility Graph
-            // 按权重取地图关键帧的共视关键帧集合，共视点数超过100的
-            const vector<KeyFrame*> vCovKFs = vpKFs[i]->GetCovisiblesByWeight(100);
-            // 地图关键帧i获取相机光心
-            cv::Mat Ow = vpKFs[i]->GetCameraCenter();
-            if(!vCovKFs.empty())
+            if(sit!=mmKeyFrameSlots.end())
             {
-                //遍历共视的关键帧
-                for(vector<KeyFrame*>::const_iterator vit=vCovKFs.begin(), vend=vCovKFs.end(); vit!=vend; vit++)
-                {
-                    if((*vit)->mnId<vpKFs[i]->mnId)
-                        continue;
-                    //获取共视关键帧的相机光心
-                    cv::Mat Ow2 = (*vit)->GetCameraCenter();
-                    //连线
-                    glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                    glVertex3f(Ow2.at<float>(0),Ow2.at<float>(1),Ow2.at<float>(2));
-                }
+                RemoveKeyFrame(sit->second);
+                mbGraphDirty = true;
             }
+            continue;
+        }
 
-            // Spanning tree
-            // 获取Spanning tree，共视程度高的两个点构成Spanning tree子和父节点
-            KeyFrame* pParent = vpKFs[i]->GetParent();
-            if(pParent)
-            {
-                //连线
-                cv::Mat Owp = pParent->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owp.at<float>(0),Owp.at<float>(1),Owp.at<float>(2));
-            }
+        int nSlot;
+        if(sit!=mmKeyFrameSlots.end())
+            nSlot = sit->second;
+        else if(mit->second & Map::CHANGE_ADDED)
+        {
+            nSlot = mvpKeyFrames.size();
+            mvpKeyFrames.push_back(pKF);
+            mmKeyFrameSlots[pKF] = nSlot;
+            mvFrustumVertices.resize(48*nSlot+48);
+            mvKeyFrameCenters.resize(3*nSlot+3);
+            mvvpGraphNeighbors.resize(nSlot+1);
+        }
+        else // 构造时的SetPose，关键帧还没有加入地图
+            continue;
 
-            // Loops
-            // 回环边
-            set<KeyFrame*> sLoopKFs = vpKFs[i]->GetLoopEdges(); //获取地图关键帧i的回环边
-            for(set<KeyFrame*>::iterator sit=sLoopKFs.begin(), send=sLoopKFs.end(); sit!=send; sit++)
+        // 视锥变换到世界坐标系
+        const cv::Mat Twc = pKF->GetPoseInverse();
+        float* pVertices = &mvFrustumVertices[48*nSlot];
+        for(int i=0; i<16; i++)
+            for(int r=0; r<3; r++)
+                pVertices[3*i+r] = Twc.at<float>(r,0)*frustum[i][0]+Twc.at<float>(r,1)*frustum[i][1]+
+                                   Twc.at<float>(r,2)*frustum[i][2]+Twc.at<float>(r,3);
+        mFrustumBuffer.SetDirty(48*nSlot*sizeof(float),48*(nSlot+1)*sizeof(float));
+
+        for(int r=0; r<3; r++)
+            mvKeyFrameCenters[3*nSlot+r] = Twc.at<float>(r,3);
+
+        // 与原来逐帧绘制时相同的连线规则
+        vector<KeyFrame*> &vpNeighbors = mvvpGraphNeighbors[nSlot];
+        vpNeighbors.clear();
+        // Covisibility Graph，共视点数超过100的，每条边只连一次
+        const vector<KeyFrame*> vCovKFs = pKF->GetCovisiblesByWeight(100);
+        for(vector<KeyFrame*>::const_iterator vit=vCovKFs.begin(), vend=vCovKFs.end(); vit!=vend; vit++)
+            if((*vit)->mnId>=pKF->mnId)
+                vpNeighbors.push_back(*vit);
+        // Spanning tree
+        KeyFrame* pParent = pKF->GetParent();
+        if(pParent)
+            vpNeighbors.push_back(pParent);
+        // Loops
+        const set<KeyFrame*> sLoopKFs = pKF->GetLoopEdges();
+        for(set<KeyFrame*>::const_iterator sit2=sLoopKFs.begin(), send=sLoopKFs.end(); sit2!=send; sit2++)
+            if((*sit2)->mnId>=pKF->mnId)
+                vpNeighbors.push_back(*sit2);
+
+        mbGraphDirty = true;
+    }
+
+    mFrustumBuffer.Upload(mvFrustumVertices.data(),mvFrustumVertices.size()*sizeof(float));
+
+    if(mbGraphDirty)
+    {
+        mvGraphVertices.clear();
+        for(size_t i=0, iend=mvpKeyFrames.size(); i<iend; i++)
+        {
+            const vector<KeyFrame*> &vpNeighbors = mvvpGraphNeighbors[i];
+            for(size_t j=0, jend=vpNeighbors.size(); j<jend; j++)
             {
-                if((*sit)->mnId<vpKFs[i]->mnId)
+                unordered_map<KeyFrame*,int>::const_iterator sit = mmKeyFrameSlots.find(vpNeighbors[j]);
+                if(sit==mmKeyFrameSlots.end())
                     continue;
-                cv::Mat Owl = (*sit)->GetCameraCenter();
-                glVertex3f(Ow.at<float>(0),Ow.at<float>(1),Ow.at<float>(2));
-                glVertex3f(Owl.at<float>(0),Owl.at<float>(1),Owl.at<float>(2));
+                mvGraphVertices.insert(mvGraphVertices.end(),mvKeyFrameCenters.begin()+3*i,mvKeyFrameCenters.begin()+3*i+3);
+                mvGraphVertices.insert(mvGraphVertices.end(),mvKeyFrameCenters.begin()+3*sit->second,mvKeyFrameCenters.begin()+3*sit->second+3);
             }
         }
+        mGraphBuffer.SetDirty(0,mvGraphVertices.size()*sizeof(float));
+        mGraphBuffer.Upload(mvGraphVertices.data(),mvGraphVertices.size()*sizeof(float));
+        mbGraphDirty = false;
+    }
+}
 
-        glEnd();
+void MapDrawer::DrawKeyFrames(const bool bDrawKF, const bool bDrawGraph)
+{
+    UpdateKeyFrames();
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    //绘制关键帧
+    if(bDrawKF && !mvpKeyFrames.empty())
+    {
+        glLineWidth(mKeyFrameLineWidth);
+        glColor3f(0.0f,0.0f,1.0f);
+        mFrustumBuffer.Bind();
+        glVertexPointer(3,GL_FLOAT,0,0);
+        glDrawArrays(GL_LINES,0,16*mvpKeyFrames.size());
     }
+    // 绘制图
+    if(bDrawGraph && !mvGraphVertices.empty())
+    {
+        glLineWidth(mGraphLineWidth);
+        glColor4f(0.0f,1.0f,0.0f,0.6f);
+        mGraphBuffer.Bind();
+        glVertexPointer(3,GL_FLOAT,0,0);
+        glDrawArrays(GL_LINES,0,mvGraphVertices.size()/3);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 void MapDrawer::DrawCurrentCamera(pangolin::OpenGlMatrix &Twc)
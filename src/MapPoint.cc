@@ -27,13 +27,15 @@ namespace ORB_SLAM2
 {
 
 long unsigned int MapPoint::nNextId=0;
+const size_t MapPoint::MAX_CACHED_DESCRIPTORS = 32;
 mutex MapPoint::mGlobalMutex;
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
     mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
     mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
-    mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap)
+    mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap),
+    mbDescriptorDirty(false)
 {
     Pos.copyTo(mWorldPos);
     mNormalVector = cv::Mat::zeros(3,1,CV_32F);
@@ -47,7 +49,7 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
-    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
+    mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap), mbDescriptorDirty(false)
 {
     Pos.copyTo(mWorldPos);
     cv::Mat Ow = pFrame->GetCameraCenter();
@@ -72,9 +74,19 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
 
 void MapPoint::SetWorldPos(const cv::Mat &Pos)
 {
-    unique_lock<mutex> lock2(mGlobalMutex);
+    {
+        unique_lock<mutex> lock2(mGlobalMutex);
+        unique_lock<mutex> lock(mMutexPos);
+        Pos.copyTo(mWorldPos);
+        // 持有mMutexPos发布，后写入的位置一定后发布，不会被旧位置覆盖
+        mpMap->NotifyMapPointChanged(mnId,Map::CHANGE_MODIFIED,mWorldPos);
+    }
+}
+
+void MapPoint::PublishWorldPos(const int nFlag)
+{
     unique_lock<mutex> lock(mMutexPos);
-    Pos.copyTo(mWorldPos);
+    mpMap->NotifyMapPointChanged(mnId,nFlag,mWorldPos);
 }
 
 cv::Mat MapPoint::GetWorldPos()
@@ -108,6 +120,23 @@ void MapPoint::AddObservation(KeyFrame* pKF, size_t idx)
         nObs+=2;
     else
         nObs++;
+
+    // 增量更新描述子距离矩阵：只需计算新描述子与已有描述子的距离，O(n)
+    // 距离矩阵只覆盖前MAX_CACHED_DESCRIPTORS个观测，超出的观测只保存描述子
+    // 描述子拷贝一份，不引用关键帧的描述子矩阵(关键帧可能释放特征数据)
+    mvpObsKFs.push_back(pKF);
+    mvDescriptors.push_back(pKF->mDescriptors.row(idx).clone());
+    if(mvvDescriptorDistances.size()<MAX_CACHED_DESCRIPTORS)
+        AddCachedDistances(mvvDescriptorDistances.size());
+    mbDescriptorDirty = true;
+
+    // 关键帧剔除用的冗余计数
+    const bool bClose = pKF->mvDepth[idx]>=0 && pKF->mvDepth[idx]<=pKF->mThDepth;
+    mvObsLevels.push_back(pKF->mvKeysUn[idx].octave);
+    mvbObsClose.push_back(bClose);
+    mvbObsRedundant.push_back(false);
+    pKF->UpdateCullingCounters(bClose,1,0);
+    UpdateRedundancy();
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF)
@@ -124,6 +153,8 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
                 nObs--;
 
             mObservations.erase(pKF);
+            EraseCachedObservation(pKF);
+            UpdateRedundancy();
 
             if(mpRefKF==pKF)
                 mpRefKF=mObservations.begin()->first;
@@ -159,6 +190,7 @@ void MapPoint::SetBadFlag()
         mbBad=true;
         obs = mObservations;
         mObservations.clear();
+        ClearCachedObservations();
     }
     for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
@@ -189,6 +221,7 @@ void MapPoint::Replace(MapPoint* pMP)
         //取这个mappoint的被观测信息(此MapPoint对应的是哪个KeyFrame中哪个特征点)
         obs=mObservations;
         mObservations.clear();  //清空
+        ClearCachedObservations();
         mbBad=true;             //设置为坏点
         nvisible = mnVisible;
         nfound = mnFound;
@@ -246,83 +279,185 @@ float MapPoint::GetFoundRatio()
 }
 
 //在此mappoint能被看到的特征点中找出最能代表此mappoint的描述子
+// 观测描述子之间的距离在AddObservation/EraseObservation中增量维护，
+// 这里只做标记，真正的选择推迟到下一次GetDescriptor()
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
+    unique_lock<mutex> lock1(mMutexFeatures);
+    if(mbBad)
+        return;
+    if(!mvDescriptors.empty())
+        mbDescriptorDirty = true;
+}
 
-    map<KeyFrame*,size_t> observations;
+cv::Mat MapPoint::GetDescriptor()
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    if(mbDescriptorDirty)
+        SelectDistinctiveDescriptor();
+    return mDescriptor.clone();
+}
 
-    {
-        unique_lock<mutex> lock1(mMutexFeatures);
-        if(mbBad)
-            return;
-        observations=mObservations;
-    }
+void MapPoint::SelectDistinctiveDescriptor()
+{
+    mbDescriptorDirty = false;
 
-    if(observations.empty())
+    const size_t M = mvvDescriptorDistances.size();
+    if(M==0)
         return;
 
-    vDescriptors.reserve(observations.size());
+    // 与原来一样不使用坏关键帧中的描述子
+    vector<size_t> vValid;
+    vValid.reserve(M);
+    for(size_t i=0; i<M; i++)
+        if(!mvpObsKFs[i]->isBad())
+            vValid.push_back(i);
 
-    //遍历此mappoint所有能够被观察的关键帧
-    //然后将mappoint在这些关键帧里对应的特征点的描述子放入vDescriptors
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    const size_t N = vValid.size();
+    if(N==0)
+        return;
+
+    // Take the descriptor with least median distance to the rest
+    // 找出与其它描述子距离的中值最小的描述子，距离已经缓存，不需要再计算汉明距离
+    // 中值相同时取关键帧id最小的，结果与观测的插入顺序无关
+    int BestMedian = INT_MAX;
+    size_t BestIdx = vValid[0];
+    vector<int> vDists(N);
+    for(size_t i=0;i<N;i++)
     {
-        KeyFrame* pKF = mit->first;
+        const vector<int> &vRow = mvvDescriptorDistances[vValid[i]];
+        for(size_t j=0; j<N; j++)
+            vDists[j] = vRow[vValid[j]];
+        // 获得中值
+        vector<int>::iterator mid = vDists.begin()+(N-1)/2;
+        nth_element(vDists.begin(),mid,vDists.end());
+        const int median = *mid;
+
+        // 寻找最小的中值
+        if(median<BestMedian || (median==BestMedian && mvpObsKFs[vValid[i]]->mnId<mvpObsKFs[BestIdx]->mnId))
+        {
+            BestMedian = median;
+            BestIdx = vValid[i];
+        }
+    }
 
-        if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+    mDescriptor = mvDescriptors[BestIdx].clone();
+}
+
+void MapPoint::AddCachedDistances(const size_t idx)
+{
+    // 计算第idx个描述子与距离矩阵中已有的描述子之间的距离，作为矩阵的第idx行/列
+    const size_t M = mvvDescriptorDistances.size();
+    vector<int> vRow(max(M,idx+1),0);
+    for(size_t i=0; i<M; i++)
+    {
+        if(i==idx)
+            continue;
+        const int dist = ORBmatcher::DescriptorDistance(mvDescriptors[i],mvDescriptors[idx]);
+        vRow[i] = dist;
+        if(idx<M)
+            mvvDescriptorDistances[i][idx] = dist;
+        else
+            mvvDescriptorDistances[i].push_back(dist);
     }
+    if(idx<M)
+        mvvDescriptorDistances[idx].swap(vRow);
+    else
+        mvvDescriptorDistances.push_back(vRow);
+}
 
-    if(vDescriptors.empty())
+void MapPoint::EraseCachedObservation(KeyFrame* pKF)
+{
+    const size_t N = mvpObsKFs.size();
+    size_t idx = 0;
+    while(idx<N && mvpObsKFs[idx]!=pKF)
+        idx++;
+    if(idx==N)
         return;
 
-    // Compute distances between them
-    //计算vDescriptors中描述子间的距离
-    const size_t N = vDescriptors.size();
+    pKF->UpdateCullingCounters(mvbObsClose[idx],-1,mvbObsRedundant[idx] ? -1 : 0);
 
-    float Distances[N][N];
-    for(size_t i=0;i<N;i++)
+    // 用最后一个观测覆盖被删除的观测，O(n)
+    const size_t last = N-1;
+    const size_t M = mvvDescriptorDistances.size();
+    if(idx!=last)
     {
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
+        mvpObsKFs[idx] = mvpObsKFs[last];
+        mvObsLevels[idx] = mvObsLevels[last];
+        mvbObsClose[idx] = mvbObsClose[last];
+        mvbObsRedundant[idx] = mvbObsRedundant[last];
+        mvDescriptors[idx] = mvDescriptors[last];
+        if(last<M)
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
+            mvvDescriptorDistances[idx].swap(mvvDescriptorDistances[last]);
+            for(size_t i=0; i<M; i++)
+                mvvDescriptorDistances[i][idx] = mvvDescriptorDistances[i][last];
         }
-    }
-
-    // Take the descriptor with least median distance to the rest
-    //找出vDescriptors中最好的描述子
-    int BestMedian = INT_MAX;
-    int BestIdx = 0;
-    for(size_t i=0;i<N;i++)
-    {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-	// 获得中值
-        int median = vDists[0.5*(N-1)];
-	
-	// 寻找最小的中值
-        if(median<BestMedian)
+        else if(idx<M)
         {
-            BestMedian = median;
-            BestIdx = i;
+            // 移过来的观测原来不在距离矩阵中，重新计算它这一行
+            AddCachedDistances(idx);
         }
     }
-
+    mvpObsKFs.pop_back();
+    mvObsLevels.pop_back();
+    mvbObsClose.pop_back();
+    mvbObsRedundant.pop_back();
+    mvDescriptors.pop_back();
+    if(last<M)
     {
-        unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        mvvDescriptorDistances.pop_back();
+        for(size_t i=0; i<last; i++)
+            mvvDescriptorDistances[i].pop_back();
     }
+
+    mbDescriptorDirty = true;
 }
 
-cv::Mat MapPoint::GetDescriptor()
+void MapPoint::ClearCachedObservations()
 {
-    unique_lock<mutex> lock(mMutexFeatures);
-    return mDescriptor.clone();
+    for(size_t i=0; i<mvpObsKFs.size(); i++)
+        mvpObsKFs[i]->UpdateCullingCounters(mvbObsClose[i],-1,mvbObsRedundant[i] ? -1 : 0);
+
+    // 坏点保留最后一次选出的描述子
+    mvpObsKFs.clear();
+    mvObsLevels.clear();
+    mvbObsClose.clear();
+    mvbObsRedundant.clear();
+    mvDescriptors.clear();
+    mvvDescriptorDistances.clear();
+    mbDescriptorDirty = false;
+}
+
+void MapPoint::UpdateRedundancy()
+{
+    // 一个观测是冗余的：该点的观测数超过thObs，并且至少thObs个其它关键帧在相同或更精细的尺度上(金字塔层数<=本层+1)观测到该点
+    // 与LocalMapping::KeyFrameCulling()原来逐点遍历观测的判断相同，这里用各层观测数的累加和，O(n)
+    const int thObs = 3;
+    const size_t N = mvpObsKFs.size();
+
+    int maxLevel = 0;
+    for(size_t i=0; i<N; i++)
+        maxLevel = max(maxLevel,mvObsLevels[i]);
+
+    // vnObsUpToLevel[l]为金字塔层数<=l的观测数
+    vector<int> vnObsUpToLevel(maxLevel+2,0);
+    for(size_t i=0; i<N; i++)
+        vnObsUpToLevel[mvObsLevels[i]]++;
+    for(size_t l=1; l<vnObsUpToLevel.size(); l++)
+        vnObsUpToLevel[l] += vnObsUpToLevel[l-1];
+
+    for(size_t i=0; i<N; i++)
+    {
+        // 减去自己
+        const int nOtherObs = vnObsUpToLevel[mvObsLevels[i]+1]-1;
+        const bool bRedundant = nObs>thObs && nOtherObs>=thObs;
+        if(bRedundant!=(bool)mvbObsRedundant[i])
+        {
+            mvbObsRedundant[i] = bRedundant;
+            mvpObsKFs[i]->UpdateCullingCounters(mvbObsClose[i],0,bRedundant ? 1 : -1);
+        }
+    }
 }
 
 int MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
@@ -0,0 +1,173 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "MapPointGrid.h"
+#include "MapPoint.h"
+#include "KeyFrame.h"
+#include "Converter.h"
+
+#include <cmath>
+#include <unordered_map>
+#include <algorithm>
+
+namespace ORB_SLAM2
+{
+
+MapPointGrid::MapPointGrid(const std::vector<MapPoint*> &vpMapPoints, float fVoxelSize)
+{
+    const int N = vpMapPoints.size();
+
+    // 取出点的位置和可观测距离
+    std::vector<Eigen::Vector3f> vPos;
+    std::vector<float> vMinDist, vMaxDist;
+    std::vector<int> vIdx;
+    vPos.reserve(N);
+    vMinDist.reserve(N);
+    vMaxDist.reserve(N);
+    vIdx.reserve(N);
+
+    Eigen::Vector3f minP = Eigen::Vector3f::Constant(1e20f);
+    Eigen::Vector3f maxP = Eigen::Vector3f::Constant(-1e20f);
+    for(int i=0; i<N; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(!pMP || pMP->isBad())
+            continue;
+
+        cv::Mat x3D = pMP->GetWorldPos();
+        const Eigen::Vector3f p(x3D.at<float>(0),x3D.at<float>(1),x3D.at<float>(2));
+        vPos.push_back(p);
+        vMinDist.push_back(pMP->GetMinDistanceInvariance());
+        vMaxDist.push_back(pMP->GetMaxDistanceInvariance());
+        vIdx.push_back(i);
+        minP = minP.cwiseMin(p);
+        maxP = maxP.cwiseMax(p);
+    }
+
+    const int nPoints = vPos.size();
+    if(nPoints==0)
+    {
+        mfVoxelSize = 1.0f;
+        mvVoxelStart.push_back(0);
+        return;
+    }
+
+    if(fVoxelSize<=0)
+    {
+        // 包围盒体积平分给每16个点一个体素
+        const Eigen::Vector3f extent = (maxP-minP).cwiseMax(1e-3f);
+        const double volume = (double)extent(0)*extent(1)*extent(2);
+        fVoxelSize = std::cbrt(volume*16.0/nPoints);
+    }
+    // 每个方向最多2^21个体素，保证体素坐标可以编码到一个64位整数中
+    const float maxExtent = (maxP-minP).maxCoeff();
+    mfVoxelSize = std::max(fVoxelSize,maxExtent/((1<<21)-1));
+    mfVoxelSize = std::max(mfVoxelSize,1e-3f);
+
+    // 体素坐标编码 -> 体素序号
+    std::unordered_map<long long,int> mVoxelIds;
+    mVoxelIds.reserve(nPoints);
+    std::vector<int> vVoxelOfPoint(nPoints);
+    std::vector<Eigen::Vector3i> vVoxelCoords;
+    for(int i=0; i<nPoints; i++)
+    {
+        const Eigen::Vector3f d = (vPos[i]-minP)/mfVoxelSize;
+        const Eigen::Vector3i c((int)std::floor(d(0)),(int)std::floor(d(1)),(int)std::floor(d(2)));
+        const long long key = ((long long)c(0)<<42) | ((long long)c(1)<<21) | (long long)c(2);
+        std::unordered_map<long long,int>::iterator it = mVoxelIds.find(key);
+        if(it==mVoxelIds.end())
+        {
+            it = mVoxelIds.insert(std::make_pair(key,(int)vVoxelCoords.size())).first;
+            vVoxelCoords.push_back(c);
+        }
+        vVoxelOfPoint[i] = it->second;
+    }
+
+    // 按体素排列点的序号(CSR)
+    const int nVoxels = vVoxelCoords.size();
+    mvVoxelStart.assign(nVoxels+1,0);
+    for(int i=0; i<nPoints; i++)
+        mvVoxelStart[vVoxelOfPoint[i]+1]++;
+    for(int v=0; v<nVoxels; v++)
+        mvVoxelStart[v+1] += mvVoxelStart[v];
+
+    mvPointIndices.resize(nPoints);
+    std::vector<int> vFill(mvVoxelStart.begin(),mvVoxelStart.end()-1);
+    mvVoxelMinDistance.assign(nVoxels,1e20f);
+    mvVoxelMaxDistance.assign(nVoxels,0.0f);
+    for(int i=0; i<nPoints; i++)
+    {
+        const int v = vVoxelOfPoint[i];
+        mvPointIndices[vFill[v]++] = vIdx[i];
+        mvVoxelMinDistance[v] = std::min(mvVoxelMinDistance[v],vMinDist[i]);
+        mvVoxelMaxDistance[v] = std::max(mvVoxelMaxDistance[v],vMaxDist[i]);
+    }
+
+    mvVoxelCenters.resize(nVoxels);
+    for(int v=0; v<nVoxels; v++)
+        mvVoxelCenters[v] = minP+(vVoxelCoords[v].cast<float>()+Eigen::Vector3f::Constant(0.5f))*mfVoxelSize;
+}
+
+void MapPointGrid::GetPointsInFrustum(KeyFrame* pKF, const cv::Mat &Scw, std::vector<int> &vIndices) const
+{
+    vIndices.clear();
+
+    // 和ORBmatcher::Fuse一样分解Scw，去掉尺度
+    const Eigen::Matrix3f sRcw = Converter::toMatrix3d(Scw.rowRange(0,3).colRange(0,3)).cast<float>();
+    const float scw = sRcw.row(0).norm();
+    const Eigen::Matrix3f Rcw = sRcw/scw;
+    const Eigen::Vector3f tcw = Converter::toVector3d(Scw.rowRange(0,3).col(3)).cast<float>()/scw;
+
+    // 视锥的四个侧面都经过光心，法向量指向视锥内部
+    const float xmin = (pKF->mnMinX-pKF->cx)*pKF->invfx;
+    const float xmax = (pKF->mnMaxX-pKF->cx)*pKF->invfx;
+    const float ymin = (pKF->mnMinY-pKF->cy)*pKF->invfy;
+    const float ymax = (pKF->mnMaxY-pKF->cy)*pKF->invfy;
+    const Eigen::Vector3f n0 = Eigen::Vector3f(1,0,-xmin).normalized();
+    const Eigen::Vector3f n1 = Eigen::Vector3f(-1,0,xmax).normalized();
+    const Eigen::Vector3f n2 = Eigen::Vector3f(0,1,-ymin).normalized();
+    const Eigen::Vector3f n3 = Eigen::Vector3f(0,-1,ymax).normalized();
+
+    // 体素外接球的半径
+    const float r = 0.5f*std::sqrt(3.0f)*mfVoxelSize;
+
+    for(size_t v=0, vend=mvVoxelCenters.size(); v<vend; v++)
+    {
+        const Eigen::Vector3f pc = Rcw*mvVoxelCenters[v]+tcw;
+
+        // 深度为正
+        if(pc(2)<-r)
+            continue;
+
+        // 和视锥的每个侧面相交或在内侧
+        if(n0.dot(pc)<-r || n1.dot(pc)<-r || n2.dot(pc)<-r || n3.dot(pc)<-r)
+            continue;
+
+        // 到光心的距离在体素内点的可观测距离范围内
+        const float dist = pc.norm();
+        if(dist-r>mvVoxelMaxDistance[v] || dist+r<mvVoxelMinDistance[v])
+            continue;
+
+        vIndices.insert(vIndices.end(),mvPointIndices.begin()+mvVoxelStart[v],mvPointIndices.begin()+mvVoxelStart[v+1]);
+    }
+}
+
+} //namespace ORB_SLAM
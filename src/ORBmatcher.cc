@@ -28,6 +28,13 @@
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
 
 #include<stdint-gcc.h>
+#include<string.h>
+#include<cmath>
+#include<algorithm>
+
+#ifdef __AVX2__
+#include<immintrin.h>
+#endif
 
 using namespace std;
 
@@ -195,6 +202,10 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
     DBoW2::FeatureVector::const_iterator KFend = vFeatVecKF.end();
     DBoW2::FeatureVector::const_iterator Fend = F.mFeatVec.end();
 
+    // 每个node的描述子块和距离，在node之间复用
+    vector<unsigned char> vDescF;
+    vector<int> vDist;
+
     //遍历vFeatVecKF的每个结点
     //遍历pKF关键帧的特征向量
     while(KFit != KFend && Fit != Fend)
@@ -202,8 +213,12 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
         //步骤1：分别取出关键帧和当前帧属于同一node的ORB特征点(只有属于同一node，才有可能是匹配点)
         if(KFit->first == Fit->first)
         {
-            const vector<unsigned int> vIndicesKF = KFit->second;
-            const vector<unsigned int> vIndicesF = Fit->second;
+            const vector<unsigned int> &vIndicesKF = KFit->second;
+            const vector<unsigned int> &vIndicesF = Fit->second;
+
+            //F中属于该node的描述子连续存放，每个KF特征点一次算出到它们的全部距离
+            GatherDescriptors(F.mDescriptors,vIndicesF,vDescF);
+            vDist.resize(vIndicesF.size());
 
             //遍历pKF中属于该node的特征点
             for(size_t iKF=0; iKF<vIndicesKF.size(); iKF++)
@@ -222,8 +237,8 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                 if(pMP->isBad())
                     continue;
 
-                //获得此特征点对应的描述子
-                const cv::Mat &dKF= pKF->mDescriptors.row(realIdxKF);
+                //获得此特征点对应的描述子，计算到F中该node所有特征点的距离
+                DescriptorDistances(pKF->mDescriptors.ptr<unsigned char>(realIdxKF),&vDescF[0],vIndicesF.size(),&vDist[0]);
 
                 int bestDist1=256;
                 int bestIdxF =-1 ;
@@ -238,9 +253,7 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
                     if(vpMapPointMatches[realIdxF])
                         continue;
 
-                    const cv::Mat &dF = F.mDescriptors.row(realIdxF);
-
-                    const int dist =  DescriptorDistance(dKF,dF);
+                    const int dist = vDist[iF];
 
                     //更新bestDist1 bestDist2
                     //bestDist1表示最佳匹配，bestDist2表示次佳匹配
@@ -617,12 +630,29 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     DBoW2::FeatureVector::const_iterator f1end = vFeatVec1.end();
     DBoW2::FeatureVector::const_iterator f2end = vFeatVec2.end();
 
+    // 每个node中pKF2有效特征点的序号、描述子块和距离，在node之间复用
+    vector<unsigned int> vIndices2;
+    vector<unsigned char> vDesc2;
+    vector<int> vDist;
+
     //遍历两帧的特征向量
     while(f1it != f1end && f2it != f2end)
     {
         //步骤1：分别取出关键帧和当前帧属于同一node的ORB特征点(只有属于同一node，才有可能是匹配点)
         if(f1it->first == f2it->first)
         {
+            //pKF2中属于该node且有mappoint的特征点，描述子连续存放
+            vIndices2.clear();
+            for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
+            {
+                const unsigned int idx2 = f2it->second[i2];
+                MapPoint* pMP2 = vpMapPoints2[idx2];
+                if(pMP2 && !pMP2->isBad())
+                    vIndices2.push_back(idx2);
+            }
+            GatherDescriptors(Descriptors2,vIndices2,vDesc2);
+            vDist.resize(vIndices2.size());
+
             //遍历pKF1的特征点 [f1it->second 代表pKF1中的特征点?]
             for(size_t i1=0, iend1=f1it->second.size(); i1<iend1; i1++)
             {
@@ -634,28 +664,24 @@ int ORBmatcher::SearchByBoW(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
                     continue;
                 if(pMP1->isBad())
                     continue;
-                //得到该mappoint的描述子
-                const cv::Mat &d1 = Descriptors1.row(idx1);
+                if(vIndices2.empty())
+                    continue;
+
+                //得到该mappoint的描述子，计算到pKF2中该node所有候选的距离
+                DescriptorDistances(Descriptors1.ptr<unsigned char>(idx1),&vDesc2[0],vIndices2.size(),&vDist[0]);
 
                 int bestDist1=256;
                 int bestIdx2 =-1 ;
                 int bestDist2=256;
                 //遍历pKF2中的mappoint，寻找与当前这个pKF1的mappoint最佳匹配的mappoint
-                for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
+                for(size_t i2=0, iend2=vIndices2.size(); i2<iend2; i2++)
                 {
-                    const size_t idx2 = f2it->second[i2];
-
-                    MapPoint* pMP2 = vpMapPoints2[idx2];
+                    const size_t idx2 = vIndices2[i2];
 
-                    if(vbMatched2[idx2] || !pMP2)
+                    if(vbMatched2[idx2])
                         continue;
 
-                    if(pMP2->isBad())
-                        continue;
-
-                    const cv::Mat &d2 = Descriptors2.row(idx2);
-
-                    int dist = DescriptorDistance(d1,d2);
+                    const int dist = vDist[i2];
                     //取最佳匹配和次优匹配
                     if(dist<bestDist1)
                     {
@@ -752,6 +778,79 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
     const float ex =pKF2->fx*C2.at<float>(0)*invz+pKF2->cx;
     const float ey =pKF2->fy*C2.at<float>(1)*invz+pKF2->cy;
 
+    const vector<MapPoint*> vpMapPoints1 = pKF1->GetMapPointMatches();
+    const vector<MapPoint*> vpMapPoints2 = pKF2->GetMapPointMatches();
+
+    // 所有极线都经过极点e，pKF1特征点的极线按其绕极点的方向角phi1表示
+    // pKF2的特征点按相对极点的方向角theta2分带，到极线的距离为r2*|sin(theta2-phi1)|，
+    // 能通过CheckDistEpipolarLine的点满足|theta2-phi1|<=alpha2=asin(dmax/r2)，
+    // 所以每个特征点只需要与方向角落在带内的候选比较描述子
+    // 极点在无穷远附近时方向角的精度不够，不分带
+    const bool bBands = std::isfinite(ex) && std::isfinite(ey) && fabs(ex)<1e5f && fabs(ey)<1e5f;
+
+    // 步骤1：pKF1每个待匹配特征点的极线只计算一次 l = x1'F12 = [a b c]，以及极线的方向角
+    const float f00 = F12.at<float>(0,0), f01 = F12.at<float>(0,1), f02 = F12.at<float>(0,2);
+    const float f10 = F12.at<float>(1,0), f11 = F12.at<float>(1,1), f12 = F12.at<float>(1,2);
+    const float f20 = F12.at<float>(2,0), f21 = F12.at<float>(2,1), f22 = F12.at<float>(2,2);
+
+    const int N1 = vpMapPoints1.size();
+    vector<float> vLines1(N1*3);
+    vector<double> vPhi1(N1,0.0);
+    for(int i1=0; i1<N1; i1++)
+    {
+        // If there is already a MapPoint skip
+        if(vpMapPoints1[i1])
+            continue;
+
+        const cv::KeyPoint &kp1 = pKF1->mvKeysUn[i1];
+        const float a = kp1.pt.x*f00+kp1.pt.y*f10+f20;
+        const float b = kp1.pt.x*f01+kp1.pt.y*f11+f21;
+        const float c = kp1.pt.x*f02+kp1.pt.y*f12+f22;
+        vLines1[3*i1] = a;
+        vLines1[3*i1+1] = b;
+        vLines1[3*i1+2] = c;
+
+        //极线方向为(-b,a)，方向角取[0,pi)
+        double phi = atan2((double)a,-(double)b);
+        if(phi<0)
+            phi+=M_PI;
+        if(phi>=M_PI)
+            phi-=M_PI;
+        vPhi1[i1] = phi;
+    }
+
+    // 步骤2：pKF2每个可匹配特征点相对极点的方向角和允许的偏差
+    const int N2 = vpMapPoints2.size();
+    vector<double> vTheta2(N2,0.0);
+    vector<double> vAlpha2(N2,M_PI_2);
+    vector<bool> vbFarFromEpipole2(N2,true);
+    for(int i2=0; i2<N2; i2++)
+    {
+        if(vpMapPoints2[i2])
+            continue;
+
+        const cv::KeyPoint &kp2 = pKF2->mvKeysUn[i2];
+        const float distex = ex-kp2.pt.x;
+        const float distey = ey-kp2.pt.y;
+        vbFarFromEpipole2[i2] = !(distex*distex+distey*distey<100*pKF2->mvScaleFactors[kp2.octave]);
+
+        if(!bBands)
+            continue;
+
+        double theta = atan2((double)kp2.pt.y-ey,(double)kp2.pt.x-ex);
+        if(theta<0)
+            theta+=M_PI;
+        if(theta>=M_PI)
+            theta-=M_PI;
+        vTheta2[i2] = theta;
+
+        // 多留1个像素的余量，保证分带不会漏掉能通过精确检查的点
+        const double dmax = sqrt(3.84*pKF2->mvLevelSigma2[kp2.octave])+1.0;
+        const double r = sqrt((double)distex*distex+(double)distey*distey);
+        if(r>dmax)
+            vAlpha2[i2] = asin(dmax/r);
+    }
+
     // Find matches between not tracked keypoints
     // Matching speed-up by ORB Vocabulary
     // Compare only ORB that share the same node
@@ -766,6 +865,12 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
 
     const float factor = 1.0f/HISTO_LENGTH;
 
+    // 每个node中pKF2的候选：按方向角排序，描述子连续存放
+    vector<pair<double,int> > vBand2;
+    vector<unsigned int> vIndices2;
+    vector<unsigned char> vDesc2;
+    vector<int> vInBand;
+
     DBoW2::FeatureVector::const_iterator f1it = vFeatVec1.begin();
     DBoW2::FeatureVector::const_iterator f2it = vFeatVec2.begin();
     DBoW2::FeatureVector::const_iterator f1end = vFeatVec1.end();
@@ -776,14 +881,38 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
     {
         if(f1it->first == f2it->first)
         {
+            // 步骤3：该node中pKF2没有mappoint的特征点按方向角排序，记录最大的允许偏差
+            vBand2.clear();
+            double maxAlpha = 0;
+            for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
+            {
+                const unsigned int idx2 = f2it->second[i2];
+                if(vpMapPoints2[idx2])
+                    continue;
+                if(bOnlyStereo && pKF2->mvuRight[idx2]<0)
+                    continue;
+                vBand2.push_back(make_pair(vTheta2[idx2],(int)i2));
+                maxAlpha = max(maxAlpha,vAlpha2[idx2]);
+            }
+            if(vBand2.empty())
+            {
+                f1it++;
+                f2it++;
+                continue;
+            }
+            sort(vBand2.begin(),vBand2.end());
+
+            vIndices2.resize(vBand2.size());
+            for(size_t j=0; j<vBand2.size(); j++)
+                vIndices2[j] = f2it->second[vBand2[j].second];
+            GatherDescriptors(pKF2->mDescriptors,vIndices2,vDesc2);
+
             for(size_t i1=0, iend1=f1it->second.size(); i1<iend1; i1++)
             {
                 const size_t idx1 = f1it->second[i1];
                 
-                MapPoint* pMP1 = pKF1->GetMapPoint(idx1);
-                
                 // If there is already a MapPoint skip
-                if(pMP1)
+                if(vpMapPoints1[idx1])
                     continue;
 
                 const bool bStereo1 = pKF1->mvuRight[idx1]>=0;
@@ -793,52 +922,99 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
                         continue;
                 
                 const cv::KeyPoint &kp1 = pKF1->mvKeysUn[idx1];
-                
-                const cv::Mat &d1 = pKF1->mDescriptors.row(idx1);
-                
+                const float a = vLines1[3*idx1];
+                const float b = vLines1[3*idx1+1];
+                const float c = vLines1[3*idx1+2];
+                const float den = a*a+b*b;
+                if(den==0)
+                    continue;
+
+                // 步骤4：二分查找方向角落在[phi1-maxAlpha, phi1+maxAlpha]内的候选(按pi循环)
+                vInBand.clear();
+                const double phi1 = vPhi1[idx1];
+                if(maxAlpha>=M_PI_2)
+                {
+                    for(size_t j=0; j<vBand2.size(); j++)
+                        vInBand.push_back(j);
+                }
+                else
+                {
+                    double lo = phi1-maxAlpha;
+                    double hi = phi1+maxAlpha;
+                    // 区间跨过0或pi时拆成两段
+                    double ranges[2][2] = {{lo,hi},{1,0}};
+                    if(lo<0)
+                    {
+                        ranges[0][0] = 0; ranges[0][1] = hi;
+                        ranges[1][0] = lo+M_PI; ranges[1][1] = M_PI;
+                    }
+                    else if(hi>=M_PI)
+                    {
+                        ranges[0][0] = lo; ranges[0][1] = M_PI;
+                        ranges[1][0] = 0; ranges[1][1] = hi-M_PI;
+                    }
+                    for(int k=0; k<2; k++)
+                    {
+                        if(ranges[k][0]>ranges[k][1])
+                            continue;
+                        vector<pair<double,int> >::const_iterator itb = lower_bound(vBand2.begin(),vBand2.end(),make_pair(ranges[k][0],INT_MIN));
+                        vector<pair<double,int> >::const_iterator ite = upper_bound(vBand2.begin(),vBand2.end(),make_pair(ranges[k][1],INT_MAX));
+                        for(; itb<ite; itb++)
+                            vInBand.push_back(itb-vBand2.begin());
+                    }
+                }
+
+                // 与原来逐个遍历的结果一致：距离最小，距离相同时取node中靠后的点
                 int bestDist = TH_LOW;
                 int bestIdx2 = -1;
+                int bestPos2 = -1;
                 //在pk2中相同的节点中寻找匹配的特征点
-                for(size_t i2=0, iend2=f2it->second.size(); i2<iend2; i2++)
+                for(size_t k=0; k<vInBand.size(); k++)
                 {
-                    size_t idx2 = f2it->second[i2];
-                    
-                    MapPoint* pMP2 = pKF2->GetMapPoint(idx2);
+                    const int j = vInBand[k];
+                    const size_t idx2 = vIndices2[j];
                     
-                    // If we have already matched or there is a MapPoint skip
-                    //已经匹配上了，或者已经有了mappoint
-                    if(vbMatched2[idx2] || pMP2)
+                    // If we have already matched skip
+                    if(vbMatched2[idx2])
                         continue;
 
+                    // 逐点检查方向角偏差
+                    if(maxAlpha<M_PI_2)
+                    {
+                        double dtheta = fabs(vBand2[j].first-phi1);
+                        if(dtheta>M_PI_2)
+                            dtheta = M_PI-dtheta;
+                        if(dtheta>vAlpha2[idx2])
+                            continue;
+                    }
+
                     const bool bStereo2 = pKF2->mvuRight[idx2]>=0;
 
-                    if(bOnlyStereo)
-                        if(!bStereo2)
-                            continue;
-                    
-                    const cv::Mat &d2 = pKF2->mDescriptors.row(idx2);
-                    
-                    const int dist = DescriptorDistance(d1,d2);
+                    int dist;
+                    DescriptorDistances(pKF1->mDescriptors.ptr<unsigned char>(idx1),&vDesc2[32*j],1,&dist);
                     
                     if(dist>TH_LOW || dist>bestDist)
                         continue;
+                    if(dist==bestDist && vBand2[j].second<bestPos2)
+                        continue;
 
                     const cv::KeyPoint &kp2 = pKF2->mvKeysUn[idx2];
 
                     if(!bStereo1 && !bStereo2)
                     {
-                        const float distex = ex-kp2.pt.x;
-                        const float distey = ey-kp2.pt.y;
-                        if(distex*distex+distey*distey<100*pKF2->mvScaleFactors[kp2.octave])
+                        if(!vbFarFromEpipole2[idx2])
                             continue;
                     }
 
-                    //如果kp1，与kp2在基础矩阵F12下是否复合对极约束
-                    if(CheckDistEpipolarLine(kp1,kp2,F12,pKF2))
+                    //kp2到kp1极线的距离，与CheckDistEpipolarLine()相同
+                    const float num = a*kp2.pt.x+b*kp2.pt.y+c;
+                    const float dsqr = num*num/den;
+                    if(dsqr<3.84*pKF2->mvLevelSigma2[kp2.octave])
                     {
                         //更新最好点和次好点的id
                         bestIdx2 = idx2;
                         bestDist = dist;
+                        bestPos2 = vBand2[j].second;
                     }
                 }
                 
@@ -916,6 +1092,19 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
  * @return 融合的mappoint的数量
  */
 int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th)
+{
+    const int nMPs = vpMapPoints.size();
+    vector<int> vMatches(nMPs,-1);
+    SearchForFuse(pKF,vpMapPoints,0,nMPs,vMatches,th);
+    return ApplyFuse(pKF,vpMapPoints,vMatches);
+}
+
+/**
+ * Fuse的投影搜索部分：只读取地图，不修改地图，可以在多个线程中同时执行
+ * vMatches[i]为vpMapPoints[i]在pKF中匹配的特征点序号，没有匹配为-1，只写[nBegin,nEnd)部分
+ */
+void ORBmatcher::SearchForFuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const int nBegin, const int nEnd,
+                               vector<int> &vMatches, const float th)
 {
     //取关键帧位姿
     cv::Mat Rcw = pKF->GetRotation();
@@ -929,13 +1118,11 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 
     cv::Mat Ow = pKF->GetCameraCenter();
 
-    int nFused=0;
-
-    const int nMPs = vpMapPoints.size();
-
     //遍历vpMapPoints中的mappoint
-    for(int i=0; i<nMPs; i++)
+    for(int i=nBegin; i<nEnd; i++)
     {
+        vMatches[i] = -1;
+
         MapPoint* pMP = vpMapPoints[i];
 
         if(!pMP)
@@ -1059,39 +1246,84 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
             }
         }
 
-        // If there is already a MapPoint replace otherwise add new measurement
         // 如果存在上面的条件都符合的在pKF帧的特征点
         if(bestDist<=TH_LOW)
+            vMatches[i] = bestIdx;
+    }
+}
+
+/**
+ * Fuse的融合部分：按vpMapPoints的顺序串行执行，结果是确定的
+ * 搜索之后地图可能已经被前面的融合修改，所以这里重新检查pMP是否仍然有效
+ * @param pvpChanged 不为NULL时，存入观测关系发生变化、需要更新描述子和平均观测方向的mappoint
+ */
+int ORBmatcher::ApplyFuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const vector<int> &vMatches,
+                          vector<MapPoint *> *pvpChanged)
+{
+    int nFused=0;
+
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        const int bestIdx = vMatches[i];
+        if(bestIdx<0)
+            continue;
+
+        MapPoint* pMP = vpMapPoints[i];
+        if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
+            continue;
+
+        // If there is already a MapPoint replace otherwise add new measurement
+        //取这个特征点对应的mappoint
+        MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
+        //检查这个特征点是否已经有对应的mappoint
+        if(pMPinKF)
         {
-            //取这个特征点对应的mappoint
-            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
-            //检查这个特征点是否已经有对应的mappoint
-            if(pMPinKF)
+            if(!pMPinKF->isBad())
             {
-                if(!pMPinKF->isBad())
+                //如果已经有对应的mappoint，
+                //则比较原来的mappoint与当前这个pMP的被观测次数，取被观测次数大的那个点
+                if(pMPinKF->Observations()>pMP->Observations())
                 {
-                    //如果已经有对应的mappoint，
-                    //则比较原来的mappoint与当前这个pMP的被观测次数，取被观测次数大的那个点
-                    if(pMPinKF->Observations()>pMP->Observations())
-                        pMP->Replace(pMPinKF);
-                    else
-                        pMPinKF->Replace(pMP);
+                    pMP->Replace(pMPinKF);
+                    if(pvpChanged)
+                        pvpChanged->push_back(pMPinKF);
+                }
+                else
+                {
+                    pMPinKF->Replace(pMP);
+                    if(pvpChanged)
+                        pvpChanged->push_back(pMP);
                 }
             }
-            else
-            {
-                //否则，将当前这个pMP点与pKF关键帧建立连接
-                pMP->AddObservation(pKF,bestIdx);
-                pKF->AddMapPoint(pMP,bestIdx);
-            }
-            nFused++;
         }
+        else
+        {
+            //否则，将当前这个pMP点与pKF关键帧建立连接
+            pMP->AddObservation(pKF,bestIdx);
+            pKF->AddMapPoint(pMP,bestIdx);
+            if(pvpChanged)
+                pvpChanged->push_back(pMP);
+        }
+        nFused++;
     }
 
     return nFused;
 }
 
 int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, float th, vector<MapPoint *> &vpReplacePoint)
+{
+    const int nPoints = vpPoints.size();
+    vector<int> vnCandidates(nPoints);
+    for(int i=0; i<nPoints; i++)
+        vnCandidates[i] = i;
+
+    vector<int> vMatches(nPoints,-1);
+    SearchForFuse(pKF,Scw,vpPoints,vnCandidates,th,vMatches);
+    return ApplyFuse(pKF,vpPoints,vMatches,vpReplacePoint);
+}
+
+void ORBmatcher::SearchForFuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoints, const vector<int> &vnCandidates,
+                               float th, vector<int> &vMatches)
 {
     // Get Calibration Parameters for later projection
     const float &fx = pKF->fx;
@@ -1116,15 +1348,11 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
     // 这是关键帧pKF原来的mappoint
     const set<MapPoint*> spAlreadyFound = pKF->GetMapPoints();
 
-    int nFused=0;
-
-    //vpPoints:闭环关键帧及其所有共视关键帧的mappoint
-    const int nPoints = vpPoints.size();
-
     // For each candidate MapPoint project and match
-    // 遍历vpPoints: 闭环关键帧及其所有共视关键帧的mappoint
-    for(int iMP=0; iMP<nPoints; iMP++)
+    // 遍历候选点，vpPoints: 闭环关键帧及其所有共视关键帧的mappoint
+    for(size_t iC=0, iCend=vnCandidates.size(); iC<iCend; iC++)
     {
+        const int iMP = vnCandidates[iC];
         MapPoint* pMP = vpPoints[iMP];
 
         // Discard Bad MapPoints and already found
@@ -1212,24 +1440,41 @@ int ORBmatcher::Fuse(KeyFrame *pKF, cv::Mat Scw, const vector<MapPoint *> &vpPoi
             }
         }
 
-        // If there is already a MapPoint replace otherwise add new measurement
         if(bestDist<=TH_LOW)
+            vMatches[iMP] = bestIdx;
+    }
+}
+
+int ORBmatcher::ApplyFuse(KeyFrame *pKF, const vector<MapPoint *> &vpPoints, const vector<int> &vMatches, vector<MapPoint *> &vpReplacePoint)
+{
+    int nFused=0;
+
+    for(size_t iMP=0, iend=vpPoints.size(); iMP<iend; iMP++)
+    {
+        const int bestIdx = vMatches[iMP];
+        if(bestIdx<0)
+            continue;
+
+        // 搜索之后地图可能已经变化(例如并行搜索的其它关键帧先做了融合)，重新检查
+        MapPoint* pMP = vpPoints[iMP];
+        if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
+            continue;
+
+        // If there is already a MapPoint replace otherwise add new measurement
+        MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
+        //如果bestIdx代表的特征点已经有mappoint匹配了
+        //那么将pMPinKF设置为坏点并抛弃
+        if(pMPinKF)
         {
-            MapPoint* pMPinKF = pKF->GetMapPoint(bestIdx);
-            //如果bestIdx代表的特征点已经有mappoint匹配了
-            //那么将pMPinKF设置为坏点并抛弃
-            if(pMPinKF)
-            {
-                if(!pMPinKF->isBad())
-                    vpReplacePoint[iMP] = pMPinKF;
-            }
-            else
-            {
-                pMP->AddObservation(pKF,bestIdx);
-                pKF->AddMapPoint(pMP,bestIdx);
-            }
-            nFused++;
+            if(!pMPinKF->isBad())
+                vpReplacePoint[iMP] = pMPinKF;
         }
+        else
+        {
+            pMP->AddObservation(pKF,bestIdx);
+            pKF->AddMapPoint(pMP,bestIdx);
+        }
+        nFused++;
     }
 
     return nFused;
@@ -1839,6 +2084,46 @@ void ORBmatcher::ComputeThreeMaxima(vector<int>* histo, const int L, int &ind1,
 }
 
 
+void ORBmatcher::DescriptorDistances(const unsigned char *a, const unsigned char *pB, const int n, int *pDist)
+{
+#ifdef __AVX2__
+    // 按4位查表求每个字节的popcount，再用sad把32个字节的计数加起来
+    const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                         0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+
+    for(int j=0; j<n; j++, pB+=32)
+    {
+        const __m256i x = _mm256_xor_si256(va,_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pB)));
+        const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut,_mm256_and_si256(x,low4)),
+                                            _mm256_shuffle_epi8(lut,_mm256_and_si256(_mm256_srli_epi16(x,4),low4)));
+        const __m256i sad = _mm256_sad_epu8(cnt,_mm256_setzero_si256());
+        const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sad),_mm256_extracti128_si256(sad,1));
+        pDist[j] = _mm_cvtsi128_si32(_mm_add_epi64(s,_mm_unpackhi_epi64(s,s)));
+    }
+#else
+    uint64_t qa[4];
+    memcpy(qa,a,32);
+
+    for(int j=0; j<n; j++, pB+=32)
+    {
+        uint64_t qb[4];
+        memcpy(qb,pB,32);
+        pDist[j] = __builtin_popcountll(qa[0]^qb[0]) + __builtin_popcountll(qa[1]^qb[1]) +
+                   __builtin_popcountll(qa[2]^qb[2]) + __builtin_popcountll(qa[3]^qb[3]);
+    }
+#endif
+}
+
+void ORBmatcher::GatherDescriptors(const cv::Mat &D, const vector<unsigned int> &vIndices, vector<unsigned char> &vBlock)
+{
+    // 多留一个描述子的空间，保证vIndices为空时&vBlock[0]也有效
+    vBlock.resize((vIndices.size()+1)*32);
+    for(size_t i=0; i<vIndices.size(); i++)
+        memcpy(&vBlock[i*32],D.ptr<unsigned char>(vIndices[i]),32);
+}
+
 // Bit set count operation from
 // http://graphics.stanford.edu/~seander/bithacks.html#CountBitsSetParallel
 int ORBmatcher::DescriptorDistance(const cv::Mat &a, const cv::Mat &b)
@@ -27,31 +27,288 @@
 #include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
+#include "Thirdparty/g2o/g2o/core/hyper_graph_action.h"
 
 #include<Eigen/StdVector>
 
 #include "Converter.h"
+#include "BASolver.h"
+#include "PoseSolver.h"
+#include "PoseGraphSolver.h"
 
 #include<mutex>
 
 namespace ORB_SLAM2
 {
 
+bool Optimizer::mbUseBASolver = false;
 
-void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+void Optimizer::SetUseBASolver(const bool bUse)
+{
+    mbUseBASolver = bUse;
+}
+
+bool Optimizer::UseBASolver()
+{
+    return mbUseBASolver;
+}
+
+bool Optimizer::mbUsePoseGraphSolver = false;
+int Optimizer::mnPoseGraphCoarseIterations = 0;
+
+void Optimizer::SetUsePoseGraphSolver(const bool bUse, const int nCoarseIterations)
+{
+    mbUsePoseGraphSolver = bUse;
+    mnPoseGraphCoarseIterations = nCoarseIterations;
+}
+
+namespace
+{
+
+// g2o每次迭代结束后调用，记录已完成的迭代次数
+class IterationCounter : public g2o::HyperGraphAction
+{
+public:
+    IterationCounter(std::atomic<int>* pnIterationsDone):mpnIterationsDone(pnIterationsDone){}
+
+    virtual g2o::HyperGraphAction* operator()(const g2o::HyperGraph* /*graph*/, Parameters* parameters)
+    {
+        ParametersIteration* params = dynamic_cast<ParametersIteration*>(parameters);
+        if(params)
+            *mpnIterationsDone = params->iteration+1;
+        return this;
+    }
+
+protected:
+    std::atomic<int>* mpnIterationsDone;
+};
+
+// LocalBundleAdjustment的g2o后端，接口与BASolver一致，边序号即vpEdgesMono/vpEdgesStereo的下标
+class LocalBAG2o
+{
+public:
+    LocalBAG2o(g2o::SparseOptimizer &optimizer, const vector<g2o::EdgeSE3ProjectXYZ*> &vpEdgesMono,
+               const vector<g2o::EdgeStereoSE3ProjectXYZ*> &vpEdgesStereo, const unsigned long maxKFid):
+        mOptimizer(optimizer), mvpEdgesMono(vpEdgesMono), mvpEdgesStereo(vpEdgesStereo), mMaxKFid(maxKFid),
+        mbInitialized(false){}
+
+    void Optimize(const int nIterations)
+    {
+        //第一次优化包含所有边，之后只优化level为0的边
+        if(mbInitialized)
+            mOptimizer.initializeOptimization(0);
+        else
+            mOptimizer.initializeOptimization();
+        mbInitialized = true;
+        mOptimizer.optimize(nIterations);
+    }
+
+    double MonoChi2(const size_t i) const { return mvpEdgesMono[i]->chi2(); }
+    double StereoChi2(const size_t i) const { return mvpEdgesStereo[i]->chi2(); }
+    bool IsMonoDepthPositive(const size_t i) const { return mvpEdgesMono[i]->isDepthPositive(); }
+    bool IsStereoDepthPositive(const size_t i) const { return mvpEdgesStereo[i]->isDepthPositive(); }
+    void SetMonoActive(const size_t i, const bool bActive) { mvpEdgesMono[i]->setLevel(bActive ? 0 : 1); }
+    void SetStereoActive(const size_t i, const bool bActive) { mvpEdgesStereo[i]->setLevel(bActive ? 0 : 1); }
+
+    void DisableRobustKernel()
+    {
+        for(size_t i=0; i<mvpEdgesMono.size(); i++)
+            mvpEdgesMono[i]->setRobustKernel(0);
+        for(size_t i=0; i<mvpEdgesStereo.size(); i++)
+            mvpEdgesStereo[i]->setRobustKernel(0);
+    }
+
+    g2o::SE3Quat KeyFramePose(KeyFrame* pKF) const
+    {
+        return static_cast<g2o::VertexSE3Expmap*>(mOptimizer.vertex(pKF->mnId))->estimate();
+    }
+
+    Eigen::Vector3d MapPointPos(MapPoint* pMP, const size_t /*nPoint*/) const
+    {
+        return static_cast<g2o::VertexSBAPointXYZ*>(mOptimizer.vertex(pMP->mnId+mMaxKFid+1))->estimate();
+    }
+
+protected:
+    g2o::SparseOptimizer &mOptimizer;
+    const vector<g2o::EdgeSE3ProjectXYZ*> &mvpEdgesMono;
+    const vector<g2o::EdgeStereoSE3ProjectXYZ*> &mvpEdgesStereo;
+    const unsigned long mMaxKFid;
+    bool mbInitialized;
+};
+
+// LocalBundleAdjustment的BASolver后端，地图点按lLocalMapPoints的顺序加入，序号即下标
+class LocalBASchur
+{
+public:
+    LocalBASchur(BASolver &solver, const vector<int> &vCamOfKF):
+        mSolver(solver), mvCamOfKF(vCamOfKF){}
+
+    void Optimize(const int nIterations) { mSolver.Optimize(nIterations); }
+
+    double MonoChi2(const size_t i) const { return mSolver.MonoChi2(i); }
+    double StereoChi2(const size_t i) const { return mSolver.StereoChi2(i); }
+    bool IsMonoDepthPositive(const size_t i) const { return mSolver.IsMonoDepthPositive(i); }
+    bool IsStereoDepthPositive(const size_t i) const { return mSolver.IsStereoDepthPositive(i); }
+    void SetMonoActive(const size_t i, const bool bActive) { mSolver.SetMonoActive(i,bActive); }
+    void SetStereoActive(const size_t i, const bool bActive) { mSolver.SetStereoActive(i,bActive); }
+
+    void DisableRobustKernel() { mSolver.SetRobustKernel(false,0,0); }
+
+    g2o::SE3Quat KeyFramePose(KeyFrame* pKF) const { return mSolver.GetCameraPose(mvCamOfKF[pKF->mnId]); }
+
+    Eigen::Vector3d MapPointPos(MapPoint* /*pMP*/, const size_t nPoint) const { return mSolver.GetPoint(nPoint); }
+
+protected:
+    BASolver &mSolver;
+    const vector<int> &mvCamOfKF;
+};
+
+/**
+ * LocalBundleAdjustment中与后端无关的部分
+ * 先带核函数优化5次，剔除外点后不带核函数再优化10次，
+ * 然后删除仍为外点的观测，并把结果写回关键帧和地图点
+ */
+template<class Backend>
+void SolveLocalBundleAdjustment(Backend &backend, bool* pbStopFlag, Map* pMap,
+                                const list<KeyFrame*> &lLocalKeyFrames, const list<MapPoint*> &lLocalMapPoints,
+                                const vector<KeyFrame*> &vpEdgeKFMono, const vector<MapPoint*> &vpMapPointEdgeMono,
+                                const vector<KeyFrame*> &vpEdgeKFStereo, const vector<MapPoint*> &vpMapPointEdgeStereo)
+{
+    // 检查pbStopFlag指针有没有值
+    if(pbStopFlag)
+        if(*pbStopFlag) //检查pbStopFlag标志，如果要求停止，则直接返回，不优化
+            return;
+
+    //开始优化，先迭代5次
+    backend.Optimize(5);
+
+    bool bDoMore= true;
+
+    // 再次检查pbStopFlag指针有没有值
+    if(pbStopFlag)
+        if(*pbStopFlag) //检查pbStopFlag标志，如果要求停止，则直接返回，终止优化
+            bDoMore = false;
+
+    // 如果还是没有请求停止的标志，则继续优化
+    if(bDoMore)
+    {
+        // Check inlier observations
+        // 检查inlier，卡方校验不通过的边不参加第二轮优化
+        for(size_t i=0, iend=vpMapPointEdgeMono.size(); i<iend;i++)
+        {
+            if(vpMapPointEdgeMono[i]->isBad())
+                continue;
+
+            if(backend.MonoChi2(i)>5.991 || !backend.IsMonoDepthPositive(i))
+                backend.SetMonoActive(i,false);
+        }
+        // 双目
+        for(size_t i=0, iend=vpMapPointEdgeStereo.size(); i<iend;i++)
+        {
+            if(vpMapPointEdgeStereo[i]->isBad())
+                continue;
+
+            if(backend.StereoChi2(i)>7.815 || !backend.IsStereoDepthPositive(i))
+                backend.SetStereoActive(i,false);
+        }
+
+        // Optimize again without the outliers
+        // 取消使用核函数，再次优化
+        backend.DisableRobustKernel();
+        backend.Optimize(10);
+    }
+
+    // 根据优化结果，选择需要剔除的关键帧和mappoint
+    vector<pair<KeyFrame*,MapPoint*> > vToErase;
+    vToErase.reserve(vpMapPointEdgeMono.size()+vpMapPointEdgeStereo.size());
+
+    // Check inlier observations
+    // 单目
+    for(size_t i=0, iend=vpMapPointEdgeMono.size(); i<iend;i++)
+    {
+        MapPoint* pMP = vpMapPointEdgeMono[i];
+
+        if(pMP->isBad())
+            continue;
+        // 卡方校验，超过阈值，加入剔除队列
+        if(backend.MonoChi2(i)>5.991 || !backend.IsMonoDepthPositive(i))
+            vToErase.push_back(make_pair(vpEdgeKFMono[i],pMP));
+    }
+    //双目
+    for(size_t i=0, iend=vpMapPointEdgeStereo.size(); i<iend;i++)
+    {
+        MapPoint* pMP = vpMapPointEdgeStereo[i];
+
+        if(pMP->isBad())
+            continue;
+
+        if(backend.StereoChi2(i)>7.815 || !backend.IsStereoDepthPositive(i))
+            vToErase.push_back(make_pair(vpEdgeKFStereo[i],pMP));
+    }
+
+    // Get Map Mutex
+    // 获取线程锁
+    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+
+    // 剔除
+    if(!vToErase.empty())
+    {
+        for(size_t i=0;i<vToErase.size();i++)
+        {
+            KeyFrame* pKFi = vToErase[i].first;
+            MapPoint* pMPi = vToErase[i].second;
+            pKFi->EraseMapPointMatch(pMPi);
+            pMPi->EraseObservation(pKFi);
+        }
+    }
+
+    // Recover optimized data
+
+    // 利用优化完的结果进行更新
+    // Keyframes
+    for(list<KeyFrame*>::const_iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    {
+        KeyFrame* pKFi = *lit;
+        pKFi->SetPose(Converter::toCvMat(backend.KeyFramePose(pKFi)));
+    }
+
+    //Points
+    size_t nMP = 0;
+    for(list<MapPoint*>::const_iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++, nMP++)
+    {
+        MapPoint* pMP = *lit;
+        pMP->SetWorldPos(Converter::toCvMat(backend.MapPointPos(pMP,nMP)));
+        pMP->UpdateNormalAndDepth();
+    }
+}
+
+} //namespace
+
+void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                       std::atomic<int>* pnIterationsDone)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
-    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
+    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust, pnIterationsDone);
 }
 
 
 void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                 std::atomic<int>* pnIterationsDone)
 {
+    if(mbUseBASolver)
+    {
+        BundleAdjustmentSchur(vpKFs,vpMP,nIterations,pbStopFlag,nLoopKF,bRobust,pnIterationsDone);
+        return;
+    }
+
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
 
+    //必须在optimizer之前构造，optimizer析构时不会释放它
+    IterationCounter iterationCounter(pnIterationsDone);
+
     g2o::SparseOptimizer optimizer;
     //typedef BlockSolver< BlockSolverTraits<6, 3> > BlockSolver_6_3;
     //这表明误差变量为6维，误差项为3维
@@ -83,8 +340,8 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose()));    //以关键帧的大概位姿作为初始值
         //设置顶点ID，为关键帧ID
         vSE3->setId(pKF->mnId);
-        //如果是第0帧，那么就不优化这个顶点误差变量(固定第0帧，避免零空间漂移)
-        vSE3->setFixed(pKF->mnId==0);
+        //如果是子地图的原点(第0帧)，那么就不优化这个顶点误差变量(固定原点，避免零空间漂移)
+        vSE3->setFixed(pKF->IsMapOrigin());
         //将配置好的顶点添加到optimizer
         optimizer.addVertex(vSE3);
         //更新maxKFid(最大id号？)
@@ -217,6 +474,12 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         }
     }
 
+    if(pnIterationsDone)
+    {
+        *pnIterationsDone = 0;
+        optimizer.addPostIterationAction(&iterationCounter);
+    }
+
     // Optimize!
     optimizer.initializeOptimization();
     optimizer.optimize(nIterations);
@@ -286,143 +549,59 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 //前端BA
 int Optimizer::PoseOptimization(Frame *pFrame)
 {
-    //这里请参考Optimizer::BundleAdjustment的注释
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
+    // 每个跟踪线程一个求解器，Clear()只清空边不释放内存，预热后不再分配
+    static thread_local PoseSolver solver;
+    solver.Clear();
+    solver.SetCalibration(pFrame->fx,pFrame->fy,pFrame->cx,pFrame->cy,pFrame->mbf);
 
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
-
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    //鲁棒性核函数的参数
+    const float deltaMono = sqrt(5.991);
+    const float deltaStereo = sqrt(7.815);
+    solver.SetRobustKernel(true,deltaMono,deltaStereo);
 
     int nInitialCorrespondences=0;  //记录边的数量,也就是关键点的数量
 
-    // Set Frame vertex
-    //将pFrame的位姿添加为顶点作为优化变量
-    g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw)); //cv::Mat 到 g2o::SE3Quat类型转换
-    vSE3->setId(0);
-    vSE3->setFixed(false);
-    optimizer.addVertex(vSE3);
-
     // Set MapPoint vertices
     const int N = pFrame->N;//关键点数量,也是特征点所构建的边的数量
 
-    vector<g2o::EdgeSE3ProjectXYZOnlyPose*> vpEdgesMono; //单目的边
-    vector<size_t> vnIndexEdgeMono;
-    vpEdgesMono.reserve(N);
+    //边在求解器中的序号到特征点序号的映射
+    static thread_local vector<size_t> vnIndexEdgeMono;
+    static thread_local vector<size_t> vnIndexEdgeStereo;
+    vnIndexEdgeMono.clear();
+    vnIndexEdgeStereo.clear();
     vnIndexEdgeMono.reserve(N);
-
-    vector<g2o::EdgeStereoSE3ProjectXYZOnlyPose*> vpEdgesStereo;
-    vector<size_t> vnIndexEdgeStereo;
-    vpEdgesStereo.reserve(N);
     vnIndexEdgeStereo.reserve(N);
 
-    //鲁棒性核函数的参数
-    const float deltaMono = sqrt(5.991);
-    const float deltaStereo = sqrt(7.815);
-
-
     {
         unique_lock<mutex> lock(MapPoint::mGlobalMutex);
 
-        //遍历pFrame帧的所有特征点，添加g2o边
+        //遍历pFrame帧的所有特征点，添加单目或双目边，地图点坐标作为常量
         for(int i=0; i<N; i++)
         {
-            //获取当前特征点所对应的路标点(世界坐标系3D点\地图点)
             MapPoint* pMP = pFrame->mvpMapPoints[i];
-            //如果此特征点有对应的mappoint
-            if(pMP)
-            {
-                // Monocular observation
-                //单目
-                if(pFrame->mvuRight[i]<0)   //负值表示单目观测
-                {
-                    //记录添加了多少条边
-                    nInitialCorrespondences++;
-                    //先将这个特征点设置为不是Outlier
-                    pFrame->mvbOutlier[i] = false;
-
-                    Eigen::Matrix<double,2,1> obs;  //观测,就是去畸变后的特征点坐标
-                    const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                    obs << kpUn.pt.x, kpUn.pt.y;
-
-                    //注意这里的边与GlobalBundleAdjustemnt()边不一样
-                    g2o::EdgeSE3ProjectXYZOnlyPose* e = new g2o::EdgeSE3ProjectXYZOnlyPose();
-                    //设置顶点,这里就一个顶点,就是当前帧的相机pose
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                    e->setMeasurement(obs); //设置观测,也就是当前索引为i的去畸变后的关键点的坐标
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];  //INFO
-                    e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
-
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;    //鲁棒性核函数Huber
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
-
-                    //设置相机内参
-                    e->fx = pFrame->fx;
-                    e->fy = pFrame->fy;
-                    e->cx = pFrame->cx;
-                    e->cy = pFrame->cy;
-
-                    //获取关键点在世界坐标系的坐标
-                    //也就是路标点的世界坐标
-                    //重投影的时候需要将这个点经过相机位姿投影到图像上,与观测做残差
-                    cv::Mat Xw = pMP->GetWorldPos();
-                    e->Xw[0] = Xw.at<float>(0);
-                    e->Xw[1] = Xw.at<float>(1);
-                    e->Xw[2] = Xw.at<float>(2);
-
-                    optimizer.addEdge(e);
-
-                    vpEdgesMono.push_back(e);
-                    vnIndexEdgeMono.push_back(i);
-                }
-                else  // Stereo observation  双目的观测
-                {
-                    //记录添加了多少条边
-                    nInitialCorrespondences++;
-                    //先将这个特征点设置为不是Outlier
-                    pFrame->mvbOutlier[i] = false;
-
-                    //SET EDGE
-                    Eigen::Matrix<double,3,1> obs;
-                    const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                    const float &kp_ur = pFrame->mvuRight[i];
-                    obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
-
-                    //双目观测的边
-                    g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();
-
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                    e->setMeasurement(obs);
-                    const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                    Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
-                    e->setInformation(Info);
+            if(!pMP)
+                continue;
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaStereo);
-
-                    e->fx = pFrame->fx;
-                    e->fy = pFrame->fy;
-                    e->cx = pFrame->cx;
-                    e->cy = pFrame->cy;
-                    e->bf = pFrame->mbf;
-                    cv::Mat Xw = pMP->GetWorldPos();
-                    e->Xw[0] = Xw.at<float>(0);
-                    e->Xw[1] = Xw.at<float>(1);
-                    e->Xw[2] = Xw.at<float>(2);
+            nInitialCorrespondences++;
+            //先将这个特征点设置为不是Outlier
+            pFrame->mvbOutlier[i] = false;
 
-                    optimizer.addEdge(e);
+            const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
+            const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
+            const cv::Mat Xw = pMP->GetWorldPos();
+            const Eigen::Vector3d X(Xw.at<float>(0),Xw.at<float>(1),Xw.at<float>(2));
 
-                    vpEdgesStereo.push_back(e);
-                    vnIndexEdgeStereo.push_back(i);
-                }
+            // Monocular observation
+            if(pFrame->mvuRight[i]<0)   //负值表示单目观测
+            {
+                solver.AddMonoEdge(X,Eigen::Vector2d(kpUn.pt.x,kpUn.pt.y),invSigma2);
+                vnIndexEdgeMono.push_back(i);
+            }
+            else  // Stereo observation  双目的观测
+            {
+                solver.AddStereoEdge(X,Eigen::Vector3d(kpUn.pt.x,kpUn.pt.y,pFrame->mvuRight[i]),invSigma2);
+                vnIndexEdgeStereo.push_back(i);
             }
-
         }
     }
 
@@ -442,86 +621,58 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     int nBad=0;
     for(size_t it=0; it<4; it++)
     {
-
         //设置初始值,这个初始值实际上是上个参考关键帧的位姿
-        vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-        optimizer.initializeOptimization(0);
-        //启动优化
-        optimizer.optimize(its[it]); //每次优化迭代10次
+        solver.SetPose(Converter::toSE3Quat(pFrame->mTcw));
+        solver.Optimize(its[it]); //每次优化迭代10次
 
+        //在优化后的位姿下重新判断所有边(包括上一轮的outlier)
         nBad=0;
-        //遍历单目模式的每条边
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)   //每次优化完都进入到这里遍历
+        for(size_t i=0, iend=vnIndexEdgeMono.size(); i<iend; i++)
         {
-            g2o::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i]; //取一条边
-
-            const size_t idx = vnIndexEdgeMono[i];  //取边的id
-
-            if(pFrame->mvbOutlier[idx]) //第一次的时候,这个数组全为false
-            {
-                e->computeError(); //计算这条边的残差
-            }
+            const size_t idx = vnIndexEdgeMono[i];
 
-            const float chi2 = e->chi2(); //平方
-
-            if(chi2>chi2Mono[it])  //判断残差是否大与阈值
+            if(solver.MonoChi2(i)>chi2Mono[it])
             {
-                pFrame->mvbOutlier[idx]=true; //则设置这条边为outlier
-                e->setLevel(1); //设置这条边的等级?
-                nBad++;         //坏的边数+1
+                pFrame->mvbOutlier[idx]=true;
+                solver.SetMonoActive(i,false);
+                nBad++;
             }
             else
             {
                 pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
+                solver.SetMonoActive(i,true);
             }
-
-            if(it==2)
-                e->setRobustKernel(0); //如果是第二次优化了,则不用核函数?
         }
 
-        //遍历双目模式的每条边
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
+        for(size_t i=0, iend=vnIndexEdgeStereo.size(); i<iend; i++)
         {
-            g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
-
             const size_t idx = vnIndexEdgeStereo[i];
 
-            //没懂
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            //判断残差是否大与阈值
-            if(chi2>chi2Stereo[it])
+            if(solver.StereoChi2(i)>chi2Stereo[it])
             {
                 pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
+                solver.SetStereoActive(i,false);
                 nBad++;
             }
             else
             {
-                e->setLevel(0);
                 pFrame->mvbOutlier[idx]=false;
+                solver.SetStereoActive(i,true);
             }
-
-            if(it==2)
-                e->setRobustKernel(0);
         }
 
+        //最后一轮优化不使用核函数
+        if(it==2)
+            solver.SetRobustKernel(false,deltaMono,deltaStereo);
+
         //如果边少于10,则不优化
-        if(optimizer.edges().size()<10)
+        if(nInitialCorrespondences<10)
             break;
     }
 
     // Recover optimized pose and return number of inliers
     // 获取优化后的结果,返回有效的边(关键点)数目
-    g2o::VertexSE3Expmap* vSE3_recov = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(0));
-    g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
-    cv::Mat pose = Converter::toCvMat(SE3quat_recov); //位姿重新转回cv::Mat类型
+    cv::Mat pose = Converter::toCvMat(solver.GetPose()); //位姿重新转回cv::Mat类型
     pFrame->SetPose(pose);  //设置该帧的pose
 
     return nInitialCorrespondences-nBad;//返回好的边(关键点)数
@@ -586,6 +737,12 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
+    if(mbUseBASolver)
+    {
+        LocalBundleAdjustmentSchur(pKF,pbStopFlag,pMap,lLocalKeyFrames,lFixedCameras,lLocalMapPoints);
+        return;
+    }
+
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
@@ -610,7 +767,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
         vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
         vSE3->setId(pKFi->mnId);
-        vSE3->setFixed(pKFi->mnId==0);
+        vSE3->setFixed(pKFi->IsMapOrigin());
         optimizer.addVertex(vSE3);
         if(pKFi->mnId>maxKFid)
             maxKFid=pKFi->mnId;
@@ -745,150 +902,237 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         }
     }
 
-    // 检查pbStopFlag指针有没有值
-    if(pbStopFlag)
-        if(*pbStopFlag) //检查pbStopFlag标志，如果要求停止，则直接返回，不优化
-            return;
-
-    //开始优化，先迭代5次
-    optimizer.initializeOptimization();
-    optimizer.optimize(5);
+    LocalBAG2o backend(optimizer,vpEdgesMono,vpEdgesStereo,maxKFid);
+    SolveLocalBundleAdjustment(backend,pbStopFlag,pMap,lLocalKeyFrames,lLocalMapPoints,
+                               vpEdgeKFMono,vpMapPointEdgeMono,vpEdgeKFStereo,vpMapPointEdgeStereo);
+}
 
-    bool bDoMore= true;
 
-    // 再次检查pbStopFlag指针有没有值
+void Optimizer::BundleAdjustmentSchur(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
+                                      int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                      std::atomic<int>* pnIterationsDone)
+{
+    BASolver solver;
+    solver.SetRobustKernel(bRobust,sqrt(5.99),sqrt(7.815));
     if(pbStopFlag)
-        if(*pbStopFlag) //检查pbStopFlag标志，如果要求停止，则直接返回，终止优化
-            bDoMore = false;
+        solver.SetForceStopFlag(pbStopFlag);
+    if(pnIterationsDone)
+    {
+        *pnIterationsDone = 0;
+        solver.SetIterationCounter(pnIterationsDone);
+    }
 
-    // 如果还是没有请求停止的标志，则继续优化
-    if(bDoMore)
+    long unsigned int maxKFid = 0;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+        if(pKF->mnId>maxKFid)
+            maxKFid=pKF->mnId;
+    }
+
+    // Set KeyFrame vertices
+    // 关键帧id到求解器中相机序号的映射，不在vpKFs中的关键帧为-1
+    vector<int> vCamOfKF(maxKFid+1,-1);
+    vector<int> vKFCam(vpKFs.size(),-1);
+    for(size_t i=0; i<vpKFs.size(); i++)
     {
+        KeyFrame* pKF = vpKFs[i];
+        if(pKF->isBad())
+            continue;
+        const int nCam = solver.AddCamera(Converter::toSE3Quat(pKF->GetPose()),pKF->fx,pKF->fy,pKF->cx,pKF->cy,pKF->mbf,pKF->IsMapOrigin());
+        vCamOfKF[pKF->mnId] = nCam;
+        vKFCam[i] = nCam;
+    }
 
-        // Check inlier observations
-        // 检查inlier
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend;i++)
-        {
-            // 取单目的边以及对应的mappoint
-            g2o::EdgeSE3ProjectXYZ* e = vpEdgesMono[i];
-            MapPoint* pMP = vpMapPointEdgeMono[i];
+    // Set MapPoint vertices and edges
+    vector<int> vMPPoint(vpMP.size(),-1);
+    for(size_t i=0; i<vpMP.size(); i++)
+    {
+        MapPoint* pMP = vpMP[i];
+        if(pMP->isBad())
+            continue;
 
-            if(pMP->isBad())
-                continue;
-            //检查这条边的误差，卡方校验
-            if(e->chi2()>5.991 || !e->isDepthPositive())
-            {
-                //这条边是outlier ?
-                e->setLevel(1);
-            }
-            //取消使用核函数
-            e->setRobustKernel(0);
-        }
-        // 双目
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend;i++)
-        {
-            g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
-            MapPoint* pMP = vpMapPointEdgeStereo[i];
+        const map<KeyFrame*,size_t> observations = pMP->GetObservations();
 
-            if(pMP->isBad())
+        int nPoint = -1;
+        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(); mit!=observations.end(); mit++)
+        {
+            KeyFrame* pKF = mit->first;
+            if(pKF->isBad() || pKF->mnId>maxKFid || vCamOfKF[pKF->mnId]<0)
                 continue;
 
-            if(e->chi2()>7.815 || !e->isDepthPositive())
+            //没有任何观测的点不加入求解器
+            if(nPoint<0)
+                nPoint = solver.AddPoint(Converter::toVector3d(pMP->GetWorldPos()));
+
+            const cv::KeyPoint &kpUn = pKF->mvKeysUn[mit->second];
+            const float &invSigma2 = pKF->mvInvLevelSigma2[kpUn.octave];
+
+            if(pKF->mvuRight[mit->second]<0)
             {
-                e->setLevel(1);
+                Eigen::Matrix<double,2,1> obs;
+                obs << kpUn.pt.x, kpUn.pt.y;
+                solver.AddMonoEdge(vCamOfKF[pKF->mnId],nPoint,obs,invSigma2);
+            }
+            else
+            {
+                Eigen::Matrix<double,3,1> obs;
+                const float kp_ur = pKF->mvuRight[mit->second];
+                obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
+                solver.AddStereoEdge(vCamOfKF[pKF->mnId],nPoint,obs,invSigma2);
             }
-
-            e->setRobustKernel(0);
         }
 
-        // Optimize again without the outliers
-        // 再次优化，已经剔除了被标记为outlier的边 (通过设置边的level)
-        optimizer.initializeOptimization(0);
-        optimizer.optimize(10);
-
+        vMPPoint[i] = nPoint;
     }
 
-    // 根据优化结果，选择需要提出的关键帧和mappoint
-    vector<pair<KeyFrame*,MapPoint*> > vToErase;
-    vToErase.reserve(vpEdgesMono.size()+vpEdgesStereo.size());
+    // Optimize!
+    solver.Optimize(nIterations);
 
-    // Check inlier observations
-    // 单目
-    for(size_t i=0, iend=vpEdgesMono.size(); i<iend;i++)
+    // Recover optimized data
+    //Keyframes
+    for(size_t i=0; i<vpKFs.size(); i++)
     {
-        // 取单目的边
-        g2o::EdgeSE3ProjectXYZ* e = vpEdgesMono[i];
-        MapPoint* pMP = vpMapPointEdgeMono[i];
-
-        if(pMP->isBad())
+        if(vKFCam[i]<0)
             continue;
-        // 卡方校验
-        if(e->chi2()>5.991 || !e->isDepthPositive())
+        KeyFrame* pKF = vpKFs[i];
+        const g2o::SE3Quat &SE3quat = solver.GetCameraPose(vKFCam[i]);
+        if(nLoopKF==0)
         {
-            //超过阈值，加入剔除队列
-            KeyFrame* pKFi = vpEdgeKFMono[i];
-            vToErase.push_back(make_pair(pKFi,pMP));
+            pKF->SetPose(Converter::toCvMat(SE3quat));
+        }
+        else
+        {
+            pKF->mTcwGBA.create(4,4,CV_32F);
+            Converter::toCvMat(SE3quat).copyTo(pKF->mTcwGBA);
+            pKF->mnBAGlobalForKF = nLoopKF;
         }
     }
-    //双目
-    for(size_t i=0, iend=vpEdgesStereo.size(); i<iend;i++)
+
+    //Points
+    for(size_t i=0; i<vpMP.size(); i++)
     {
-        g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
-        MapPoint* pMP = vpMapPointEdgeStereo[i];
+        if(vMPPoint[i]<0)
+            continue;
+
+        MapPoint* pMP = vpMP[i];
 
         if(pMP->isBad())
             continue;
 
-        if(e->chi2()>7.815 || !e->isDepthPositive())
+        const Eigen::Vector3d &Xw = solver.GetPoint(vMPPoint[i]);
+
+        if(nLoopKF==0)
         {
-            KeyFrame* pKFi = vpEdgeKFStereo[i];
-            vToErase.push_back(make_pair(pKFi,pMP));
+            pMP->SetWorldPos(Converter::toCvMat(Xw));
+            pMP->UpdateNormalAndDepth();
         }
-    }
-
-    // Get Map Mutex
-    // 获取线程锁
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
-
-    // 剔除
-    if(!vToErase.empty())
-    {
-        for(size_t i=0;i<vToErase.size();i++)
+        else
         {
-            KeyFrame* pKFi = vToErase[i].first;
-            MapPoint* pMPi = vToErase[i].second;
-            pKFi->EraseMapPointMatch(pMPi);
-            pMPi->EraseObservation(pKFi);
+            pMP->mPosGBA.create(3,1,CV_32F);
+            Converter::toCvMat(Xw).copyTo(pMP->mPosGBA);
+            pMP->mnBAGlobalForKF = nLoopKF;
         }
     }
+}
 
-    // Recover optimized data
+void Optimizer::LocalBundleAdjustmentSchur(KeyFrame *pKF, bool* pbStopFlag, Map* pMap,
+                                           const list<KeyFrame*> &lLocalKeyFrames,
+                                           const list<KeyFrame*> &lFixedCameras,
+                                           const list<MapPoint*> &lLocalMapPoints)
+{
+    BASolver solver;
+    solver.SetRobustKernel(true,sqrt(5.991),sqrt(7.815));
+    if(pbStopFlag)
+        solver.SetForceStopFlag(pbStopFlag);
 
-    // 利用优化完的结果进行更新
-    // Keyframes
-    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    unsigned long maxKFid = 0;
+    for(list<KeyFrame*>::const_iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+        maxKFid = max(maxKFid,(*lit)->mnId);
+    for(list<KeyFrame*>::const_iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
+        maxKFid = max(maxKFid,(*lit)->mnId);
+
+    // 局部关键帧可优化(第0帧除外)，lFixedCameras中的关键帧固定
+    vector<int> vCamOfKF(maxKFid+1,-1);
+    for(list<KeyFrame*>::const_iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
-        KeyFrame* pKF = *lit;
-        g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKF->mnId));
-        g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKF->SetPose(Converter::toCvMat(SE3quat));
+        KeyFrame* pKFi = *lit;
+        vCamOfKF[pKFi->mnId] = solver.AddCamera(Converter::toSE3Quat(pKFi->GetPose()),
+                                                pKFi->fx,pKFi->fy,pKFi->cx,pKFi->cy,pKFi->mbf,pKFi->IsMapOrigin());
+    }
+    for(list<KeyFrame*>::const_iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
+    {
+        KeyFrame* pKFi = *lit;
+        vCamOfKF[pKFi->mnId] = solver.AddCamera(Converter::toSE3Quat(pKFi->GetPose()),
+                                                pKFi->fx,pKFi->fy,pKFi->cx,pKFi->cy,pKFi->mbf,true);
     }
 
-    //Points
-    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    const int nExpectedSize = (lLocalKeyFrames.size()+lFixedCameras.size())*lLocalMapPoints.size();
+
+    // 边在求解器中的序号与下面数组的下标一致
+    vector<KeyFrame*> vpEdgeKFMono;
+    vpEdgeKFMono.reserve(nExpectedSize);
+
+    vector<MapPoint*> vpMapPointEdgeMono;
+    vpMapPointEdgeMono.reserve(nExpectedSize);
+
+    vector<KeyFrame*> vpEdgeKFStereo;
+    vpEdgeKFStereo.reserve(nExpectedSize);
+
+    vector<MapPoint*> vpMapPointEdgeStereo;
+    vpMapPointEdgeStereo.reserve(nExpectedSize);
+
+    for(list<MapPoint*>::const_iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
-        pMP->UpdateNormalAndDepth();
+        const int nPoint = solver.AddPoint(Converter::toVector3d(pMP->GetWorldPos()));
+
+        const map<KeyFrame*,size_t> observations = pMP->GetObservations();
+
+        for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            KeyFrame* pKFi = mit->first;
+
+            //选取局部关键帧之后新增的观测没有对应的相机
+            if(pKFi->isBad() || pKFi->mnId>maxKFid || vCamOfKF[pKFi->mnId]<0)
+                continue;
+
+            const cv::KeyPoint &kpUn = pKFi->mvKeysUn[mit->second];
+            const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
+
+            if(pKFi->mvuRight[mit->second]<0)
+            {
+                Eigen::Matrix<double,2,1> obs;
+                obs << kpUn.pt.x, kpUn.pt.y;
+                solver.AddMonoEdge(vCamOfKF[pKFi->mnId],nPoint,obs,invSigma2);
+                vpEdgeKFMono.push_back(pKFi);
+                vpMapPointEdgeMono.push_back(pMP);
+            }
+            else
+            {
+                Eigen::Matrix<double,3,1> obs;
+                const float kp_ur = pKFi->mvuRight[mit->second];
+                obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
+                solver.AddStereoEdge(vCamOfKF[pKFi->mnId],nPoint,obs,invSigma2);
+                vpEdgeKFStereo.push_back(pKFi);
+                vpMapPointEdgeStereo.push_back(pMP);
+            }
+        }
     }
-}
 
+    LocalBASchur backend(solver,vCamOfKF);
+    SolveLocalBundleAdjustment(backend,pbStopFlag,pMap,lLocalKeyFrames,lLocalMapPoints,
+                               vpEdgeKFMono,vpMapPointEdgeMono,vpEdgeKFStereo,vpMapPointEdgeStereo);
+}
 
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale,
+                                       LoopClosing::KeyFrameAndPose &InitialSim3, LoopClosing::KeyFrameAndPose &OptimizedSim3,
+                                       const std::function<void()> &graphBuilt)
 {
     // pLoopKF：闭环关键帧
     // pCurKF：当前关键帧
@@ -896,42 +1140,54 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     // CorrectedSim3：当前关键帧以及共视的关键帧的经过sim3修正的位姿
     // LoopConnections: 新的共视连接关系
 
-    // Setup optimizer
-    g2o::SparseOptimizer optimizer;
-    optimizer.setVerbose(false);
-    // typedef BlockSolver< BlockSolverTraits<7, 3> > BlockSolver_7_3;
-    //这表明误差变量为7维，误差项为3维
-    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
-            new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
-    g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+    EssentialGraph graph;
+    vector<KeyFrame*> vpKFs;
+    BuildEssentialGraph(pMap,pLoopKF,pCurKF,NonCorrectedSim3,CorrectedSim3,LoopConnections,graph,vpKFs);
 
-    solver->setUserLambdaInit(1e-16);
-    optimizer.setAlgorithm(solver);
+    // 图已经建好，之后只在优化器内部计算
+    if(graphBuilt)
+        graphBuilt();
 
-    // 取地图所有关键帧和mappoint
-    const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
-    const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
+    // Optimize!
+    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScwOptimized;
+    OptimizeEssentialGraph(graph,bFixScale,20,vScwOptimized);
+
+    // 输出优化前后的sim3位姿，由调用者分批应用到地图上
+    // 关键帧位姿和mappoint的修正见LoopClosing::ApplyEssentialGraph()
+    InitialSim3.clear();
+    OptimizedSim3.clear();
+    for(size_t i=0;i<vpKFs.size();i++)
+    {
+        InitialSim3[vpKFs[i]] = graph.vScw[i];
+        OptimizedSim3[vpKFs[i]] = vScwOptimized[i];
+    }
+}
+
+void Optimizer::BuildEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
+                                    const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
+                                    const LoopClosing::KeyFrameAndPose &CorrectedSim3,
+                                    const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
+                                    EssentialGraph &graph, vector<KeyFrame*> &vpKFs)
+{
+    // 取地图所有关键帧
+    const vector<KeyFrame*> vpAllKFs = pMap->GetAllKeyFrames();
 
     const unsigned int nMaxKFid = pMap->GetMaxKFid();   //取地图最新关键帧id
 
-    //储存ba优化前的原sim3位姿
+    //储存优化前的原sim3位姿
     vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vScw(nMaxKFid+1);
-    //
-    vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > vCorrectedSwc(nMaxKFid+1);
-    //储存所有顶点
-    vector<g2o::VertexSim3Expmap*> vpVertices(nMaxKFid+1);
+    //关键帧id到顶点序号，坏的关键帧没有顶点
+    vector<int> vVertex(nMaxKFid+1,-1);
 
     const int minFeat = 100;
 
     // Set KeyFrame vertices
-    //将map中的所有关键帧添加为g2o的顶点
-    for(size_t i=0, iend=vpKFs.size(); i<iend;i++)
+    //将map中的所有关键帧添加为顶点
+    for(size_t i=0, iend=vpAllKFs.size(); i<iend;i++)
     {
-        KeyFrame* pKF = vpKFs[i];
+        KeyFrame* pKF = vpAllKFs[i];
         if(pKF->isBad())
             continue;
-        g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
 
         const int nIDi = pKF->mnId;
 
@@ -941,43 +1197,32 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         //表示CorrectedSim3.find(pKF)寻找成功
         if(it!=CorrectedSim3.end())
         {
+            // 使用修正后的sim3位姿作为初始值
             vScw[nIDi] = it->second;
-            // 使用原来的sim3位姿作为初始值
-            VSim3->setEstimate(it->second);
         }
         else
         {
-            //如果当前的关键帧没有sim3位姿
+            //如果当前的关键帧没有sim3位姿，则取其se3位姿，然后把尺度设置为1
             Eigen::Matrix<double,3,3> Rcw = Converter::toMatrix3d(pKF->GetRotation());
             Eigen::Matrix<double,3,1> tcw = Converter::toVector3d(pKF->GetTranslation());
-            g2o::Sim3 Siw(Rcw,tcw,1.0);
-            //则取其se3位姿，然后把尺度设置为1
-            vScw[nIDi] = Siw;
-            VSim3->setEstimate(Siw);
+            vScw[nIDi] = g2o::Sim3(Rcw,tcw,1.0);
         }
 
-        //如果遍历到的关键帧是闭环关键帧，则固定其顶点sim3位姿
-        if(pKF==pLoopKF)
-            VSim3->setFixed(true);
-
-        //顶点id设置为关键帧id
-        VSim3->setId(nIDi);
-        VSim3->setMarginalized(false);
-        VSim3->_fix_scale = bFixScale;
-
-        optimizer.addVertex(VSim3);
-
-        vpVertices[nIDi]=VSim3;
+        vVertex[nIDi] = graph.vScw.size();
+        vpKFs.push_back(pKF);
+        graph.vnIds.push_back(pKF->mnId);
+        graph.vScw.push_back(vScw[nIDi]);
+        //闭环关键帧固定，其它(没有参与这次闭环的)子地图各自固定原点
+        graph.vbFixed.push_back(pKF==pLoopKF || (pKF->IsMapOrigin() && pKF->GetMapId()!=pLoopKF->GetMapId()));
     }
 
+    EssentialGraph::Edge e;
 
-    //在g2o中已经形成误差边的两个顶点，firstid数较小的顶点
+    //已经形成误差边的两个顶点，firstid数较小的顶点
     set<pair<long unsigned int,long unsigned int> > sInsertedEdges;
 
-    const Eigen::Matrix<double,7,7> matLambda = Eigen::Matrix<double,7,7>::Identity();
-
     // Set Loop edges
-    // LoopConnections: 新的共视连接关系
+    // LoopConnections: 新的共视连接关系，属于分层求解时的粗略图
     for(map<KeyFrame *, set<KeyFrame *> >::const_iterator mit = LoopConnections.begin(), mend=LoopConnections.end(); mit!=mend; mit++)
     {
         //取一个关键帧
@@ -985,7 +1230,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         const long unsigned int nIDi = pKF->mnId;
         //取关键帧pKF的共视关键帧集合spConnections
         const set<KeyFrame*> &spConnections = mit->second;
-        //vScw： 储存ba优化前的原sim3位姿
+        //vScw： 储存优化前的原sim3位姿
         const g2o::Sim3 Siw = vScw[nIDi];
         // 取逆，即为关键帧pKF的相机坐标系到世界坐标系的sim3变换
         const g2o::Sim3 Swi = Siw.inverse();
@@ -997,30 +1242,24 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             const long unsigned int nIDj = (*sit)->mnId;
             if((nIDi!=pCurKF->mnId || nIDj!=pLoopKF->mnId) && pKF->GetWeight(*sit)<minFeat)
                 continue;
+            if(vVertex[nIDi]<0 || vVertex[nIDj]<0)
+                continue;
+
             //取该id对应的sim3位姿
             const g2o::Sim3 Sjw = vScw[nIDj];
-            //关键帧i与j之间的相对sim3变换，得到从关键帧i到关键帧j的sim3变换
-            const g2o::Sim3 Sji = Sjw * Swi;
-
-            // g2o sim3类型的边
-            g2o::EdgeSim3* e = new g2o::EdgeSim3();
-            // 添加关键帧i和关键j对应的顶点作为连接顶点
-            e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDj)));
-            e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-            // 观测量即为上面根据两帧sim3位姿得到的相对变换
-            e->setMeasurement(Sji);
-
-            e->information() = matLambda;
-
-            optimizer.addEdge(e);
+            //关键帧i与j之间的相对sim3变换，得到从关键帧i到关键帧j的sim3变换，作为观测
+            e.i = vVertex[nIDi];
+            e.j = vVertex[nIDj];
+            e.Sji = Sjw * Swi;
+            e.bCoarse = true;
+            graph.vEdges.push_back(e);
 
             sInsertedEdges.insert(make_pair(min(nIDi,nIDj),max(nIDi,nIDj)));
         }
     }
 
     // Set normal edges
-    // vpKFs: 地图上所有关键帧
-    // 遍历vpKFs，将vpKFs和其在spanningtree中的父节点在g2o图中连接起来形成一条误差边；
+    // 遍历所有关键帧，将关键帧和其在spanningtree中的父节点连接起来形成一条误差边；
     for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
     {
         //取关键帧pKF
@@ -1034,15 +1273,15 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
         LoopClosing::KeyFrameAndPose::const_iterator iti = NonCorrectedSim3.find(pKF);
 
         if(iti!=NonCorrectedSim3.end())
-            Swi = (iti->second).inverse();  //没有，则取原来的位姿Tcw的逆(没有经过sim3修正)，尺度为1
+            Swi = (iti->second).inverse();  //有，则取原来的位姿Tcw的逆(没有经过sim3修正)，尺度为1
         else
             Swi = vScw[nIDi].inverse();     //否则，取sim3位姿
 
         KeyFrame* pParentKF = pKF->GetParent(); //取pKF父节点，即共视程度最高的关键帧
 
         // Spanning tree edge
-        //将vpKFs和其在spanningtree中的父节点在g2o图中连接起来形成一条误差边；
-        if(pParentKF)
+        //将关键帧和其在spanningtree中的父节点连接起来形成一条误差边；
+        if(pParentKF && vVertex[pParentKF->mnId]>=0)
         {
             int nIDj = pParentKF->mnId;
             //取父节点关键帧的sim3位姿
@@ -1051,34 +1290,28 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             LoopClosing::KeyFrameAndPose::const_iterator itj = NonCorrectedSim3.find(pParentKF);
 
             if(itj!=NonCorrectedSim3.end())
-                Sjw = itj->second;  //没有，则取原来的位姿Tcw的逆(没有经过sim3修正)，尺度为1
+                Sjw = itj->second;
             else
-                Sjw = vScw[nIDj];   //否则，取sim3位姿
+                Sjw = vScw[nIDj];
 
             //得到关键帧pKF与父节点关键帧的sim3相对变换，作为观测值
-            g2o::Sim3 Sji = Sjw * Swi;
-
-            g2o::EdgeSim3* e = new g2o::EdgeSim3();
-            e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDj)));
-            e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-            e->setMeasurement(Sji);
-
-            e->information() = matLambda;
-            optimizer.addEdge(e);
+            e.i = vVertex[nIDi];
+            e.j = vVertex[nIDj];
+            e.Sji = Sjw * Swi;
+            e.bCoarse = true;
+            graph.vEdges.push_back(e);
         }
 
         // Loop edges
-        // 取地图的关键帧已经构造的回环边mspLoopEdges，这个在OptimizeEssentialGraph才被设置
+        // 取关键帧已经构造的回环边mspLoopEdges，这个在CorrectLoop最后才被设置
+        // 将关键帧和其形成闭环的帧连接起来形成一条误差边
         const set<KeyFrame*> sLoopEdges = pKF->GetLoopEdges();
-        // vpKFs: 地图上所有关键帧
-        // 将vpKFs和其形成闭环的帧在g2o图中连接起来形成一条误差边
-        // 说白了就是把已经形成回环的记录下来了，这里直接取这些已经是回环的边
         for(set<KeyFrame*>::const_iterator sit=sLoopEdges.begin(), send=sLoopEdges.end(); sit!=send; sit++)
         {
             //取与关键帧pKF形成回环的一个关键帧pLKF
             KeyFrame* pLKF = *sit;
             //检查先后次序
-            if(pLKF->mnId<pKF->mnId)
+            if(pLKF->mnId<pKF->mnId && vVertex[pLKF->mnId]>=0)
             {
                 //构造观测
                 g2o::Sim3 Slw;
@@ -1089,15 +1322,12 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
                     Slw = itl->second;
                 else
                     Slw = vScw[pLKF->mnId];
-                g2o::Sim3 Sli = Slw * Swi;
-
-                //生成g2o边
-                g2o::EdgeSim3* el = new g2o::EdgeSim3();
-                el->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pLKF->mnId)));
-                el->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-                el->setMeasurement(Sli);
-                el->information() = matLambda;
-                optimizer.addEdge(el);
+
+                e.i = vVertex[nIDi];
+                e.j = vVertex[pLKF->mnId];
+                e.Sji = Slw * Swi;
+                e.bCoarse = true;
+                graph.vEdges.push_back(e);
             }
         }
 
@@ -1110,7 +1340,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
             //避免和前面的边添加重复
             if(pKFn && pKFn!=pParentKF && !pKF->hasChild(pKFn) && !sLoopEdges.count(pKFn))
             {
-                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId)
+                if(!pKFn->isBad() && pKFn->mnId<pKF->mnId && vVertex[pKFn->mnId]>=0)
                 {
                     //为避免重复添加，先查找
                     if(sInsertedEdges.count(make_pair(min(pKF->mnId,pKFn->mnId),max(pKF->mnId,pKFn->mnId))))
@@ -1123,98 +1353,97 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
                         Snw = itn->second;
                     else
                         Snw = vScw[pKFn->mnId];
-                    g2o::Sim3 Sni = Snw * Swi;
-
-                    //构造g2o边
-                    g2o::EdgeSim3* en = new g2o::EdgeSim3();
-                    en->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFn->mnId)));
-                    en->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(nIDi)));
-                    en->setMeasurement(Sni);
-                    en->information() = matLambda;
-                    optimizer.addEdge(en);
+
+                    e.i = vVertex[nIDi];
+                    e.j = vVertex[pKFn->mnId];
+                    e.Sji = Snw * Swi;
+                    e.bCoarse = false;
+                    graph.vEdges.push_back(e);
                 }
             }
         }
     }
+}
 
-    // Optimize!
-    optimizer.initializeOptimization();
-    optimizer.optimize(20);
-
-    unique_lock<mutex> lock(pMap->mMutexMapUpdate);
+int Optimizer::OptimizeEssentialGraph(const EssentialGraph &graph, const bool bFixScale, const int nIterations,
+                                      vector<g2o::Sim3,Eigen::aligned_allocator<g2o::Sim3> > &vScwOptimized)
+{
+    const size_t N = graph.vScw.size();
+    vScwOptimized.resize(N);
 
-    // SE3 Pose Recovering. Sim3:[sR t;0 1] -> SE3:[R t/s;0 1]
-    // 更新优化后的闭环检测位姿
-    for(size_t i=0;i<vpKFs.size();i++)
+    if(mbUsePoseGraphSolver)
     {
-        //取地图的关键帧
-        KeyFrame* pKFi = vpKFs[i];
-
-        const int nIDi = pKFi->mnId;
+        // 消元顺序在多次调用之间缓存，只在闭环线程(或基准测试)中调用
+        static PoseGraphSolver::Ordering ordering;
 
-        //取优化之后的顶点
-        g2o::VertexSim3Expmap* VSim3 = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(nIDi));
-        //得到优化之后的关键帧sim3位姿
-        g2o::Sim3 CorrectedSiw =  VSim3->estimate();
-        //vCorrectedSwc： 储存逆的形式，即 从相机坐标系到世界坐标系的sim3变换
-        vCorrectedSwc[nIDi]=CorrectedSiw.inverse();
+        PoseGraphSolver solver;
+        solver.SetFixScale(bFixScale);
+        solver.SetLambdaInit(1e-16);
+        solver.SetOrderingCache(&ordering);
 
-        //取优化结果更新关键帧位姿
-        Eigen::Matrix3d eigR = CorrectedSiw.rotation().toRotationMatrix();
-        Eigen::Vector3d eigt = CorrectedSiw.translation();
-        double s = CorrectedSiw.scale();
-        //这是为了保持尺度，与mappoint保持一致，mappoint的修正经历两次sim3投影，一次正一次反
-        eigt *=(1./s); //[R t/s;0 1]
+        for(size_t i=0; i<N; i++)
+            solver.AddVertex(graph.vScw[i],graph.vbFixed[i],graph.vnIds[i]);
+        for(size_t k=0; k<graph.vEdges.size(); k++)
+        {
+            const EssentialGraph::Edge &e = graph.vEdges[k];
+            solver.AddEdge(e.i,e.j,e.Sji,e.bCoarse);
+        }
 
-        cv::Mat Tiw = Converter::toCvSE3(eigR,eigt);
+        const int nIterationsDone = solver.Optimize(nIterations,mnPoseGraphCoarseIterations);
 
-        pKFi->SetPose(Tiw);
+        for(size_t i=0; i<N; i++)
+            vScwOptimized[i] = solver.GetEstimate(i);
+        return nIterationsDone;
     }
 
-    // Correct points. Transform to "non-optimized" reference keyframe pose and transform back with optimized pose
-    // 修正mappoint位姿，先使用没有优化的位姿投影到参考关键帧，再使用该关键帧优化之后的sim3位姿投影回来
-    // 经历两次投影，一次正，一次反，所以尺度不会发生很大变化
-    for(size_t i=0, iend=vpMPs.size(); i<iend; i++)
-    {
-        MapPoint* pMP = vpMPs[i];
+    // Setup optimizer
+    g2o::SparseOptimizer optimizer;
+    optimizer.setVerbose(false);
+    // typedef BlockSolver< BlockSolverTraits<7, 3> > BlockSolver_7_3;
+    //这表明误差变量为7维，误差项为3维
+    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
+            new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+    g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
+    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
 
-        if(pMP->isBad())
-            continue;
+    solver->setUserLambdaInit(1e-16);
+    optimizer.setAlgorithm(solver);
 
-        int nIDr;
-        // 检查该mappoint是否在CorrLoop主函数中修正过
-        if(pMP->mnCorrectedByKF==pCurKF->mnId)
-        {
-            //是，则直接取修正的关键帧id
-            nIDr = pMP->mnCorrectedReference;
-        }
-        else
-        {
-            //否则，取生成这个mappoint的关键帧的id
-            KeyFrame* pRefKF = pMP->GetReferenceKeyFrame();
-            nIDr = pRefKF->mnId;
-        }
+    //储存所有顶点，顶点id为顶点序号
+    vector<g2o::VertexSim3Expmap*> vpVertices(N);
+    for(size_t i=0; i<N; i++)
+    {
+        g2o::VertexSim3Expmap* VSim3 = new g2o::VertexSim3Expmap();
+        VSim3->setEstimate(graph.vScw[i]);
+        VSim3->setFixed(graph.vbFixed[i]);
+        VSim3->setId(i);
+        VSim3->setMarginalized(false);
+        VSim3->_fix_scale = bFixScale;
+        optimizer.addVertex(VSim3);
+        vpVertices[i] = VSim3;
+    }
 
-        //ba优化前的原sim3位姿
-        g2o::Sim3 Srw = vScw[nIDr];
-        //ba优化后的sim3位姿
-        g2o::Sim3 correctedSwr = vCorrectedSwc[nIDr];
-        //取当前mappoint坐标
-        cv::Mat P3Dw = pMP->GetWorldPos();
-        //转化为EIgen
-        Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-        //correctedSwr=[s2,R2,t2]
-        //1.先使用优化前的原sim3位姿将mappoint进行变换 p_s1=s1R1* p_w + t1
-        //2.再使用优化后的sim3位姿，将mappoint反变换到世界坐标系 p_w_new=s2R2* p_s1+ t2
-        //其中，s2=1/s_opt R2=R_opt^T  t2=-s2*R2*t_opt
-        //所以，如果s1=s_opt R1=R_opt t1=t_opt (即优化值等于初始值)，那么 p_w_new = p_w
-        Eigen::Matrix<double,3,1> eigCorrectedP3Dw = correctedSwr.map(Srw.map(eigP3Dw));
-
-        cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-        pMP->SetWorldPos(cvCorrectedP3Dw);
-
-        pMP->UpdateNormalAndDepth();//更新此mappoint参考帧光心到mappoint平均观测方向以及观测距离范围
+    const Eigen::Matrix<double,7,7> matLambda = Eigen::Matrix<double,7,7>::Identity();
+
+    for(size_t k=0; k<graph.vEdges.size(); k++)
+    {
+        const EssentialGraph::Edge &e = graph.vEdges[k];
+        // g2o sim3类型的边，观测量为两个顶点之间的相对sim3变换
+        g2o::EdgeSim3* pEdge = new g2o::EdgeSim3();
+        pEdge->setVertex(1, vpVertices[e.j]);
+        pEdge->setVertex(0, vpVertices[e.i]);
+        pEdge->setMeasurement(e.Sji);
+        pEdge->information() = matLambda;
+        optimizer.addEdge(pEdge);
     }
+
+    // Optimize!
+    optimizer.initializeOptimization();
+    const int nIterationsDone = optimizer.optimize(nIterations);
+
+    for(size_t i=0; i<N; i++)
+        vScwOptimized[i] = vpVertices[i]->estimate();
+    return nIterationsDone;
 }
 
 int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &vpMatches1, g2o::Sim3 &g2oS12, const float th2, const bool bFixScale)
@@ -51,13 +51,20 @@
 #include <iostream>
 
 #include "PnPsolver.h"
+#include "ORBmatcher.h"
+#include "Converter.h"
 
 #include <vector>
 #include <cmath>
+#include <complex>
+#include <limits>
 #include <opencv2/core/core.hpp>
-#include "Thirdparty/DBoW2/DUtils/Random.h"
 #include <algorithm>
 
+#include <Eigen/SVD>
+#include <Eigen/QR>
+#include <Eigen/Eigenvalues>
+
 using namespace std;
 
 namespace ORB_SLAM2
@@ -65,8 +72,7 @@ namespace ORB_SLAM2
 
 
 PnPsolver::PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches):
-    pws(0), us(0), alphas(0), pcs(0), maximum_number_of_correspondences(0), number_of_correspondences(0), mnInliersi(0),
-    mnIterations(0), mnBestInliers(0), N(0)
+    mnInliersi(0), mRansac(this), mnBestInliers(0), N(0)
 {
     //vvpMapPointMatches[当前帧第j个特征点]=当前帧第j个特征点对应的路标点mappoint
     mvpMapPointMatches = vpMapPointMatches;
@@ -76,11 +82,12 @@ PnPsolver::PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches)
     mvSigma2.reserve(F.mvpMapPoints.size());
     //F(当前帧)的所有观测到的mappoint的3d世界坐标
     mvP3Dw.reserve(F.mvpMapPoints.size());
+    //特征点的单位方向向量，P3P使用
+    mvBearings.reserve(F.mvpMapPoints.size());
     //mvP2D,mvP3Dw对应F的特征点在F中的序号
     mvKeyPointIndices.reserve(F.mvpMapPoints.size());
-    mvAllIndices.reserve(F.mvpMapPoints.size());
+    mvDistances.reserve(F.mvpMapPoints.size());
 
-    int idx=0;
     for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
     {
         //取当前帧F第i个特征点对应的路边点mappoint
@@ -101,16 +108,14 @@ PnPsolver::PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches)
                 cv::Mat Pos = pMP->GetWorldPos();
                 mvP3Dw.push_back(cv::Point3f(Pos.at<float>(0),Pos.at<float>(1), Pos.at<float>(2)));
 
+                mvBearings.push_back(Eigen::Vector3d((kp.pt.x-F.cx)*F.invfx,(kp.pt.y-F.cy)*F.invfy,1.0).normalized());
+
                 //储存索引i
                 //mvKeyPointIndices=[i_1,i_2,...] 储存的是有对应路标点的特征点索引
                 mvKeyPointIndices.push_back(i);
 
-
-                //mvAllIndices=[0,..,N]的序列，N为F的特征点数量大小
-                //后面RANSAC生成随机序列有用
-                mvAllIndices.push_back(idx);
-
-                idx++;
+                //匹配的描述子距离，RANSAC抽样的顺序
+                mvDistances.push_back(ORBmatcher::DescriptorDistance(F.mDescriptors.row(i),pMP->GetDescriptor()));
             }
         }
     }
@@ -126,10 +131,6 @@ PnPsolver::PnPsolver(const Frame &F, const vector<MapPoint*> &vpMapPointMatches)
 
 PnPsolver::~PnPsolver()
 {
-    delete [] pws;
-    delete [] us;
-    delete [] alphas;
-    delete [] pcs;
 }
 
 
@@ -137,8 +138,6 @@ void PnPsolver::SetRansacParameters(double probability, int minInliers, int maxI
 {
     mRansacProb = probability;
     mRansacMinInliers = minInliers;
-    
-    mRansacMaxIts = maxIterations;
     mRansacEpsilon = epsilon;
     //一次RANSAC所需要的数据集
     mRansacMinSet = minSet;
@@ -163,15 +162,19 @@ void PnPsolver::SetRansacParameters(double probability, int minInliers, int maxI
         mRansacEpsilon=(float)mRansacMinInliers/N;
 
     // Set RANSAC iterations according to probability, epsilon, and max iterations
-    //计算mRansacMaxIts
-    int nIterations;
+    // 初始的迭代次数由mRansacEpsilon决定，之后按实际的内点比例自适应地减少
+    mRansac.SetParameters(N,mRansacMinSet,mRansacProb,mRansacEpsilon,maxIterations);
 
-    if(mRansacMinInliers==N)
-        nIterations=1;
-    else
-        nIterations = ceil(log(1-mRansacProb)/log(1-pow(mRansacEpsilon,3)));
+    // 描述子距离小的匹配更可能是内点，按距离从小到大的顺序渐进抽样
+    vector<int> vOrder(N);
+    for(int i=0; i<N; i++)
+        vOrder[i] = i;
+    stable_sort(vOrder.begin(),vOrder.end(),[this](const int a, const int b){ return mvDistances[a]<mvDistances[b]; });
+    mRansac.SetOrder(vOrder);
 
-    mRansacMaxIts = max(1,min(nIterations,mRansacMaxIts));
+    // EPnP使用的缓存，之后不再分配内存
+    mvCorrespondences.reserve(N);
+    mvAlphas.reserve(N);
 
     mvMaxError.resize(mvSigma2.size());
     for(size_t i=0; i<mvSigma2.size(); i++)
@@ -181,7 +184,7 @@ void PnPsolver::SetRansacParameters(double probability, int minInliers, int maxI
 cv::Mat PnPsolver::find(vector<bool> &vbInliers, int &nInliers)
 {
     bool bFlag;
-    return iterate(mRansacMaxIts,bFlag,vbInliers,nInliers);
+    return iterate(mRansac.MaxIterations(),bFlag,vbInliers,nInliers);
 }
 
 
@@ -192,9 +195,6 @@ cv::Mat PnPsolver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInlie
     vbInliers.clear();
     nInliers=0;
 
-    // mRansacMinSet为每次RANSAC需要的特征点数，前面设置了默认为4组3D-2D对应点
-    set_maximum_number_of_correspondences(mRansacMinSet);
-
     // mRansacMinInliers为RANSAC迭代成功的阈值
     // N为有匹配的mappoint点的特征点个数
     if(N<mRansacMinInliers)
@@ -204,84 +204,22 @@ cv::Mat PnPsolver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInlie
         return cv::Mat();
     }
 
-    // mvAllIndices为所有参与PnP的2D点的索引
-    // vAvailableIndices为每次从mvAllIndices中随机挑选mRansacMinSet组3D-2D对应点进行一次RANSAC
-    vector<size_t> vAvailableIndices;
-
-    int nCurrentIterations = 0;
-    //nCurrentIterations<nIterations计算nIterations次，或者当mnIterations<mRansacMaxIts中断
-    //一次while循环表示计算了一次epnp获得位姿
-    while(mnIterations<mRansacMaxIts || nCurrentIterations<nIterations)
+    // 每次从所有点对中抽取mRansacMinSet组3D-2D对应点用P3P计算一次位姿，见ComputeHypothesis()
+    // 某次内点数超过阈值并且Refine()成功时返回
+    if(mRansac.Iterate(nIterations))
     {
-        nCurrentIterations++;// 这个函数中迭代的次数
-        mnIterations++;// 总的迭代次数
-        reset_correspondences();
-
-        //[0,..,N]的序列，N为F的特征点数量大小
-        vAvailableIndices = mvAllIndices;
-
-        // Get min set of points
-        //生成RANSAC所需的随机序列
-        for(short i = 0; i < mRansacMinSet; ++i)    //mRansacMinSet:每次RANSAC需要的特征点数
+        nInliers = mnRefinedInliers;
+        vbInliers = vector<bool>(mvpMapPointMatches.size(),false);
+        //将mvbRefinedInliers拷贝至vbInliers
+        for(int i=0; i<N; i++)
         {
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
-
-            int idx = vAvailableIndices[randi];
-
-            // 添加关联点对
-            // 将3D-2D点对存到pws,us这两个数组中,索引一一对应
-            add_correspondence(mvP3Dw[idx].x,mvP3Dw[idx].y,mvP3Dw[idx].z,mvP2D[idx].x,mvP2D[idx].y);
-
-            vAvailableIndices[randi] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
-        }
-
-        // Compute camera pose
-        //通过epnp计算相机位姿
-        compute_pose(mRi, mti);
-
-        // Check inliers
-        //对于本次iter的RANSAC计算的epnp求得的位姿，原先F中的特征点与mappoint的匹配还有哪些成立
-        CheckInliers();
-
-        //如果此次求得的位姿所对应的内点超过阈值
-        if(mnInliersi>=mRansacMinInliers)
-        {
-            // If it is the best solution so far, save it
-            // 储存目前最好的结果，更新mnBestInliers，mnBestInliers ,mBestTcw
-            if(mnInliersi>mnBestInliers)
-            {
-                mvbBestInliers = mvbInliersi;
-                mnBestInliers = mnInliersi;
-
-                cv::Mat Rcw(3,3,CV_64F,mRi);
-                cv::Mat tcw(3,1,CV_64F,mti);
-                Rcw.convertTo(Rcw,CV_32F);
-                tcw.convertTo(tcw,CV_32F);
-                mBestTcw = cv::Mat::eye(4,4,CV_32F);
-                Rcw.copyTo(mBestTcw.rowRange(0,3).colRange(0,3));
-                tcw.copyTo(mBestTcw.rowRange(0,3).col(3));
-            }
-
-            //在Refine()中以mvbBestInliers中的点对通过epnp计算位姿而不是先前使用4个点对计算位姿
-            //如果计算的结果对应的inliner超过阈值mRansacMinInliers，则返回成功
-            if(Refine())
-            {
-                nInliers = mnRefinedInliers;
-                vbInliers = vector<bool>(mvpMapPointMatches.size(),false);
-                //将mvbRefinedInliers拷贝至vbInliers
-                for(int i=0; i<N; i++)
-                {
-                    if(mvbRefinedInliers[i])
-                        vbInliers[mvKeyPointIndices[i]] = true;
-                }
-                return mRefinedTcw.clone();
-            }
-
+            if(mvbRefinedInliers[i])
+                vbInliers[mvKeyPointIndices[i]] = true;
         }
+        return mRefinedTcw.clone();
     }
 
-    if(mnIterations>=mRansacMaxIts)
+    if(mRansac.Exhausted())
     {
         bNoMore=true;
         if(mnBestInliers>=mRansacMinInliers)
@@ -300,27 +238,90 @@ cv::Mat PnPsolver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInlie
     return cv::Mat();
 }
 
-bool PnPsolver::Refine()
+bool PnPsolver::ComputeHypothesis(const vector<int> &vSample)
 {
-    vector<int> vIndices;
-    vIndices.reserve(mvbBestInliers.size());
+    // 前3对点用P3P求解，最多4个解
+    Eigen::Matrix3d F, P;
+    for(int i=0; i<3; i++)
+    {
+        F.col(i) = mvBearings[vSample[i]];
+        P.col(i) = Pw(vSample[i]);
+    }
 
-    for(size_t i=0; i<mvbBestInliers.size(); i++)
+    Eigen::Matrix3d Rs[4];
+    Eigen::Vector3d ts[4];
+    const int nSolutions = ComputePoseP3P(F,P,Rs,ts);
+
+    // 用最小集中其余的点对选择重投影误差最小的解
+    int bestSolution = -1;
+    double bestError = numeric_limits<double>::max();
+    for(int s=0; s<nSolutions; s++)
     {
-        if(mvbBestInliers[i])
+        double error = 0;
+        for(size_t i=3; i<vSample.size(); i++)
         {
-            vIndices.push_back(i);
+            const Eigen::Vector3d Pc = Rs[s]*Pw(vSample[i])+ts[s];
+            if(Pc(2)<=0)
+            {
+                error = numeric_limits<double>::max();
+                break;
+            }
+            const double du = uc + fu*Pc(0)/Pc(2) - mvP2D[vSample[i]].x;
+            const double dv = vc + fv*Pc(1)/Pc(2) - mvP2D[vSample[i]].y;
+            error += du*du+dv*dv;
+        }
+
+        if(error<bestError)
+        {
+            bestError = error;
+            bestSolution = s;
         }
     }
 
-    set_maximum_number_of_correspondences(vIndices.size());
+    if(bestSolution<0)
+        return false;
+
+    mRi = Rs[bestSolution];
+    mti = ts[bestSolution];
 
-    reset_correspondences();
+    return true;
+}
+
+int PnPsolver::ScoreHypothesis()
+{
+    // Check inliers
+    //内点数达不到mRansacMinInliers的位姿不会被采用
+    CheckInliers(mRansacMinInliers);
+    return mnInliersi;
+}
 
-    for(size_t i=0; i<vIndices.size(); i++)
+bool PnPsolver::AcceptHypothesis(const int nInliers)
+{
+    //如果此次求得的位姿所对应的内点超过阈值
+    if(nInliers<mRansacMinInliers)
+        return false;
+
+    // If it is the best solution so far, save it
+    // 储存目前最好的结果，更新mnBestInliers，mnBestInliers ,mBestTcw
+    if(nInliers>mnBestInliers)
     {
-        int idx = vIndices[i];
-        add_correspondence(mvP3Dw[idx].x,mvP3Dw[idx].y,mvP3Dw[idx].z,mvP2D[idx].x,mvP2D[idx].y);
+        mvbBestInliers = mvbInliersi;
+        mnBestInliers = nInliers;
+        mBestTcw = Converter::toCvSE3(mRi,mti);
+    }
+
+    //在Refine()中以mvbBestInliers中的点对通过epnp计算位姿而不是先前使用最小集计算位姿
+    //如果计算的结果对应的inliner超过阈值mRansacMinInliers，则返回成功
+    return Refine();
+}
+
+bool PnPsolver::Refine()
+{
+    mvCorrespondences.clear();
+    for(size_t i=0; i<mvbBestInliers.size(); i++)
+    {
+        if(mvbBestInliers[i])
+            mvCorrespondences.push_back(i);
     }
 
     // Compute camera pose
@@ -328,20 +329,14 @@ bool PnPsolver::Refine()
 
     // Check inliers
     CheckInliers();
-    
+
     mnRefinedInliers =mnInliersi;
     mvbRefinedInliers = mvbInliersi;
 
     //如果达到阈值
     if(mnInliersi>mRansacMinInliers)
     {
-        cv::Mat Rcw(3,3,CV_64F,mRi);
-        cv::Mat tcw(3,1,CV_64F,mti);
-        Rcw.convertTo(Rcw,CV_32F);
-        tcw.convertTo(tcw,CV_32F);
-        mRefinedTcw = cv::Mat::eye(4,4,CV_32F);
-        Rcw.copyTo(mRefinedTcw.rowRange(0,3).colRange(0,3));
-        tcw.copyTo(mRefinedTcw.rowRange(0,3).col(3));
+        mRefinedTcw = Converter::toCvSE3(mRi,mti);
         return true;
     }
 
@@ -349,27 +344,27 @@ bool PnPsolver::Refine()
 }
 
 
-void PnPsolver::CheckInliers()
+void PnPsolver::CheckInliers(const int nRequired)
 {
     mnInliersi=0;
 
     //匹配点对的数量
     for(int i=0; i<N; i++)
     {
-        cv::Point3f P3Dw = mvP3Dw[i];
-        cv::Point2f P2D = mvP2D[i];
+        //剩下的点全是内点也达不到nRequired，这个位姿不会被采用
+        if(mnInliersi+N-i<nRequired)
+            break;
 
-        float Xc = mRi[0][0]*P3Dw.x+mRi[0][1]*P3Dw.y+mRi[0][2]*P3Dw.z+mti[0];
-        float Yc = mRi[1][0]*P3Dw.x+mRi[1][1]*P3Dw.y+mRi[1][2]*P3Dw.z+mti[1];
-        float invZc = 1/(mRi[2][0]*P3Dw.x+mRi[2][1]*P3Dw.y+mRi[2][2]*P3Dw.z+mti[2]);
+        const Eigen::Vector3d Pc = mRi*Pw(i)+mti;
+        const double invZc = 1.0/Pc(2);
 
-        double ue = uc + fu * Xc * invZc;
-        double ve = vc + fv * Yc * invZc;
+        const double ue = uc + fu * Pc(0) * invZc;
+        const double ve = vc + fv * Pc(1) * invZc;
 
-        float distX = P2D.x-ue;
-        float distY = P2D.y-ve;
+        const float distX = mvP2D[i].x-ue;
+        const float distY = mvP2D[i].y-ve;
 
-        float error2 = distX*distX+distY*distY;
+        const float error2 = distX*distX+distY*distY;
 
         if(error2<mvMaxError[i])
         {
@@ -383,355 +378,202 @@ void PnPsolver::CheckInliers()
     }
 }
 
-
-void PnPsolver::set_maximum_number_of_correspondences(int n)
-{
-    if (maximum_number_of_correspondences < n) {
-        if (pws != 0) delete [] pws;
-        if (us != 0) delete [] us;
-        if (alphas != 0) delete [] alphas;
-        if (pcs != 0) delete [] pcs;
-
-        maximum_number_of_correspondences = n;
-        pws = new double[3 * maximum_number_of_correspondences];
-        us = new double[2 * maximum_number_of_correspondences];
-        alphas = new double[4 * maximum_number_of_correspondences];
-        pcs = new double[3 * maximum_number_of_correspondences];
-    }
-}
-
-void PnPsolver::reset_correspondences(void)
-{
-    number_of_correspondences = 0;
-}
-
-void PnPsolver::add_correspondence(double X, double Y, double Z, double u, double v)
-{
-    pws[3 * number_of_correspondences    ] = X;
-    pws[3 * number_of_correspondences + 1] = Y;
-    pws[3 * number_of_correspondences + 2] = Z;
-
-    us[2 * number_of_correspondences    ] = u;
-    us[2 * number_of_correspondences + 1] = v;
-
-    number_of_correspondences++;
-}
-
 void PnPsolver::choose_control_points(void)
 {
+    const int n = mvCorrespondences.size();
+
     // Take C0 as the reference points centroid:
     // 选择C0控制点为质心
-    cws[0][0] = cws[0][1] = cws[0][2] = 0;
-    for(int i = 0; i < number_of_correspondences; i++)
-        for(int j = 0; j < 3; j++)
-            cws[0][j] += pws[3 * i + j];
-
-    for(int j = 0; j < 3; j++)
-        cws[0][j] /= number_of_correspondences;
-
+    mCws.col(0).setZero();
+    for(int i = 0; i < n; i++)
+        mCws.col(0) += Pw(mvCorrespondences[i]);
+    mCws.col(0) /= n;
 
     // Take C1, C2, and C3 from PCA on the reference points:
-    CvMat * PW0 = cvCreateMat(number_of_correspondences, 3, CV_64F);
-
-    double pw0tpw0[3 * 3], dc[3], uct[3 * 3];
-    CvMat PW0tPW0 = cvMat(3, 3, CV_64F, pw0tpw0);
-    CvMat DC      = cvMat(3, 1, CV_64F, dc);
-    CvMat UCt     = cvMat(3, 3, CV_64F, uct);
-
-    // 计算去质心坐标
-    for(int i = 0; i < number_of_correspondences; i++)
-        for(int j = 0; j < 3; j++)
-            PW0->data.db[3 * i + j] = pws[3 * i + j] - cws[0][j];
-
-    //cvMulTransposed:计算PW0T*PW0
-    cvMulTransposed(PW0, &PW0tPW0, 1);
-    //SVD
-    cvSVD(&PW0tPW0, &DC, &UCt, 0, CV_SVD_MODIFY_A | CV_SVD_U_T);
-
-    cvReleaseMat(&PW0);
-
-    for(int i = 1; i < 4; i++) {
-        //dc[]：SVD分解得到的特征值数组
-        double k = sqrt(dc[i - 1] / number_of_correspondences);
-        //uct=特征值向量v
-        for(int j = 0; j < 3; j++)
-            cws[i][j] = cws[0][j] + k * uct[3 * (i - 1) + j];
+    // 去质心坐标的协方差 PW0^T*PW0
+    Eigen::Matrix3d PW0tPW0 = Eigen::Matrix3d::Zero();
+    for(int i = 0; i < n; i++)
+    {
+        const Eigen::Vector3d pw0 = Pw(mvCorrespondences[i]) - mCws.col(0);
+        PW0tPW0 += pw0 * pw0.transpose();
+    }
+
+    // 对称矩阵的特征值升序排列，控制点按特征值从大到小取
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(PW0tPW0);
+    for(int i = 1; i < 4; i++)
+    {
+        const double k = sqrt(max(es.eigenvalues()(3 - i), 0.0) / n);
+        mCws.col(i) = mCws.col(0) + k * es.eigenvectors().col(3 - i);
     }
 }
 
 void PnPsolver::compute_barycentric_coordinates(void)
 {
-    //计算权重alpha
-    double cc[3 * 3], cc_inv[3 * 3];
-    CvMat CC     = cvMat(3, 3, CV_64F, cc);
-    CvMat CC_inv = cvMat(3, 3, CV_64F, cc_inv);
-
     //取减去质心之后的控制点坐标
     //c1w-c0w , c2w-c0w , c3w-c0w
-    for(int i = 0; i < 3; i++)
-        for(int j = 1; j < 4; j++)
-            cc[3 * i + j - 1] = cws[j][i] - cws[0][i];
-
-    //求逆
-    cvInvert(&CC, &CC_inv, CV_SVD);
-    double * ci = cc_inv;
-    //有多少个3D点就遍历多少次
-    for(int i = 0; i < number_of_correspondences; i++) {
-        double * pi = pws + 3 * i;
-        double * a = alphas + 4 * i;
-
-        for(int j = 0; j < 3; j++)
-            a[1 + j] =
-                    ci[3 * j    ] * (pi[0] - cws[0][0]) +
-                    ci[3 * j + 1] * (pi[1] - cws[0][1]) +
-                    ci[3 * j + 2] * (pi[2] - cws[0][2]);
-        a[0] = 1.0f - a[1] - a[2] - a[3];
-    }
-}
-
-void PnPsolver::fill_M(CvMat * M,
-                       const int row, const double * as, const double u, const double v)
-{
-    double * M1 = M->data.db + row * 12;
-    double * M2 = M1 + 12;
-
-    for(int i = 0; i < 4; i++) {
-        M1[3 * i    ] = as[i] * fu;
-        M1[3 * i + 1] = 0.0;
-        M1[3 * i + 2] = as[i] * (uc - u);
+    Eigen::Matrix3d CC;
+    for(int j = 1; j < 4; j++)
+        CC.col(j - 1) = mCws.col(j) - mCws.col(0);
+
+    //求(伪)逆，点共面时CC奇异
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(CC, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    const Eigen::Vector3d sv = svd.singularValues();
+    Eigen::Vector3d svInv;
+    for(int j = 0; j < 3; j++)
+        svInv(j) = sv(j) > 1e-10 * sv(0) ? 1.0 / sv(j) : 0.0;
+    const Eigen::Matrix3d CC_inv = svd.matrixV() * svInv.asDiagonal() * svd.matrixU().transpose();
 
-        M2[3 * i    ] = 0.0;
-        M2[3 * i + 1] = as[i] * fv;
-        M2[3 * i + 2] = as[i] * (vc - v);
+    //计算权重alpha
+    const int n = mvCorrespondences.size();
+    mvAlphas.resize(n);
+    for(int i = 0; i < n; i++)
+    {
+        Eigen::Vector4d &a = mvAlphas[i];
+        a.tail<3>() = CC_inv * (Pw(mvCorrespondences[i]) - mCws.col(0));
+        a(0) = 1.0 - a(1) - a(2) - a(3);
     }
 }
 
-void PnPsolver::compute_ccs(const double * betas, const double * ut)
+void PnPsolver::compute_ccs(const Eigen::Vector4d &betas, const Eigen::Matrix<double,12,4> &V)
 {
+    mCcs.setZero();
     for(int i = 0; i < 4; i++)
-        ccs[i][0] = ccs[i][1] = ccs[i][2] = 0.0f;
-
-    for(int i = 0; i < 4; i++) {
-        const double * v = ut + 12 * (11 - i);
         for(int j = 0; j < 4; j++)
-            for(int k = 0; k < 3; k++)
-                ccs[j][k] += betas[i] * v[3 * j + k];
-    }
+            mCcs.col(j) += betas(i) * V.block<3,1>(3 * j, i);
 }
 
-void PnPsolver::compute_pcs(void)
-{
-    for(int i = 0; i < number_of_correspondences; i++) {
-        double * a = alphas + 4 * i;
-        double * pc = pcs + 3 * i;
-
-        for(int j = 0; j < 3; j++)
-            pc[j] = a[0] * ccs[0][j] + a[1] * ccs[1][j] + a[2] * ccs[2][j] + a[3] * ccs[3][j];
-    }
-}
-
-double PnPsolver::compute_pose(double R[3][3], double t[3])
+double PnPsolver::compute_pose(Eigen::Matrix3d &R, Eigen::Vector3d &t)
 {
     //获得EPnP算法中的四个控制点
     choose_control_points();    //计算世界坐标系的控制点
     compute_barycentric_coordinates();  //计算权重alpha
 
-    //创建 (2*n, 12)矩阵
-    CvMat * M = cvCreateMat(2 * number_of_correspondences, 12, CV_64F);
+    // M^T*M，M为(2*n, 12)矩阵，每个点对贡献两行，直接累加不储存M
+    Eigen::Matrix<double,12,12> MtM = Eigen::Matrix<double,12,12>::Zero();
+    Eigen::Matrix<double,12,1> M1, M2;
+    for(size_t i = 0; i < mvCorrespondences.size(); i++)
+    {
+        const Eigen::Vector4d &as = mvAlphas[i];
+        const Eigen::Vector2d u = Us(mvCorrespondences[i]);
+        for(int j = 0; j < 4; j++)
+        {
+            M1(3 * j    ) = as(j) * fu;
+            M1(3 * j + 1) = 0.0;
+            M1(3 * j + 2) = as(j) * (uc - u(0));
+
+            M2(3 * j    ) = 0.0;
+            M2(3 * j + 1) = as(j) * fv;
+            M2(3 * j + 2) = as(j) * (vc - u(1));
+        }
+        MtM.noalias() += M1 * M1.transpose();
+        MtM.noalias() += M2 * M2.transpose();
+    }
 
-    //遍历每一个2D点
-    for(int i = 0; i < number_of_correspondences; i++)
-        fill_M(M, 2 * i, alphas + 4 * i, us[2 * i], us[2 * i + 1]);
+    // 得到特征值和特征向量v，特征值升序排列，前4列对应最小的4个特征值
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double,12,12> > es(MtM);
+    const Eigen::Matrix<double,12,4> V = es.eigenvectors().leftCols<4>();
 
-    double mtm[12 * 12], d[12], ut[12 * 12];
-    CvMat MtM = cvMat(12, 12, CV_64F, mtm);
-    CvMat D   = cvMat(12,  1, CV_64F, d);
-    CvMat Ut  = cvMat(12, 12, CV_64F, ut);
+    //一种近似方法，只考虑N=4的情况，即目标是求出4个 \beta值
+    Eigen::Matrix<double,6,10> L_6x10;
+    Eigen::Matrix<double,6,1> Rho;
+    compute_L_6x10(V, L_6x10); //系数矩阵L  6x10
+    compute_rho(Rho);          //距离残差    6x1
 
-    //M^TM
-    cvMulTransposed(M, &MtM, 1);
-    cvSVD(&MtM, &D, &Ut, 0, CV_SVD_MODIFY_A | CV_SVD_U_T);  //得到特征值和特征向量v
-    cvReleaseMat(&M);
+    Eigen::Vector4d Betas[4];
+    double rep_errors[4];
+    Eigen::Matrix3d Rs[4];
+    Eigen::Vector3d ts[4];
 
-    double l_6x10[6 * 10], rho[6];
-    CvMat L_6x10 = cvMat(6, 10, CV_64F, l_6x10);
-    CvMat Rho    = cvMat(6,  1, CV_64F, rho);
+    find_betas_approx_1(L_6x10, Rho, Betas[1]);
+    gauss_newton(L_6x10, Rho, Betas[1]);  //迭代优化
+    rep_errors[1] = compute_R_and_t(V, Betas[1], Rs[1], ts[1]);    //求出R，t，并通过重投影计算得分
 
-    //一种近似方法，只考虑N=4的情况，即目标是求出4个 \beta值
-    compute_L_6x10(ut, l_6x10); //系数矩阵L  10x6
-    compute_rho(rho);           //距离残差    6x1
-
-    double Betas[4][4], rep_errors[4];
-    double Rs[4][3][3], ts[4][3];
-
-    //find_betas_approx: 求出\beta的近似值，
-    //存到Betas[1][0] Betas[1][1] Betas[1][2] Betas[1][3]
-    find_betas_approx_1(&L_6x10, &Rho, Betas[1]);
-    gauss_newton(&L_6x10, &Rho, Betas[1]);  //迭代优化
-    rep_errors[1] = compute_R_and_t(ut, Betas[1], Rs[1], ts[1]);    //求出R，t，并通过重投影计算得分
-
-    //find_betas_approx: 求出\beta的近似值，
-    //存到Betas[2][0] Betas[2][1] Betas[2][2] Betas[2][3]
-    find_betas_approx_2(&L_6x10, &Rho, Betas[2]);
-    gauss_newton(&L_6x10, &Rho, Betas[2]);
-    rep_errors[2] = compute_R_and_t(ut, Betas[2], Rs[2], ts[2]);
-
-    //find_betas_approx: 求出\beta的近似值，
-    //存到Betas[3][0] Betas[3][1] Betas[3][2] Betas[3][3]
-    find_betas_approx_3(&L_6x10, &Rho, Betas[3]);
-    gauss_newton(&L_6x10, &Rho, Betas[3]);
-    rep_errors[3] = compute_R_and_t(ut, Betas[3], Rs[3], ts[3]);
+    find_betas_approx_2(L_6x10, Rho, Betas[2]);
+    gauss_newton(L_6x10, Rho, Betas[2]);
+    rep_errors[2] = compute_R_and_t(V, Betas[2], Rs[2], ts[2]);
+
+    find_betas_approx_3(L_6x10, Rho, Betas[3]);
+    gauss_newton(L_6x10, Rho, Betas[3]);
+    rep_errors[3] = compute_R_and_t(V, Betas[3], Rs[3], ts[3]);
 
     //选取得分最高的方案，N表示哪一种方案
     int N = 1;
     if (rep_errors[2] < rep_errors[1]) N = 2;
     if (rep_errors[3] < rep_errors[N]) N = 3;
 
-    copy_R_and_t(Rs[N], ts[N], R, t);
+    R = Rs[N];
+    t = ts[N];
 
     return rep_errors[N];
 }
 
-void PnPsolver::copy_R_and_t(const double R_src[3][3], const double t_src[3],
-double R_dst[3][3], double t_dst[3])
-{
-    for(int i = 0; i < 3; i++) {
-        for(int j = 0; j < 3; j++)
-            R_dst[i][j] = R_src[i][j];
-        t_dst[i] = t_src[i];
-    }
-}
-
-double PnPsolver::dist2(const double * p1, const double * p2)
-{
-    return
-            (p1[0] - p2[0]) * (p1[0] - p2[0]) +
-            (p1[1] - p2[1]) * (p1[1] - p2[1]) +
-            (p1[2] - p2[2]) * (p1[2] - p2[2]);
-}
-
-double PnPsolver::dot(const double * v1, const double * v2)
-{
-    return v1[0] * v2[0] + v1[1] * v2[1] + v1[2] * v2[2];
-}
-
-double PnPsolver::reprojection_error(const double R[3][3], const double t[3])
+double PnPsolver::reprojection_error(const Eigen::Matrix3d &R, const Eigen::Vector3d &t)
 {
     double sum2 = 0.0;
 
-    for(int i = 0; i < number_of_correspondences; i++) {
+    const int n = mvCorrespondences.size();
+    for(int i = 0; i < n; i++) {
         //世界坐标系的点转换到相机坐标系
-        double * pw = pws + 3 * i;
-        double Xc = dot(R[0], pw) + t[0];
-        double Yc = dot(R[1], pw) + t[1];
-        double inv_Zc = 1.0 / (dot(R[2], pw) + t[2]);
+        const Eigen::Vector3d Pc = R * Pw(mvCorrespondences[i]) + t;
+        const double inv_Zc = 1.0 / Pc(2);
         //相机模型，
-        double ue = uc + fu * Xc * inv_Zc;
-        double ve = vc + fv * Yc * inv_Zc;
+        const double ue = uc + fu * Pc(0) * inv_Zc;
+        const double ve = vc + fv * Pc(1) * inv_Zc;
 
         //3D点经过投影后的估计点与对应2D点计算偏差
-        double u = us[2 * i], v = us[2 * i + 1];
-        sum2 += sqrt( (u - ue) * (u - ue) + (v - ve) * (v - ve) );
+        const Eigen::Vector2d u = Us(mvCorrespondences[i]);
+        sum2 += sqrt( (u(0) - ue) * (u(0) - ue) + (u(1) - ve) * (u(1) - ve) );
     }
     //返回平均误差
-    return sum2 / number_of_correspondences;
+    return sum2 / n;
 }
 
-void PnPsolver::estimate_R_and_t(double R[3][3], double t[3])
+void PnPsolver::estimate_R_and_t(Eigen::Matrix3d &R, Eigen::Vector3d &t)
 {
-    double pc0[3], pw0[3];
+    const int n = mvCorrespondences.size();
 
     //两组点云： 世界坐标系下的  相机坐标系下的
     //两组点云的质心坐标
-    pc0[0] = pc0[1] = pc0[2] = 0.0;
-    pw0[0] = pw0[1] = pw0[2] = 0.0;
-
-    for(int i = 0; i < number_of_correspondences; i++) {
-        const double * pc = pcs + 3 * i;
-        const double * pw = pws + 3 * i;
-
-        for(int j = 0; j < 3; j++) {
-            pc0[j] += pc[j];
-            pw0[j] += pw[j];
-        }
-    }
-    //质心坐标
-    for(int j = 0; j < 3; j++) {
-        pc0[j] /= number_of_correspondences;
-        pw0[j] /= number_of_correspondences;
+    Eigen::Vector3d pc0 = Eigen::Vector3d::Zero();
+    Eigen::Vector3d pw0 = Eigen::Vector3d::Zero();
+    for(int i = 0; i < n; i++) {
+        pc0 += mCcs * mvAlphas[i];
+        pw0 += Pw(mvCorrespondences[i]);
     }
-
-    double abt[3 * 3], abt_d[3], abt_u[3 * 3], abt_v[3 * 3];
-    CvMat ABt   = cvMat(3, 3, CV_64F, abt);
-    CvMat ABt_D = cvMat(3, 1, CV_64F, abt_d);
-    CvMat ABt_U = cvMat(3, 3, CV_64F, abt_u);
-    CvMat ABt_V = cvMat(3, 3, CV_64F, abt_v);
+    pc0 /= n;
+    pw0 /= n;
 
     //ICP的系数矩阵
-    cvSetZero(&ABt);
-    for(int i = 0; i < number_of_correspondences; i++) {
-        double * pc = pcs + 3 * i;
-        double * pw = pws + 3 * i;
-
-        for(int j = 0; j < 3; j++) {
-            abt[3 * j    ] += (pc[j] - pc0[j]) * (pw[0] - pw0[0]);
-            abt[3 * j + 1] += (pc[j] - pc0[j]) * (pw[1] - pw0[1]);
-            abt[3 * j + 2] += (pc[j] - pc0[j]) * (pw[2] - pw0[2]);
-        }
-    }
-    //SVD分解
-    cvSVD(&ABt, &ABt_D, &ABt_U, &ABt_V, CV_SVD_MODIFY_A);
-    //恢复R矩阵
-    for(int i = 0; i < 3; i++)
-        for(int j = 0; j < 3; j++)
-            R[i][j] = dot(abt_u + 3 * i, abt_v + 3 * j);
+    Eigen::Matrix3d ABt = Eigen::Matrix3d::Zero();
+    for(int i = 0; i < n; i++)
+        ABt += (mCcs * mvAlphas[i] - pc0) * (Pw(mvCorrespondences[i]) - pw0).transpose();
+
+    //SVD分解，恢复R矩阵
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(ABt, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d U = svd.matrixU();
+    R = U * svd.matrixV().transpose();
     //检查R矩阵的行列式
-    const double det =
-            R[0][0] * R[1][1] * R[2][2] + R[0][1] * R[1][2] * R[2][0] + R[0][2] * R[1][0] * R[2][1] -
-            R[0][2] * R[1][1] * R[2][0] - R[0][1] * R[1][0] * R[2][2] - R[0][0] * R[1][2] * R[2][1];
-
-    if (det < 0) {
-        R[2][0] = -R[2][0];
-        R[2][1] = -R[2][1];
-        R[2][2] = -R[2][2];
+    if (R.determinant() < 0) {
+        U.col(2) = -U.col(2);
+        R = U * svd.matrixV().transpose();
     }
     //恢复出t
-    t[0] = pc0[0] - dot(R[0], pw0);
-    t[1] = pc0[1] - dot(R[1], pw0);
-    t[2] = pc0[2] - dot(R[2], pw0);
-}
-
-void PnPsolver::print_pose(const double R[3][3], const double t[3])
-{
-    cout << R[0][0] << " " << R[0][1] << " " << R[0][2] << " " << t[0] << endl;
-    cout << R[1][0] << " " << R[1][1] << " " << R[1][2] << " " << t[1] << endl;
-    cout << R[2][0] << " " << R[2][1] << " " << R[2][2] << " " << t[2] << endl;
+    t = pc0 - R * pw0;
 }
 
 void PnPsolver::solve_for_sign(void)
 {
-    if (pcs[2] < 0.0) {
-        for(int i = 0; i < 4; i++)
-            for(int j = 0; j < 3; j++)
-                ccs[i][j] = -ccs[i][j];
-
-        for(int i = 0; i < number_of_correspondences; i++) {
-            pcs[3 * i    ] = -pcs[3 * i];
-            pcs[3 * i + 1] = -pcs[3 * i + 1];
-            pcs[3 * i + 2] = -pcs[3 * i + 2];
-        }
-    }
+    //第一个点在相机后方时，控制点取反
+    if ((mCcs * mvAlphas[0])(2) < 0.0)
+        mCcs = -mCcs;
 }
 
-double PnPsolver::compute_R_and_t(const double * ut, const double * betas,
-                                  double R[3][3], double t[3])
+double PnPsolver::compute_R_and_t(const Eigen::Matrix<double,12,4> &V, const Eigen::Vector4d &betas,
+                                  Eigen::Matrix3d &R, Eigen::Vector3d &t)
 {
     //计算控制点在相机坐标系的坐标
-    compute_ccs(betas, ut);
-    //用相机坐标系的控制点表示在相机坐标系的点
-    compute_pcs();
+    compute_ccs(betas, V);
 
-    //计算相机坐标系下参考点的去质心坐标
     solve_for_sign();
 
     //求解ICP
@@ -743,116 +585,85 @@ double PnPsolver::compute_R_and_t(const double * ut, const double * betas,
 // betas10        = [B11 B12 B22 B13 B23 B33 B14 B24 B34 B44]
 // betas_approx_1 = [B11 B12     B13         B14]
 
-void PnPsolver::find_betas_approx_1(const CvMat * L_6x10, const CvMat * Rho,
-                                    double * betas)
+void PnPsolver::find_betas_approx_1(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                                    Eigen::Vector4d &betas)
 {
-    double l_6x4[6 * 4], b4[4];
-    CvMat L_6x4 = cvMat(6, 4, CV_64F, l_6x4);
-    CvMat B4    = cvMat(4, 1, CV_64F, b4);
-
-    for(int i = 0; i < 6; i++) {
-        cvmSet(&L_6x4, i, 0, cvmGet(L_6x10, i, 0));
-        cvmSet(&L_6x4, i, 1, cvmGet(L_6x10, i, 1));
-        cvmSet(&L_6x4, i, 2, cvmGet(L_6x10, i, 3));
-        cvmSet(&L_6x4, i, 3, cvmGet(L_6x10, i, 6));
-    }
+    Eigen::Matrix<double,6,4> L_6x4;
+    L_6x4.col(0) = L_6x10.col(0);
+    L_6x4.col(1) = L_6x10.col(1);
+    L_6x4.col(2) = L_6x10.col(3);
+    L_6x4.col(3) = L_6x10.col(6);
 
-    cvSolve(&L_6x4, Rho, &B4, CV_SVD);
+    const Eigen::Vector4d b4 = Eigen::JacobiSVD<Eigen::Matrix<double,6,4> >(L_6x4, Eigen::ComputeFullU | Eigen::ComputeFullV).solve(Rho);
 
-    if (b4[0] < 0) {
-        betas[0] = sqrt(-b4[0]);
-        betas[1] = -b4[1] / betas[0];
-        betas[2] = -b4[2] / betas[0];
-        betas[3] = -b4[3] / betas[0];
+    if (b4(0) < 0) {
+        betas(0) = sqrt(-b4(0));
+        betas(1) = -b4(1) / betas(0);
+        betas(2) = -b4(2) / betas(0);
+        betas(3) = -b4(3) / betas(0);
     } else {
-        betas[0] = sqrt(b4[0]);
-        betas[1] = b4[1] / betas[0];
-        betas[2] = b4[2] / betas[0];
-        betas[3] = b4[3] / betas[0];
+        betas(0) = sqrt(b4(0));
+        betas(1) = b4(1) / betas(0);
+        betas(2) = b4(2) / betas(0);
+        betas(3) = b4(3) / betas(0);
     }
 }
 
 // betas10        = [B11 B12 B22 B13 B23 B33 B14 B24 B34 B44]
 // betas_approx_2 = [B11 B12 B22                            ]
 
-void PnPsolver::find_betas_approx_2(const CvMat * L_6x10, const CvMat * Rho,
-                                    double * betas)
+void PnPsolver::find_betas_approx_2(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                                    Eigen::Vector4d &betas)
 {
-    double l_6x3[6 * 3], b3[3];
-    CvMat L_6x3  = cvMat(6, 3, CV_64F, l_6x3);
-    CvMat B3     = cvMat(3, 1, CV_64F, b3);
+    const Eigen::Matrix<double,6,3> L_6x3 = L_6x10.leftCols<3>();
 
-    for(int i = 0; i < 6; i++) {
-        cvmSet(&L_6x3, i, 0, cvmGet(L_6x10, i, 0));
-        cvmSet(&L_6x3, i, 1, cvmGet(L_6x10, i, 1));
-        cvmSet(&L_6x3, i, 2, cvmGet(L_6x10, i, 2));
-    }
+    const Eigen::Vector3d b3 = Eigen::JacobiSVD<Eigen::Matrix<double,6,3> >(L_6x3, Eigen::ComputeFullU | Eigen::ComputeFullV).solve(Rho);
 
-    cvSolve(&L_6x3, Rho, &B3, CV_SVD);
-
-    if (b3[0] < 0) {
-        betas[0] = sqrt(-b3[0]);
-        betas[1] = (b3[2] < 0) ? sqrt(-b3[2]) : 0.0;
+    if (b3(0) < 0) {
+        betas(0) = sqrt(-b3(0));
+        betas(1) = (b3(2) < 0) ? sqrt(-b3(2)) : 0.0;
     } else {
-        betas[0] = sqrt(b3[0]);
-        betas[1] = (b3[2] > 0) ? sqrt(b3[2]) : 0.0;
+        betas(0) = sqrt(b3(0));
+        betas(1) = (b3(2) > 0) ? sqrt(b3(2)) : 0.0;
     }
 
-    if (b3[1] < 0) betas[0] = -betas[0];
+    if (b3(1) < 0) betas(0) = -betas(0);
 
-    betas[2] = 0.0;
-    betas[3] = 0.0;
+    betas(2) = 0.0;
+    betas(3) = 0.0;
 }
 
 // betas10        = [B11 B12 B22 B13 B23 B33 B14 B24 B34 B44]
 // betas_approx_3 = [B11 B12 B22 B13 B23                    ]
 
-void PnPsolver::find_betas_approx_3(const CvMat * L_6x10, const CvMat * Rho,
-                                    double * betas)
+void PnPsolver::find_betas_approx_3(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                                    Eigen::Vector4d &betas)
 {
-    double l_6x5[6 * 5], b5[5];
-    CvMat L_6x5 = cvMat(6, 5, CV_64F, l_6x5);
-    CvMat B5    = cvMat(5, 1, CV_64F, b5);
+    const Eigen::Matrix<double,6,5> L_6x5 = L_6x10.leftCols<5>();
 
-    for(int i = 0; i < 6; i++) {
-        cvmSet(&L_6x5, i, 0, cvmGet(L_6x10, i, 0));
-        cvmSet(&L_6x5, i, 1, cvmGet(L_6x10, i, 1));
-        cvmSet(&L_6x5, i, 2, cvmGet(L_6x10, i, 2));
-        cvmSet(&L_6x5, i, 3, cvmGet(L_6x10, i, 3));
-        cvmSet(&L_6x5, i, 4, cvmGet(L_6x10, i, 4));
-    }
+    const Eigen::Matrix<double,5,1> b5 = Eigen::JacobiSVD<Eigen::Matrix<double,6,5> >(L_6x5, Eigen::ComputeFullU | Eigen::ComputeFullV).solve(Rho);
 
-    cvSolve(&L_6x5, Rho, &B5, CV_SVD);
-
-    if (b5[0] < 0) {
-        betas[0] = sqrt(-b5[0]);
-        betas[1] = (b5[2] < 0) ? sqrt(-b5[2]) : 0.0;
+    if (b5(0) < 0) {
+        betas(0) = sqrt(-b5(0));
+        betas(1) = (b5(2) < 0) ? sqrt(-b5(2)) : 0.0;
     } else {
-        betas[0] = sqrt(b5[0]);
-        betas[1] = (b5[2] > 0) ? sqrt(b5[2]) : 0.0;
+        betas(0) = sqrt(b5(0));
+        betas(1) = (b5(2) > 0) ? sqrt(b5(2)) : 0.0;
     }
-    if (b5[1] < 0) betas[0] = -betas[0];
-    betas[2] = b5[3] / betas[0];
-    betas[3] = 0.0;
+    if (b5(1) < 0) betas(0) = -betas(0);
+    betas(2) = b5(3) / betas(0);
+    betas(3) = 0.0;
 }
 
-void PnPsolver::compute_L_6x10(const double * ut, double * l_6x10)
+void PnPsolver::compute_L_6x10(const Eigen::Matrix<double,12,4> &V, Eigen::Matrix<double,6,10> &L_6x10)
 {
-    const double * v[4];
-
-    v[0] = ut + 12 * 11;
-    v[1] = ut + 12 * 10;
-    v[2] = ut + 12 *  9;
-    v[3] = ut + 12 *  8;
-
-    double dv[4][6][3];
+    // dv[i][j]: 第i个特征向量中第j对控制点之差
+    Eigen::Vector3d dv[4][6];
 
     for(int i = 0; i < 4; i++) {
         int a = 0, b = 1;
         for(int j = 0; j < 6; j++) {
-            dv[i][j][0] = v[i][3 * a    ] - v[i][3 * b];
-            dv[i][j][1] = v[i][3 * a + 1] - v[i][3 * b + 1];
-            dv[i][j][2] = v[i][3 * a + 2] - v[i][3 * b + 2];
+            dv[i][j] = V.block<3,1>(3 * a, i) - V.block<3,1>(3 * b, i);
 
             b++;
             if (b > 3) {
@@ -863,239 +674,248 @@ void PnPsolver::compute_L_6x10(const double * ut, double * l_6x10)
     }
 
     for(int i = 0; i < 6; i++) {
-        double * row = l_6x10 + 10 * i;
-
-        row[0] =        dot(dv[0][i], dv[0][i]);
-        row[1] = 2.0f * dot(dv[0][i], dv[1][i]);
-        row[2] =        dot(dv[1][i], dv[1][i]);
-        row[3] = 2.0f * dot(dv[0][i], dv[2][i]);
-        row[4] = 2.0f * dot(dv[1][i], dv[2][i]);
-        row[5] =        dot(dv[2][i], dv[2][i]);
-        row[6] = 2.0f * dot(dv[0][i], dv[3][i]);
-        row[7] = 2.0f * dot(dv[1][i], dv[3][i]);
-        row[8] = 2.0f * dot(dv[2][i], dv[3][i]);
-        row[9] =        dot(dv[3][i], dv[3][i]);
+        L_6x10(i, 0) =       dv[0][i].dot(dv[0][i]);
+        L_6x10(i, 1) = 2.0 * dv[0][i].dot(dv[1][i]);
+        L_6x10(i, 2) =       dv[1][i].dot(dv[1][i]);
+        L_6x10(i, 3) = 2.0 * dv[0][i].dot(dv[2][i]);
+        L_6x10(i, 4) = 2.0 * dv[1][i].dot(dv[2][i]);
+        L_6x10(i, 5) =       dv[2][i].dot(dv[2][i]);
+        L_6x10(i, 6) = 2.0 * dv[0][i].dot(dv[3][i]);
+        L_6x10(i, 7) = 2.0 * dv[1][i].dot(dv[3][i]);
+        L_6x10(i, 8) = 2.0 * dv[2][i].dot(dv[3][i]);
+        L_6x10(i, 9) =       dv[3][i].dot(dv[3][i]);
     }
 }
 
-void PnPsolver::compute_rho(double * rho)
+void PnPsolver::compute_rho(Eigen::Matrix<double,6,1> &Rho)
 {
-    rho[0] = dist2(cws[0], cws[1]);
-    rho[1] = dist2(cws[0], cws[2]);
-    rho[2] = dist2(cws[0], cws[3]);
-    rho[3] = dist2(cws[1], cws[2]);
-    rho[4] = dist2(cws[1], cws[3]);
-    rho[5] = dist2(cws[2], cws[3]);
+    Rho(0) = (mCws.col(0) - mCws.col(1)).squaredNorm();
+    Rho(1) = (mCws.col(0) - mCws.col(2)).squaredNorm();
+    Rho(2) = (mCws.col(0) - mCws.col(3)).squaredNorm();
+    Rho(3) = (mCws.col(1) - mCws.col(2)).squaredNorm();
+    Rho(4) = (mCws.col(1) - mCws.col(3)).squaredNorm();
+    Rho(5) = (mCws.col(2) - mCws.col(3)).squaredNorm();
 }
 
-void PnPsolver::compute_A_and_b_gauss_newton(const double * l_6x10, const double * rho,
-                                             double betas[4], CvMat * A, CvMat * b)
+void PnPsolver::compute_A_and_b_gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                                             const Eigen::Vector4d &betas, Eigen::Matrix<double,6,4> &A, Eigen::Matrix<double,6,1> &b)
 {
     for(int i = 0; i < 6; i++) {
-        const double * rowL = l_6x10 + i * 10;
-        double * rowA = A->data.db + i * 4;
+        const Eigen::Matrix<double,1,10> rowL = L_6x10.row(i);
 
-        rowA[0] = 2 * rowL[0] * betas[0] +     rowL[1] * betas[1] +     rowL[3] * betas[2] +     rowL[6] * betas[3];
-        rowA[1] =     rowL[1] * betas[0] + 2 * rowL[2] * betas[1] +     rowL[4] * betas[2] +     rowL[7] * betas[3];
-        rowA[2] =     rowL[3] * betas[0] +     rowL[4] * betas[1] + 2 * rowL[5] * betas[2] +     rowL[8] * betas[3];
-        rowA[3] =     rowL[6] * betas[0] +     rowL[7] * betas[1] +     rowL[8] * betas[2] + 2 * rowL[9] * betas[3];
+        A(i, 0) = 2 * rowL(0) * betas(0) +     rowL(1) * betas(1) +     rowL(3) * betas(2) +     rowL(6) * betas(3);
+        A(i, 1) =     rowL(1) * betas(0) + 2 * rowL(2) * betas(1) +     rowL(4) * betas(2) +     rowL(7) * betas(3);
+        A(i, 2) =     rowL(3) * betas(0) +     rowL(4) * betas(1) + 2 * rowL(5) * betas(2) +     rowL(8) * betas(3);
+        A(i, 3) =     rowL(6) * betas(0) +     rowL(7) * betas(1) +     rowL(8) * betas(2) + 2 * rowL(9) * betas(3);
 
-        cvmSet(b, i, 0, rho[i] -
+        b(i) = Rho(i) -
                (
-                   rowL[0] * betas[0] * betas[0] +
-                rowL[1] * betas[0] * betas[1] +
-                rowL[2] * betas[1] * betas[1] +
-                rowL[3] * betas[0] * betas[2] +
-                rowL[4] * betas[1] * betas[2] +
-                rowL[5] * betas[2] * betas[2] +
-                rowL[6] * betas[0] * betas[3] +
-                rowL[7] * betas[1] * betas[3] +
-                rowL[8] * betas[2] * betas[3] +
-                rowL[9] * betas[3] * betas[3]
-                ));
+                rowL(0) * betas(0) * betas(0) +
+                rowL(1) * betas(0) * betas(1) +
+                rowL(2) * betas(1) * betas(1) +
+                rowL(3) * betas(0) * betas(2) +
+                rowL(4) * betas(1) * betas(2) +
+                rowL(5) * betas(2) * betas(2) +
+                rowL(6) * betas(0) * betas(3) +
+                rowL(7) * betas(1) * betas(3) +
+                rowL(8) * betas(2) * betas(3) +
+                rowL(9) * betas(3) * betas(3)
+                );
     }
 }
 
-void PnPsolver::gauss_newton(const CvMat * L_6x10, const CvMat * Rho,
-                             double betas[4])
+void PnPsolver::gauss_newton(const Eigen::Matrix<double,6,10> &L_6x10, const Eigen::Matrix<double,6,1> &Rho,
+                             Eigen::Vector4d &betas)
 {
     const int iterations_number = 5;
 
-    double a[6*4], b[6], x[4];
-    CvMat A = cvMat(6, 4, CV_64F, a);
-    CvMat B = cvMat(6, 1, CV_64F, b);
-    CvMat X = cvMat(4, 1, CV_64F, x);
+    Eigen::Matrix<double,6,4> A;
+    Eigen::Matrix<double,6,1> b;
 
     for(int k = 0; k < iterations_number; k++) {
-        compute_A_and_b_gauss_newton(L_6x10->data.db, Rho->data.db,
-                                     betas, &A, &B);
-        qr_solve(&A, &B, &X);
+        compute_A_and_b_gauss_newton(L_6x10, Rho, betas, A, b);
+        //Householder QR求最小二乘解，固定大小不分配内存
+        const Eigen::Vector4d x = A.householderQr().solve(b);
+        //A奇异时放弃迭代
+        if(!std::isfinite(x.sum()))
+            break;
 
-        for(int i = 0; i < 4; i++)
-            betas[i] += x[i];
+        betas += x;
     }
 }
 
-void PnPsolver::qr_solve(CvMat * A, CvMat * b, CvMat * X)
+// Ferrari法求四次方程 factors[0]*x^4+...+factors[4] = 0 的根
+// 复根只保留实部，由调用者检查
+static void SolveQuartic(const double factors[5], double realRoots[4])
 {
-    static int max_nr = 0;
-    static double * A1, * A2;
+    const double A = factors[0];
+    const double B = factors[1];
+    const double C = factors[2];
+    const double D = factors[3];
+    const double E = factors[4];
 
-    const int nr = A->rows;
-    const int nc = A->cols;
+    const double A_pw2 = A * A;
+    const double B_pw2 = B * B;
+    const double A_pw3 = A_pw2 * A;
+    const double B_pw3 = B_pw2 * B;
+    const double A_pw4 = A_pw3 * A;
+    const double B_pw4 = B_pw3 * B;
 
-    if (max_nr != 0 && max_nr < nr) {
-        delete [] A1;
-        delete [] A2;
-    }
-    if (max_nr < nr) {
-        max_nr = nr;
-        A1 = new double[nr];
-        A2 = new double[nr];
-    }
+    const double alpha = -3 * B_pw2 / (8 * A_pw2) + C / A;
+    const double beta = B_pw3 / (8 * A_pw3) - B * C / (2 * A_pw2) + D / A;
+    const double gamma = -3 * B_pw4 / (256 * A_pw4) + B_pw2 * C / (16 * A_pw3) - B * D / (4 * A_pw2) + E / A;
 
-    double * pA = A->data.db, * ppAkk = pA;
-    for(int k = 0; k < nc; k++) {
-        double * ppAik = ppAkk, eta = fabs(*ppAik);
-        for(int i = k + 1; i < nr; i++) {
-            double elt = fabs(*ppAik);
-            if (eta < elt) eta = elt;
-            ppAik += nc;
-        }
+    const double alpha_pw2 = alpha * alpha;
+    const double alpha_pw3 = alpha_pw2 * alpha;
 
-        if (eta == 0) {
-            A1[k] = A2[k] = 0.0;
-            cerr << "God damnit, A is singular, this shouldn't happen." << endl;
-            return;
-        } else {
-            double * ppAik = ppAkk, sum = 0.0, inv_eta = 1. / eta;
-            for(int i = k; i < nr; i++) {
-                *ppAik *= inv_eta;
-                sum += *ppAik * *ppAik;
-                ppAik += nc;
-            }
-            double sigma = sqrt(sum);
-            if (*ppAkk < 0)
-                sigma = -sigma;
-            *ppAkk += sigma;
-            A1[k] = sigma * *ppAkk;
-            A2[k] = -eta * sigma;
-            for(int j = k + 1; j < nc; j++) {
-                double * ppAik = ppAkk, sum = 0;
-                for(int i = k; i < nr; i++) {
-                    sum += *ppAik * ppAik[j - k];
-                    ppAik += nc;
-                }
-                double tau = sum / A1[k];
-                ppAik = ppAkk;
-                for(int i = k; i < nr; i++) {
-                    ppAik[j - k] -= tau * *ppAik;
-                    ppAik += nc;
-                }
-            }
-        }
-        ppAkk += nc + 1;
-    }
+    const std::complex<double> P(-alpha_pw2 / 12 - gamma, 0);
+    const std::complex<double> Q(-alpha_pw3 / 108 + alpha * gamma / 3 - beta * beta / 8, 0);
+    const std::complex<double> R = -Q / 2.0 + sqrt(Q * Q / 4.0 + P * P * P / 27.0);
 
-    // b <- Qt b
-    double * ppAjj = pA, * pb = b->data.db;
-    for(int j = 0; j < nc; j++) {
-        double * ppAij = ppAjj, tau = 0;
-        for(int i = j; i < nr; i++)	{
-            tau += *ppAij * pb[i];
-            ppAij += nc;
-        }
-        tau /= A1[j];
-        ppAij = ppAjj;
-        for(int i = j; i < nr; i++) {
-            pb[i] -= tau * *ppAij;
-            ppAij += nc;
-        }
-        ppAjj += nc + 1;
-    }
+    const std::complex<double> U = pow(R, 1.0 / 3.0);
+    std::complex<double> y;
+    if (U.real() == 0)
+        y = -5.0 * alpha / 6.0 - pow(Q, 1.0 / 3.0);
+    else
+        y = -5.0 * alpha / 6.0 - P / (3.0 * U) + U;
 
-    // X = R-1 b
-    double * pX = X->data.db;
-    pX[nc - 1] = pb[nc - 1] / A2[nc - 1];
-    for(int i = nc - 2; i >= 0; i--) {
-        double * ppAij = pA + i * nc + (i + 1), sum = 0;
+    const std::complex<double> w = sqrt(alpha + 2.0 * y);
 
-        for(int j = i + 1; j < nc; j++) {
-            sum += *ppAij * pX[j];
-            ppAij++;
-        }
-        pX[i] = (pb[i] - sum) / A2[i];
-    }
+    realRoots[0] = (-B / (4.0 * A) + 0.5 * (w + sqrt(-(3.0 * alpha + 2.0 * y + 2.0 * beta / w)))).real();
+    realRoots[1] = (-B / (4.0 * A) + 0.5 * (w - sqrt(-(3.0 * alpha + 2.0 * y + 2.0 * beta / w)))).real();
+    realRoots[2] = (-B / (4.0 * A) + 0.5 * (-w + sqrt(-(3.0 * alpha + 2.0 * y - 2.0 * beta / w)))).real();
+    realRoots[3] = (-B / (4.0 * A) + 0.5 * (-w - sqrt(-(3.0 * alpha + 2.0 * y - 2.0 * beta / w)))).real();
 }
 
+int PnPsolver::ComputePoseP3P(const Eigen::Matrix3d &F, const Eigen::Matrix3d &P, Eigen::Matrix3d Rs[4], Eigen::Vector3d ts[4])
+{
+    Eigen::Vector3d P1 = P.col(0);
+    Eigen::Vector3d P2 = P.col(1);
+    Eigen::Vector3d P3 = P.col(2);
+
+    // 三个点不能共线
+    if((P2 - P1).cross(P3 - P1).squaredNorm() == 0)
+        return 0;
 
+    Eigen::Vector3d f1 = F.col(0);
+    Eigen::Vector3d f2 = F.col(1);
+    Eigen::Vector3d f3 = F.col(2);
 
-void PnPsolver::relative_error(double & rot_err, double & transl_err,
-                               const double Rtrue[3][3], const double ttrue[3],
-const double Rest[3][3],  const double test[3])
-{
-    double qtrue[4], qest[4];
-
-    mat_to_quat(Rtrue, qtrue);
-    mat_to_quat(Rest, qest);
-
-    double rot_err1 = sqrt((qtrue[0] - qest[0]) * (qtrue[0] - qest[0]) +
-            (qtrue[1] - qest[1]) * (qtrue[1] - qest[1]) +
-            (qtrue[2] - qest[2]) * (qtrue[2] - qest[2]) +
-            (qtrue[3] - qest[3]) * (qtrue[3] - qest[3]) ) /
-            sqrt(qtrue[0] * qtrue[0] + qtrue[1] * qtrue[1] + qtrue[2] * qtrue[2] + qtrue[3] * qtrue[3]);
-
-    double rot_err2 = sqrt((qtrue[0] + qest[0]) * (qtrue[0] + qest[0]) +
-            (qtrue[1] + qest[1]) * (qtrue[1] + qest[1]) +
-            (qtrue[2] + qest[2]) * (qtrue[2] + qest[2]) +
-            (qtrue[3] + qest[3]) * (qtrue[3] + qest[3]) ) /
-            sqrt(qtrue[0] * qtrue[0] + qtrue[1] * qtrue[1] + qtrue[2] * qtrue[2] + qtrue[3] * qtrue[3]);
-
-    rot_err = min(rot_err1, rot_err2);
-
-    transl_err =
-            sqrt((ttrue[0] - test[0]) * (ttrue[0] - test[0]) +
-            (ttrue[1] - test[1]) * (ttrue[1] - test[1]) +
-            (ttrue[2] - test[2]) * (ttrue[2] - test[2])) /
-            sqrt(ttrue[0] * ttrue[0] + ttrue[1] * ttrue[1] + ttrue[2] * ttrue[2]);
-}
+    // 中间相机坐标系 T = [e1 e2 e3]^T
+    Eigen::Vector3d e1 = f1;
+    Eigen::Vector3d e3 = f1.cross(f2).normalized();
+    Eigen::Vector3d e2 = e3.cross(e1);
+    Eigen::Matrix3d T;
+    T.row(0) = e1.transpose();
+    T.row(1) = e2.transpose();
+    T.row(2) = e3.transpose();
+    f3 = T * f3;
 
-void PnPsolver::mat_to_quat(const double R[3][3], double q[4])
-{
-    double tr = R[0][0] + R[1][1] + R[2][2];
-    double n4;
-
-    if (tr > 0.0f) {
-        q[0] = R[1][2] - R[2][1];
-        q[1] = R[2][0] - R[0][2];
-        q[2] = R[0][1] - R[1][0];
-        q[3] = tr + 1.0f;
-        n4 = q[3];
-    } else if ( (R[0][0] > R[1][1]) && (R[0][0] > R[2][2]) ) {
-        q[0] = 1.0f + R[0][0] - R[1][1] - R[2][2];
-        q[1] = R[1][0] + R[0][1];
-        q[2] = R[2][0] + R[0][2];
-        q[3] = R[1][2] - R[2][1];
-        n4 = q[0];
-    } else if (R[1][1] > R[2][2]) {
-        q[0] = R[1][0] + R[0][1];
-        q[1] = 1.0f + R[1][1] - R[0][0] - R[2][2];
-        q[2] = R[2][1] + R[1][2];
-        q[3] = R[2][0] - R[0][2];
-        n4 = q[1];
-    } else {
-        q[0] = R[2][0] + R[0][2];
-        q[1] = R[2][1] + R[1][2];
-        q[2] = 1.0f + R[2][2] - R[0][0] - R[1][1];
-        q[3] = R[0][1] - R[1][0];
-        n4 = q[2];
+    // 保证f3在中间坐标系中z<0，即theta在[0,pi]之间，否则交换前两个点
+    if(f3(2) > 0)
+    {
+        f1 = F.col(1);
+        f2 = F.col(0);
+        f3 = F.col(2);
+
+        e1 = f1;
+        e3 = f1.cross(f2).normalized();
+        e2 = e3.cross(e1);
+        T.row(0) = e1.transpose();
+        T.row(1) = e2.transpose();
+        T.row(2) = e3.transpose();
+        f3 = T * f3;
+
+        P1 = P.col(1);
+        P2 = P.col(0);
+        P3 = P.col(2);
+    }
+
+    // 中间世界坐标系 N = [n1 n2 n3]^T
+    const Eigen::Vector3d n1 = (P2 - P1).normalized();
+    const Eigen::Vector3d n3 = n1.cross(P3 - P1).normalized();
+    const Eigen::Vector3d n2 = n3.cross(n1);
+    Eigen::Matrix3d N;
+    N.row(0) = n1.transpose();
+    N.row(1) = n2.transpose();
+    N.row(2) = n3.transpose();
+
+    P3 = N * (P3 - P1);
+
+    const double d_12 = (P2 - P1).norm();
+    const double f_1 = f3(0) / f3(2);
+    const double f_2 = f3(1) / f3(2);
+    const double p_1 = P3(0);
+    const double p_2 = P3(1);
+
+    const double cos_beta = f1.dot(f2);
+    double b = 1 / (1 - cos_beta * cos_beta) - 1;
+    b = cos_beta < 0 ? -sqrt(b) : sqrt(b);
+
+    const double f_1_pw2 = f_1 * f_1;
+    const double f_2_pw2 = f_2 * f_2;
+    const double p_1_pw2 = p_1 * p_1;
+    const double p_1_pw3 = p_1_pw2 * p_1;
+    const double p_1_pw4 = p_1_pw3 * p_1;
+    const double p_2_pw2 = p_2 * p_2;
+    const double p_2_pw3 = p_2_pw2 * p_2;
+    const double p_2_pw4 = p_2_pw3 * p_2;
+    const double d_12_pw2 = d_12 * d_12;
+    const double b_pw2 = b * b;
+
+    // cos(theta)满足的四次方程
+    double factors[5];
+    factors[0] = -f_2_pw2 * p_2_pw4 - p_2_pw4 * f_1_pw2 - p_2_pw4;
+    factors[1] = 2 * p_2_pw3 * d_12 * b + 2 * f_2_pw2 * p_2_pw3 * d_12 * b - 2 * f_2 * p_2_pw3 * f_1 * d_12;
+    factors[2] = -f_2_pw2 * p_2_pw2 * p_1_pw2 - f_2_pw2 * p_2_pw2 * d_12_pw2 * b_pw2 - f_2_pw2 * p_2_pw2 * d_12_pw2
+                 + f_2_pw2 * p_2_pw4 + p_2_pw4 * f_1_pw2 + 2 * p_1 * p_2_pw2 * d_12 + 2 * f_1 * f_2 * p_1 * p_2_pw2 * d_12 * b
+                 - p_2_pw2 * p_1_pw2 * f_1_pw2 + 2 * p_1 * p_2_pw2 * f_2_pw2 * d_12 - p_2_pw2 * d_12_pw2 * b_pw2 - 2 * p_1_pw2 * p_2_pw2;
+    factors[3] = 2 * p_1_pw2 * p_2 * d_12 * b + 2 * f_2 * p_2_pw3 * f_1 * d_12 - 2 * f_2_pw2 * p_2_pw3 * d_12 * b - 2 * p_1 * p_2 * d_12_pw2 * b;
+    factors[4] = -2 * f_2 * p_2_pw2 * f_1 * p_1 * d_12 * b + f_2_pw2 * p_2_pw2 * d_12_pw2 + 2 * p_1_pw3 * d_12 - p_1_pw2 * d_12_pw2
+                 + f_2_pw2 * p_2_pw2 * p_1_pw2 - p_1_pw4 - 2 * f_2_pw2 * p_2_pw2 * p_1 * d_12 + p_2_pw2 * f_1_pw2 * p_1_pw2
+                 + f_2_pw2 * p_2_pw2 * d_12_pw2 * b_pw2;
+
+    double realRoots[4];
+    SolveQuartic(factors, realRoots);
+
+    // 回代求出每个解的位姿
+    int nSolutions = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        const double cos_theta = realRoots[i];
+        if(!(fabs(cos_theta) <= 1.0))
+            continue;
+
+        const double cot_alpha = (-f_1 * p_1 / f_2 - cos_theta * p_2 + d_12 * b) / (-f_1 * cos_theta * p_2 / f_2 + p_1 - d_12);
+
+        const double sin_theta = sqrt(1 - cos_theta * cos_theta);
+        const double sin_alpha = sqrt(1 / (cot_alpha * cot_alpha + 1));
+        double cos_alpha = sqrt(1 - sin_alpha * sin_alpha);
+        if (cot_alpha < 0)
+            cos_alpha = -cos_alpha;
+
+        const double k = d_12 * sin_alpha * (sin_alpha * b + cos_alpha);
+        // 相机中心在中间世界坐标系中的位置
+        const Eigen::Vector3d C(d_12 * cos_alpha * (sin_alpha * b + cos_alpha), cos_theta * k, sin_theta * k);
+
+        Eigen::Matrix3d Q;
+        Q << -cos_alpha, -sin_alpha * cos_theta, -sin_alpha * sin_theta,
+              sin_alpha, -cos_alpha * cos_theta, -cos_alpha * sin_theta,
+              0,         -sin_theta,              cos_theta;
+
+        // 相机到世界的旋转Rwc和相机中心Ow，转换为Rcw, tcw
+        const Eigen::Matrix3d Rwc = N.transpose() * Q.transpose() * T;
+        const Eigen::Vector3d Ow = P1 + N.transpose() * C;
+
+        if(!std::isfinite(Rwc.sum() + Ow.sum()))
+            continue;
+
+        Rs[nSolutions] = Rwc.transpose();
+        ts[nSolutions] = -Rwc.transpose() * Ow;
+        nSolutions++;
     }
-    double scale = 0.5f / double(sqrt(n4));
 
-    q[0] *= scale;
-    q[1] *= scale;
-    q[2] *= scale;
-    q[3] *= scale;
+    return nSolutions;
 }
 
 } //namespace ORB_SLAM
@@ -0,0 +1,447 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PoseGraphSolver.h"
+
+#include "SolverKernels.h"
+
+#include <Eigen/Dense>
+#include <Eigen/OrderingMethods>
+
+#include <cmath>
+#include <map>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+using SolverKernels::Skew;
+
+namespace
+{
+
+typedef PoseGraphSolver::Vector7d Vector7d;
+typedef PoseGraphSolver::Matrix7d Matrix7d;
+
+// Sim3的伴随矩阵，满足 S*exp(x)*S^-1 = exp(Ad(S)*x)，x=[omega,upsilon,sigma]
+inline Matrix7d Adjoint(const g2o::Sim3 &S)
+{
+    const Eigen::Matrix3d R = S.rotation().toRotationMatrix();
+    const Eigen::Vector3d &t = S.translation();
+    Matrix7d Ad = Matrix7d::Zero();
+    Ad.block<3,3>(0,0) = R;
+    Ad.block<3,3>(3,0) = Skew(t)*R;
+    Ad.block<3,3>(3,3) = S.scale()*R;
+    Ad.block<3,1>(3,6) = -t;
+    Ad(6,6) = 1;
+    return Ad;
+}
+
+// 左雅克比的逆取一阶近似 Jl^-1(e) = I - ad(e)/2
+inline Matrix7d InvLeftJacobian(const Vector7d &e)
+{
+    const Eigen::Vector3d omega = e.head<3>();
+    const Eigen::Vector3d upsilon = e.segment<3>(3);
+    Matrix7d ad = Matrix7d::Zero();
+    ad.block<3,3>(0,0) = Skew(omega);
+    ad.block<3,3>(3,0) = Skew(upsilon);
+    ad.block<3,3>(3,3) = Skew(omega)+e(6)*Eigen::Matrix3d::Identity();
+    ad.block<3,1>(3,6) = -upsilon;
+    return Matrix7d::Identity()-0.5*ad;
+}
+
+} //namespace
+
+PoseGraphSolver::PoseGraphSolver():
+    mbFixScale(false), mLambdaInit(-1), mpOrdering(NULL), mOrderingReuseRatio(0.8), mnFree(0)
+{
+}
+
+int PoseGraphSolver::AddVertex(const g2o::Sim3 &Siw, const bool bFixed, const long unsigned int nKey)
+{
+    mvEstimates.push_back(Siw);
+    mvbFixed.push_back(bFixed);
+    mvKeys.push_back(nKey);
+    return mvEstimates.size()-1;
+}
+
+int PoseGraphSolver::AddEdge(const int i, const int j, const g2o::Sim3 &Sji, const bool bCoarse)
+{
+    mvEdgeI.push_back(i);
+    mvEdgeJ.push_back(j);
+    mvMeasurements.push_back(Sji);
+    mvbCoarse.push_back(bCoarse);
+    return mvEdgeI.size()-1;
+}
+
+void PoseGraphSolver::SetFixScale(const bool bFixScale)
+{
+    mbFixScale = bFixScale;
+}
+
+void PoseGraphSolver::SetLambdaInit(const double lambda)
+{
+    mLambdaInit = lambda;
+}
+
+void PoseGraphSolver::SetOrderingCache(Ordering *pOrdering)
+{
+    mpOrdering = pOrdering;
+}
+
+void PoseGraphSolver::SetOrderingReuseRatio(const double ratio)
+{
+    mOrderingReuseRatio = ratio;
+}
+
+void PoseGraphSolver::ComputeOrdering(const bool bCoarse, vector<int> &vRank)
+{
+    const int N = mvEstimates.size();
+    vRank.assign(N,-1);
+
+    vector<int> vFree;
+    vFree.reserve(N);
+    for(int v=0; v<N; v++)
+        if(!mvbFixed[v])
+            vFree.push_back(v);
+    const int nFree = vFree.size();
+
+    // 沿用缓存的次序：已排序的关键帧保持原来的相对次序，新的关键帧按id排在最后
+    // 新关键帧一般只和最近的关键帧相连，排在最后引入的填充很少
+    if(!bCoarse && mpOrdering && mpOrdering->nOrdered>0)
+    {
+        const vector<int> &vCached = mpOrdering->vRank;
+        vector<pair<long long,int> > vKeyed;
+        vKeyed.reserve(nFree);
+        int nKnown = 0;
+        for(int k=0; k<nFree; k++)
+        {
+            const long unsigned int key = mvKeys[vFree[k]];
+            if(key<vCached.size() && vCached[key]>=0)
+            {
+                vKeyed.push_back(make_pair((long long)vCached[key],vFree[k]));
+                nKnown++;
+            }
+            else
+                vKeyed.push_back(make_pair((long long)mpOrdering->nOrdered+key,vFree[k]));
+        }
+
+        if(nKnown>=mOrderingReuseRatio*nFree)
+        {
+            sort(vKeyed.begin(),vKeyed.end());
+            for(int k=0; k<nFree; k++)
+                vRank[vKeyed[k].second] = k;
+            return;
+        }
+    }
+
+    // 块层面的近似最小度排序
+    vector<int> vFreeIdx(N,-1);
+    for(int k=0; k<nFree; k++)
+        vFreeIdx[vFree[k]] = k;
+
+    vector<Eigen::Triplet<double> > vTriplets;
+    vTriplets.reserve(nFree+mvEdgeI.size());
+    for(int k=0; k<nFree; k++)
+        vTriplets.push_back(Eigen::Triplet<double>(k,k,1.0));
+    for(size_t e=0; e<mvEdgeI.size(); e++)
+    {
+        if(bCoarse && !mvbCoarse[e])
+            continue;
+        const int a = vFreeIdx[mvEdgeI[e]];
+        const int b = vFreeIdx[mvEdgeJ[e]];
+        if(a<0 || b<0)
+            continue;
+        vTriplets.push_back(Eigen::Triplet<double>(min(a,b),max(a,b),1.0));
+    }
+    Eigen::SparseMatrix<double> pattern(nFree,nFree);
+    pattern.setFromTriplets(vTriplets.begin(),vTriplets.end());
+
+    Eigen::PermutationMatrix<Eigen::Dynamic,Eigen::Dynamic,int> perm;
+    Eigen::AMDOrdering<int> amd;
+    amd(pattern,perm);
+
+    // perm.indices()(k)为第k个消元的顶点
+    for(int k=0; k<nFree; k++)
+        vRank[vFree[perm.indices()(k)]] = k;
+
+    if(!bCoarse && mpOrdering)
+    {
+        long unsigned int maxKey = 0;
+        for(int k=0; k<nFree; k++)
+            maxKey = max(maxKey,mvKeys[vFree[k]]);
+        mpOrdering->vRank.assign(maxKey+1,-1);
+        for(int k=0; k<nFree; k++)
+            mpOrdering->vRank[mvKeys[vFree[k]]] = vRank[vFree[k]];
+        mpOrdering->nOrdered = nFree;
+    }
+}
+
+void PoseGraphSolver::BuildStructure(const bool bCoarse)
+{
+    ComputeOrdering(bCoarse,mvPos);
+
+    mnFree = 0;
+    for(size_t v=0; v<mvPos.size(); v++)
+        if(mvPos[v]>=0)
+            mnFree++;
+
+    // 前mnFree个块为对角块
+    mvBlockIdx.clear();
+    for(int p=0; p<mnFree; p++)
+        mvBlockIdx.push_back(make_pair(p,p));
+
+    map<pair<int,int>,int> mBlocks;
+    mvEdgeBlock.assign(mvEdgeI.size(),-1);
+    for(size_t e=0; e<mvEdgeI.size(); e++)
+    {
+        if(bCoarse && !mvbCoarse[e])
+            continue;
+        const int pi = mvPos[mvEdgeI[e]];
+        const int pj = mvPos[mvEdgeJ[e]];
+        if(pi<0 || pj<0 || pi==pj)
+            continue;
+        const pair<int,int> idx(min(pi,pj),max(pi,pj));
+        map<pair<int,int>,int>::iterator mit = mBlocks.find(idx);
+        if(mit==mBlocks.end())
+        {
+            mit = mBlocks.insert(make_pair(idx,(int)mvBlockIdx.size())).first;
+            mvBlockIdx.push_back(idx);
+        }
+        mvEdgeBlock[e] = mit->second;
+    }
+
+    // 稀疏矩阵只储存上三角
+    const int nBlocks = mvBlockIdx.size();
+    vector<Eigen::Triplet<double> > vTriplets;
+    vTriplets.reserve(nBlocks*49);
+    for(int k=0; k<nBlocks; k++)
+    {
+        const int r = mvBlockIdx[k].first;
+        const int c = mvBlockIdx[k].second;
+        for(int b=0; b<7; b++)
+            for(int a=0; a<(r<c ? 7 : b+1); a++)
+                vTriplets.push_back(Eigen::Triplet<double>(r*7+a,c*7+b,0.0));
+    }
+    mH.resize(mnFree*7,mnFree*7);
+    mH.setFromTriplets(vTriplets.begin(),vTriplets.end());
+    mH.makeCompressed();
+
+    // 每个块的每一列在数值数组中是连续的
+    const int* outer = mH.outerIndexPtr();
+    const int* inner = mH.innerIndexPtr();
+    mvBlockColStart.resize(nBlocks*7);
+    for(int k=0; k<nBlocks; k++)
+    {
+        const int r = mvBlockIdx[k].first;
+        const int c = mvBlockIdx[k].second;
+        for(int b=0; b<7; b++)
+        {
+            const int col = c*7+b;
+            mvBlockColStart[k*7+b] = lower_bound(inner+outer[col],inner+outer[col+1],r*7)-inner;
+        }
+    }
+
+    mvBlocks.resize(nBlocks);
+    mb.resize(mnFree*7);
+
+    mLDLT.analyzePattern(mH);
+}
+
+double PoseGraphSolver::Linearize(const bool bCoarse)
+{
+    for(size_t k=0; k<mvBlocks.size(); k++)
+        mvBlocks[k].setZero();
+    mb.setZero();
+
+    double chi2 = 0;
+    for(size_t e=0; e<mvEdgeI.size(); e++)
+    {
+        if(bCoarse && !mvbCoarse[e])
+            continue;
+
+        const int i = mvEdgeI[e];
+        const int j = mvEdgeJ[e];
+        const g2o::Sim3 &Sji = mvMeasurements[e];
+
+        const g2o::Sim3 E = Sji*mvEstimates[i]*mvEstimates[j].inverse();
+        const Vector7d err = E.log();
+        chi2 += err.squaredNorm();
+
+        const int pi = mvPos[i];
+        const int pj = mvPos[j];
+        if(pi<0 && pj<0)
+            continue;
+
+        // Si <- exp(d)*Si: E <- exp(Ad(Sji)*d)*E
+        // Sj <- exp(d)*Sj: E <- exp(-Ad(E)*d)*E
+        const Matrix7d Jl = InvLeftJacobian(err);
+        Matrix7d Ji = Jl*Adjoint(Sji);
+        Matrix7d Jj = -Jl*Adjoint(E);
+        if(mbFixScale)
+        {
+            Ji.col(6).setZero();
+            Jj.col(6).setZero();
+        }
+
+        if(pi>=0)
+        {
+            mvBlocks[pi].noalias() += Ji.transpose()*Ji;
+            mb.segment<7>(pi*7).noalias() -= Ji.transpose()*err;
+        }
+        if(pj>=0)
+        {
+            mvBlocks[pj].noalias() += Jj.transpose()*Jj;
+            mb.segment<7>(pj*7).noalias() -= Jj.transpose()*err;
+        }
+        if(mvEdgeBlock[e]>=0)
+        {
+            if(pi<pj)
+                mvBlocks[mvEdgeBlock[e]].noalias() += Ji.transpose()*Jj;
+            else
+                mvBlocks[mvEdgeBlock[e]].noalias() += Jj.transpose()*Ji;
+        }
+    }
+
+    return chi2;
+}
+
+double PoseGraphSolver::ComputeChi2(const bool bCoarse) const
+{
+    double chi2 = 0;
+    for(size_t e=0; e<mvEdgeI.size(); e++)
+    {
+        if(bCoarse && !mvbCoarse[e])
+            continue;
+        const g2o::Sim3 E = mvMeasurements[e]*mvEstimates[mvEdgeI[e]]*mvEstimates[mvEdgeJ[e]].inverse();
+        chi2 += E.log().squaredNorm();
+    }
+    return chi2;
+}
+
+void PoseGraphSolver::FillMatrix(const double lambda)
+{
+    double* values = mH.valuePtr();
+    for(size_t k=0; k<mvBlockIdx.size(); k++)
+    {
+        const Matrix7d &B = mvBlocks[k];
+        const bool bDiag = mvBlockIdx[k].first==mvBlockIdx[k].second;
+        for(int b=0; b<7; b++)
+        {
+            double* col = values+mvBlockColStart[k*7+b];
+            const int nRows = bDiag ? b+1 : 7;
+            for(int a=0; a<nRows; a++)
+                col[a] = B(a,b);
+            if(bDiag)
+                col[b] += lambda;
+        }
+    }
+}
+
+int PoseGraphSolver::RunLM(const int nIterations, const bool bCoarse)
+{
+    BuildStructure(bCoarse);
+    if(mnFree==0)
+        return 0;
+
+    vector<g2o::Sim3, Eigen::aligned_allocator<g2o::Sim3> > vBackup;
+    Eigen::VectorXd dx;
+
+    // 阻尼策略与g2o::OptimizationAlgorithmLevenberg相同
+    double lambda = -1;
+    double ni = 2;
+    int it = 0;
+    for(; it<nIterations; it++)
+    {
+        const double chi2 = Linearize(bCoarse);
+
+        if(lambda<0)
+        {
+            if(mLambdaInit>0)
+                lambda = mLambdaInit;
+            else
+            {
+                double maxDiag = 0;
+                for(int p=0; p<mnFree; p++)
+                    maxDiag = max(maxDiag,mvBlocks[p].diagonal().maxCoeff());
+                lambda = 1e-5*maxDiag;
+            }
+        }
+
+        bool bAccepted = false;
+        for(int nTries=0; nTries<10; nTries++)
+        {
+            FillMatrix(lambda);
+            mLDLT.factorize(mH);
+            if(mLDLT.info()==Eigen::Success)
+            {
+                dx = mLDLT.solve(mb);
+                vBackup = mvEstimates;
+
+                for(size_t v=0; v<mvEstimates.size(); v++)
+                {
+                    if(mvPos[v]<0)
+                        continue;
+                    Vector7d update = dx.segment<7>(mvPos[v]*7);
+                    if(mbFixScale)
+                        update[6] = 0;
+                    mvEstimates[v] = g2o::Sim3(update)*mvEstimates[v];
+                }
+
+                const double scale = dx.dot(lambda*dx+mb)+1e-3;
+                const double newChi2 = ComputeChi2(bCoarse);
+                const double rho = (chi2-newChi2)/scale;
+                if(rho>0 && std::isfinite(newChi2))
+                {
+                    const double alpha = min(1.-pow((2*rho-1),3),2./3.);
+                    lambda *= max(1./3.,alpha);
+                    ni = 2;
+                    bAccepted = true;
+                    break;
+                }
+
+                mvEstimates.swap(vBackup);
+            }
+
+            lambda *= ni;
+            ni *= 2;
+            if(!std::isfinite(lambda))
+                break;
+        }
+
+        if(!bAccepted)
+            break;
+    }
+
+    return it;
+}
+
+int PoseGraphSolver::Optimize(const int nIterations, const int nCoarseIterations)
+{
+    if(nCoarseIterations>0)
+        RunLM(nCoarseIterations,true);
+
+    return RunLM(nIterations,false);
+}
+
+} //namespace ORB_SLAM
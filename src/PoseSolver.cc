@@ -0,0 +1,234 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PoseSolver.h"
+
+#include "SolverKernels.h"
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace ORB_SLAM2
+{
+
+using namespace SolverKernels;
+
+PoseSolver::PoseSolver():
+    mfx(0), mfy(0), mcx(0), mcy(0), mbf(0),
+    mbRobust(true), mDeltaMono(sqrt(5.991)), mDeltaStereo(sqrt(7.815))
+{
+}
+
+void PoseSolver::Clear()
+{
+    mMono.clear();
+    mStereo.clear();
+}
+
+void PoseSolver::SetCalibration(const double fx, const double fy, const double cx, const double cy, const double bf)
+{
+    mfx = fx;
+    mfy = fy;
+    mcx = cx;
+    mcy = cy;
+    mbf = bf;
+}
+
+void PoseSolver::SetPose(const g2o::SE3Quat &Tcw)
+{
+    mTcw = Tcw;
+}
+
+int PoseSolver::AddMonoEdge(const Eigen::Vector3d &Xw, const Eigen::Vector2d &obs, const double invSigma2)
+{
+    mMono.vXw.push_back(Xw);
+    mMono.vObs.push_back(obs);
+    mMono.vInvSigma2.push_back(invSigma2);
+    mMono.vbActive.push_back(true);
+    return mMono.vbActive.size()-1;
+}
+
+int PoseSolver::AddStereoEdge(const Eigen::Vector3d &Xw, const Eigen::Vector3d &obs, const double invSigma2)
+{
+    mStereo.vXw.push_back(Xw);
+    mStereo.vObs.push_back(obs);
+    mStereo.vInvSigma2.push_back(invSigma2);
+    mStereo.vbActive.push_back(true);
+    return mStereo.vbActive.size()-1;
+}
+
+void PoseSolver::SetRobustKernel(const bool bRobust, const double deltaMono, const double deltaStereo)
+{
+    mbRobust = bRobust;
+    mDeltaMono = deltaMono;
+    mDeltaStereo = deltaStereo;
+}
+
+double PoseSolver::MonoChi2(const size_t i) const
+{
+    Eigen::Vector2d h;
+    Eigen::Matrix<double,2,3> Jp;
+    Project(mTcw.map(mMono.vXw[i]),mfx,mfy,mcx,mcy,mbf,h,Jp);
+    return (mMono.vObs[i]-h).squaredNorm()*mMono.vInvSigma2[i];
+}
+
+double PoseSolver::StereoChi2(const size_t i) const
+{
+    Eigen::Vector3d h;
+    Eigen::Matrix3d Jp;
+    Project(mTcw.map(mStereo.vXw[i]),mfx,mfy,mcx,mcy,mbf,h,Jp);
+    return (mStereo.vObs[i]-h).squaredNorm()*mStereo.vInvSigma2[i];
+}
+
+template<int D>
+void PoseSolver::LinearizeEdges(const EdgeSet<D> &edges, const double delta, const g2o::SE3Quat &Tcw,
+                                Matrix6d &H, Vector6d &b, double &chi2) const
+{
+    typedef Eigen::Matrix<double,D,1> VectorD;
+    typedef Eigen::Matrix<double,D,3> MatrixD3;
+    typedef Eigen::Matrix<double,D,6> MatrixD6;
+
+    VectorD h;
+    MatrixD3 Jp;
+    MatrixD6 J;
+
+    const size_t N = edges.vbActive.size();
+    for(size_t i=0; i<N; i++)
+    {
+        if(!edges.vbActive[i])
+            continue;
+
+        const Eigen::Vector3d Xc = Tcw.map(edges.vXw[i]);
+        Project(Xc,mfx,mfy,mcx,mcy,mbf,h,Jp);
+
+        const VectorD e = edges.vObs[i]-h;
+        const double e2 = e.squaredNorm()*edges.vInvSigma2[i];
+
+        double w = 1.0;
+        chi2 += mbRobust ? Huber(e2,delta,w) : e2;
+        w *= edges.vInvSigma2[i];
+
+        // 误差对位姿(左乘扰动[w,v])的雅克比
+        J.template leftCols<3>() = Jp*Skew(Xc);
+        J.template rightCols<3>() = -Jp;
+
+        H.noalias() += w*J.transpose()*J;
+        b.noalias() -= w*J.transpose()*e;
+    }
+}
+
+double PoseSolver::Linearize(const g2o::SE3Quat &Tcw, Matrix6d &H, Vector6d &b) const
+{
+    H.setZero();
+    b.setZero();
+    double chi2 = 0;
+    LinearizeEdges(mMono,mDeltaMono,Tcw,H,b,chi2);
+    LinearizeEdges(mStereo,mDeltaStereo,Tcw,H,b,chi2);
+    return chi2;
+}
+
+template<int D>
+double PoseSolver::ComputeEdgesChi2(const EdgeSet<D> &edges, const double delta, const g2o::SE3Quat &Tcw) const
+{
+    Eigen::Matrix<double,D,1> h;
+    Eigen::Matrix<double,D,3> Jp;
+
+    double chi2 = 0;
+    const size_t N = edges.vbActive.size();
+    for(size_t i=0; i<N; i++)
+    {
+        if(!edges.vbActive[i])
+            continue;
+
+        Project(Tcw.map(edges.vXw[i]),mfx,mfy,mcx,mcy,mbf,h,Jp);
+        const double e2 = (edges.vObs[i]-h).squaredNorm()*edges.vInvSigma2[i];
+        double w;
+        chi2 += mbRobust ? Huber(e2,delta,w) : e2;
+    }
+    return chi2;
+}
+
+double PoseSolver::ComputeTotalChi2(const g2o::SE3Quat &Tcw) const
+{
+    return ComputeEdgesChi2(mMono,mDeltaMono,Tcw)+ComputeEdgesChi2(mStereo,mDeltaStereo,Tcw);
+}
+
+int PoseSolver::Optimize(const int nIterations)
+{
+    Matrix6d H;
+    Vector6d b;
+    Matrix6d Hlm;
+    Vector6d dx;
+    Eigen::LDLT<Matrix6d> ldlt;
+
+    // 阻尼策略与g2o::OptimizationAlgorithmLevenberg相同
+    double lambda = -1;
+    double ni = 2;
+    int it = 0;
+    for(; it<nIterations; it++)
+    {
+        const double chi2 = Linearize(mTcw,H,b);
+
+        if(lambda<0)
+            lambda = 1e-5*H.diagonal().maxCoeff();
+
+        bool bAccepted = false;
+        for(int nTries=0; nTries<10; nTries++)
+        {
+            Hlm = H;
+            Hlm.diagonal().array() += lambda;
+            ldlt.compute(Hlm);
+            if(ldlt.info()==Eigen::Success)
+            {
+                dx = ldlt.solve(b);
+                const g2o::SE3Quat Tnew = g2o::SE3Quat::exp(dx)*mTcw;
+                const double scale = dx.dot(lambda*dx+b)+1e-3;
+                const double newChi2 = ComputeTotalChi2(Tnew);
+                const double rho = (chi2-newChi2)/scale;
+                if(rho>0 && std::isfinite(newChi2))
+                {
+                    mTcw = Tnew;
+                    const double alpha = min(1.-pow((2*rho-1),3),2./3.);
+                    lambda *= max(1./3.,alpha);
+                    ni = 2;
+                    bAccepted = true;
+                    break;
+                }
+            }
+
+            lambda *= ni;
+            ni *= 2;
+            if(!std::isfinite(lambda))
+                break;
+        }
+
+        if(!bAccepted)
+            break;
+    }
+
+    return it;
+}
+
+} //namespace ORB_SLAM
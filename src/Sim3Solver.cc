@@ -23,19 +23,22 @@
 
 #include <vector>
 #include <cmath>
+#include <algorithm>
 #include <opencv2/core/core.hpp>
 
+#include <Eigen/Eigenvalues>
+#include <Eigen/Geometry>
+
 #include "KeyFrame.h"
 #include "ORBmatcher.h"
-
-#include "Thirdparty/DBoW2/DUtils/Random.h"
+#include "Converter.h"
 
 namespace ORB_SLAM2
 {
 
 
 Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *> &vpMatched12, const bool bFixScale):
-    mnIterations(0), mnBestInliers(0), mbFixScale(bFixScale)
+    mRansac(this), mnBestInliers(0), mbFixScale(bFixScale)
 {
     mpKF1 = pKF1;   //当前帧
     mpKF2 = pKF2;   //候选关键帧
@@ -53,14 +56,13 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
     mvX3Dc2.reserve(mN1);
 
     //取两帧的位姿
-    cv::Mat Rcw1 = pKF1->GetRotation();
-    cv::Mat tcw1 = pKF1->GetTranslation();
-    cv::Mat Rcw2 = pKF2->GetRotation();
-    cv::Mat tcw2 = pKF2->GetTranslation();
+    const Eigen::Matrix3f Rcw1 = Converter::toMatrix3d(pKF1->GetRotation()).cast<float>();
+    const Eigen::Vector3f tcw1 = Converter::toVector3d(pKF1->GetTranslation()).cast<float>();
+    const Eigen::Matrix3f Rcw2 = Converter::toMatrix3d(pKF2->GetRotation()).cast<float>();
+    const Eigen::Vector3f tcw2 = Converter::toVector3d(pKF2->GetTranslation()).cast<float>();
 
-    mvAllIndices.reserve(mN1);
+    mvDistances.reserve(mN1);
 
-    size_t idx=0;
     // mN1为pKF1特征点的个数,遍历vpMatched12中匹配的每对的mappoint
     for(int i1=0; i1<mN1; i1++)
     {
@@ -102,24 +104,28 @@ Sim3Solver::Sim3Solver(KeyFrame *pKF1, KeyFrame *pKF2, const vector<MapPoint *>
 
             //保存当前帧pKF1的mappoint的转到pKF1相机坐标系的坐标
             //pMP1->GetWorldPos()：3x1的列向量
-            cv::Mat X3D1w = pMP1->GetWorldPos();
+            const Eigen::Vector3f X3D1w = Converter::toVector3d(pMP1->GetWorldPos()).cast<float>();
             mvX3Dc1.push_back(Rcw1*X3D1w+tcw1);
 
             //保存当前帧pKF2的mappoint的转到pKF2相机坐标系的坐标
-            cv::Mat X3D2w = pMP2->GetWorldPos();
+            const Eigen::Vector3f X3D2w = Converter::toVector3d(pMP2->GetWorldPos()).cast<float>();
             mvX3Dc2.push_back(Rcw2*X3D2w+tcw2);
 
-            mvAllIndices.push_back(idx);
-            idx++;
+            mvDistances.push_back(ORBmatcher::DescriptorDistance(pKF1->mDescriptors.row(indexKF1),pKF2->mDescriptors.row(indexKF2)));
         }
     }
     //内参
-    mK1 = pKF1->mK;
-    mK2 = pKF2->mK;
-    
-    //相机模型？
-    FromCameraToImage(mvX3Dc1,mvP1im1,mK1);
-    FromCameraToImage(mvX3Dc2,mvP2im2,mK2);
+    mfx1 = pKF1->fx; mfy1 = pKF1->fy; mcx1 = pKF1->cx; mcy1 = pKF1->cy;
+    mfx2 = pKF2->fx; mfy2 = pKF2->fy; mcx2 = pKF2->cx; mcy2 = pKF2->cy;
+
+    //两帧各自的mappoint在自己图像上的投影
+    mvP1im1.reserve(mvX3Dc1.size());
+    mvP2im2.reserve(mvX3Dc2.size());
+    for(size_t i=0; i<mvX3Dc1.size(); i++)
+    {
+        mvP1im1.push_back(Project(mvX3Dc1[i],mfx1,mfy1,mcx1,mcy1));
+        mvP2im2.push_back(Project(mvX3Dc2[i],mfx2,mfy2,mcx2,mcy2));
+    }
 
     SetRansacParameters();
 }
@@ -128,7 +134,6 @@ void Sim3Solver::SetRansacParameters(double probability, int minInliers, int max
 {
     mRansacProb = probability;
     mRansacMinInliers = minInliers;
-    mRansacMaxIts = maxIterations;    
 
     N = mvpMapPoints1.size(); // number of correspondences
 
@@ -138,16 +143,15 @@ void Sim3Solver::SetRansacParameters(double probability, int minInliers, int max
     float epsilon = (float)mRansacMinInliers/N;
 
     // Set RANSAC iterations according to probability, epsilon, and max iterations
-    int nIterations;
-
-    if(mRansacMinInliers==N)
-        nIterations=1;
-    else
-        nIterations = ceil(log(1-mRansacProb)/log(1-pow(epsilon,3)));
-
-    mRansacMaxIts = max(1,min(nIterations,mRansacMaxIts));
-
-    mnIterations = 0;
+    // 初始的迭代次数由epsilon决定，之后按实际的内点比例自适应地减少
+    mRansac.SetParameters(N,3,mRansacProb,epsilon,maxIterations);
+
+    // 描述子距离小的匹配更可能是内点，按距离从小到大的顺序渐进抽样
+    vector<int> vOrder(N);
+    for(int i=0; i<N; i++)
+        vOrder[i] = i;
+    stable_sort(vOrder.begin(),vOrder.end(),[this](const int a, const int b){ return mvDistances[a]<mvDistances[b]; });
+    mRansac.SetOrder(vOrder);
 }
 
 cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInliers, int &nInliers)
@@ -164,104 +168,79 @@ cv::Mat Sim3Solver::iterate(int nIterations, bool &bNoMore, vector<bool> &vbInli
         return cv::Mat();
     }
 
-    vector<size_t> vAvailableIndices;
-
-    //随机抽取的3对点
-    cv::Mat P3Dc1i(3,3,CV_32F);
-    cv::Mat P3Dc2i(3,3,CV_32F);
-
-    int nCurrentIterations = 0;
-    while(mnIterations<mRansacMaxIts && nCurrentIterations<nIterations)
+    // 每次任意取三组点算Sim矩阵并通过投影误差进行inlier检测，见ComputeHypothesis()和ScoreHypothesis()
+    // 只要计算得到一次合格的Sim变换，就直接返回
+    if(mRansac.Iterate(nIterations))
     {
-        nCurrentIterations++;// 这个函数中迭代的次数
-        mnIterations++;// 当前这个Sim3Solver总的迭代次数，默认为最大为300
-
-        //为了随机抽取而准备的序列，如果匹配数为N，则mvAllIndices=[0,1,...,N-1]
-        vAvailableIndices = mvAllIndices;
-
-        // 步骤1：任意取三组点算Sim矩阵
-        // Get min set of points
-        // 从vAvailableIndices储存的序列集合中随机抽取3个数字
-        for(short i = 0; i < 3; ++i)
-        {
-            //生成随机数
-            int randi = DUtils::Random::RandomInt(0, vAvailableIndices.size()-1);
-
-            int idx = vAvailableIndices[randi];
-            //将每个点(x_c,y_c,z_c)^T复制到列向量，一列代表一个点
-            // P3Dc1i和P3Dc2i中点的排列顺序：
-            // x1 x2 x3 ...
-            // y1 y2 y3 ...
-            // z1 z2 z3 ...
-            mvX3Dc1[idx].copyTo(P3Dc1i.col(i));//mvpMapPoints1在相机mpKF1下的坐标
-            mvX3Dc2[idx].copyTo(P3Dc2i.col(i));//mvpMapPoints2在相机mpKF2下的坐标
-
-            //删除已经用过的随机数序号
-            vAvailableIndices[randi] = vAvailableIndices.back();
-            vAvailableIndices.pop_back();
-        }
-	
+        nInliers = mnBestInliers;
+        for(int i=0; i<N; i++)
+            if(mvbBestInliers[i])
+                vbInliers[mvnIndices1[i]] = true;
+
+        // 从坐标系2到1的变换 [sR t; 0 1]
+        Eigen::Matrix4d T12 = Eigen::Matrix4d::Identity();
+        T12.block<3,3>(0,0) = (mBestScale*mBestRotation).cast<double>();
+        T12.block<3,1>(0,3) = mBestTranslation.cast<double>();
+        return Converter::toCvMat(T12);
+    }
 
-        // 步骤2：根据3对匹配的3D点，计算之间的Sim3变换，也就是计算尺度s旋转R以及平移t
-        ComputeSim3(P3Dc1i,P3Dc2i);
+    //总的迭代次数超过阈值都还有没达到mnInliersi>mRansacMinInliers的要求，于是bNoMore=true
+    if(mRansac.Exhausted())
+        bNoMore=true;
 
-        // 步骤3：通过投影误差进行inlier检测
-        CheckInliers();
+    return cv::Mat();
+}
 
-        //取内点数最高的一种求解
-        //更新mnBestInliers
-        if(mnInliersi>=mnBestInliers)
-        {
-            mvbBestInliers = mvbInliersi;
-            mnBestInliers = mnInliersi;
-            mBestT12 = mT12i.clone();
-            mBestRotation = mR12i.clone();
-            mBestTranslation = mt12i.clone();
-            mBestScale = ms12i;
-
-            // 只要计算得到一次合格的Sim变换，就直接返回
-            if(mnInliersi>mRansacMinInliers)
-            {
-                nInliers = mnInliersi;
-                for(int i=0; i<N; i++)
-                    if(mvbInliersi[i])
-                        vbInliers[mvnIndices1[i]] = true;
-                return mBestT12;
-            }
-        }
+bool Sim3Solver::ComputeHypothesis(const vector<int> &vSample)
+{
+    // P3Dc1i和P3Dc2i中点的排列顺序：
+    // x1 x2 x3
+    // y1 y2 y3
+    // z1 z2 z3
+    Eigen::Matrix3f P3Dc1i;
+    Eigen::Matrix3f P3Dc2i;
+    for(int i=0; i<3; i++)
+    {
+        P3Dc1i.col(i) = mvX3Dc1[vSample[i]];//mvpMapPoints1在相机mpKF1下的坐标
+        P3Dc2i.col(i) = mvX3Dc2[vSample[i]];//mvpMapPoints2在相机mpKF2下的坐标
     }
 
-    //总的迭代次数超过阈值mRansacMaxIts都还有没达到mnInliersi>mRansacMinInliers的要求，于是bNoMore=true
-    if(mnIterations>=mRansacMaxIts)
-        bNoMore=true;
+    // 根据3对匹配的3D点，计算之间的Sim3变换，也就是计算尺度s旋转R以及平移t
+    ComputeSim3(P3Dc1i,P3Dc2i);
 
-    return cv::Mat();
+    return true;
 }
 
-cv::Mat Sim3Solver::find(vector<bool> &vbInliers12, int &nInliers)
+int Sim3Solver::ScoreHypothesis()
 {
-    bool bFlag;
-    return iterate(mRansacMaxIts,bFlag,vbInliers12,nInliers);
+    //内点数比目前最好的结果少的Sim3不会被采用
+    CheckInliers(mnBestInliers);
+    return mnInliersi;
 }
 
-void Sim3Solver::ComputeCentroid(cv::Mat &P, cv::Mat &Pr, cv::Mat &C)
+bool Sim3Solver::AcceptHypothesis(const int nInliers)
 {
-    //Reduces a matrix to a vector
-    //CV_REDUCE_SUM-输出是矩阵的所有行/列的和.
-    //第3个参数为1： 表示将输入的3个点变成一个列向量，即对矩阵每一行求和，变成3x1列向量
-    cv::reduce(P,C,1,CV_REDUCE_SUM);
-    //求均值
-    //得到3个点的均值(x_bar,y_bar,z_bar)^T
-    C = C/P.cols;
-
-    //变成去质心坐标
-    for(int i=0; i<P.cols; i++)
-    {
-        Pr.col(i)=P.col(i)-C;
-    }
+    //取内点数最高的一种求解
+    //更新mnBestInliers
+    if(nInliers<mnBestInliers)
+        return false;
+
+    mvbBestInliers = mvbInliersi;
+    mnBestInliers = nInliers;
+    mBestRotation = mR12i;
+    mBestTranslation = mt12i;
+    mBestScale = ms12i;
+
+    return nInliers>mRansacMinInliers;
+}
+
+cv::Mat Sim3Solver::find(vector<bool> &vbInliers12, int &nInliers)
+{
+    bool bFlag;
+    return iterate(mRansac.MaxIterations(),bFlag,vbInliers12,nInliers);
 }
 
-void Sim3Solver::ComputeSim3(cv::Mat &P1, cv::Mat &P2)
+void Sim3Solver::ComputeSim3(const Eigen::Matrix3f &P1, const Eigen::Matrix3f &P2)
 {
     // ！！！！！！！这段代码一定要看这篇论文！！！！！！！！！！！
     // Custom implementation of:
@@ -269,94 +248,59 @@ void Sim3Solver::ComputeSim3(cv::Mat &P1, cv::Mat &P2)
 
     // Step 1: Centroid and relative coordinates
 
-    // Pr1: 3x3矩阵，每一列是一个点
-    cv::Mat Pr1(P1.size(),P1.type()); // Relative coordinates to centroid (set 1)
-    cv::Mat Pr2(P2.size(),P2.type()); // Relative coordinates to centroid (set 2)
-    cv::Mat O1(3,1,Pr1.type()); // Centroid of P1
-    cv::Mat O2(3,1,Pr2.type()); // Centroid of P2
-
-    //Pr1,Pr2为去质心坐标，O1为质心
-    ComputeCentroid(P1,Pr1,O1);
-    ComputeCentroid(P2,Pr2,O2);
+    //O1,O2为质心，Pr1,Pr2为去质心坐标，每一列是一个点
+    const Eigen::Vector3f O1 = P1.rowwise().mean();
+    const Eigen::Vector3f O2 = P2.rowwise().mean();
+    const Eigen::Matrix3f Pr1 = P1.colwise()-O1;
+    const Eigen::Matrix3f Pr2 = P2.colwise()-O2;
 
     /// 接下来并没有选择直接求解旋转矩阵，
     /// 为了使后面求尺度因子时的误差最小化，这里先采用四元数解法来求R，具体看论文推导
 
     // Step 2: Compute M matrix
     // M: 去质心点矩阵相乘
-    cv::Mat M = Pr2*Pr1.t();
+    const Eigen::Matrix3d M = (Pr2*Pr1.transpose()).cast<double>();
 
     // Step 3: Compute N matrix
 
-    double N11, N12, N13, N14, N22, N23, N24, N33, N34, N44;
-
-    cv::Mat N(4,4,P1.type());
-
-    N11 = M.at<float>(0,0)+M.at<float>(1,1)+M.at<float>(2,2);
-    N12 = M.at<float>(1,2)-M.at<float>(2,1);
-    N13 = M.at<float>(2,0)-M.at<float>(0,2);
-    N14 = M.at<float>(0,1)-M.at<float>(1,0);
-    N22 = M.at<float>(0,0)-M.at<float>(1,1)-M.at<float>(2,2);
-    N23 = M.at<float>(0,1)+M.at<float>(1,0);
-    N24 = M.at<float>(2,0)+M.at<float>(0,2);
-    N33 = -M.at<float>(0,0)+M.at<float>(1,1)-M.at<float>(2,2);
-    N34 = M.at<float>(1,2)+M.at<float>(2,1);
-    N44 = -M.at<float>(0,0)-M.at<float>(1,1)+M.at<float>(2,2);
-
-    N = (cv::Mat_<float>(4,4) << N11, N12, N13, N14,
-                                 N12, N22, N23, N24,
-                                 N13, N23, N33, N34,
-                                 N14, N24, N34, N44);
-
+    const double N11 = M(0,0)+M(1,1)+M(2,2);
+    const double N12 = M(1,2)-M(2,1);
+    const double N13 = M(2,0)-M(0,2);
+    const double N14 = M(0,1)-M(1,0);
+    const double N22 = M(0,0)-M(1,1)-M(2,2);
+    const double N23 = M(0,1)+M(1,0);
+    const double N24 = M(2,0)+M(0,2);
+    const double N33 = -M(0,0)+M(1,1)-M(2,2);
+    const double N34 = M(1,2)+M(2,1);
+    const double N44 = -M(0,0)-M(1,1)+M(2,2);
+
+    Eigen::Matrix4d N;
+    N << N11, N12, N13, N14,
+         N12, N22, N23, N24,
+         N13, N23, N33, N34,
+         N14, N24, N34, N44;
 
     // Step 4: Eigenvector of the highest eigenvalue
 
-    cv::Mat eval, evec;
-    //对矩阵N进行特征值分解
-    cv::eigen(N,eval,evec); //evec[0] is the quaternion of the desired rotation
-
-    //取最大特征值对应的特征向量，是与旋转矩阵有关的四元数
-    cv::Mat vec(1,3,evec.type());
-    (evec.row(0).colRange(1,4)).copyTo(vec); //extract imaginary part of the quaternion (sin*axis)
-
-    // Rotation angle. sin is the norm of the imaginary part, cos is the real part
-    // 从四元数提取旋转的角度
-    // 四元数 q= cos(\theta * 0.5)+ n_{3x1} * sin(\theta *0.5)
-    double ang=atan2(norm(vec),evec.at<float>(0,0));
-
-    // 将四元素变成轴角表示， 乘以2是因为从四元数提取出来的角度只是一半
-    vec = 2*ang*vec/norm(vec); //Angle-axis representation. quaternion angle is the half
+    // 特征值按升序排列，最后一列对应最大特征值，是所求旋转的四元数(w,x,y,z)
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> eig(N);
+    const Eigen::Vector4d q = eig.eigenvectors().col(3);
 
-    //罗德里格斯，将旋转向量转为旋转矩阵，保存到mR12i
     // 注意：这里求出来的旋转是 从相机坐标系2到相机坐标系1的变换，
-    mR12i.create(3,3,P1.type());
-    cv::Rodrigues(vec,mR12i); // computes the rotation matrix from angle-axis
+    mR12i = Eigen::Quaterniond(q(0),q(1),q(2),q(3)).normalized().toRotationMatrix().cast<float>();
 
     // Step 5: Rotate set 2
 
     //将去质心坐标Pr2转换到第一帧坐标系下(这里只是旋转对齐，还没有加平移)
-    cv::Mat P3 = mR12i*Pr2;
+    const Eigen::Matrix3f P3 = mR12i*Pr2;
 
     // Step 6: Scale
     // 先检查是不是双目或者RGBD这些固定尺度的情况
     if(!mbFixScale)
     {
         //不是，则求解尺度因子,按照论文公式来
-        //两个矩阵求内积？
-        double nom = Pr1.dot(P3);
-        //aux_P3: 3x3
-        cv::Mat aux_P3(P3.size(),P3.type());
-        aux_P3=P3;
-        cv::pow(P3,2,aux_P3);   //矩阵元素各自平方
-        double den = 0;
-
-        for(int i=0; i<aux_P3.rows; i++)
-        {
-            for(int j=0; j<aux_P3.cols; j++)
-            {
-                den+=aux_P3.at<float>(i,j);
-            }
-        }
+        const double nom = Pr1.cwiseProduct(P3).sum();
+        const double den = P3.squaredNorm();
         //两个点云的尺度
         ms12i = nom/den;
     }
@@ -365,51 +309,35 @@ void Sim3Solver::ComputeSim3(cv::Mat &P1, cv::Mat &P2)
 
     // Step 7: Translation
     // 计算平移
-    mt12i.create(1,3,P1.type());
     mt12i = O1 - ms12i*mR12i*O2;
 
     // Step 8: Transformation
 
-    // Step 8.1 T12
-    // 组合成变换矩阵T
-    mT12i = cv::Mat::eye(4,4,P1.type());
-
-    // sR_12
-    cv::Mat sR = ms12i*mR12i;
-
-    sR.copyTo(mT12i.rowRange(0,3).colRange(0,3));
-    mt12i.copyTo(mT12i.rowRange(0,3).col(3));
-
-    // Step 8.2 T21
-
-    mT21i = cv::Mat::eye(4,4,P1.type());
-
     // s'*R_21=1/(s*R_12)=(1/s)*(R_12^T)
-    cv::Mat sRinv = (1.0/ms12i)*mR12i.t();
-
-    sRinv.copyTo(mT21i.rowRange(0,3).colRange(0,3));
-    cv::Mat tinv = -sRinv*mt12i;
-    tinv.copyTo(mT21i.rowRange(0,3).col(3));
+    msR21i = (1.0f/ms12i)*mR12i.transpose();
+    mt21i = -msR21i*mt12i;
 }
 
 
-void Sim3Solver::CheckInliers()
+void Sim3Solver::CheckInliers(const int nRequired)
 {
-    vector<cv::Mat> vP1im2, vP2im1;
-    ////将mvX3Dc2中的3d点通过参数mT12i，mK1投影为2d像素坐标，放入vP2im1
-    Project(mvX3Dc2,vP2im1,mT12i,mK1);  // 把2系中的3D经过Sim3变换(mT12i)到1系中计算重投影坐标
-    Project(mvX3Dc1,vP1im2,mT21i,mK2);  // 把1系中的3D经过Sim3变换(mT21i)到2系中计算重投影坐标
-
     mnInliersi=0;
 
+    const Eigen::Matrix3f sR12 = ms12i*mR12i;
+
     //判定mvP1im1中的点哪些是内点
-    for(size_t i=0; i<mvP1im1.size(); i++)
+    for(int i=0; i<N; i++)
     {
-        cv::Mat dist1 = mvP1im1[i]-vP2im1[i];
-        cv::Mat dist2 = vP1im2[i]-mvP2im2[i];
+        //剩下的点全是内点也达不到nRequired
+        if(mnInliersi+N-i<nRequired)
+            break;
 
-        const float err1 = dist1.dot(dist1);
-        const float err2 = dist2.dot(dist2);
+        // 把2系中的3D经过Sim3变换到1系中计算重投影坐标，反之亦然
+        const Eigen::Vector2f P2im1 = Project(sR12*mvX3Dc2[i]+mt12i,mfx1,mfy1,mcx1,mcy1);
+        const Eigen::Vector2f P1im2 = Project(msR21i*mvX3Dc1[i]+mt21i,mfx2,mfy2,mcx2,mcy2);
+
+        const float err1 = (mvP1im1[i]-P2im1).squaredNorm();
+        const float err2 = (P1im2-mvP2im2[i]).squaredNorm();
 
         if(err1<mvnMaxError1[i] && err2<mvnMaxError2[i])
         {
@@ -424,12 +352,12 @@ void Sim3Solver::CheckInliers()
 
 cv::Mat Sim3Solver::GetEstimatedRotation()
 {
-    return mBestRotation.clone();
+    return Converter::toCvMat(Eigen::Matrix3d(mBestRotation.cast<double>()));
 }
 
 cv::Mat Sim3Solver::GetEstimatedTranslation()
 {
-    return mBestTranslation.clone();
+    return Converter::toCvMat(Eigen::Matrix<double,3,1>(mBestTranslation.cast<double>()));
 }
 
 float Sim3Solver::GetEstimatedScale()
@@ -437,47 +365,10 @@ float Sim3Solver::GetEstimatedScale()
     return mBestScale;
 }
 
-void Sim3Solver::Project(const vector<cv::Mat> &vP3Dw, vector<cv::Mat> &vP2D, cv::Mat Tcw, cv::Mat K)
-{
-    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
-    const float &fx = K.at<float>(0,0);
-    const float &fy = K.at<float>(1,1);
-    const float &cx = K.at<float>(0,2);
-    const float &cy = K.at<float>(1,2);
-
-    vP2D.clear();
-    vP2D.reserve(vP3Dw.size());
-
-    for(size_t i=0, iend=vP3Dw.size(); i<iend; i++)
-    {
-        cv::Mat P3Dc = Rcw*vP3Dw[i]+tcw;
-        const float invz = 1/(P3Dc.at<float>(2));
-        const float x = P3Dc.at<float>(0)*invz;
-        const float y = P3Dc.at<float>(1)*invz;
-
-        vP2D.push_back((cv::Mat_<float>(2,1) << fx*x+cx, fy*y+cy));
-    }
-}
-
-void Sim3Solver::FromCameraToImage(const vector<cv::Mat> &vP3Dc, vector<cv::Mat> &vP2D, cv::Mat K)
+Eigen::Vector2f Sim3Solver::Project(const Eigen::Vector3f &P3Dc, const float fx, const float fy, const float cx, const float cy)
 {
-    const float &fx = K.at<float>(0,0);
-    const float &fy = K.at<float>(1,1);
-    const float &cx = K.at<float>(0,2);
-    const float &cy = K.at<float>(1,2);
-
-    vP2D.clear();
-    vP2D.reserve(vP3Dc.size());
-
-    for(size_t i=0, iend=vP3Dc.size(); i<iend; i++)
-    {
-        const float invz = 1/(vP3Dc[i].at<float>(2));
-        const float x = vP3Dc[i].at<float>(0)*invz;
-        const float y = vP3Dc[i].at<float>(1)*invz;
-
-        vP2D.push_back((cv::Mat_<float>(2,1) << fx*x+cx, fy*y+cy));
-    }
+    const float invz = 1/P3Dc(2);
+    return Eigen::Vector2f(fx*P3Dc(0)*invz+cx, fy*P3Dc(1)*invz+cy);
 }
 
 } //namespace ORB_SLAM
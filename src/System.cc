@@ -22,16 +22,23 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "Optimizer.h"
 #include <thread>
-#include <pangolin/pangolin.h>
 #include <iomanip>
 
+#ifdef COMPILEDWITHVIEWER
+#include "Viewer.h"
+#include "FrameDrawer.h"
+#include "MapDrawer.h"
+#include <pangolin/pangolin.h>
+#endif
+
 namespace ORB_SLAM2
 {
 
 System::System(const string &strVocFile, const string &strSettingsFile, const eSensor sensor,
-               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mbActivateLocalizationMode(false),
-        mbDeactivateLocalizationMode(false)
+               const bool bUseViewer):mSensor(sensor), mpViewer(static_cast<Viewer*>(NULL)), mbReset(false),mnTrackingCameras(0),
+        mbActivateLocalizationMode(false), mbDeactivateLocalizationMode(false)
 {
     // Output welcome message
     cout << endl <<
@@ -57,6 +64,18 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
        exit(-1);
     }
 
+    //BA求解器：0为g2o(默认)，1为BASolver，两者在相同输入上可以对比
+    int nUseBASolver = fsSettings["Optimizer.UseBASolver"];
+    Optimizer::SetUseBASolver(nUseBASolver!=0);
+    if(nUseBASolver)
+        cout << "Bundle adjustment solver: BASolver (Schur complement)" << endl;
+
+    //Essential Graph求解器：0为g2o(默认)，1为PoseGraphSolver；分层求解时粗略图的迭代次数(0为不分层)
+    int nUsePoseGraphSolver = fsSettings["Optimizer.UsePoseGraphSolver"];
+    int nPoseGraphCoarseIterations = fsSettings["Optimizer.PoseGraphCoarseIterations"];
+    Optimizer::SetUsePoseGraphSolver(nUsePoseGraphSolver!=0,nPoseGraphCoarseIterations);
+    if(nUsePoseGraphSolver)
+        cout << "Essential graph solver: PoseGraphSolver, coarse iterations: " << nPoseGraphCoarseIterations << endl;
 
     //Load ORB Vocabulary
     cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
@@ -78,8 +97,19 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     mpMap = new Map();
 
     //Create Drawers. These are used by the Viewer
-    mpFrameDrawer = new FrameDrawer(mpMap);
-    mpMapDrawer = new MapDrawer(mpMap, strSettingsFile);
+    //无界面时不创建，Tracking中每帧的绘图数据拷贝也随之跳过
+    mpFrameDrawer = static_cast<FrameDrawer*>(NULL);
+    mpMapDrawer = static_cast<MapDrawer*>(NULL);
+#ifdef COMPILEDWITHVIEWER
+    if(bUseViewer)
+    {
+        mpFrameDrawer = new FrameDrawer(mpMap);
+        mpMapDrawer = new MapDrawer(mpMap, strSettingsFile);
+    }
+#else
+    if(bUseViewer)
+        cout << "Built without viewer (WITH_VIEWER=OFF), running headless" << endl;
+#endif
 
 
     //(it will live in the main thread of execution, the one that called this constructor)
@@ -87,6 +117,11 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //在main中会进行调用，（来一张图片，调用一次）
     mpTracker = new Tracking(this, mpVocabulary, mpFrameDrawer, mpMapDrawer,
                              mpMap, mpKeyFrameDatabase, strSettingsFile, mSensor);
+    mvpTrackers.push_back(mpTracker);
+    mvTrackingState.resize(1);
+    mvTrackedMapPoints.resize(1);
+    mvTrackedKeyPointsUn.resize(1);
+    mvFrameTimes.resize(1);
 
     //Initialize the Tracking thread
 
@@ -95,17 +130,35 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     mpLocalMapper = new LocalMapping(mpMap, mSensor==MONOCULAR);
     mptLocalMapping = new thread(&ORB_SLAM2::LocalMapping::Run,mpLocalMapper);
 
+    //长时间运行的地图上限：关键帧数、mappoint数、估计内存(MB)，0为不限制(默认)
+    //是否回收被删除的对象(默认1，0为不回收)，回收前等待所有持有地图指针的线程确认
+    int nMaxKeyFrames = fsSettings["Map.MaxKeyFrames"];
+    int nMaxMapPoints = fsSettings["Map.MaxMapPoints"];
+    int nMaxMemoryMB = fsSettings["Map.MaxMemoryMB"];
+    mpLocalMapper->SetMapBudget(nMaxKeyFrames,nMaxMapPoints,(size_t)max(nMaxMemoryMB,0)*1024*1024);
+    if(nMaxKeyFrames>0 || nMaxMapPoints>0 || nMaxMemoryMB>0)
+        cout << "Map budget: " << nMaxKeyFrames << " keyframes, " << nMaxMapPoints << " points, " << nMaxMemoryMB << " MB (0 = unlimited)" << endl;
+    if(!fsSettings["Map.ReclaimErased"].empty())
+    {
+        int nReclaim = fsSettings["Map.ReclaimErased"];
+        mpLocalMapper->SetReclaimErased(nReclaim!=0);
+        if(nReclaim==0)
+            cout << "Erased map objects are not reclaimed" << endl;
+    }
+
     //Initialize the Loop Closing thread and launch
     mpLoopCloser = new LoopClosing(mpMap, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR);
     mptLoopClosing = new thread(&ORB_SLAM2::LoopClosing::Run, mpLoopCloser);
 
     //Initialize the Viewer thread and launch
+#ifdef COMPILEDWITHVIEWER
     if(bUseViewer)
     {
         mpViewer = new Viewer(this, mpFrameDrawer,mpMapDrawer,mpTracker,strSettingsFile);
         mptViewer = new thread(&Viewer::Run, mpViewer);
         mpTracker->SetViewer(mpViewer);
     }
+#endif
 
     //Set pointers between threads
     //建立关联
@@ -116,113 +169,160 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     mpLocalMapper->SetLoopCloser(mpLoopCloser);
 
     mpLoopCloser->SetTracker(mpTracker);
+    mpLoopCloser->AddTracker(mpTracker);
     mpLoopCloser->SetLocalMapper(mpLocalMapper);
 }
 
-cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp)
+int System::AddCamera(const string &strSettingsFile)
 {
-    if(mSensor!=STEREO)
+    cv::FileStorage fsSettings(strSettingsFile.c_str(), cv::FileStorage::READ);
+    if(!fsSettings.isOpened())
     {
-        cerr << "ERROR: you called TrackStereo but input sensor was not set to STEREO." << endl;
+       cerr << "Failed to open settings file at: " << strSettingsFile << endl;
+       exit(-1);
+    }
+
+    // 其它相机不绘图，共享地图、关键帧数据库、词典和LocalMapping、LoopClosing线程
+    const int nCamera = mvpTrackers.size();
+    Tracking* pTracker = new Tracking(this, mpVocabulary, static_cast<FrameDrawer*>(NULL), static_cast<MapDrawer*>(NULL),
+                                      mpMap, mpKeyFrameDatabase, strSettingsFile, mSensor, nCamera);
+    pTracker->SetLocalMapper(mpLocalMapper);
+    pTracker->SetLoopClosing(mpLoopCloser);
+    mpLoopCloser->AddTracker(pTracker);
+
+    unique_lock<mutex> lock(mMutexState);
+    mvpTrackers.push_back(pTracker);
+    mvTrackingState.resize(mvpTrackers.size());
+    mvTrackedMapPoints.resize(mvpTrackers.size());
+    mvTrackedKeyPointsUn.resize(mvpTrackers.size());
+    mvFrameTimes.resize(mvpTrackers.size());
+
+    cout << "Camera " << nCamera << " added with settings " << strSettingsFile << endl;
+
+    return nCamera;
+}
+
+int System::GetNumberOfCameras()
+{
+    unique_lock<mutex> lock(mMutexState);
+    return mvpTrackers.size();
+}
+
+Tracking* System::BeginTracking(const int nCamera)
+{
+    if(nCamera<0 || nCamera>=GetNumberOfCameras())
+    {
+        cerr << "ERROR: camera " << nCamera << " was not added to the system." << endl;
         exit(-1);
-    }   
+    }
+
+    unique_lock<mutex> lock(mMutexReset);
+
+    // 模式切换和重置影响所有相机，等其它相机处理完当前帧再进行
+    while(mnTrackingCameras>0)
+    {
+        bool bModeChange;
+        {
+            unique_lock<mutex> lockMode(mMutexMode);
+            bModeChange = mbActivateLocalizationMode || mbDeactivateLocalizationMode;
+        }
+        if(!bModeChange && !mbReset)
+            break;
+        mCondTracking.wait(lock);
+    }
 
     // Check mode change
     {
-        unique_lock<mutex> lock(mMutexMode);
+        unique_lock<mutex> lockMode(mMutexMode);
+        //LocalizationMode（纯定位）模式是否激活，如果激活则要求停止LocalMapper
+        //在viewer中有个开关menuLocalizationMode，有它控制是否ActivateLocalizationMode，并最终管控mbOnlyTracking
         if(mbActivateLocalizationMode)
         {
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            // 等待建图器停止
+            mpLocalMapper->WaitUntilStopped();
 
-            mpTracker->InformOnlyTracking(true);
+            //只进行跟踪,不建图
+            for(size_t i=0; i<mvpTrackers.size(); i++)
+                mvpTrackers[i]->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
         }
         if(mbDeactivateLocalizationMode)
         {
-            mpTracker->InformOnlyTracking(false);
+            for(size_t i=0; i<mvpTrackers.size(); i++)
+                mvpTrackers[i]->InformOnlyTracking(false);
             mpLocalMapper->Release();
             mbDeactivateLocalizationMode = false;
         }
     }
 
     // Check reset
-    {
-    unique_lock<mutex> lock(mMutexReset);
+    //判断是否reset重启了，第一个相机清空地图，其它相机只重置自己的状态
     if(mbReset)
     {
         mpTracker->Reset();
+        for(size_t i=1; i<mvpTrackers.size(); i++)
+            mvpTrackers[i]->ResetState();
         mbReset = false;
     }
-    }
 
-    cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
+    mnTrackingCameras++;
+
+    return mvpTrackers[nCamera];
+}
+
+void System::EndTracking(const int nCamera)
+{
+    {
+        unique_lock<mutex> lock(mMutexReset);
+        mnTrackingCameras--;
+    }
+    mCondTracking.notify_all();
 
+    Tracking* pTracker = mvpTrackers[nCamera];
     unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
-    return Tcw;
+    mvTrackingState[nCamera] = pTracker->mState;
+    mvTrackedMapPoints[nCamera] = pTracker->mCurrentFrame.mvpMapPoints;
+    mvTrackedKeyPointsUn[nCamera] = pTracker->mCurrentFrame.mvKeysUn;
+    mvFrameTimes[nCamera] = pTracker->mFrameTimes;
 }
 
-cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp)
+cv::Mat System::TrackStereo(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timestamp, const int nCamera)
 {
-    if(mSensor!=RGBD)
+    if(mSensor!=STEREO)
     {
-        cerr << "ERROR: you called TrackRGBD but input sensor was not set to RGBD." << endl;
+        cerr << "ERROR: you called TrackStereo but input sensor was not set to STEREO." << endl;
         exit(-1);
-    }    
+    }   
 
-    // Check mode change
-    {
-        unique_lock<mutex> lock(mMutexMode);
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+    Tracking* pTracker = BeginTracking(nCamera);
 
-            // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+    cv::Mat Tcw = pTracker->GrabImageStereo(imLeft,imRight,timestamp);
 
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
+    EndTracking(nCamera);
+    return Tcw;
+}
 
-    // Check reset
-    {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
+cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const double &timestamp, const int nCamera)
+{
+    if(mSensor!=RGBD)
     {
-        mpTracker->Reset();
-        mbReset = false;
-    }
-    }
+        cerr << "ERROR: you called TrackRGBD but input sensor was not set to RGBD." << endl;
+        exit(-1);
+    }    
 
-    cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
+    Tracking* pTracker = BeginTracking(nCamera);
 
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    cv::Mat Tcw = pTracker->GrabImageRGBD(im,depthmap,timestamp);
+
+    EndTracking(nCamera);
     return Tcw;
 }
 
 // 每一帧调用一次
-cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
+cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp, const int nCamera)
 {
     if(mSensor!=MONOCULAR)
     {
@@ -230,54 +330,12 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
         exit(-1);
     }
 
-    // Check mode change
-    {
-	
-        unique_lock<mutex> lock(mMutexMode);
-        //LocalizationMode（纯定位）模式是否激活，如果激活则要求停止LocalMapper
-        //在viewer中有个开关menuLocalizationMode，有它控制是否ActivateLocalizationMode，并最终管控mbOnlyTracking
-        if(mbActivateLocalizationMode)
-        {
-            mpLocalMapper->RequestStop();
+    Tracking* pTracker = BeginTracking(nCamera);
 
-            // Wait until Local Mapping has effectively stopped
-            // 等待建图器停止
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
-
-            //只进行跟踪,不建图
-            mpTracker->InformOnlyTracking(true);
-            mbActivateLocalizationMode = false;
-        }
-        if(mbDeactivateLocalizationMode)
-        {
-            mpTracker->InformOnlyTracking(false);
-            mpLocalMapper->Release();
-            mbDeactivateLocalizationMode = false;
-        }
-    }
-
-    // Check reset
-    //判断是否reset重启了
-    {
-    unique_lock<mutex> lock(mMutexReset);
-    if(mbReset)
-    {
-        mpTracker->Reset();
-        mbReset = false;
-    }
-    }
-    
-    //调用mpTracker->GrabImageMonocular(图像，时间戳)
-    cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp);
-
-    unique_lock<mutex> lock2(mMutexState);
-    mTrackingState = mpTracker->mState;
-    mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
-    mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
+    //调用Tracking::GrabImageMonocular(图像，时间戳)
+    cv::Mat Tcw = pTracker->GrabImageMonocular(im,timestamp);
 
+    EndTracking(nCamera);
     return Tcw;
 }
 
@@ -316,24 +374,25 @@ void System::Shutdown()
 {
     mpLocalMapper->RequestFinish();
     mpLoopCloser->RequestFinish();
+#ifdef COMPILEDWITHVIEWER
     if(mpViewer)
     {
         mpViewer->RequestFinish();
-        while(!mpViewer->isFinished())
-            usleep(5000);
+        mpViewer->WaitUntilFinished();
     }
+#endif
 
     // Wait until all thread have effectively stopped
-    while(!mpLocalMapper->isFinished() || !mpLoopCloser->isFinished() || mpLoopCloser->isRunningGBA())
-    {
-        usleep(5000);
-    }
+    mpLocalMapper->WaitUntilFinished();
+    mpLoopCloser->WaitUntilFinished();
 
+#ifdef COMPILEDWITHVIEWER
     if(mpViewer)
         pangolin::BindToContext("ORB-SLAM2: Map Viewer");
+#endif
 }
 
-void System::SaveTrajectoryTUM(const string &filename)
+void System::SaveTrajectoryTUM(const string &filename, const int nCamera)
 {
     cout << endl << "Saving camera trajectory to " << filename << " ..." << endl;
     if(mSensor==MONOCULAR)
@@ -342,28 +401,52 @@ void System::SaveTrajectoryTUM(const string &filename)
         return;
     }
 
-    vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
-    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
-
-    // Transform all keyframes so that the first keyframe is at the origin.
-    // After a loop closure the first keyframe might not be at the origin.
-    cv::Mat Two = vpKFs[0]->GetPoseInverse();
+    vector<double> vTimestamps;
+    vector<cv::Mat> vTwc;
+    GetTrajectory(vTimestamps,vTwc,nCamera);
 
     ofstream f;
     f.open(filename.c_str());
     f << fixed;
 
+    for(size_t i=0; i<vTwc.size(); i++)
+    {
+        cv::Mat Rwc = vTwc[i].rowRange(0,3).colRange(0,3);
+        cv::Mat twc = vTwc[i].rowRange(0,3).col(3);
+
+        vector<float> q = Converter::toQuaternion(Rwc);
+
+        f << setprecision(6) << vTimestamps[i] << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+    }
+    f.close();
+    cout << endl << "trajectory saved!" << endl;
+}
+
+void System::GetTrajectory(vector<double> &vTimestamps, vector<cv::Mat> &vTwc, const int nCamera)
+{
+    vTimestamps.clear();
+    vTwc.clear();
+
+    // Transform all keyframes so that the first keyframe is at the origin.
+    // After a loop closure the first keyframe might not be at the origin.
+    // 每个子地图有自己的坐标系，帧的位姿以它所在子地图的第一个关键帧为原点
+    map<long unsigned int,cv::Mat> mTwo;
+    GetMapOrigins(mTwo);
+    if(mTwo.empty())
+        return;
+
     // Frame pose is stored relative to its reference keyframe (which is optimized by BA and pose graph).
     // We need to get first the keyframe pose and then concatenate the relative transformation.
     // Frames not localized (tracking failure) are not saved.
 
     // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
     // which is true when tracking failed (lbL).
-    list<ORB_SLAM2::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
-    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-    list<bool>::iterator lbL = mpTracker->mlbLost.begin();
-    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(),
-        lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++, lbL++)
+    Tracking* pTracker = mvpTrackers[nCamera];
+    list<ORB_SLAM2::KeyFrame*>::iterator lRit = pTracker->mlpReferences.begin();
+    list<double>::iterator lT = pTracker->mlFrameTimes.begin();
+    list<bool>::iterator lbL = pTracker->mlbLost.begin();
+    for(list<cv::Mat>::iterator lit=pTracker->mlRelativeFramePoses.begin(),
+        lend=pTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++, lbL++)
     {
         if(*lbL)
             continue;
@@ -379,20 +462,39 @@ void System::SaveTrajectoryTUM(const string &filename)
             pKF = pKF->GetParent();
         }
 
-        Trw = Trw*pKF->GetPose()*Two;
+        map<long unsigned int,cv::Mat>::const_iterator mit = mTwo.find(pKF->GetMapId());
+        if(mit==mTwo.end())
+            continue;
+
+        Trw = Trw*pKF->GetPose()*mit->second;
 
         cv::Mat Tcw = (*lit)*Trw;
+        cv::Mat Twc = cv::Mat::eye(4,4,CV_32F);
         cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
+        Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
         cv::Mat twc = -Rwc*Tcw.rowRange(0,3).col(3);
+        twc.copyTo(Twc.rowRange(0,3).col(3));
 
-        vector<float> q = Converter::toQuaternion(Rwc);
-
-        f << setprecision(6) << *lT << " " <<  setprecision(9) << twc.at<float>(0) << " " << twc.at<float>(1) << " " << twc.at<float>(2) << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << endl;
+        vTimestamps.push_back(*lT);
+        vTwc.push_back(Twc);
     }
-    f.close();
-    cout << endl << "trajectory saved!" << endl;
 }
 
+void System::GetMapOrigins(map<long unsigned int,cv::Mat> &mTwo)
+{
+    mTwo.clear();
+
+    vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
+    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
+
+    // 按id顺序，每个子地图第一个出现的关键帧就是它的原点
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        const long unsigned int nMapId = vpKFs[i]->GetMapId();
+        if(!mTwo.count(nMapId))
+            mTwo[nMapId] = vpKFs[i]->GetPoseInverse();
+    }
+}
 
 void System::SaveKeyFrameTrajectoryTUM(const string &filename)
 {
@@ -430,7 +532,7 @@ void System::SaveKeyFrameTrajectoryTUM(const string &filename)
     cout << endl << "trajectory saved!" << endl;
 }
 
-void System::SaveTrajectoryKITTI(const string &filename)
+void System::SaveTrajectoryKITTI(const string &filename, const int nCamera)
 {
     cout << endl << "Saving camera trajectory to " << filename << " ..." << endl;
     if(mSensor==MONOCULAR)
@@ -439,12 +541,11 @@ void System::SaveTrajectoryKITTI(const string &filename)
         return;
     }
 
-    vector<KeyFrame*> vpKFs = mpMap->GetAllKeyFrames();
-    sort(vpKFs.begin(),vpKFs.end(),KeyFrame::lId);
-
     // Transform all keyframes so that the first keyframe is at the origin.
     // After a loop closure the first keyframe might not be at the origin.
-    cv::Mat Two = vpKFs[0]->GetPoseInverse();
+    // 每个子地图有自己的坐标系，帧的位姿以它所在子地图的第一个关键帧为原点
+    map<long unsigned int,cv::Mat> mTwo;
+    GetMapOrigins(mTwo);
 
     ofstream f;
     f.open(filename.c_str());
@@ -456,9 +557,10 @@ void System::SaveTrajectoryKITTI(const string &filename)
 
     // For each frame we have a reference keyframe (lRit), the timestamp (lT) and a flag
     // which is true when tracking failed (lbL).
-    list<ORB_SLAM2::KeyFrame*>::iterator lRit = mpTracker->mlpReferences.begin();
-    list<double>::iterator lT = mpTracker->mlFrameTimes.begin();
-    for(list<cv::Mat>::iterator lit=mpTracker->mlRelativeFramePoses.begin(), lend=mpTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++)
+    Tracking* pTracker = mvpTrackers[nCamera];
+    list<ORB_SLAM2::KeyFrame*>::iterator lRit = pTracker->mlpReferences.begin();
+    list<double>::iterator lT = pTracker->mlFrameTimes.begin();
+    for(list<cv::Mat>::iterator lit=pTracker->mlRelativeFramePoses.begin(), lend=pTracker->mlRelativeFramePoses.end();lit!=lend;lit++, lRit++, lT++)
     {
         ORB_SLAM2::KeyFrame* pKF = *lRit;
 
@@ -471,7 +573,11 @@ void System::SaveTrajectoryKITTI(const string &filename)
             pKF = pKF->GetParent();
         }
 
-        Trw = Trw*pKF->GetPose()*Two;
+        map<long unsigned int,cv::Mat>::const_iterator mit = mTwo.find(pKF->GetMapId());
+        if(mit==mTwo.end())
+            continue;
+
+        Trw = Trw*pKF->GetPose()*mit->second;
 
         cv::Mat Tcw = (*lit)*Trw;
         cv::Mat Rwc = Tcw.rowRange(0,3).colRange(0,3).t();
@@ -485,22 +591,49 @@ void System::SaveTrajectoryKITTI(const string &filename)
     cout << endl << "trajectory saved!" << endl;
 }
 
-int System::GetTrackingState()
+int System::GetTrackingState(const int nCamera)
 {
     unique_lock<mutex> lock(mMutexState);
-    return mTrackingState;
+    return mvTrackingState[nCamera];
 }
 
-vector<MapPoint*> System::GetTrackedMapPoints()
+vector<MapPoint*> System::GetTrackedMapPoints(const int nCamera)
 {
     unique_lock<mutex> lock(mMutexState);
-    return mTrackedMapPoints;
+    return mvTrackedMapPoints[nCamera];
 }
 
-vector<cv::KeyPoint> System::GetTrackedKeyPointsUn()
+vector<cv::KeyPoint> System::GetTrackedKeyPointsUn(const int nCamera)
 {
     unique_lock<mutex> lock(mMutexState);
-    return mTrackedKeyPointsUn;
+    return mvTrackedKeyPointsUn[nCamera];
+}
+
+Tracking::FrameTimes System::GetFrameTimes(const int nCamera)
+{
+    unique_lock<mutex> lock(mMutexState);
+    return mvFrameTimes[nCamera];
+}
+
+vector<LocalMapping::KeyFrameTimes> System::GetKeyFrameTimes()
+{
+    return mpLocalMapper->GetKeyFrameTimes();
+}
+
+void System::WaitForLocalMapping()
+{
+    mpLocalMapper->WaitUntilIdle();
+}
+
+bool System::IsRunningGlobalBA()
+{
+    return mpLoopCloser->isRunningGBA();
+}
+
+void System::GetMapSize(long unsigned int &nKeyFrames, long unsigned int &nMapPoints)
+{
+    nKeyFrames = mpMap->KeyFramesInMap();
+    nMapPoints = mpMap->MapPointsInMap();
 }
 
 } //namespace ORB_SLAM
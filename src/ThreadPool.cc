@@ -0,0 +1,116 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ThreadPool.h"
+
+namespace ORB_SLAM2
+{
+
+ThreadPool::ThreadPool(int nThreads):
+    mpJob(NULL), mnJobSize(0), mnNextIdx(0), mnActive(0), mnGeneration(0), mbFinish(false)
+{
+    if(nThreads<=0)
+        nThreads = std::thread::hardware_concurrency();
+
+    // 调用线程本身也参与计算，所以只需要创建nThreads-1个工作线程
+    for(int i=1; i<nThreads; i++)
+        mvThreads.push_back(std::thread(&ThreadPool::WorkerLoop,this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbFinish = true;
+    }
+    mCondJob.notify_all();
+
+    for(size_t i=0; i<mvThreads.size(); i++)
+        mvThreads[i].join();
+}
+
+void ThreadPool::ParallelFor(const int n, const std::function<void(int)> &f)
+{
+    if(n<=0)
+        return;
+
+    // 没有工作线程或只有一个任务时直接在当前线程执行
+    if(mvThreads.empty() || n==1)
+    {
+        for(int i=0; i<n; i++)
+            f(i);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mpJob = &f;
+        mnJobSize = n;
+        mnNextIdx = 0;
+        mnActive = mvThreads.size();
+        mnGeneration++;
+    }
+    mCondJob.notify_all();
+
+    RunJob();
+
+    // f是调用者的局部对象，必须等所有工作线程都离开RunJob后才能返回
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(mnActive>0)
+        mCondDone.wait(lock);
+    mpJob = NULL;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned long nGeneration = 0;
+
+    while(1)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            while(!mbFinish && mnGeneration==nGeneration)
+                mCondJob.wait(lock);
+            if(mbFinish)
+                return;
+            nGeneration = mnGeneration;
+        }
+
+        RunJob();
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mnActive--;
+            if(mnActive==0)
+                mCondDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::RunJob()
+{
+    const std::function<void(int)> &f = *mpJob;
+    int i;
+    while((i=mnNextIdx++)<mnJobSize)
+        f(i);
+}
+
+} //namespace ORB_SLAM
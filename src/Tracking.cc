@@ -25,10 +25,10 @@
 #include<opencv2/features2d/features2d.hpp>
 
 #include"ORBmatcher.h"
-#include"FrameDrawer.h"
 #include"Converter.h"
 #include"Map.h"
 #include"Initializer.h"
+#include"System.h"
 
 #include"Optimizer.h"
 #include"PnPsolver.h"
@@ -36,17 +36,25 @@
 #include<iostream>
 
 #include<mutex>
+#include<algorithm>
 
+#ifdef COMPILEDWITHVIEWER
+#include"Viewer.h"
+#include"FrameDrawer.h"
+#include"MapDrawer.h"
+#endif
 
 using namespace std;
 
 namespace ORB_SLAM2
 {
 
-Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor):
+Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer, MapDrawer *pMapDrawer, Map *pMap, KeyFrameDatabase* pKFDB, const string &strSettingPath, const int sensor, const int nAgentId):
     mState(NO_IMAGES_YET), mSensor(sensor), mbOnlyTracking(false), mbVO(false), mpORBVocabulary(pVoc),
     mpKeyFrameDB(pKFDB), mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
-    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnLastRelocFrameId(0)
+    mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpMap(pMap), mnAgentId(nAgentId),
+    mnReclaimSlot(pMap->RegisterReclaimThread()), mnFrameCount(0),
+    mnLastRelocFrameId(0), mnLostFrameId(0)
 {
     // Load camera parameters from settings file
 
@@ -86,6 +94,12 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     mMinFrames = 0;
     mMaxFrames = fps;
 
+    // 多地图：跟踪丢失后重定位连续失败Map.NewMapAfterLostFrames帧(默认1秒)，保留旧地图并开始新的子地图
+    int nMultiMap = fSettings["Map.MultiMap"];
+    mbMultiMap = nMultiMap;
+    int nNewMapAfterLostFrames = fSettings["Map.NewMapAfterLostFrames"];
+    mnNewMapAfterLostFrames = nNewMapAfterLostFrames>0 ? nNewMapAfterLostFrames : mMaxFrames;
+
     cout << endl << "Camera Parameters: " << endl;
     cout << "- fx: " << fx << endl;
     cout << "- fy: " << fy << endl;
@@ -122,8 +136,13 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     if(sensor==System::STEREO)
         mpORBextractorRight = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
 
+    // 单目初始化时并行计算H和F的RANSAC假设
+    mpIniThreadPool = NULL;
     if(sensor==System::MONOCULAR)
+    {
         mpIniORBextractor = new ORBextractor(2*nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+        mpIniThreadPool = new ThreadPool(std::min(4,(int)std::thread::hardware_concurrency()));
+    }
 
     cout << endl  << "ORB Extractor Parameters: " << endl;
     cout << "- Number of Features: " << nFeatures << endl;
@@ -165,9 +184,41 @@ void Tracking::SetViewer(Viewer *pViewer)
     mpViewer=pViewer;
 }
 
+void Tracking::StartFrameTimes()
+{
+    mFrameTimes = FrameTimes();
+    mtFrameStart = mtStageStart = chrono::steady_clock::now();
+}
+
+double Tracking::StageTime()
+{
+    const chrono::steady_clock::time_point tNow = chrono::steady_clock::now();
+    const double t = chrono::duration_cast<chrono::duration<double> >(tNow-mtStageStart).count();
+    mtStageStart = tNow;
+    return t;
+}
+
+// 无界面时(编译时关闭WITH_VIEWER或运行时不显示)没有创建绘图器，以下为空操作
+void Tracking::UpdateFrameDrawer()
+{
+#ifdef COMPILEDWITHVIEWER
+    if(mpFrameDrawer)
+        mpFrameDrawer->Update(this);
+#endif
+}
+
+void Tracking::SetDrawerCameraPose(const cv::Mat &Tcw)
+{
+#ifdef COMPILEDWITHVIEWER
+    if(mpMapDrawer)
+        mpMapDrawer->SetCurrentCameraPose(Tcw);
+#endif
+}
+
 
 cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRectRight, const double &timestamp)
 {
+    StartFrameTimes();
     mImGray = imRectLeft;
     cv::Mat imGrayRight = imRectRight;
     //将图片转化为灰度图
@@ -201,7 +252,10 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
     //构造函数是stereo版本的
     mCurrentFrame = Frame(mImGray,imGrayRight,timestamp,mpORBextractorLeft,mpORBextractorRight,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
 
+    mFrameTimes.tExtract = StageTime();
+
     Track();
+    mFrameTimes.tTotal = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-mtFrameStart).count();
 
     return mCurrentFrame.mTcw.clone();
 }
@@ -209,6 +263,7 @@ cv::Mat Tracking::GrabImageStereo(const cv::Mat &imRectLeft, const cv::Mat &imRe
 
 cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const double &timestamp)
 {
+    StartFrameTimes();
     mImGray = imRGB;
     cv::Mat imDepth = imD;
 
@@ -232,7 +287,10 @@ cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const d
 
     mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
 
+    mFrameTimes.tExtract = StageTime();
+
     Track();
+    mFrameTimes.tTotal = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-mtFrameStart).count();
 
     return mCurrentFrame.mTcw.clone();
 }
@@ -240,6 +298,7 @@ cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const d
 
 cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
 {
+    StartFrameTimes();
     mImGray = im;
 
 	  //将图片转化为灰度图
@@ -265,8 +324,11 @@ cv::Mat Tracking::GrabImageMonocular(const cv::Mat &im, const double &timestamp)
     else
         mCurrentFrame = Frame(mImGray,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth);
 
+    mFrameTimes.tExtract = StageTime();
+
     //跟踪
     Track();
+    mFrameTimes.tTotal = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-mtFrameStart).count();
 
     //返回跟踪结果
     return mCurrentFrame.mTcw.clone();
@@ -280,12 +342,18 @@ void Tracking:: Track()
         mState = NOT_INITIALIZED;
     }
 
+    // 本相机处理的帧数
+    mnFrameCount++;
+
     mLastProcessedState=mState;
 
     // Get Map Mutex -> Map cannot be changed
     // 线程锁, 锁定地图,此时不允许地图更新
     unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
+    // 帧与帧之间上一帧和局部地图点(跟踪丢失时不会重建)持有mappoint指针，清理之后确认，之前删除的mappoint可以回收
+    QuiescentState();
+
     //如果tracking没有初始化，则初始化
     if(mState==NOT_INITIALIZED)
     {
@@ -293,8 +361,9 @@ void Tracking:: Track()
             StereoInitialization();
         else
             MonocularInitialization();
+        mFrameTimes.tPose = StageTime();
 
-        mpFrameDrawer->Update(this);
+        UpdateFrameDrawer();
 
         //tracking初始化完成之后, mState=OK
         if(mState!=OK)
@@ -325,7 +394,7 @@ void Tracking:: Track()
                 CheckReplacedInLastFrame();
 
                 // 运动模型是空的或刚完成重定位
-                if(mVelocity.empty() || mCurrentFrame.mnId<mnLastRelocFrameId+2)
+                if(mVelocity.empty() || mnFrameCount<mnLastRelocFrameId+2)
                 {
                     /**
                     * 将参考帧关键帧的位姿作为当前帧的初始位姿进行跟踪；
@@ -440,6 +509,7 @@ void Tracking:: Track()
             }
         }
         ////////上面的跟踪得到了根据上一关键帧或者重定位得到的当前帧位姿估计(粗略估计)//////////
+        mFrameTimes.tPose = StageTime();
 
         //设置当前帧的参考关键帧，与当前帧共视的mappoint数量最多的关键帧
         mCurrentFrame.mpReferenceKF = mpReferenceKF;
@@ -462,13 +532,20 @@ void Tracking:: Track()
                 bOK = TrackLocalMap();
         }
 
+        mFrameTimes.tLocalMap = StageTime();
+
         if(bOK)
             mState = OK;
         else
+        {
+            //记录开始丢失的帧
+            if(mState!=LOST)
+                mnLostFrameId = mnFrameCount;
             mState=LOST;
+        }
 
         // Update drawer
-        mpFrameDrawer->Update(this);
+        UpdateFrameDrawer();
 
         // If tracking were good, check if we insert a keyframe
         // 如果跟踪良好
@@ -490,7 +567,7 @@ void Tracking:: Track()
                 mVelocity = cv::Mat();
 
             // 设置当前相机位姿,用于可视化
-            mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+            SetDrawerCameraPose(mCurrentFrame.mTcw);
 
             // Clean VO matches
             // 清除UpdateLastFrame中为当前帧临时添加的MapPoints
@@ -518,8 +595,10 @@ void Tracking:: Track()
 
             // Check if we need to insert a new keyframe
             // 判断是否插入keyframe
+            StageTime();
             if(NeedNewKeyFrame())
                 CreateNewKeyFrame();
+            mFrameTimes.tKeyFrame = StageTime();
 
             // We allow points with high innovation (considererd outliers by the Huber Function)
             // pass to the new keyframe, so that bundle adjustment will finally decide
@@ -540,8 +619,15 @@ void Tracking:: Track()
         if(mState==LOST)
         {
             //如果跟踪失败
-            if(mpMap->KeyFramesInMap()<=5)
+            if(mpMap->KeyFramesInMap(mpMap->GetCurrentMapId(mnAgentId))<=5)
             {
+                // 还有其它子地图或者其它相机共享地图时不重置整个系统，只开始新的子地图
+                if(mpMap->GetNumberOfMaps()>1 || mpSystem->GetNumberOfCameras()>1)
+                {
+                    cout << "Track lost soon after initialisation, starting a new map..." << endl;
+                    StartNewMap();
+                    return;
+                }
                 // 并且才刚刚初始化完成
                 cout << "Track lost soon after initialisation, reseting..." << endl;
                 // 系统重置
@@ -549,6 +635,10 @@ void Tracking:: Track()
                 mpSystem->Reset();
                 return;
             }
+
+            // 多地图：重定位一直失败，保留当前地图，从下一帧开始初始化新的子地图
+            if(mbMultiMap && !mbOnlyTracking && mnFrameCount>=mnLostFrameId+mnNewMapAfterLostFrames)
+                StartNewMap();
         }
         //如果当前帧还没设置参考关键帧
         if(!mCurrentFrame.mpReferenceKF)
@@ -598,7 +688,9 @@ void Tracking::StereoInitialization()
 
         // Create KeyFrame
         // 创建关键帧
-        KeyFrame* pKFini = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB);
+        // 每次初始化都开始一个新的子地图，第一个关键帧是它的原点
+        mpMap->StartNewMap(mnAgentId);
+        KeyFrame* pKFini = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB,mnAgentId);
 
         // Insert KeyFrame in the map
         // 关键帧插入地图
@@ -629,29 +721,31 @@ void Tracking::StereoInitialization()
             }
         }
 
-        cout << "New map created with " << mpMap->MapPointsInMap() << " points" << endl;
+        cout << "New map created with " << pKFini->GetMapPoints().size() << " points" << endl;
 
         //LocalMapping插入关键帧
         mpLocalMapper->InsertKeyFrame(pKFini);
 
         //当前帧传保存为LastFrame
         mLastFrame = Frame(mCurrentFrame);
-        mnLastKeyFrameId=mCurrentFrame.mnId;
+        mnLastKeyFrameId=mnFrameCount;
         mpLastKeyFrame = pKFini;
 
         //储存当前帧
         mvpLocalKeyFrames.push_back(pKFini);
-        //设置局部地图mappoint
-        mvpLocalMapPoints=mpMap->GetAllMapPoints();
+        //设置局部地图mappoint(地图中可能还有其它子地图，只取新建的点)
+        mvpLocalMapPoints=pKFini->GetMapPointMatches();
+        mvpLocalMapPoints.erase(remove(mvpLocalMapPoints.begin(),mvpLocalMapPoints.end(),static_cast<MapPoint*>(NULL)),mvpLocalMapPoints.end());
         mpReferenceKF = pKFini;
         mCurrentFrame.mpReferenceKF = pKFini;
 
         // 将局部地图mappoint设置为参考mappoint，用于绘图
-        mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
+        if(mpMapDrawer)
+            mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
         //按顺序储存关键帧到地图
         mpMap->mvpKeyFrameOrigins.push_back(pKFini);
         //设置绘图器相机位姿为当前帧位姿(用于可视化)
-        mpMapDrawer->SetCurrentCameraPose(mCurrentFrame.mTcw);
+        SetDrawerCameraPose(mCurrentFrame.mTcw);
 
         mState=OK;
     }
@@ -680,7 +774,7 @@ void Tracking::MonocularInitialization()
             if(mpInitializer)
                 delete mpInitializer;
 
-            mpInitializer =  new Initializer(mCurrentFrame,1.0,200);
+            mpInitializer =  new Initializer(mCurrentFrame,1.0,200,mpIniThreadPool);
 	    
             //将mvIniMatches全部初始化为-1
             //初始化时得到的特征点匹配，大小是mInitialFrame的特征点数量，其值是当前帧特征点序号
@@ -760,8 +854,10 @@ void Tracking::CreateInitialMapMonocular()
 {
     // Create KeyFrames
   
-    KeyFrame* pKFini = new KeyFrame(mInitialFrame,mpMap,mpKeyFrameDB);
-    KeyFrame* pKFcur = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB);
+    // 每次初始化都开始一个新的子地图，第一个关键帧是它的原点
+    mpMap->StartNewMap(mnAgentId);
+    KeyFrame* pKFini = new KeyFrame(mInitialFrame,mpMap,mpKeyFrameDB,mnAgentId);
+    KeyFrame* pKFcur = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB,mnAgentId);
 
 
     //计算关键帧的词袋bow和featurevector
@@ -814,11 +910,18 @@ void Tracking::CreateInitialMapMonocular()
     pKFini->UpdateConnections();
     pKFcur->UpdateConnections();
 
+    // 新建的mappoint，地图中可能还有其它子地图
+    vector<MapPoint*> vpIniMapPoints = pKFini->GetMapPointMatches();
+    vpIniMapPoints.erase(remove(vpIniMapPoints.begin(),vpIniMapPoints.end(),static_cast<MapPoint*>(NULL)),vpIniMapPoints.end());
+
     // Bundle Adjustment
-    cout << "New Map created with " << mpMap->MapPointsInMap() << " points" << endl;
+    cout << "New Map created with " << vpIniMapPoints.size() << " points" << endl;
 
-    //进行一次全局BA
-    Optimizer::GlobalBundleAdjustemnt(mpMap,20);
+    //对初始化的两帧和新建的mappoint进行一次BA
+    vector<KeyFrame*> vpIniKFs;
+    vpIniKFs.push_back(pKFini);
+    vpIniKFs.push_back(pKFcur);
+    Optimizer::BundleAdjustment(vpIniKFs,vpIniMapPoints,20);
 
     // Set median depth to 1
 
@@ -830,6 +933,17 @@ void Tracking::CreateInitialMapMonocular()
     // 如果深度中位数<0 ， 或者 本关键帧观测到的mappoint被其他关键帧观测的次数太少了
     if(medianDepth<0 || pKFcur->TrackedMapPoints(1)<100)
     {
+        // 地图中还有其它子地图或者其它相机共享地图时只丢弃这次新建的关键帧和mappoint，重新初始化
+        if(mpMap->GetNumberOfMaps()>1 || mpSystem->GetNumberOfCameras()>1)
+        {
+            cout << "Wrong initialization, discarding new map..." << endl;
+            for(size_t i=0; i<vpIniMapPoints.size(); i++)
+                vpIniMapPoints[i]->SetBadFlag();
+            mpMap->EraseKeyFrame(pKFcur);
+            mpMap->EraseKeyFrame(pKFini);
+            StartNewMap();
+            return;
+        }
         cout << "Wrong initialization, reseting..." << endl;
         Reset();
         return;
@@ -860,13 +974,13 @@ void Tracking::CreateInitialMapMonocular()
     mpLocalMapper->InsertKeyFrame(pKFcur);
 
     mCurrentFrame.SetPose(pKFcur->GetPose());
-    mnLastKeyFrameId=mCurrentFrame.mnId;
+    mnLastKeyFrameId=mnFrameCount;
     mpLastKeyFrame = pKFcur;
 
     //局部地图
     mvpLocalKeyFrames.push_back(pKFcur);
     mvpLocalKeyFrames.push_back(pKFini);
-    mvpLocalMapPoints=mpMap->GetAllMapPoints();
+    mvpLocalMapPoints=vpIniMapPoints;
     //为下一帧做准备
     mpReferenceKF = pKFcur;
     mCurrentFrame.mpReferenceKF = pKFcur;
@@ -875,11 +989,12 @@ void Tracking::CreateInitialMapMonocular()
     mLastFrame = Frame(mCurrentFrame);
 
     // 将局部地图mappoint设置为参考mappoint，用于绘图
-    mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
+    if(mpMapDrawer)
+        mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
 
     //地图绘制器
     //设置相机位姿为当前关键帧位姿
-    mpMapDrawer->SetCurrentCameraPose(pKFcur->GetPose());
+    SetDrawerCameraPose(pKFcur->GetPose());
 
     //按顺序储存关键帧到地图
     mpMap->mvpKeyFrameOrigins.push_back(pKFini);
@@ -906,6 +1021,35 @@ void Tracking::CheckReplacedInLastFrame()
     }
 }
 
+void Tracking::QuiescentState()
+{
+    // 先取删除序号再清理：在此之前删除的mappoint已经被标记为坏点，清理时都能看到
+    const long unsigned int nEpoch = mpMap->GetEraseEpoch();
+
+    // 被替换的点换成替换它的点，其余的坏点置空(还没有上一帧时mvpMapPoints为空)
+    for(size_t i=0; i<mLastFrame.mvpMapPoints.size(); i++)
+    {
+        MapPoint* pMP = mLastFrame.mvpMapPoints[i];
+        if(!pMP || !pMP->isBad())
+            continue;
+
+        MapPoint* pRep = pMP->GetReplaced();
+        if(pRep && !pRep->isBad())
+            mLastFrame.mvpMapPoints[i] = pRep;
+        else
+            mLastFrame.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
+    }
+
+    // 局部地图点在下一次UpdateLocalPoints()之前还会被SearchLocalPoints()等使用，去掉坏点
+    size_t nGood = 0;
+    for(size_t i=0; i<mvpLocalMapPoints.size(); i++)
+        if(!mvpLocalMapPoints[i]->isBad())
+            mvpLocalMapPoints[nGood++] = mvpLocalMapPoints[i];
+    mvpLocalMapPoints.resize(nGood);
+
+    mpMap->QuiescentState(mnReclaimSlot,nEpoch);
+}
+
 //跟踪,计算当前帧前端优化位姿
 bool Tracking::TrackReferenceKeyFrame()
 {
@@ -980,7 +1124,7 @@ void Tracking::UpdateLastFrame()
     mLastFrame.SetPose(Tlr*pRef->GetPose());
 
     //如果上一帧就是对应的关键帧,或者是单目相机,又或者是正常的slam,则return
-    if(mnLastKeyFrameId==mLastFrame.mnId || mSensor==System::MONOCULAR || !mbOnlyTracking)
+    if(mpLastKeyFrame->mnFrameId==mLastFrame.mnId || mSensor==System::MONOCULAR || !mbOnlyTracking)
         return;
 
     // Create "visual odometry" MapPoints
@@ -1191,7 +1335,7 @@ bool Tracking::TrackLocalMap()
     // More restrictive if there was a relocalization recently
     // 决定是否跟踪成功
     // 如果当前帧和上一次重定位太近并且当前帧特征点与mappoint的匹配数太少(<50)
-    if(mCurrentFrame.mnId<mnLastRelocFrameId+mMaxFrames && mnMatchesInliers<50)
+    if(mnFrameCount<mnLastRelocFrameId+mMaxFrames && mnMatchesInliers<50)
         return false;
 
     // 或者当前帧特征点与mappoint的匹配数太少(但是不是重定位不久)
@@ -1213,12 +1357,12 @@ bool Tracking::NeedNewKeyFrame()
     if(mpLocalMapper->isStopped() || mpLocalMapper->stopRequested())
         return false;
 
-    //获取当前地图上的关键帧数量
-    const int nKFs = mpMap->KeyFramesInMap();
+    //获取当前(子)地图上的关键帧数量
+    const int nKFs = mpMap->KeyFramesInMap(mpMap->GetCurrentMapId(mnAgentId));
 
     // Do not insert keyframes if not enough frames have passed from last relocalisation
     // 如果刚刚重定位完并且地图上的关键帧>阈值,也不插入关键帧
-    if(mCurrentFrame.mnId<mnLastRelocFrameId+mMaxFrames && nKFs>mMaxFrames)
+    if(mnFrameCount<mnLastRelocFrameId+mMaxFrames && nKFs>mMaxFrames)
         return false;
 
     // Tracked MapPoints in the reference keyframe
@@ -1263,10 +1407,10 @@ bool Tracking::NeedNewKeyFrame()
 
     // Condition 1a: More than "MaxFrames" have passed from last keyframe insertion
     // 和上一个关键帧间隔需要大于mMaxFrames
-    const bool c1a = mCurrentFrame.mnId>=mnLastKeyFrameId+mMaxFrames;
+    const bool c1a = mnFrameCount>=mnLastKeyFrameId+mMaxFrames;
     // Condition 1b: More than "MinFrames" have passed and Local Mapping is idle
     // 如果Local Mapping空闲，且和上一个关键帧间隔需要大于mMinFrames
-    const bool c1b = (mCurrentFrame.mnId>=mnLastKeyFrameId+mMinFrames && bLocalMappingIdle);
+    const bool c1b = (mnFrameCount>=mnLastKeyFrameId+mMinFrames && bLocalMappingIdle);
     // Condition 1c: tracking is weak
     // 如果不是单目, 内点数少或者跟踪不好,则需要插入关键帧
     const bool c1c =  mSensor!=System::MONOCULAR && (mnMatchesInliers<nRefMatches*0.25 || bNeedToInsertClose) ;
@@ -1295,7 +1439,8 @@ bool Tracking::NeedNewKeyFrame()
             if(mSensor!=System::MONOCULAR)
             {
                 // 关键帧队列还没满,则表示可以插入
-                if(mpLocalMapper->KeyframesInQueue()<3)
+                // 多相机时只计算本相机的关键帧，避免一个相机占满队列
+                if(mpLocalMapper->KeyframesInQueue(mnAgentId)<3)
                     return true;
                 else
                     return false;
@@ -1314,7 +1459,7 @@ void Tracking::CreateNewKeyFrame()
         return;
 
     // 步骤1：将当前帧构造成关键帧
-    KeyFrame* pKF = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB); //mpKeyFrameDB:跟踪所用的词袋数据库
+    KeyFrame* pKF = new KeyFrame(mCurrentFrame,mpMap,mpKeyFrameDB,mnAgentId); //mpKeyFrameDB:跟踪所用的词袋数据库
 
     // 步骤2：跟踪器的参考关键帧也设置为当前帧, 当前帧的参考关键帧也设置为当前帧
     mpReferenceKF = pKF;    //为下一帧做准备
@@ -1396,7 +1541,7 @@ void Tracking::CreateNewKeyFrame()
 
     mpLocalMapper->SetNotStop(false);
     //将跟踪器上一个关键帧设置为当前关键帧,为下一帧做准备
-    mnLastKeyFrameId = mCurrentFrame.mnId;
+    mnLastKeyFrameId = mnFrameCount;
     mpLastKeyFrame = pKF;
 }
 
@@ -1459,7 +1604,7 @@ void Tracking::SearchLocalPoints()
         if(mSensor==System::RGBD)
             th=3;
         // If the camera has been relocalised recently, perform a coarser search
-        if(mCurrentFrame.mnId<mnLastRelocFrameId+2) //如果才进行完重定位不久,搜索范围大一点
+        if(mnFrameCount<mnLastRelocFrameId+2) //如果才进行完重定位不久,搜索范围大一点
             th=5;
         //局部地图点和当前帧匹配(再次匹配,为了增加匹配对数,用于位姿优化)
         //如果某个局部地图点已经和当前帧匹配上了,则跳过该局部地图点
@@ -1470,14 +1615,15 @@ void Tracking::SearchLocalPoints()
 // 利用与当前帧有关系的一些关键帧来构建一个局部地图
 void Tracking::UpdateLocalMap()
 {
-    // This is for visualization
-    // mvpLocalKeyFrames的所有关键帧的所有匹配的mappoint集合
-    // 用于可视化
-    mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
-
     // Update
     UpdateLocalKeyFrames(); //更新局部地图关键帧 [基于当前帧观测到的mappoint,把观测到这些mappoint的关键帧都添加进来]
     UpdateLocalPoints();    //更新局部地图mappoint [把上面得到的局部地图关键帧所有的mappoint添加到局部地图中]
+
+    // This is for visualization
+    // mvpLocalKeyFrames的所有关键帧的所有匹配的mappoint集合，重建之后再发布
+    // 用于可视化，无界面时不需要每帧拷贝
+    if(mpMapDrawer)
+        mpMap->SetReferenceMapPoints(mvpLocalMapPoints);
 }
 
 void Tracking::UpdateLocalPoints()
@@ -1864,6 +2010,8 @@ bool Tracking::Relocalization()
                 if(nGood>=50)
                 {
                     bMatch = true;
+                    //候选关键帧可能在其它子地图中，之后新建的关键帧属于这个子地图
+                    mpMap->SetCurrentMapId(vpCandidateKFs[i]->GetMapId(),mnAgentId);
                     break;
                 }
             }
@@ -1877,22 +2025,42 @@ bool Tracking::Relocalization()
     else
     {
         //记录上一次Relocalization()使用的Frame ID，最近一次重定位帧的ID
-        mnLastRelocFrameId = mCurrentFrame.mnId;
+        mnLastRelocFrameId = mnFrameCount;
         return true;
     }
 
 }
 
+void Tracking::StartNewMap()
+{
+    cout << "Starting a new map (" << mpMap->GetNumberOfMaps() << " maps kept)" << endl;
+
+    // 旧的子地图和它的关键帧(关键帧数据库中)保留，用于之后的重定位和地图合并
+    // 新的子地图在下一次初始化创建第一个关键帧时开始
+
+    if(mpInitializer)
+    {
+        delete mpInitializer;
+        mpInitializer = static_cast<Initializer*>(NULL);
+    }
+
+    mState = NOT_INITIALIZED;
+    mVelocity = cv::Mat();
+    mvpLocalKeyFrames.clear();
+    mvpLocalMapPoints.clear();
+}
+
 void Tracking::Reset()
 {
 
     cout << "System Reseting" << endl;
+#ifdef COMPILEDWITHVIEWER
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            usleep(3000);
+        mpViewer->WaitUntilStopped();
     }
+#endif
 
     // Reset Local Mapping
     cout << "Reseting Local Mapper...";
@@ -1914,7 +2082,19 @@ void Tracking::Reset()
 
     KeyFrame::nNextId = 0;
     Frame::nNextId = 0;
+    ResetState();
+
+#ifdef COMPILEDWITHVIEWER
+    if(mpViewer)
+        mpViewer->Release();
+#endif
+}
+
+void Tracking::ResetState()
+{
     mState = NO_IMAGES_YET;
+    mnFrameCount = 0;
+    mnLastRelocFrameId = 0;
 
     if(mpInitializer)
     {
@@ -1926,9 +2106,40 @@ void Tracking::Reset()
     mlpReferences.clear();
     mlFrameTimes.clear();
     mlbLost.clear();
+}
 
-    if(mpViewer)
-        mpViewer->Release();
+void Tracking::TransformMap(const long unsigned int nMapId, const cv::Mat &Rnw, const cv::Mat &tnw, const float s)
+{
+    // 上一帧: Xc' = s*Xc = Rcw*Rnw^T*X' - Rcw*Rnw^T*tnw + s*tcw
+    if(!mLastFrame.mTcw.empty() && mLastFrame.mpReferenceKF && mLastFrame.mpReferenceKF->GetMapId()==nMapId)
+    {
+        cv::Mat Tcw = cv::Mat::eye(4,4,CV_32F);
+        cv::Mat Rcw = mLastFrame.mTcw.rowRange(0,3).colRange(0,3)*Rnw.t();
+        cv::Mat tcw = s*mLastFrame.mTcw.rowRange(0,3).col(3)-Rcw*tnw;
+        Rcw.copyTo(Tcw.rowRange(0,3).colRange(0,3));
+        tcw.copyTo(Tcw.rowRange(0,3).col(3));
+        mLastFrame.SetPose(Tcw);
+
+        if(!mVelocity.empty())
+        {
+            cv::Mat Velocity = mVelocity.clone();
+            cv::Mat t = s*mVelocity.rowRange(0,3).col(3);
+            t.copyTo(Velocity.rowRange(0,3).col(3));
+            mVelocity = Velocity;
+        }
+    }
+
+    // 跟踪丢失的帧和前一帧共享同一个矩阵，复制之后再缩放，不能原地修改
+    list<KeyFrame*>::iterator lRit = mlpReferences.begin();
+    for(list<cv::Mat>::iterator lit=mlRelativeFramePoses.begin(), lend=mlRelativeFramePoses.end(); lit!=lend; lit++, lRit++)
+    {
+        if((*lRit)->GetMapId()!=nMapId)
+            continue;
+        cv::Mat Tcr = lit->clone();
+        cv::Mat t = s*lit->rowRange(0,3).col(3);
+        t.copyTo(Tcr.rowRange(0,3).col(3));
+        *lit = Tcr;
+    }
 }
 
 void Tracking::ChangeCalibration(const string &strSettingPath)
@@ -1960,8 +2171,6 @@ void Tracking::ChangeCalibration(const string &strSettingPath)
     DistCoef.copyTo(mDistCoef);
 
     mbf = fSettings["Camera.bf"];
-
-    Frame::mbInitialComputations = true;
 }
 
 void Tracking::InformOnlyTracking(const bool &flag)
@@ -166,10 +166,10 @@ void Viewer::Run()
 
         if(Stop())
         {
-            while(isStopped())
-            {
-                usleep(3000);
-            }
+            // 阻塞直到Release()
+            unique_lock<mutex> lock(mMutexStop);
+            while(mbStopped)
+                mCondStop.wait(lock);
         }
 
         if(CheckFinish())
@@ -195,6 +195,7 @@ void Viewer::SetFinish()
 {
     unique_lock<mutex> lock(mMutexFinish);
     mbFinished = true;
+    mCondFinish.notify_all();
 }
 
 bool Viewer::isFinished()
@@ -203,6 +204,13 @@ bool Viewer::isFinished()
     return mbFinished;
 }
 
+void Viewer::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    while(!mbFinished)
+        mCondFinish.wait(lock);
+}
+
 void Viewer::RequestStop()
 {
     unique_lock<mutex> lock(mMutexStop);
@@ -216,6 +224,13 @@ bool Viewer::isStopped()
     return mbStopped;
 }
 
+void Viewer::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    while(!mbStopped)
+        mCondStop.wait(lock);
+}
+
 bool Viewer::Stop()
 {
     unique_lock<mutex> lock(mMutexStop);
@@ -227,6 +242,7 @@ bool Viewer::Stop()
     {
         mbStopped = true;
         mbStopRequested = false;
+        mCondStop.notify_all();
         return true;
     }
 
@@ -238,6 +254,7 @@ void Viewer::Release()
 {
     unique_lock<mutex> lock(mMutexStop);
     mbStopped = false;
+    mCondStop.notify_all();
 }
 
 }